@@ -38,12 +38,23 @@ BOOL AssertFailedLine(LPCSTR lpszFileName, int nLine)
     return FALSE;
 }
 
+// In headless mode the alerts go to the console, there is nobody to close a message box
 void AlertInfo(LPCTSTR sMessage)
 {
+    if (Option_Headless)
+    {
+        Headless_PrintFormat(_T("%s\r\n"), sMessage);
+        return;
+    }
     ::MessageBox(NULL, sMessage, g_szTitle, MB_OK | MB_ICONINFORMATION | MB_TOPMOST);
 }
 void AlertWarning(LPCTSTR sMessage)
 {
+    if (Option_Headless)
+    {
+        Headless_PrintFormat(_T("%s\r\n"), sMessage);
+        return;
+    }
     ::MessageBox(NULL, sMessage, g_szTitle, MB_OK | MB_ICONEXCLAMATION | MB_TOPMOST);
 }
 void AlertWarningFormat(LPCTSTR sFormat, ...)
@@ -56,10 +67,15 @@ void AlertWarningFormat(LPCTSTR sFormat, ...)
     _vsntprintf_s(buffer, buffersize, buffersize - 1, sFormat, ptr);
     va_end(ptr);
 
-    ::MessageBox(NULL, buffer, g_szTitle, MB_OK | MB_ICONEXCLAMATION | MB_TOPMOST);
+    AlertWarning(buffer);
 }
 BOOL AlertOkCancel(LPCTSTR sMessage)
 {
+    if (Option_Headless)
+    {
+        Headless_PrintFormat(_T("%s\r\n"), sMessage);
+        return FALSE;
+    }
     int result = ::MessageBox(NULL, sMessage, g_szTitle, MB_OKCANCEL | MB_ICONQUESTION | MB_TOPMOST);
     return (result == IDOK);
 }
@@ -74,8 +90,13 @@ void DebugPrint(LPCTSTR) {}
 void DebugPrintFormat(LPCTSTR, ...) {}
 void DebugLogClear() {}
 void DebugLogCloseFile() {}
+void DebugLogDone() {}
+void DebugLogGetStats(DWORD* pMessages, DWORD* pDropped) { *pMessages = 0;  *pDropped = 0; }
 void DebugLog(LPCTSTR) {}
 void DebugLogFormat(LPCTSTR, ...) {}
+DWORD DebugLogGetMask() { return LOGCAT_NONE; }
+void DebugLogSetMask(DWORD) {}
+void DebugLogSuspend(bool) {}
 
 #else
 
@@ -100,59 +121,301 @@ void DebugPrintFormat(LPCTSTR pszFormat, ...)
     DebugPrint(buffer);
 }
 
+// Debug log goes through per-thread queues to the writer thread, so the message costs the formatting
+// and the copy only. Every queue is a lock-free ring with one producer, the thread owning it,
+// and one consumer, the writer thread; only the writer moves the head. When the ring is full the new message
+// is dropped and counted; the writer puts the dropped count to the log, so the gap is visible.
+// The queue is released when its thread exits, the writer frees it for another thread when the ring is empty.
+
 const LPCTSTR TRACELOG_FILE_NAME = _T("trace.log");
 const LPCTSTR TRACELOG_NEWLINE = _T("\r\n");
 
+const int DEBUGLOG_QUEUE_MAX = 8;  // Threads writing to the log at once; messages of other threads are dropped
+const uint32_t DEBUGLOG_QUEUE_SIZE = 256 * 1024;  // Bytes per thread, power of 2
+const int DEBUGLOG_MESSAGE_MAX = 512;  // Longer messages are cut
+const DWORD DEBUGLOG_FLUSH_INTERVAL = 100;  // Milliseconds
+
+// Queue states
+const LONG DEBUGLOG_QUEUE_FREE = 0;
+const LONG DEBUGLOG_QUEUE_OWNED = 1;  // Taken by a thread
+const LONG DEBUGLOG_QUEUE_RELEASED = 2;  // The thread exited, the writer frees the queue when the ring is empty
+
+// Log states
+const LONG DEBUGLOG_STATE_CLOSED = 0;  // The first message creates the file
+const LONG DEBUGLOG_STATE_BUSY = 1;  // The file is being created or closed
+const LONG DEBUGLOG_STATE_OPEN = 2;
+const LONG DEBUGLOG_STATE_DONE = 3;  // Closed for good on the program exit, the messages are rejected
+
+struct DebugLogQueue
+{
+    volatile LONG state;  // DEBUGLOG_QUEUE_XXX
+    volatile uint32_t head;  // Read position, moved by the writer thread
+    volatile uint32_t tail;  // Write position, moved by the owner thread
+    volatile LONG messages;  // Messages queued, counted by the owner thread
+    volatile LONG dropped;  // Messages dropped, counted by the owner thread
+    LONG droppedReported;  // Dropped count already written to the log
+    char data[DEBUGLOG_QUEUE_SIZE];
+};
+
+// Releases the queue of the thread on the thread exit
+struct DebugLogQueueOwner
+{
+    DebugLogQueue* pQueue;
+    ~DebugLogQueueOwner()
+    {
+        if (pQueue != nullptr)
+            ::InterlockedExchange(&pQueue->state, DEBUGLOG_QUEUE_RELEASED);
+    }
+};
+
 HANDLE Common_LogFile = NULL;
+HANDLE Common_LogThread = NULL;
+HANDLE Common_LogWakeEvent = NULL;
+volatile LONG Common_LogState = DEBUGLOG_STATE_CLOSED;
+volatile LONG Common_LogStopping = FALSE;
+DebugLogQueue Common_LogQueues[DEBUGLOG_QUEUE_MAX];
+volatile LONG Common_LogDroppedNoQueue = 0;  // Messages of the threads with no free queue
+LONG Common_LogDroppedNoQueueReported = 0;
+thread_local DebugLogQueueOwner Common_LogThreadQueue = { nullptr };
+DebugLogSite* volatile Common_LogSites = nullptr;  // DEBUGLOG_CAT call sites with the messages skipped, see DebugLogSiteCheck()
+
+static void DebugLogWriteDropped(LONG dropped)
+{
+    char message[64];
+    int length = _snprintf_s(message, sizeof(message), _TRUNCATE, "*** %ld debug log messages dropped\r\n", dropped);
+    DWORD dwBytesWritten = 0;
+    ::WriteFile(Common_LogFile, message, length, &dwBytesWritten, NULL);
+}
 
-void DebugLogCreateFile()
+// Report the messages skipped by the call sites gone quiet, their next message may never come
+static void DebugLogWriteSuppressed()
 {
-    if (Common_LogFile == NULL)
+    DWORD dwTicks = ::GetTickCount();
+    for (DebugLogSite* pSite = Common_LogSites; pSite != nullptr; pSite = pSite->pNext)
     {
-        Common_LogFile = ::CreateFile(TRACELOG_FILE_NAME,
-                GENERIC_WRITE, FILE_SHARE_READ, NULL,
-                CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (pSite->suppressed == 0 || dwTicks - pSite->windowStart < 1000)
+            continue;
+        LONG suppressed = ::InterlockedExchange(&pSite->suppressed, 0);
+        if (suppressed == 0)
+            continue;  // Reported by the site itself
+
+        char message[MAX_PATH + 64];
+        int length = _snprintf_s(message, sizeof(message), _TRUNCATE, "*** %s(%d): %ld debug log messages suppressed\r\n",
+                pSite->fileName, pSite->line, suppressed);
+        DWORD dwBytesWritten = 0;
+        ::WriteFile(Common_LogFile, message, length, &dwBytesWritten, NULL);
     }
 }
 
-void DebugLogCloseFile()
+// Write the queued messages, free the released queues; called by the writer thread only
+static void DebugLogWriteQueues()
+{
+    for (int i = 0; i < DEBUGLOG_QUEUE_MAX; i++)
+    {
+        DebugLogQueue* pQueue = Common_LogQueues + i;
+        LONG state = pQueue->state;
+        if (state == DEBUGLOG_QUEUE_FREE)
+            continue;
+        uint32_t head = pQueue->head;
+        uint32_t tail = pQueue->tail;
+        MemoryBarrier();  // Read the data after the tail
+
+        DWORD dwBytesWritten = 0;
+        while (head != tail)
+        {
+            uint32_t offset = head & (DEBUGLOG_QUEUE_SIZE - 1);
+            uint32_t length = tail - head;
+            if (length > DEBUGLOG_QUEUE_SIZE - offset)
+                length = DEBUGLOG_QUEUE_SIZE - offset;  // Up to the ring end, the rest goes next
+            ::WriteFile(Common_LogFile, pQueue->data + offset, length, &dwBytesWritten, NULL);
+            head += length;
+        }
+        MemoryBarrier();  // Done with the data before the owner can overwrite it
+        pQueue->head = head;
+
+        LONG dropped = pQueue->dropped;
+        if (dropped != pQueue->droppedReported)
+        {
+            DebugLogWriteDropped(dropped - pQueue->droppedReported);
+            pQueue->droppedReported = dropped;
+        }
+
+        // The thread exited after the state was read, so the ring is empty now
+        if (state == DEBUGLOG_QUEUE_RELEASED)
+            ::InterlockedExchange(&pQueue->state, DEBUGLOG_QUEUE_FREE);
+    }
+
+    LONG droppedNoQueue = Common_LogDroppedNoQueue;
+    if (droppedNoQueue != Common_LogDroppedNoQueueReported)
+    {
+        DebugLogWriteDropped(droppedNoQueue - Common_LogDroppedNoQueueReported);
+        Common_LogDroppedNoQueueReported = droppedNoQueue;
+    }
+
+    DebugLogWriteSuppressed();
+}
+
+static DWORD WINAPI DebugLogWriterThreadProc(LPVOID /*lpParameter*/)
 {
-    if (Common_LogFile == NULL)
+    for (;;)
+    {
+        ::WaitForSingleObject(Common_LogWakeEvent, DEBUGLOG_FLUSH_INTERVAL);
+        bool okStopping = Common_LogStopping != FALSE;
+        DebugLogWriteQueues();
+        if (okStopping)
+            break;
+    }
+    return 0;
+}
+
+// Create the file and start the writer thread, one thread does it; returns true if the log is open
+static bool DebugLogCreateFile()
+{
+    LONG state = ::InterlockedCompareExchange(&Common_LogState, DEBUGLOG_STATE_BUSY, DEBUGLOG_STATE_CLOSED);
+    if (state != DEBUGLOG_STATE_CLOSED)
+        return state == DEBUGLOG_STATE_OPEN;
+
+    Common_LogFile = ::CreateFile(TRACELOG_FILE_NAME,
+            GENERIC_WRITE, FILE_SHARE_READ, NULL,
+            CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (Common_LogFile == INVALID_HANDLE_VALUE)
+    {
+        Common_LogFile = NULL;
+        ::InterlockedExchange(&Common_LogState, DEBUGLOG_STATE_CLOSED);
+        return false;
+    }
+
+    Common_LogStopping = FALSE;
+    Common_LogWakeEvent = ::CreateEvent(NULL, FALSE, FALSE, NULL);
+    Common_LogThread = ::CreateThread(NULL, 0, DebugLogWriterThreadProc, NULL, 0, NULL);
+    ::InterlockedExchange(&Common_LogState, DEBUGLOG_STATE_OPEN);
+    return true;
+}
+
+// Stop the writer thread after it writes the rest of the messages, close the file, go to the new state
+static void DebugLogStop(LONG newState)
+{
+    LONG state;
+    while ((state = ::InterlockedCompareExchange(&Common_LogState, DEBUGLOG_STATE_BUSY, DEBUGLOG_STATE_OPEN)) == DEBUGLOG_STATE_BUSY)
+        ::Sleep(0);  // Another thread opens the file
+    if (state != DEBUGLOG_STATE_OPEN)
+    {
+        if (state == DEBUGLOG_STATE_CLOSED)
+            ::InterlockedCompareExchange(&Common_LogState, newState, DEBUGLOG_STATE_CLOSED);
         return;
+    }
+
+    if (Common_LogThread != NULL)
+    {
+        ::InterlockedExchange(&Common_LogStopping, TRUE);
+        ::SetEvent(Common_LogWakeEvent);
+        ::WaitForSingleObject(Common_LogThread, INFINITE);
+        ::CloseHandle(Common_LogThread);
+        Common_LogThread = NULL;
+    }
+    if (Common_LogWakeEvent != NULL)
+    {
+        ::CloseHandle(Common_LogWakeEvent);
+        Common_LogWakeEvent = NULL;
+    }
 
     ::CloseHandle(Common_LogFile);
     Common_LogFile = NULL;
+    ::InterlockedExchange(&Common_LogState, newState);
+}
+
+void DebugLogCloseFile()
+{
+    DebugLogStop(DEBUGLOG_STATE_CLOSED);
+}
+
+void DebugLogDone()
+{
+    DebugLogStop(DEBUGLOG_STATE_DONE);
 }
 
 void DebugLogClear()
 {
+    // Write the pending messages, then create the file again with zero length
+    DebugLogCloseFile();
     DebugLogCreateFile();
+}
 
-    if (Common_LogFile != NULL)
+void DebugLogGetStats(DWORD* pMessages, DWORD* pDropped)
+{
+    DWORD messages = 0;
+    DWORD dropped = Common_LogDroppedNoQueue;
+    for (int i = 0; i < DEBUGLOG_QUEUE_MAX; i++)
     {
-        // Trunkate to zero length
-        ::SetFilePointer(Common_LogFile, 0, 0, 0);
-        ::SetEndOfFile(Common_LogFile);
+        messages += Common_LogQueues[i].messages;
+        dropped += Common_LogQueues[i].dropped;
     }
+    *pMessages = messages;
+    *pDropped = dropped;
+}
+
+// Get the queue of the current thread, take a free one on the first call; nullptr if no free queue.
+// The counters of the queue go on from the previous owner, so the stats are kept since the start.
+static DebugLogQueue* DebugLogGetQueue()
+{
+    if (Common_LogThreadQueue.pQueue == nullptr)
+    {
+        for (int i = 0; i < DEBUGLOG_QUEUE_MAX; i++)
+        {
+            DebugLogQueue* pQueue = Common_LogQueues + i;
+            if (::InterlockedCompareExchange(&pQueue->state, DEBUGLOG_QUEUE_OWNED, DEBUGLOG_QUEUE_FREE) == DEBUGLOG_QUEUE_FREE)
+            {
+                Common_LogThreadQueue.pQueue = pQueue;
+                break;
+            }
+        }
+    }
+    return Common_LogThreadQueue.pQueue;
 }
 
 void DebugLog(LPCTSTR message)
 {
-    DebugLogCreateFile();
+    if (Common_LogState != DEBUGLOG_STATE_OPEN && !DebugLogCreateFile())
+        return;
 
-    SetFilePointer(Common_LogFile, 0, NULL, FILE_END);
+    DebugLogQueue* pQueue = DebugLogGetQueue();
+    if (pQueue == nullptr)
+    {
+        ::InterlockedIncrement(&Common_LogDroppedNoQueue);
+        return;
+    }
 
-    DWORD dwLength = lstrlen(message) * sizeof(TCHAR);
+    int count = lstrlen(message);
+    if (count > DEBUGLOG_MESSAGE_MAX) count = DEBUGLOG_MESSAGE_MAX;
+    char ascii[DEBUGLOG_MESSAGE_MAX * 2];
+    uint32_t length = (uint32_t)::WideCharToMultiByte(CP_ACP, 0, message, count, ascii, sizeof(ascii), NULL, NULL);
+    if (length == 0)
+        return;
 
-    char ascii[256];  *ascii = 0;
-    WideCharToMultiByte(CP_ACP, 0, message, dwLength, ascii, 256, NULL, NULL);
+    uint32_t tail = pQueue->tail;
+    uint32_t used = tail - pQueue->head;
+    if (length > DEBUGLOG_QUEUE_SIZE - used)  // No room, keep the messages already queued
+    {
+        pQueue->dropped++;
+        return;
+    }
 
-    DWORD dwBytesWritten = 0;
-    //WriteFile(Common_LogFile, message, dwLength, &dwBytesWritten, NULL);
-    WriteFile(Common_LogFile, ascii, strlen(ascii), &dwBytesWritten, NULL);
+    uint32_t offset = tail & (DEBUGLOG_QUEUE_SIZE - 1);
+    uint32_t part = DEBUGLOG_QUEUE_SIZE - offset;
+    if (part >= length)
+        ::memcpy(pQueue->data + offset, ascii, length);
+    else  // Wrap around the ring end
+    {
+        ::memcpy(pQueue->data + offset, ascii, part);
+        ::memcpy(pQueue->data, ascii + part, length - part);
+    }
+    MemoryBarrier();  // The data is in place before the new tail is seen
+    pQueue->tail = tail + length;
+    pQueue->messages++;
 
-    //dwLength = lstrlen(TRACELOG_NEWLINE) * sizeof(TCHAR);
-    //WriteFile(Common_LogFile, TRACELOG_NEWLINE, dwLength, &dwBytesWritten, NULL);
+    // Wake up the writer when the queue gets half full, not to wait for the flush interval
+    if (used < DEBUGLOG_QUEUE_SIZE / 2 && used + length >= DEBUGLOG_QUEUE_SIZE / 2 && Common_LogWakeEvent != NULL)
+        ::SetEvent(Common_LogWakeEvent);
 }
 
 void DebugLogFormat(LPCTSTR pszFormat, ...)
@@ -168,6 +431,57 @@ void DebugLogFormat(LPCTSTR pszFormat, ...)
     DebugLog(buffer);
 }
 
+DWORD Common_LogMask = LOGCAT_DEFAULT;  // Zero while suspended
+DWORD Common_LogUserMask = LOGCAT_DEFAULT;
+bool Common_LogSuspended = false;
+
+DWORD DebugLogGetMask()
+{
+    return Common_LogUserMask;
+}
+void DebugLogSetMask(DWORD mask)
+{
+    Common_LogUserMask = mask & LOGCAT_ALL;
+    if (!Common_LogSuspended)
+        Common_LogMask = Common_LogUserMask;
+}
+void DebugLogSuspend(bool okSuspend)
+{
+    Common_LogSuspended = okSuspend;
+    Common_LogMask = okSuspend ? LOGCAT_NONE : Common_LogUserMask;
+}
+
+bool DebugLogSiteCheck(DebugLogSite* pSite)
+{
+    DWORD dwTicks = ::GetTickCount();
+    if (dwTicks - pSite->windowStart >= 1000)  // New window
+    {
+        LONG suppressed = ::InterlockedExchange(&pSite->suppressed, 0);  // The writer thread may have reported them
+        if (suppressed > 0)
+            DebugLogFormat(_T("*** %S(%d): %ld debug log messages suppressed\r\n"), pSite->fileName, pSite->line, suppressed);
+        pSite->windowStart = dwTicks;
+        pSite->count = 0;
+    }
+    if (pSite->count >= DEBUGLOG_SITE_LIMIT)
+    {
+        if (::InterlockedCompareExchange(&pSite->registered, TRUE, FALSE) == FALSE)
+        {
+            // Put the site to the list for the writer thread
+            DebugLogSite* pHead;
+            do
+            {
+                pHead = Common_LogSites;
+                pSite->pNext = pHead;
+            }
+            while (::InterlockedCompareExchangePointer(reinterpret_cast<PVOID volatile*>(&Common_LogSites), pSite, pHead) != pHead);
+        }
+        ::InterlockedIncrement(&pSite->suppressed);
+        return false;
+    }
+    pSite->count++;
+    return true;
+}
+
 #endif // !defined(PRODUCT)
 
 
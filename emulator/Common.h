@@ -56,10 +56,60 @@ BOOL AlertOkCancel(LPCTSTR sMessage);
 void DebugPrint(LPCTSTR message);
 void DebugPrintFormat(LPCTSTR pszFormat, ...);
 void DebugLogClear();
-void DebugLogCloseFile();
+void DebugLogCloseFile();  // Write the messages queued and close the file
+void DebugLogDone();  // Close the file for good, on the program exit; the later messages are rejected
+void DebugLogGetStats(DWORD* pMessages, DWORD* pDropped);  // Messages logged and dropped since the start
 void DebugLog(LPCTSTR message);
 void DebugLogFormat(LPCTSTR pszFormat, ...);
 
+// Debug log categories, see DEBUGLOG_CAT
+#define LOGCAT_CPU      0001  // Invalid instructions, memory watch
+#define LOGCAT_INT      0002  // Interrupts
+#define LOGCAT_PORT     0004  // Port reads and writes
+#define LOGCAT_KBD      0010  // Keyboard
+#define LOGCAT_SMP      0020  // SMP commands and data
+#define LOGCAT_LCD      0040  // LCD controller
+#define LOGCAT_NONE     0
+#define LOGCAT_ALL      0077
+#define LOGCAT_DEFAULT  LOGCAT_CPU
+
+#define DEBUGLOG_SITE_LIMIT  100  // Messages per second from one call site, the rest are skipped
+
+struct DebugLogSite  // Rate limit state of one DEBUGLOG_CAT call site
+{
+    DWORD windowStart;  // GetTickCount() value at the one-second window start
+    DWORD count;  // Messages written in the window
+    volatile LONG suppressed;  // Messages skipped and not reported yet; the writer thread reports them when the site is quiet
+    LPCSTR fileName;
+    int line;
+    volatile LONG registered;  // The site is in the list the writer thread checks, since the first message skipped
+    DebugLogSite* pNext;
+};
+
+DWORD DebugLogGetMask();
+void DebugLogSetMask(DWORD mask);
+void DebugLogSuspend(bool okSuspend);  // No DEBUGLOG_CAT messages while suspended, for the run-ahead frames
+
+// Write the message when the category is on and the call site is below the rate limit.
+// The mask is checked first, so the arguments are not evaluated and nothing is formatted when the category is off;
+// while the log is suspended the mask is zero.
+// In PRODUCT build the macro is empty.
+#if defined(PRODUCT)
+#define DEBUGLOG_CAT(category, ...)  ((void)0)
+#else
+extern DWORD Common_LogMask;
+bool DebugLogSiteCheck(DebugLogSite* pSite);
+#define DEBUGLOG_CAT(category, ...) \
+    do { \
+        if (Common_LogMask & (category)) \
+        { \
+            static DebugLogSite debugLogSite = { 0, 0, 0, __FILE__, __LINE__, 0, nullptr }; \
+            if (DebugLogSiteCheck(&debugLogSite)) \
+                DebugLogFormat(__VA_ARGS__); \
+        } \
+    } while (false)
+#endif
+
 
 //////////////////////////////////////////////////////////////////////
 
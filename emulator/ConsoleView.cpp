@@ -15,6 +15,14 @@ MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
 #include "Views.h"
 #include "ToolWindow.h"
 #include "Emulator.h"
+#include "Movie.h"
+#include "Profiler.h"
+#include "Coverage.h"
+#include "TraceLog.h"
+#include "WriteLog.h"
+#include "EventTrace.h"
+#include "PerfCounters.h"
+#include "FrameTiming.h"
 #include "emubase/Emubase.h"
 
 //////////////////////////////////////////////////////////////////////
@@ -430,13 +438,25 @@ int ConsoleView_PrintDisassemble(CProcessor* pProc, WORD address, BOOL okOneInst
 #if !defined(PRODUCT)
 void ConsoleView_TraceLog(DWORD value)
 {
-    g_pBoard->SetTrace(value);
     if (value != TRACE_NONE)
-        ConsoleView_PrintFormat(_T("  Trace ON, trace flags %06o\r\n"), (uint16_t)g_pBoard->GetTrace());
+    {
+        if (TraceLog_IsRunning())
+            TraceLog_SetFlags(value);
+        else if (!TraceLog_Start(FILENAME_TRACE, value))
+        {
+            ConsoleView_Print(_T("  Failed to create trace.mk90trc file.\r\n"));
+            return;
+        }
+        ConsoleView_PrintFormat(_T("  Trace ON, trace flags %06o\r\n"), (uint16_t)TraceLog_GetFlags());
+    }
     else
     {
         ConsoleView_Print(_T("  Trace OFF.\r\n"));
+        TraceLog_Stop();
         DebugLogCloseFile();
+        DWORD dwMessages, dwDropped;
+        DebugLogGetStats(&dwMessages, &dwDropped);
+        ConsoleView_PrintFormat(_T("  Debug log: %lu messages, %lu dropped.\r\n"), dwMessages, dwDropped);
     }
 }
 #endif
@@ -450,6 +470,7 @@ struct ConsoleCommandParams
     LPCTSTR     commandText;
     int         paramReg1;
     uint16_t    paramOct1, paramOct2;
+    uint64_t    paramDec1;
 };
 
 void ConsoleView_CmdShowHelp(const ConsoleCommandParams& /*params*/)
@@ -477,10 +498,51 @@ void ConsoleView_CmdShowHelp(const ConsoleCommandParams& /*params*/)
             _T("  wcXXXXXX   Remove watch at address XXXXXX\r\n")
             _T("  wc         Remove all watches\r\n")
             _T("  u          Save memory dump to file memdump.bin\r\n")
+            _T("  q          List quick-save slots\r\n")
+            _T("  qsN        Quick save to slot N; N=0..7\r\n")
+            _T("  qlN        Quick load from slot N\r\n")
+            _T("  qdN        Show differences between slot N and the current state\r\n")
+            _T("  qdN M      Show differences between slots N and M\r\n")
+            _T("  p          Profiler on/off\r\n")
+            _T("  pc         Clear the profiler counters\r\n")
+            _T("  pr         Show the profile top, save full profile to profile.txt,\r\n")
+            _T("             call graph to callgraph.txt and flamegraph stacks to stacks.txt\r\n")
+            _T("  pb         BASIC line profiler on/off\r\n")
+            _T("  pbc        Clear the BASIC line profiler counters\r\n")
+            _T("  pbr        Show the BASIC lines top, save the table to basicprofile.txt\r\n")
+            _T("             and program.bas source annotated to basicprofile.lst\r\n")
+            _T("  pm         Memory access counters on/off, shown in Memory Map view\r\n")
+            _T("  pmc        Clear the memory access counters\r\n")
+            _T("  pmr        Save the counters to memcount.bin and heatmap to memheat.png\r\n")
+            _T("  pf         Performance counters on/off\r\n")
+            _T("  pfc        Clear the performance counters\r\n")
+            _T("  pfr        Print the performance counters, save them to metrics.prom\r\n")
+            _T("  ft         Frame timing on/off\r\n")
+            _T("  ftc        Clear the frame timing\r\n")
+            _T("  ftr        Print the frame timing: p50, p99, max by part, the worst frames\r\n")
+            _T("  cv         Code coverage on/off\r\n")
+            _T("  cvc        Clear the code coverage\r\n")
+            _T("  cvm        Merge coverage.mk90cov into the code coverage\r\n")
+            _T("  cvr        Save the code coverage to coverage.mk90cov, and\r\n")
+            _T("             basic10.lst or basic20.lst listing annotated to coverage.lst\r\n")
+            _T("  fr         Print the last instructions from the flight recorder\r\n")
+            _T("  frs        Save the flight recorder to history.txt\r\n")
+            _T("  wl         Memory write log on/off\r\n")
+            _T("  wlc        Clear the memory write log\r\n")
+            _T("  wlXXXXXX   Last writes to address XXXXXX\r\n")
+            _T("  wlXXXXXX<N Last writes to address XXXXXX before cycle N\r\n")
+            _T("  wlXXXXXX YYYYYY\r\n")
+            _T("             All the instructions writing to XXXXXX..YYYYYY\r\n")
+            _T("  ev         Event tracer on/off\r\n")
+            _T("  evs        Save the events to events.json, Chrome trace format\r\n")
 #if !defined(PRODUCT)
-            _T("  t          Tracing on/off to trace.log file\r\n")
+            _T("  t          Tracing on/off to trace.mk90trc file\r\n")
             _T("  tXXXXXX    Set tracing flags\r\n")
-            _T("  tc         Clear trace.log file\r\n")
+            _T("  tc         Clear trace.log and trace.mk90trc files\r\n")
+            _T("  td         Decode trace.mk90trc file to trace.txt\r\n")
+            _T("  lg         Print the debug log categories\r\n")
+            _T("  lgXXXXXX   Set the debug log categories: 1 CPU, 2 INT, 4 PORT,\r\n")
+            _T("             10 KBD, 20 SMP, 40 LCD; 0 = off, 77 = all\r\n")
 #endif
                      );
 }
@@ -587,6 +649,7 @@ void ConsoleView_CmdStepInto(const ConsoleCommandParams& /*params*/)
 
     ConsoleView_PrintDisassemble(pProc, pProc->GetPC(), TRUE, FALSE);
 
+    Movie_Stop();  // Step breaks the frame sequence
     g_pBoard->DebugTicks();
 
     MainWindow_UpdateAllViews();
@@ -704,21 +767,588 @@ void ConsoleView_CmdRemoveAllWatches(const ConsoleCommandParams& /*params*/)
     DebugView_Redraw();
 }
 
+void ConsoleView_CmdQuickListSlots(const ConsoleCommandParams& /*params*/)
+{
+    bool okAny = false;
+    for (int slot = 0; slot < EMULATOR_QUICKSLOT_COUNT; slot++)
+    {
+        const CMotherboardSnapshot* pSnapshot = Emulator_GetQuickSlot(slot);
+        if (pSnapshot == nullptr)
+            continue;
+        ConsoleView_PrintFormat(_T("  Slot %d  PC=%06o\r\n"), slot, pSnapshot->cpu.R[7]);
+        okAny = true;
+    }
+    if (!okAny)
+        ConsoleView_Print(_T("  No quick-save slots used.\r\n"));
+}
+void ConsoleView_CmdQuickSave(const ConsoleCommandParams& params)
+{
+    if (!Emulator_QuickSave(params.paramOct1))
+        ConsoleView_Print(_T("  Failed to save the slot.\r\n"));
+}
+void ConsoleView_CmdQuickLoad(const ConsoleCommandParams& params)
+{
+    if (!Emulator_QuickLoad(params.paramOct1))
+    {
+        ConsoleView_Print(_T("  Failed to load the slot: slot is empty or saved with another ROM.\r\n"));
+        return;
+    }
+    MainWindow_UpdateAllViews();
+}
+
+static void ConsoleView_PrintSnapshotDiff(const CMotherboardSnapshot* pSnapshot1, const CMotherboardSnapshot* pSnapshot2)
+{
+    int count = 0;
+    for (int r = 0; r < 8; r++)
+    {
+        if (pSnapshot1->cpu.R[r] == pSnapshot2->cpu.R[r])
+            continue;
+        ConsoleView_PrintFormat(_T("  %s  %06o  %06o\r\n"), REGISTER_NAME[r], pSnapshot1->cpu.R[r], pSnapshot2->cpu.R[r]);
+        count++;
+    }
+    if (pSnapshot1->cpu.psw != pSnapshot2->cpu.psw)
+    {
+        ConsoleView_PrintFormat(_T("  PS  %06o  %06o\r\n"), pSnapshot1->cpu.psw, pSnapshot2->cpu.psw);
+        count++;
+    }
+
+    // RAM, show the first differences only
+    int ramCount = 0;
+    for (int address = 0; address < 65536; address++)
+    {
+        if (pSnapshot1->ram[address] == pSnapshot2->ram[address])
+            continue;
+        if (ramCount < 16)
+            ConsoleView_PrintFormat(_T("  %06o  %03o  %03o\r\n"), address, pSnapshot1->ram[address], pSnapshot2->ram[address]);
+        ramCount++;
+    }
+    if (ramCount > 0)
+        ConsoleView_PrintFormat(_T("  %d RAM bytes differ.\r\n"), ramCount);
+    else if (count == 0)
+        ConsoleView_Print(_T("  No differences in registers and RAM.\r\n"));
+}
+void ConsoleView_CmdQuickDiffSlots(const ConsoleCommandParams& params)
+{
+    const CMotherboardSnapshot* pSnapshot1 = Emulator_GetQuickSlot(params.paramOct1);
+    const CMotherboardSnapshot* pSnapshot2 = Emulator_GetQuickSlot(params.paramOct2);
+    if (pSnapshot1 == nullptr || pSnapshot2 == nullptr)
+    {
+        ConsoleView_Print(_T("  The slot is empty.\r\n"));
+        return;
+    }
+    ConsoleView_PrintSnapshotDiff(pSnapshot1, pSnapshot2);
+}
+void ConsoleView_CmdQuickDiff(const ConsoleCommandParams& params)
+{
+    const CMotherboardSnapshot* pSnapshot1 = Emulator_GetQuickSlot(params.paramOct1);
+    if (pSnapshot1 == nullptr)
+    {
+        ConsoleView_Print(_T("  The slot is empty.\r\n"));
+        return;
+    }
+    CMotherboardSnapshot* pCurrent = static_cast<CMotherboardSnapshot*>(::calloc(1, sizeof(CMotherboardSnapshot)));
+    if (pCurrent == nullptr)
+    {
+        ConsoleView_Print(_T("  Failed to allocate memory.\r\n"));
+        return;
+    }
+    g_pBoard->SaveToSnapshot(pCurrent);
+    ConsoleView_PrintSnapshotDiff(pSnapshot1, pCurrent);
+    ::free(pCurrent);
+}
+
+void ConsoleView_CmdProfilerOnOff(const ConsoleCommandParams& /*params*/)
+{
+    if (Profiler_IsRunning())
+    {
+        Profiler_Stop();
+        ConsoleView_Print(_T("  Profiler OFF.\r\n"));
+    }
+    else if (Profiler_Start())
+        ConsoleView_Print(_T("  Profiler ON.\r\n"));
+    else
+        ConsoleView_Print(_T("  Failed to start the profiler.\r\n"));
+}
+void ConsoleView_CmdProfilerClear(const ConsoleCommandParams& /*params*/)
+{
+    Profiler_Clear();
+    ConsoleView_Print(_T("  Profiler counters cleared.\r\n"));
+}
+void ConsoleView_CmdProfilerReport(const ConsoleCommandParams& /*params*/)
+{
+    const int nTopCount = 20;
+    ProfilerEntry entries[nTopCount];
+    if (!Profiler_SaveReport(_T("profile.txt")))  // Loads the symbols too
+    {
+        ConsoleView_Print(_T("  No profile data.\r\n"));
+        return;
+    }
+
+    uint64_t totalTicks = Profiler_GetTotalTicks();
+    int count = Profiler_GetTopEntries(entries, nTopCount);
+    TCHAR buffer[128];
+    for (int i = 0; i < count; i++)
+    {
+        Profiler_FormatEntry(entries[i], totalTicks, buffer, sizeof(buffer) / sizeof(TCHAR) - 2);
+        ConsoleView_Print(buffer);
+        ConsoleView_Print(_T("\r\n"));
+    }
+    ConsoleView_Print(_T("  Full profile saved to profile.txt\r\n"));
+    if (Profiler_SaveCallGraphReport(_T("callgraph.txt")) && Profiler_SaveCollapsedStacks(_T("stacks.txt")))
+        ConsoleView_Print(_T("  Call graph saved to callgraph.txt and stacks.txt\r\n"));
+}
+
+void ConsoleView_CmdProfilerBasicOnOff(const ConsoleCommandParams& /*params*/)
+{
+    if (Profiler_IsBasicRunning())
+    {
+        Profiler_StopBasic();
+        ConsoleView_Print(_T("  BASIC line profiler OFF.\r\n"));
+    }
+    else if (Profiler_StartBasic())
+        ConsoleView_Print(_T("  BASIC line profiler ON.\r\n"));
+    else
+        ConsoleView_Print(_T("  Failed to start the BASIC line profiler.\r\n"));
+}
+void ConsoleView_CmdProfilerBasicClear(const ConsoleCommandParams& /*params*/)
+{
+    Profiler_ClearBasic();
+    ConsoleView_Print(_T("  BASIC line profiler counters cleared.\r\n"));
+}
+void ConsoleView_CmdProfilerBasicReport(const ConsoleCommandParams& /*params*/)
+{
+    const int nTopCount = 20;
+    ProfilerEntry entries[nTopCount];
+    if (!Profiler_SaveBasicReport(_T("basicprofile.txt")) ||
+        !Profiler_SaveBasicListing(_T("program.bas"), _T("basicprofile.lst")))
+    {
+        ConsoleView_Print(_T("  No BASIC profile data.\r\n"));
+        return;
+    }
+
+    uint64_t programTicks = Profiler_GetBasicProgramTicks();
+    int count = Profiler_GetBasicTopLines(entries, nTopCount);
+    TCHAR buffer[80];
+    for (int i = 0; i < count; i++)
+    {
+        Profiler_FormatBasicEntry(entries[i], programTicks, buffer, sizeof(buffer) / sizeof(TCHAR) - 2);
+        ConsoleView_Print(buffer);
+        ConsoleView_Print(_T("\r\n"));
+    }
+    ConsoleView_Print(_T("  BASIC profile saved to basicprofile.txt and basicprofile.lst\r\n"));
+}
+
+void ConsoleView_CmdProfilerMemoryOnOff(const ConsoleCommandParams& /*params*/)
+{
+    if (Profiler_IsMemoryCounting())
+    {
+        Profiler_StopMemoryCounters();
+        ConsoleView_Print(_T("  Memory access counters OFF.\r\n"));
+    }
+    else if (Profiler_StartMemoryCounters())
+        ConsoleView_Print(_T("  Memory access counters ON.\r\n"));
+    else
+        ConsoleView_Print(_T("  Failed to start the memory access counters.\r\n"));
+    MemoryMapView_RedrawMap();
+}
+void ConsoleView_CmdProfilerMemoryClear(const ConsoleCommandParams& /*params*/)
+{
+    Profiler_ClearMemoryCounters();
+    ConsoleView_Print(_T("  Memory access counters cleared.\r\n"));
+    MemoryMapView_RedrawMap();
+}
+void ConsoleView_CmdProfilerMemoryReport(const ConsoleCommandParams& /*params*/)
+{
+    if (!Profiler_SaveMemoryCounters(_T("memcount.bin")) || !Profiler_SaveMemoryHeatmap(_T("memheat.png")))
+    {
+        ConsoleView_Print(_T("  No memory access counters.\r\n"));
+        return;
+    }
+    ConsoleView_Print(_T("  Memory access counters saved to memcount.bin and memheat.png\r\n"));
+}
+
+void ConsoleView_CmdPerfCountersOnOff(const ConsoleCommandParams& /*params*/)
+{
+    if (PerfCounters_IsRunning())
+    {
+        PerfCounters_Stop();
+        ConsoleView_Print(_T("  Performance counters OFF.\r\n"));
+    }
+    else
+    {
+        PerfCounters_Start();
+        ConsoleView_Print(_T("  Performance counters ON.\r\n"));
+    }
+}
+void ConsoleView_CmdPerfCountersClear(const ConsoleCommandParams& /*params*/)
+{
+    PerfCounters_Clear();
+    ConsoleView_Print(_T("  Performance counters cleared.\r\n"));
+}
+void ConsoleView_CmdPerfCountersReport(const ConsoleCommandParams& /*params*/)
+{
+    CPerfCounters counters;
+    PerfCounters_GetSnapshot(&counters);
+
+    ConsoleView_PrintFormat(_T("  Frames %I64u, ticks %I64u, instructions %I64u\r\n"),
+            counters.frames, counters.ticks, counters.instructions);
+    if (counters.instructions > 0)
+        ConsoleView_PrintFormat(_T("  Ticks per instruction: %.2f\r\n"), (double)counters.ticks / counters.instructions);
+    ConsoleView_PrintFormat(_T("  Reserved instruction traps %I64u, bus faults %I64u\r\n"),
+            counters.reservedTraps, counters.busFaults);
+    for (int i = 0; i < PERFCOUNTER_VECTORS; i++)
+    {
+        if (counters.interrupts[i] != 0)
+            ConsoleView_PrintFormat(_T("  Vector %06o: %I64u\r\n"), (uint16_t)(i * 4), counters.interrupts[i]);
+    }
+    for (int i = 0; i < PERFCOUNTER_PORTS; i++)
+    {
+        if (counters.portReads[i] == 0 && counters.portWrites[i] == 0)
+            continue;
+        if (i < PERFCOUNTER_PORTS - 1)
+            ConsoleView_PrintFormat(_T("  Port %06o: %I64u reads, %I64u writes\r\n"),
+                    (uint16_t)(0164000 + i * 2), counters.portReads[i], counters.portWrites[i]);
+        else
+            ConsoleView_PrintFormat(_T("  Other ports: %I64u reads, %I64u writes\r\n"),
+                    counters.portReads[i], counters.portWrites[i]);
+    }
+    ConsoleView_PrintFormat(_T("  LCD address changes %I64u, SMP0 bytes %I64u, SMP1 bytes %I64u\r\n"),
+            counters.lcdAddressChanges, counters.smpBytes[0], counters.smpBytes[1]);
+
+    if (!PerfCounters_SaveMetrics(FILENAME_METRICS))
+    {
+        ConsoleView_Print(_T("  Failed to save metrics.prom\r\n"));
+        return;
+    }
+    ConsoleView_Print(_T("  Performance counters saved to metrics.prom\r\n"));
+}
+
+void ConsoleView_CmdFrameTimingOnOff(const ConsoleCommandParams& /*params*/)
+{
+    if (FrameTiming_IsRunning())
+    {
+        FrameTiming_Stop();
+        ConsoleView_Print(_T("  Frame timing OFF.\r\n"));
+    }
+    else
+    {
+        FrameTiming_Start();
+        ConsoleView_Print(_T("  Frame timing ON.\r\n"));
+    }
+}
+void ConsoleView_CmdFrameTimingClear(const ConsoleCommandParams& /*params*/)
+{
+    FrameTiming_Clear();
+    ConsoleView_Print(_T("  Frame timing cleared.\r\n"));
+}
+void ConsoleView_CmdFrameTimingReport(const ConsoleCommandParams& /*params*/)
+{
+    FrameTimingStats stats;
+    FrameTiming_GetStats(&stats);
+    if (stats.frames == 0)
+    {
+        ConsoleView_Print(_T("  No frames measured.\r\n"));
+        return;
+    }
+
+    ConsoleView_PrintFormat(_T("  %u frames, percentiles over the last %d, ms:\r\n"), stats.frames, stats.window);
+    ConsoleView_Print(_T("  Part           p50      p99      max\r\n"));
+    for (int part = 0; part < FRAMETIMING_COUNT; part++)
+    {
+        ConsoleView_PrintFormat(_T("  %-9s %8.3f %8.3f %8.3f\r\n"), FrameTiming_GetPartName(part),
+                stats.p50[part] / 1000.0, stats.p99[part] / 1000.0, stats.max[part] / 1000.0);
+    }
+
+    FrameTimingRecord records[FRAMETIMING_WORST];
+    int count = FrameTiming_GetWorstFrames(records, FRAMETIMING_WORST);
+    ConsoleView_Print(_T("  Worst frames, ms: frame, total = CPU + events + sound + keyboard + screen\r\n"));
+    for (int i = 0; i < count; i++)
+    {
+        const float* time = records[i].time;
+        ConsoleView_PrintFormat(_T("  %8u %8.3f = %.3f + %.3f + %.3f + %.3f + %.3f\r\n"), records[i].frame,
+                time[FRAMETIMING_TOTAL] / 1000.0, time[FRAMETIMING_CPU] / 1000.0, time[FRAMETIMING_EVENTS] / 1000.0,
+                time[FRAMETIMING_SOUND] / 1000.0, time[FRAMETIMING_KEYBOARD] / 1000.0, time[FRAMETIMING_SCREEN] / 1000.0);
+    }
+}
+
+void ConsoleView_CmdPrintHistory(const ConsoleCommandParams& /*params*/)
+{
+    const int lines = 16;
+    const CProcessorHistory* pHistory = g_pBoard->GetCPU()->GetHistory();
+    uint32_t count = (pHistory->count < (uint32_t)lines) ? pHistory->count : (uint32_t)lines;
+    TCHAR buffer[128];
+    for (uint32_t i = pHistory->count - count; i != pHistory->count; i++)
+    {
+        Emulator_FormatHistoryEntry(pHistory->entries[i & (HISTORY_SIZE - 1)], buffer, sizeof(buffer) / sizeof(TCHAR));
+        ConsoleView_PrintFormat(_T("  %s\r\n"), buffer);
+    }
+}
+void ConsoleView_CmdSaveHistory(const ConsoleCommandParams& /*params*/)
+{
+    if (!Emulator_SaveHistory(g_pBoard->GetCPU()->GetHistory(), _T("Console request")))
+    {
+        ConsoleView_Print(_T("  Failed to save history.txt\r\n"));
+        return;
+    }
+    ConsoleView_Print(_T("  Flight recorder saved to history.txt\r\n"));
+}
+
+void ConsoleView_CmdWriteLogOnOff(const ConsoleCommandParams& /*params*/)
+{
+    if (WriteLog_IsRunning())
+    {
+        WriteLog_Stop();
+        WriteLogStats stats;
+        WriteLog_GetStats(&stats);
+        ConsoleView_PrintFormat(_T("  Write log OFF, %I64u writes, %d chunks, %u KB, cycle %I64u.\r\n"),
+                stats.records, stats.chunks, (uint32_t)(stats.packedSize / 1024), WriteLog_GetCycle());
+    }
+    else if (WriteLog_Start())
+        ConsoleView_Print(_T("  Write log ON.\r\n"));
+    else
+        ConsoleView_Print(_T("  Failed to start the write log.\r\n"));
+}
+void ConsoleView_CmdWriteLogClear(const ConsoleCommandParams& /*params*/)
+{
+    WriteLog_Clear();
+    ConsoleView_Print(_T("  Write log cleared.\r\n"));
+}
+// Symbol name with offset for the address, empty if no symbols
+static void ConsoleView_FormatSymbol(uint16_t address, TCHAR* buffer, size_t bufferSize)
+{
+    buffer[0] = 0;
+    uint16_t offset;
+    LPCTSTR name = Profiler_FindSymbol(address, &offset);
+    if (name != nullptr && offset == 0)
+        _sntprintf(buffer, bufferSize - 1, _T("%s"), name);
+    else if (name != nullptr)
+        _sntprintf(buffer, bufferSize - 1, _T("%s+%o"), name, offset);
+}
+static void ConsoleView_PrintWriteLogRecord(const CWriteLogRecord& record)
+{
+    TCHAR symbol[40];
+    ConsoleView_FormatSymbol(record.pc, symbol, sizeof(symbol) / sizeof(TCHAR));
+
+    if (record.flags & WRITELOG_FLAG_BYTE)
+        ConsoleView_PrintFormat(_T("  %12I64u  PC=%06o  %06o byte %03o -> %03o  %s\r\n"),
+                WriteLog_GetRecordCycle(record), record.pc, record.address, record.oldValue, record.newValue, symbol);
+    else
+        ConsoleView_PrintFormat(_T("  %12I64u  PC=%06o  %06o word %06o -> %06o  %s\r\n"),
+                WriteLog_GetRecordCycle(record), record.pc, record.address, record.oldValue, record.newValue, symbol);
+}
+static void ConsoleView_PrintLastWriters(uint16_t address, uint64_t cycleBefore)
+{
+    const int maxCount = 16;
+    CWriteLogRecord records[maxCount];
+    int count = WriteLog_FindLastWriters(address, cycleBefore, records, maxCount);
+    if (count == 0)
+    {
+        ConsoleView_PrintFormat(_T("  No writes to %06o logged.\r\n"), address);
+        return;
+    }
+    ConsoleView_Print(_T("         cycle  PC          address  old -> new, latest first\r\n"));
+    for (int i = 0; i < count; i++)
+        ConsoleView_PrintWriteLogRecord(records[i]);
+}
+void ConsoleView_CmdWriteLogLastWriters(const ConsoleCommandParams& params)
+{
+    ConsoleView_PrintLastWriters(params.paramOct1, ~(uint64_t)0);
+}
+void ConsoleView_CmdWriteLogLastWritersBefore(const ConsoleCommandParams& params)
+{
+    ConsoleView_PrintLastWriters(params.paramOct1, params.paramDec1);
+}
+
+const int CONSOLE_WRITERS_MAX = 32;  // Distinct instructions listed by the write range query
+struct ConsoleWriter
+{
+    uint16_t pc;
+    uint32_t count;
+    uint64_t lastCycle;
+};
+struct ConsoleWriters
+{
+    int count;
+    uint64_t others;  // Writes by the instructions not fitting into the list
+    ConsoleWriter writers[CONSOLE_WRITERS_MAX];
+};
+static bool CALLBACK ConsoleView_CountWriter(const CWriteLogRecord& record, void* pParam)
+{
+    ConsoleWriters* pWriters = static_cast<ConsoleWriters*>(pParam);
+    int i = 0;
+    while (i < pWriters->count && pWriters->writers[i].pc != record.pc)
+        i++;
+    if (i == CONSOLE_WRITERS_MAX)
+    {
+        pWriters->others++;
+        return true;
+    }
+    if (i == pWriters->count)
+    {
+        pWriters->count++;
+        pWriters->writers[i].pc = record.pc;
+        pWriters->writers[i].count = 0;
+    }
+    pWriters->writers[i].count++;
+    pWriters->writers[i].lastCycle = WriteLog_GetRecordCycle(record);
+    return true;
+}
+void ConsoleView_CmdWriteLogRangeWriters(const ConsoleCommandParams& params)
+{
+    if (params.paramOct2 < params.paramOct1)
+    {
+        ConsoleView_Print(_T("  Wrong address range.\r\n"));
+        return;
+    }
+    ConsoleWriters writers;
+    writers.count = 0;
+    writers.others = 0;
+    uint64_t total = WriteLog_FindWriters(params.paramOct1, params.paramOct2, ConsoleView_CountWriter, &writers);
+    ConsoleView_PrintFormat(_T("  %I64u writes to %06o..%06o logged.\r\n"), total, params.paramOct1, params.paramOct2);
+    for (int i = 0; i < writers.count; i++)
+    {
+        const ConsoleWriter& writer = writers.writers[i];
+        TCHAR symbol[40];
+        ConsoleView_FormatSymbol(writer.pc, symbol, sizeof(symbol) / sizeof(TCHAR));
+        ConsoleView_PrintFormat(_T("  PC=%06o  %10u writes, last at cycle %I64u  %s\r\n"),
+                writer.pc, writer.count, writer.lastCycle, symbol);
+    }
+    if (writers.others > 0)
+        ConsoleView_PrintFormat(_T("  ... %I64u writes by other instructions\r\n"), writers.others);
+}
+
+void ConsoleView_CmdEventTraceOnOff(const ConsoleCommandParams& /*params*/)
+{
+    if (EventTrace_IsRunning())
+    {
+        EventTrace_Stop();
+        ConsoleView_PrintFormat(_T("  Event tracer OFF, %d events, %d dropped.\r\n"),
+                EventTrace_GetEventCount(), EventTrace_GetDroppedCount());
+    }
+    else
+    {
+        EventTrace_Start();
+        ConsoleView_Print(_T("  Event tracer ON.\r\n"));
+    }
+}
+void ConsoleView_CmdEventTraceSave(const ConsoleCommandParams& /*params*/)
+{
+    if (!EventTrace_Save(FILENAME_EVENTTRACE))
+    {
+        ConsoleView_Print(_T("  Failed to save events.json\r\n"));
+        return;
+    }
+    ConsoleView_PrintFormat(_T("  %d events saved to events.json\r\n"), EventTrace_GetEventCount());
+}
+
+void ConsoleView_CmdCoverageOnOff(const ConsoleCommandParams& /*params*/)
+{
+    if (Coverage_IsRunning())
+    {
+        Coverage_Stop();
+        ConsoleView_Print(_T("  Code coverage OFF.\r\n"));
+    }
+    else
+    {
+        Coverage_Start();
+        ConsoleView_Print(_T("  Code coverage ON.\r\n"));
+    }
+}
+void ConsoleView_CmdCoverageClear(const ConsoleCommandParams& /*params*/)
+{
+    Coverage_Clear();
+    ConsoleView_Print(_T("  Code coverage cleared.\r\n"));
+}
+void ConsoleView_CmdCoverageMerge(const ConsoleCommandParams& /*params*/)
+{
+    if (!Coverage_Merge(FILENAME_COVERAGE))
+    {
+        ConsoleView_Print(_T("  Failed to merge coverage.mk90cov, no file or the configuration differs.\r\n"));
+        return;
+    }
+    ConsoleView_Print(_T("  Code coverage merged with coverage.mk90cov\r\n"));
+}
+void ConsoleView_CmdCoverageReport(const ConsoleCommandParams& /*params*/)
+{
+    CoverageMap map;
+    Coverage_GetMap(&map);
+    CoverageStats stats;
+    Coverage_GetStats(&map, &stats);
+
+    TCHAR buffer[80];
+    _sntprintf(buffer, sizeof(buffer) / sizeof(TCHAR) - 1, _T("  Executed: ROM %d words, RAM %d words\r\n"),
+            stats.romWords, stats.ramWords);
+    ConsoleView_Print(buffer);
+
+    if (!Coverage_Save(FILENAME_COVERAGE))
+    {
+        ConsoleView_Print(_T("  Failed to save coverage.mk90cov\r\n"));
+        return;
+    }
+
+    LPCTSTR sListingPath = (map.configuration == EMU_CONF_BASIC10) ? _T("basic10.lst") : _T("basic20.lst");
+    int executed = 0;
+    int total = Coverage_AnnotateListing(&map, sListingPath, _T("coverage.lst"), &executed);
+    if (total < 0)
+    {
+        ConsoleView_Print(_T("  Code coverage saved to coverage.mk90cov\r\n"));
+        return;
+    }
+    _sntprintf(buffer, sizeof(buffer) / sizeof(TCHAR) - 1, _T("  Instructions executed: %d of %d listed\r\n"),
+            executed, total);
+    ConsoleView_Print(buffer);
+    ConsoleView_Print(_T("  Code coverage saved to coverage.mk90cov and coverage.lst\r\n"));
+}
+
 #if !defined(PRODUCT)
 void ConsoleView_CmdClearTraceLog(const ConsoleCommandParams& /*params*/)
 {
     DebugLogClear();
+    if (TraceLog_IsRunning())
+        TraceLog_Start(FILENAME_TRACE, TraceLog_GetFlags());
     ConsoleView_Print(_T("  Trace log cleared.\r\n"));
 }
+void ConsoleView_CmdDecodeTraceLog(const ConsoleCommandParams& /*params*/)
+{
+    if (TraceLog_IsRunning())
+    {
+        ConsoleView_Print(_T("  Trace is on, turn it off first.\r\n"));
+        return;
+    }
+    int records = TraceLog_Decode(FILENAME_TRACE, FILENAME_TRACE_TEXT);
+    if (records < 0)
+    {
+        ConsoleView_Print(_T("  Failed to decode trace.mk90trc file.\r\n"));
+        return;
+    }
+    ConsoleView_PrintFormat(_T("  Trace decoded to trace.txt, %d records.\r\n"), records);
+}
 void ConsoleView_CmdTraceLogWithMask(const ConsoleCommandParams& params)
 {
     ConsoleView_TraceLog(params.paramOct1);
 }
 void ConsoleView_CmdTraceLogOnOff(const ConsoleCommandParams& /*params*/)
 {
-    DWORD dwTrace = (g_pBoard->GetTrace() == TRACE_NONE ? TRACE_ALL : TRACE_NONE);
+    DWORD dwTrace = (TraceLog_IsRunning() ? TRACE_NONE : TRACE_ALL);
     ConsoleView_TraceLog(dwTrace);
 }
+void ConsoleView_PrintLogMask()
+{
+    DWORD mask = DebugLogGetMask();
+    ConsoleView_PrintFormat(_T("  Debug log categories %06o:%s%s%s%s%s%s\r\n"), (uint16_t)mask,
+            (mask & LOGCAT_CPU) ? _T(" CPU") : _T(""), (mask & LOGCAT_INT) ? _T(" INT") : _T(""),
+            (mask & LOGCAT_PORT) ? _T(" PORT") : _T(""), (mask & LOGCAT_KBD) ? _T(" KBD") : _T(""),
+            (mask & LOGCAT_SMP) ? _T(" SMP") : _T(""), (mask & LOGCAT_LCD) ? _T(" LCD") : _T(""));
+}
+void ConsoleView_CmdLogMask(const ConsoleCommandParams& /*params*/)
+{
+    ConsoleView_PrintLogMask();
+}
+void ConsoleView_CmdSetLogMask(const ConsoleCommandParams& params)
+{
+    DebugLogSetMask(params.paramOct1);
+    ConsoleView_PrintLogMask();
+}
 #endif
 
 
@@ -731,6 +1361,7 @@ enum ConsoleCommandArgInfo
     ARGINFO_OCT,      // Octal value
     ARGINFO_REG_OCT,  // Register number, octal value
     ARGINFO_OCT_OCT,  // Octal value, octal value
+    ARGINFO_OCT_DEC64,  // Octal value, 64-bit decimal value
 };
 
 typedef void(*CONSOLE_COMMAND_CALLBACK)(const ConsoleCommandParams& params);
@@ -773,10 +1404,46 @@ static ConsoleCommands[] =
     { _T("w"), ARGINFO_NONE, ConsoleView_CmdPrintAllWatches },
     { _T("wc%ho"), ARGINFO_OCT, ConsoleView_CmdRemoveWatchAtAddress },
     { _T("wc"), ARGINFO_NONE, ConsoleView_CmdRemoveAllWatches },
+    { _T("qs%ho"), ARGINFO_OCT, ConsoleView_CmdQuickSave },
+    { _T("ql%ho"), ARGINFO_OCT, ConsoleView_CmdQuickLoad },
+    { _T("qd%ho %ho"), ARGINFO_OCT_OCT, ConsoleView_CmdQuickDiffSlots },
+    { _T("qd%ho"), ARGINFO_OCT, ConsoleView_CmdQuickDiff },
+    { _T("q"), ARGINFO_NONE, ConsoleView_CmdQuickListSlots },
+    { _T("p"), ARGINFO_NONE, ConsoleView_CmdProfilerOnOff },
+    { _T("pc"), ARGINFO_NONE, ConsoleView_CmdProfilerClear },
+    { _T("pr"), ARGINFO_NONE, ConsoleView_CmdProfilerReport },
+    { _T("pb"), ARGINFO_NONE, ConsoleView_CmdProfilerBasicOnOff },
+    { _T("pbc"), ARGINFO_NONE, ConsoleView_CmdProfilerBasicClear },
+    { _T("pbr"), ARGINFO_NONE, ConsoleView_CmdProfilerBasicReport },
+    { _T("pm"), ARGINFO_NONE, ConsoleView_CmdProfilerMemoryOnOff },
+    { _T("pmc"), ARGINFO_NONE, ConsoleView_CmdProfilerMemoryClear },
+    { _T("pmr"), ARGINFO_NONE, ConsoleView_CmdProfilerMemoryReport },
+    { _T("pf"), ARGINFO_NONE, ConsoleView_CmdPerfCountersOnOff },
+    { _T("pfc"), ARGINFO_NONE, ConsoleView_CmdPerfCountersClear },
+    { _T("pfr"), ARGINFO_NONE, ConsoleView_CmdPerfCountersReport },
+    { _T("ft"), ARGINFO_NONE, ConsoleView_CmdFrameTimingOnOff },
+    { _T("ftc"), ARGINFO_NONE, ConsoleView_CmdFrameTimingClear },
+    { _T("ftr"), ARGINFO_NONE, ConsoleView_CmdFrameTimingReport },
+    { _T("fr"), ARGINFO_NONE, ConsoleView_CmdPrintHistory },
+    { _T("frs"), ARGINFO_NONE, ConsoleView_CmdSaveHistory },
+    { _T("wl%ho<%I64u"), ARGINFO_OCT_DEC64, ConsoleView_CmdWriteLogLastWritersBefore },
+    { _T("wl%ho %ho"), ARGINFO_OCT_OCT, ConsoleView_CmdWriteLogRangeWriters },
+    { _T("wl%ho"), ARGINFO_OCT, ConsoleView_CmdWriteLogLastWriters },
+    { _T("wl"), ARGINFO_NONE, ConsoleView_CmdWriteLogOnOff },
+    { _T("wlc"), ARGINFO_NONE, ConsoleView_CmdWriteLogClear },
+    { _T("ev"), ARGINFO_NONE, ConsoleView_CmdEventTraceOnOff },
+    { _T("evs"), ARGINFO_NONE, ConsoleView_CmdEventTraceSave },
+    { _T("cv"), ARGINFO_NONE, ConsoleView_CmdCoverageOnOff },
+    { _T("cvc"), ARGINFO_NONE, ConsoleView_CmdCoverageClear },
+    { _T("cvm"), ARGINFO_NONE, ConsoleView_CmdCoverageMerge },
+    { _T("cvr"), ARGINFO_NONE, ConsoleView_CmdCoverageReport },
 #if !defined(PRODUCT)
     { _T("t%ho"), ARGINFO_OCT, ConsoleView_CmdTraceLogWithMask },
     { _T("t"), ARGINFO_NONE, ConsoleView_CmdTraceLogOnOff },
     { _T("tc"), ARGINFO_NONE, ConsoleView_CmdClearTraceLog },
+    { _T("td"), ARGINFO_NONE, ConsoleView_CmdDecodeTraceLog },
+    { _T("lg%ho"), ARGINFO_OCT, ConsoleView_CmdSetLogMask },
+    { _T("lg"), ARGINFO_NONE, ConsoleView_CmdLogMask },
 #endif
 };
 const size_t ConsoleCommandsCount = sizeof(ConsoleCommands) / sizeof(ConsoleCommands[0]);
@@ -802,6 +1469,7 @@ void ConsoleView_DoConsoleCommand()
     params.paramReg1 = -1;
     params.paramOct1 = 0;
     params.paramOct2 = 0;
+    params.paramDec1 = 0;
 
     // Find matching console command from the list, parse and execute the command
     bool parsedOkay = false, parseError = false;
@@ -841,6 +1509,10 @@ void ConsoleView_DoConsoleCommand()
             paramsParsed = _sntscanf_s(command, 32, cmd.pattern, &params.paramOct1, &params.paramOct2);
             parsedOkay = (paramsParsed == 2);
             break;
+        case ARGINFO_OCT_DEC64:
+            paramsParsed = _sntscanf_s(command, 32, cmd.pattern, &params.paramOct1, &params.paramDec1);
+            parsedOkay = (paramsParsed == 2);
+            break;
         }
 
         if (parseError)
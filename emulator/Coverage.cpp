@@ -0,0 +1,258 @@
+﻿/*  This file is part of MK90BTL.
+    MK90BTL is free software: you can redistribute it and/or modify it under the terms
+of the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+    MK90BTL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License along with
+MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
+
+// Coverage.cpp
+
+#include "stdafx.h"
+#include <stdio.h>
+#include <Share.h>
+#include "Main.h"
+#include "Emulator.h"
+#include "emubase\Emubase.h"
+#include "Coverage.h"
+
+//////////////////////////////////////////////////////////////////////
+
+
+CoverageMap m_Coverage;
+bool m_okCoverageRunning = false;
+TCHAR m_sCoverageAutoSaveFile[MAX_PATH] = { 0 };
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+bool Coverage_IsRunning() { return m_okCoverageRunning; }
+
+bool Coverage_Start()
+{
+    if (!m_okCoverageRunning)
+        m_Coverage.configuration = g_nEmulatorConfiguration;
+    g_pBoard->GetCPU()->SetCoverage(&m_Coverage.coverage);
+    m_okCoverageRunning = true;
+    return true;
+}
+
+void Coverage_Stop()
+{
+    if (g_pBoard != nullptr)
+        g_pBoard->GetCPU()->SetCoverage(nullptr);
+    m_okCoverageRunning = false;
+}
+
+void Coverage_Clear()
+{
+    ::memset(&m_Coverage.coverage, 0, sizeof(m_Coverage.coverage));
+    m_Coverage.configuration = g_nEmulatorConfiguration;
+}
+
+void Coverage_SetAutoSaveFile(LPCTSTR sFilePath)
+{
+    if (sFilePath == nullptr)
+        m_sCoverageAutoSaveFile[0] = 0;
+    else
+        _tcsncpy_s(m_sCoverageAutoSaveFile, MAX_PATH, sFilePath, _TRUNCATE);
+}
+
+static void Coverage_AutoSave()
+{
+    if (m_sCoverageAutoSaveFile[0] == 0 || m_Coverage.configuration == 0)
+        return;
+    CoverageStats stats;
+    Coverage_GetStats(&m_Coverage, &stats);
+    if (stats.romWords + stats.ramWords == 0)
+        return;  // Nothing to merge
+
+    if (!Coverage_MergeToFile(m_sCoverageAutoSaveFile, &m_Coverage))
+        DebugLogFormat(_T("Failed to merge the coverage to %s\r\n"), m_sCoverageAutoSaveFile);
+}
+
+void Coverage_Done()
+{
+    Coverage_Stop();
+    Coverage_AutoSave();
+}
+
+void Coverage_OnConfigurationChanged()
+{
+    // The map is valid for one ROM only
+    if (m_Coverage.configuration == g_nEmulatorConfiguration)
+        return;
+    Coverage_AutoSave();
+    Coverage_Clear();
+}
+
+void Coverage_GetMap(CoverageMap* pMap)
+{
+    ::memcpy(pMap, &m_Coverage, sizeof(CoverageMap));
+}
+
+bool Coverage_Merge(LPCTSTR sFilePath)
+{
+    CoverageMap map;
+    if (!Coverage_LoadMap(sFilePath, &map) || map.configuration != m_Coverage.configuration)
+        return false;
+
+    for (size_t i = 0; i < sizeof(map.coverage.bits); i++)
+        m_Coverage.coverage.bits[i] |= map.coverage.bits[i];
+    return true;
+}
+
+bool Coverage_Save(LPCTSTR sFilePath)
+{
+    return Coverage_SaveMap(sFilePath, &m_Coverage);
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Coverage maps
+
+
+bool Coverage_IsExecuted(const CoverageMap* pMap, uint16_t address)
+{
+    return (pMap->coverage.bits[address >> 4] & (1 << ((address >> 1) & 7))) != 0;
+}
+
+void Coverage_GetStats(const CoverageMap* pMap, CoverageStats* pStats)
+{
+    pStats->romWords = pStats->ramWords = 0;
+    for (int address = 0; address < 65536; address += 2)
+    {
+        if (!Coverage_IsExecuted(pMap, (uint16_t)address))
+            continue;
+        if (address >= 0100000)
+            pStats->romWords++;
+        else if (address < 0040000)
+            pStats->ramWords++;
+    }
+}
+
+bool Coverage_LoadMap(LPCTSTR sFilePath, CoverageMap* pMap)
+{
+    FILE* fpFile = ::_tfsopen(sFilePath, _T("rb"), _SH_DENYWR);
+    if (fpFile == nullptr)
+        return false;
+
+    CoverageFileHeader header;
+    bool okResult =
+        ::fread(&header, 1, sizeof(header), fpFile) == sizeof(header) &&
+        header.header1 == MK90COVER_HEADER1 && header.header2 == MK90COVER_HEADER2 &&
+        (header.version >> 16) == (MK90COVER_VERSION >> 16) &&
+        ::fread(&pMap->coverage, 1, sizeof(pMap->coverage), fpFile) == sizeof(pMap->coverage);
+    pMap->configuration = (int)header.configuration;
+
+    ::fclose(fpFile);
+    return okResult;
+}
+
+bool Coverage_SaveMap(LPCTSTR sFilePath, const CoverageMap* pMap)
+{
+    FILE* fpFile = ::_tfsopen(sFilePath, _T("wb"), _SH_DENYWR);
+    if (fpFile == nullptr)
+        return false;
+
+    CoverageFileHeader header;
+    header.header1 = MK90COVER_HEADER1;
+    header.header2 = MK90COVER_HEADER2;
+    header.version = MK90COVER_VERSION;
+    header.configuration = (uint32_t)pMap->configuration;
+    bool okResult =
+        ::fwrite(&header, 1, sizeof(header), fpFile) == sizeof(header) &&
+        ::fwrite(&pMap->coverage, 1, sizeof(pMap->coverage), fpFile) == sizeof(pMap->coverage);
+
+    ::fclose(fpFile);
+    return okResult;
+}
+
+bool Coverage_MergeToFile(LPCTSTR sFilePath, const CoverageMap* pMap)
+{
+    CoverageMap map;
+    if (Coverage_LoadMap(sFilePath, &map))
+    {
+        if (map.configuration != pMap->configuration)
+            return false;
+        for (size_t i = 0; i < sizeof(map.coverage.bits); i++)
+            map.coverage.bits[i] |= pMap->coverage.bits[i];
+    }
+    else
+        ::memcpy(&map, pMap, sizeof(CoverageMap));
+
+    return Coverage_SaveMap(sFilePath, &map);
+}
+
+// Parse the listing line "NNNNNN:<tab>MNEMONIC..."; returns true for instruction line, not for directive
+static bool Coverage_ParseListingLine(LPCTSTR text, uint16_t* pAddress)
+{
+    uint16_t address = 0;
+    int digits = 0;
+    for (; digits < 6; digits++)
+    {
+        if (text[digits] < _T('0') || text[digits] > _T('7'))
+            return false;
+        address = (uint16_t)(address * 8 + (text[digits] - _T('0')));
+    }
+    if (text[digits] != _T(':'))
+        return false;
+
+    LPCTSTR p = text + digits + 1;
+    while (*p == _T(' ') || *p == _T('\t')) p++;
+    if (*p == 0 || *p == _T('\n') || *p == _T(';') || *p == _T('.'))
+        return false;  // Label only, comment or directive
+
+    *pAddress = address;
+    return true;
+}
+
+int Coverage_AnnotateListing(const CoverageMap* pMap, LPCTSTR sListingPath, LPCTSTR sFilePath, int* pExecuted)
+{
+    FILE* fpListing = ::_tfsopen(sListingPath, _T("rt"), _SH_DENYWR);
+    if (fpListing == nullptr)
+        return -1;
+    FILE* fpFile = ::_tfsopen(sFilePath, _T("wt"), _SH_DENYWR);
+    if (fpFile == nullptr)
+    {
+        ::fclose(fpListing);
+        return -1;
+    }
+
+    int total = 0, executed = 0;
+    bool okLineStart = true;  // Long lines are read by parts
+    TCHAR text[256];
+    while (::_fgetts(text, sizeof(text) / sizeof(TCHAR), fpListing) != nullptr)
+    {
+        uint16_t address;
+        LPCTSTR marker = _T("  ");
+        if (okLineStart && Coverage_ParseListingLine(text, &address))
+        {
+            total++;
+            if (Coverage_IsExecuted(pMap, address))
+            {
+                executed++;
+                marker = _T("+ ");
+            }
+            else
+                marker = _T("- ");
+        }
+        ::_fputts(okLineStart ? marker : _T(""), fpFile);
+        ::_fputts(text, fpFile);
+
+        size_t length = _tcslen(text);
+        okLineStart = (length > 0 && text[length - 1] == _T('\n'));
+    }
+
+    ::fclose(fpListing);
+    ::fclose(fpFile);
+
+    *pExecuted = executed;
+    return total;
+}
+
+
+//////////////////////////////////////////////////////////////////////
@@ -0,0 +1,73 @@
+﻿/*  This file is part of MK90BTL.
+    MK90BTL is free software: you can redistribute it and/or modify it under the terms
+of the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+    MK90BTL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License along with
+MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
+
+// Coverage.h
+
+#pragma once
+
+//////////////////////////////////////////////////////////////////////
+//
+// Code coverage keeps one bit for every word address where an instruction was fetched, see CProcessorCoverage.
+// It is cheap enough to keep it on for the whole test run.
+// Coverage file format:
+//   16 bytes       Header, see CoverageFileHeader
+//   4096 bytes     Bits, see CProcessorCoverage
+
+#define MK90COVER_HEADER1 0x30394B4D  // "MK90"
+#define MK90COVER_HEADER2 0x21564F43  // "COV!"
+#define MK90COVER_VERSION 0x00010000  // 1.0
+
+const LPCTSTR FILENAME_COVERAGE = _T("coverage.mk90cov");  // Default coverage file
+
+struct CoverageFileHeader
+{
+    uint32_t header1;
+    uint32_t header2;
+    uint32_t version;
+    uint32_t configuration;
+};
+
+struct CoverageMap
+{
+    int configuration;
+    CProcessorCoverage coverage;
+};
+
+struct CoverageStats
+{
+    int romWords;  // Executed word addresses in ROM, 100000-177777
+    int ramWords;  // Executed word addresses in RAM, 000000-037777
+};
+
+bool Coverage_Start();  // Start or continue marking the executed addresses
+void Coverage_Stop();  // Stop marking, the map is kept
+bool Coverage_IsRunning();
+void Coverage_Clear();
+void Coverage_Done();  // Merge to the auto-save file if any, called on the emulator exit
+// Set the file to merge the map into on the exit and on configuration change; nullptr = no auto-save
+void Coverage_SetAutoSaveFile(LPCTSTR sFilePath);
+void Coverage_OnConfigurationChanged();
+
+void Coverage_GetMap(CoverageMap* pMap);  // Get copy of the current map
+bool Coverage_Merge(LPCTSTR sFilePath);  // Merge the map from the file into the current map
+bool Coverage_Save(LPCTSTR sFilePath);  // Write the current map
+
+bool Coverage_IsExecuted(const CoverageMap* pMap, uint16_t address);
+void Coverage_GetStats(const CoverageMap* pMap, CoverageStats* pStats);
+bool Coverage_LoadMap(LPCTSTR sFilePath, CoverageMap* pMap);
+bool Coverage_SaveMap(LPCTSTR sFilePath, const CoverageMap* pMap);
+// Merge the map into the file; the file is created if needed, configuration should match
+bool Coverage_MergeToFile(LPCTSTR sFilePath, const CoverageMap* pMap);
+// Write the disassembly listing, like docs/basic20.lst, marking the instruction lines:
+// "+" executed, "-" never executed; returns number of instruction lines, -1 on error
+int  Coverage_AnnotateListing(const CoverageMap* pMap, LPCTSTR sListingPath, LPCTSTR sFilePath, int* pExecuted);
+
+
+//////////////////////////////////////////////////////////////////////
@@ -18,6 +18,17 @@ MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
 #include "Views.h"
 #include "emubase\Emubase.h"
 #include "SoundGen.h"
+#include "Movie.h"
+#include "Profiler.h"
+#include "Coverage.h"
+#include "TraceLog.h"
+#include "WriteLog.h"
+#include "EventTrace.h"
+#include "PerfCounters.h"
+#include "FrameTiming.h"
+#include "util/HashLogFile.h"
+#include "util/Crc32.h"
+#include "util/LzCodec.h"
 
 //////////////////////////////////////////////////////////////////////
 
@@ -39,15 +50,34 @@ bool m_okEmulatorCovox = false;
 long m_nFrameCount = 0;
 uint32_t m_dwTickCount = 0;
 uint32_t m_dwEmulatorUptime = 0;  // Machine uptime, seconds, from turn on or reset, increments every 25 frames
+uint64_t m_EmulatorRomHash = 0;  // Hash of the ROM loaded for the current configuration
+uint8_t* m_pEmulatorStateScratch = nullptr;  // Scratch buffer for image loading, allocated once
+uint32_t m_dwEmulatorAutoSavePeriod = 0;  // Autosave period in milliseconds of the host time, 0 = off
+uint32_t m_dwEmulatorAutoSaveTicks = 0;  // GetTickCount() at the last autosave
+CMotherboardSnapshot* m_pEmulatorBootSnapshot = nullptr;  // Boot cache: the machine state after the cold boot
 long m_nUptimeFrameCount = 0;
+int m_nEmulatorHistoryDumps = 0;  // Flight recorder dumps made on the events and breakpoints
 
 uint8_t* g_pEmulatorRam = nullptr;  // RAM values - for change tracking
 uint8_t* g_pEmulatorChangedRam = nullptr;  // RAM change flags
 uint16_t g_wEmulatorCpuPC = 0177777;      // Current PC value
 uint16_t g_wEmulatorPrevCpuPC = 0177777;  // Previous PC value
 
+const int EMULATOR_VIDEOBUFFER_SIZE = 32 * 30;  // LCD video buffer size, bytes
 
-void CALLBACK Emulator_SoundGenCallback(unsigned short L, unsigned short R);
+int m_nEmulatorRunAhead = 0;  // Run-ahead frames count, 0 = run-ahead is off
+CMotherboardSnapshot* m_pEmulatorRunAheadSnapshot = nullptr;
+uint8_t m_EmulatorRunAheadVideo[EMULATOR_VIDEOBUFFER_SIZE];  // Video buffer copy taken after the run-ahead frames
+bool m_okEmulatorRunAheadVideo = false;
+
+HHASHLOGFILE m_hEmulatorHashLog = nullptr;  // Machine state hash for every frame
+uint32_t m_nEmulatorHashLogFrame = 0;
+
+
+void Emulator_SoundGenCallback(unsigned short L, unsigned short R);
+static void Emulator_DoneSaveImage();
+static void Emulator_DoneQuickSlots();
+static void Emulator_BootBoard(bool okFillCache);
 
 //////////////////////////////////////////////////////////////////////
 //Прототип функции преобразования экрана
@@ -100,6 +130,10 @@ const uint32_t ScreenView_Palette[][4] =
 
 const LPCTSTR FILENAME_ROM_BASIC10 = _T("basic10.rom");
 const LPCTSTR FILENAME_ROM_BASIC20 = _T("basic20.rom");
+const LPCTSTR FILENAME_AUTOSAVE = _T("autosave.mk90st");
+const LPCTSTR FILENAME_BOOTCACHE_FORMAT = _T("boot%08x%08x.mk90st");  // Boot cache key
+
+const int EMULATOR_HISTORY_MAX_DUMPS = 16;  // Limit for the event dumps, the program may hit the event repeatedly
 
 
 //////////////////////////////////////////////////////////////////////
@@ -129,6 +163,42 @@ bool Emulator_LoadRomFile(LPCTSTR strFileName, uint8_t* buffer, uint32_t fileOff
     return true;
 }
 
+// Load ROM for the configuration: from the ROM file, or from the resource if the file is not found
+static bool Emulator_LoadConfigurationRom(uint16_t configuration, uint8_t* buffer)
+{
+    LPCTSTR szRomFileName = nullptr;
+    uint16_t nRomResourceId;
+    switch (configuration)
+    {
+    default:
+    case EMU_CONF_BASIC10:
+        szRomFileName = FILENAME_ROM_BASIC10;
+        nRomResourceId = IDR_MK90_ROM_BASIC10;
+        break;
+    case EMU_CONF_BASIC20:
+        szRomFileName = FILENAME_ROM_BASIC20;
+        nRomResourceId = IDR_MK90_ROM_BASIC20;
+        break;
+    }
+
+    // Load ROM file
+    if (Emulator_LoadRomFile(szRomFileName, buffer, 0, 32768))
+        return true;
+
+    // ROM file not found or failed to load, load the ROM from resource instead
+    HRSRC hRes = NULL;
+    uint32_t dwDataSize = 0;
+    HGLOBAL hResLoaded = NULL;
+    void * pResData = nullptr;
+    if ((hRes = ::FindResource(NULL, MAKEINTRESOURCE(nRomResourceId), _T("BIN"))) == NULL ||
+        (dwDataSize = ::SizeofResource(NULL, hRes)) < 32768 ||
+        (hResLoaded = ::LoadResource(NULL, hRes)) == NULL ||
+        (pResData = ::LockResource(hResLoaded)) == NULL)
+        return false;
+    ::memcpy(buffer, pResData, 32768);
+    return true;
+}
+
 bool Emulator_Init()
 {
     ASSERT(g_pBoard == nullptr);
@@ -178,12 +248,25 @@ void Emulator_Done()
     g_pBoard->SetSoundGenCallback(nullptr);
     SoundGen_Finalize();
 
+    Emulator_SetRunAhead(0);
+    Emulator_StopHashLog();
+    Profiler_Done();
+    Coverage_Done();
+    TraceLog_Stop();
+    WriteLog_Done();
+    EventTrace_Done();
+    PerfCounters_Done();
+
     delete g_pBoard;
     g_pBoard = nullptr;
 
     // Free memory used for old RAM values
     ::free(g_pEmulatorRam);  g_pEmulatorRam = nullptr;
     ::free(g_pEmulatorChangedRam);  g_pEmulatorChangedRam = nullptr;
+    ::free(m_pEmulatorStateScratch);  m_pEmulatorStateScratch = nullptr;
+    Emulator_DoneSaveImage();
+    Emulator_DoneQuickSlots();
+    ::free(m_pEmulatorBootSnapshot);  m_pEmulatorBootSnapshot = nullptr;
 }
 
 LPCTSTR Emulator_GetConfigurationName()
@@ -197,48 +280,25 @@ LPCTSTR Emulator_GetConfigurationName()
 
 bool Emulator_InitConfiguration(uint16_t configuration)
 {
-    g_pBoard->SetConfiguration(configuration);
+    Movie_Stop();
 
-    LPCTSTR szRomFileName = nullptr;
-    uint16_t nRomResourceId;
-    switch (configuration)
-    {
-    default:
-    case EMU_CONF_BASIC10:
-        szRomFileName = FILENAME_ROM_BASIC10;
-        nRomResourceId = IDR_MK90_ROM_BASIC10;
-        break;
-    case EMU_CONF_BASIC20:
-        szRomFileName = FILENAME_ROM_BASIC20;
-        nRomResourceId = IDR_MK90_ROM_BASIC20;
-        break;
-    }
+    g_pBoard->SetConfiguration(configuration);
 
     uint8_t buffer[32768];//TODO: allocate on the heap
 
-    // Load ROM file
-    if (!Emulator_LoadRomFile(szRomFileName, buffer, 0, 32768))
-    {
-        // ROM file not found or failed to load, load the ROM from resource instead
-        HRSRC hRes = NULL;
-        uint32_t dwDataSize = 0;
-        HGLOBAL hResLoaded = NULL;
-        void * pResData = nullptr;
-        if ((hRes = ::FindResource(NULL, MAKEINTRESOURCE(nRomResourceId), _T("BIN"))) == NULL ||
-            (dwDataSize = ::SizeofResource(NULL, hRes)) < 32768 ||
-            (hResLoaded = ::LoadResource(NULL, hRes)) == NULL ||
-            (pResData = ::LockResource(hResLoaded)) == NULL)
-        {
-            AlertWarning(_T("Failed to load the ROM."));
-            return false;
-        }
-        ::memcpy(buffer, pResData, 32768);
+    if (!Emulator_LoadConfigurationRom(configuration, buffer))
+    {
+        AlertWarning(_T("Failed to load the ROM."));
+        return false;
     }
     g_pBoard->LoadROM(buffer);
+    m_EmulatorRomHash = CMotherboard::CalculateRomHash(buffer);
 
     g_nEmulatorConfiguration = configuration;
+    Profiler_OnConfigurationChanged();
+    Coverage_OnConfigurationChanged();
 
-    g_pBoard->Reset();
+    Emulator_BootBoard(true);
 
     m_nUptimeFrameCount = 0;
     m_dwEmulatorUptime = 0;
@@ -264,6 +324,8 @@ void Emulator_Start()
 void Emulator_Stop()
 {
     g_okEmulatorRunning = false;
+    m_okEmulatorRunAheadVideo = false;
+    FrameTiming_CancelFrame();
 
     Emulator_SetTempCPUBreakpoint(0177777);
 
@@ -281,7 +343,11 @@ void Emulator_Reset()
 {
     ASSERT(g_pBoard != nullptr);
 
-    g_pBoard->Reset();
+    if (Movie_IsPlaying())
+        Movie_Stop();
+
+    Emulator_BootBoard(false);
+    Movie_RecordReset();
 
     m_nUptimeFrameCount = 0;
     m_dwEmulatorUptime = 0;
@@ -289,6 +355,33 @@ void Emulator_Reset()
     MainWindow_UpdateAllViews();
 }
 
+// All the user input goes through these functions to be recorded in the movie
+void Emulator_KeyboardEvent(uint8_t scancode, bool okPressed)
+{
+    g_pBoard->KeyboardEvent(scancode, okPressed);
+    Movie_RecordKeyboardEvent(scancode, okPressed);
+}
+bool Emulator_AttachSmpImage(int slot, LPCTSTR sFilePath)
+{
+    if (Movie_IsPlaying())
+        Movie_Stop();
+
+    FILE* fpFile = ::_tfopen(sFilePath, _T("r+b"));
+    if (fpFile == nullptr || !g_pBoard->AttachSmpImage(slot, fpFile))
+        return false;
+
+    Movie_RecordSmpAttach(slot);
+    return true;
+}
+void Emulator_DetachSmpImage(int slot)
+{
+    if (Movie_IsPlaying())
+        Movie_Stop();
+
+    g_pBoard->DetachSmpImage(slot);
+    Movie_RecordSmpDetach(slot);
+}
+
 bool Emulator_AddCPUBreakpoint(uint16_t address)
 {
     if (m_wEmulatorCPUBpsCount == MAX_BREAKPOINTCOUNT - 1 || address == 0177777)
@@ -471,19 +564,256 @@ void Emulator_SetSound(bool soundOnOff)
     m_okEmulatorSound = soundOnOff;
 }
 
+void Emulator_SetRunAhead(int frames)
+{
+    if (frames < 0) frames = 0;
+    if (frames > MAX_RUNAHEADFRAMES) frames = MAX_RUNAHEADFRAMES;
+
+    if (frames > 0 && m_pEmulatorRunAheadSnapshot == nullptr)
+    {
+        m_pEmulatorRunAheadSnapshot = static_cast<CMotherboardSnapshot*>(::calloc(1, sizeof(CMotherboardSnapshot)));
+        if (m_pEmulatorRunAheadSnapshot == nullptr)
+            frames = 0;
+    }
+    if (frames == 0 && m_pEmulatorRunAheadSnapshot != nullptr)
+    {
+        ::free(m_pEmulatorRunAheadSnapshot);
+        m_pEmulatorRunAheadSnapshot = nullptr;
+    }
+
+    m_nEmulatorRunAhead = frames;
+    m_okEmulatorRunAheadVideo = false;
+}
+
+// Observers detached while the hidden frames run: the user never sees these frames,
+// so the sound, breakpoints, profilers, tracing, counters and debug log should not see them too
+struct EmulatorHiddenFrames
+{
+    CProcessorProfile*  pProfile;
+    CCallGraph*         pCallGraph;
+    CSampler*           pSampler;
+    CProcessorWordProfile* pWordProfile;
+    CMotherboardAccessCounters* pAccessCounters;
+    CProcessorCoverage* pCoverage;
+    BOARDEVENTCALLBACK  eventCallback;
+    CPerfCounters*      pPerfCounters;
+    CProcessorHistory   history;  // Flight recorder kept while the hidden frames run
+    bool                okHistoryEvent;
+};
+EmulatorHiddenFrames m_EmulatorHiddenFrames;
+
+// Detach the observers before the hidden frames: run-ahead frames, boot to the prompt
+static void Emulator_BeginHiddenFrames()
+{
+    EmulatorHiddenFrames& saved = m_EmulatorHiddenFrames;
+    g_pBoard->SuspendTrace(true);  // The trace cycles go on from the same point after the hidden frames
+    g_pBoard->SetSoundGenCallback(nullptr);
+    g_pBoard->SetCPUBreakpoints(nullptr);
+    CProcessor* pCPU = g_pBoard->GetCPU();
+    saved.pProfile = pCPU->GetProfile();
+    saved.pCallGraph = pCPU->GetCallGraph();
+    saved.pSampler = pCPU->GetSampler();
+    saved.pWordProfile = pCPU->GetWordProfile();
+    saved.pAccessCounters = g_pBoard->GetAccessCounters();
+    saved.pCoverage = pCPU->GetCoverage();
+    pCPU->SetProfile(nullptr);
+    pCPU->SetCallGraph(nullptr);
+    pCPU->SetSampler(nullptr);
+    pCPU->SetWordProfile(nullptr);
+    g_pBoard->SetAccessCounters(nullptr);
+    pCPU->SetCoverage(nullptr);
+    saved.eventCallback = g_pBoard->GetEventCallback();
+    g_pBoard->SetEventCallback(nullptr);
+    saved.pPerfCounters = g_pBoard->GetPerfCounters();
+    g_pBoard->SetPerfCounters(nullptr);
+    saved.history = *pCPU->GetHistory();
+    saved.okHistoryEvent = pCPU->GetHistoryEvent() != HISTORY_EVENT_NONE;
+    DebugLogSuspend(true);
+}
+
+// Attach the observers back after the hidden frames
+static void Emulator_EndHiddenFrames()
+{
+    const EmulatorHiddenFrames& saved = m_EmulatorHiddenFrames;
+    DebugLogSuspend(false);
+    g_pBoard->SuspendTrace(false);
+    CProcessor* pCPU = g_pBoard->GetCPU();
+    pCPU->SetHistory(&saved.history);
+    if (!saved.okHistoryEvent)
+        pCPU->ClearHistoryEvent();  // The event will happen again for real
+
+    if (m_okEmulatorSound)
+        g_pBoard->SetSoundGenCallback(Emulator_SoundGenCallback);
+    g_pBoard->SetCPUBreakpoints(m_wEmulatorCPUBpsCount > 0 ? m_EmulatorCPUBps : nullptr);
+    pCPU->SetProfile(saved.pProfile);
+    pCPU->SetCallGraph(saved.pCallGraph);
+    pCPU->SetSampler(saved.pSampler);
+    pCPU->SetWordProfile(saved.pWordProfile);
+    g_pBoard->SetAccessCounters(saved.pAccessCounters);
+    pCPU->SetCoverage(saved.pCoverage);
+    g_pBoard->SetEventCallback(saved.eventCallback);
+    g_pBoard->SetPerfCounters(saved.pPerfCounters);
+}
+
+// Run several frames ahead to show the screen the user will see later, then roll the machine back.
+// The speculative frames have no side effects: no sound, no breakpoints, no tracing.
+void Emulator_RunAheadFrames()
+{
+    g_pBoard->SaveToSnapshot(m_pEmulatorRunAheadSnapshot);
+    Emulator_BeginHiddenFrames();
+
+    for (int frame = 0; frame < m_nEmulatorRunAhead; frame++)
+        g_pBoard->SystemFrame();
+
+    // Keep the speculative screen
+    const uint8_t* pVideoBuffer = g_pBoard->GetVideoBuffer();
+    ::memcpy(m_EmulatorRunAheadVideo, pVideoBuffer, EMULATOR_VIDEOBUFFER_SIZE);
+    m_okEmulatorRunAheadVideo = true;
+
+    g_pBoard->LoadFromSnapshot(m_pEmulatorRunAheadSnapshot);
+    Emulator_EndHiddenFrames();
+}
+
+bool Emulator_StartHashLog(LPCTSTR sFilePath)
+{
+    Emulator_StopHashLog();
+
+    m_hEmulatorHashLog = HashLogFile_Create(::_tfsopen(sFilePath, _T("w+b"), _SH_DENYWR));
+    m_nEmulatorHashLogFrame = 0;
+
+    return m_hEmulatorHashLog != nullptr;
+}
+void Emulator_StopHashLog()
+{
+    if (m_hEmulatorHashLog == nullptr)
+        return;
+
+    HashLogFile_Close(m_hEmulatorHashLog);
+    m_hEmulatorHashLog = nullptr;
+}
+
+void Emulator_FormatHistoryEntry(const CProcessorHistoryEntry& entry, TCHAR* buffer, size_t bufferSize)
+{
+    // Only the instruction word is recorded, the operand words are taken as they are now
+    bool okHaltMode = (entry.psw & 0400) != 0;
+    int addrtype;
+    uint16_t memory[3];
+    memory[0] = entry.instruction;
+    memory[1] = g_pBoard->GetWordView(entry.pc + 2, okHaltMode, true, &addrtype);
+    memory[2] = g_pBoard->GetWordView(entry.pc + 4, okHaltMode, true, &addrtype);
+
+    TCHAR instr[8];
+    TCHAR args[32];
+    DisassembleInstruction(memory, entry.pc, instr, args);
+    _sntprintf(buffer, bufferSize - 1, _T("%06o: %-7s %-24s PSW=%06o R0=%06o R1=%06o R2=%06o R3=%06o SP=%06o"),
+            entry.pc, instr, args, entry.psw, entry.reg[0], entry.reg[1], entry.reg[2], entry.reg[3], entry.sp);
+}
+
+bool Emulator_SaveHistory(const CProcessorHistory* pHistory, LPCTSTR sReason)
+{
+    FILE* fpFile = ::_tfsopen(FILENAME_HISTORY, _T("at"), _SH_DENYWR);
+    if (fpFile == nullptr)
+        return false;
+
+    ::_ftprintf(fpFile, _T("=== %s, frame %ld, %u instructions retired\n"), sReason, m_nUptimeFrameCount, pHistory->count);
+    uint32_t count = (pHistory->count < HISTORY_SIZE) ? pHistory->count : HISTORY_SIZE;
+    TCHAR buffer[128];
+    for (uint32_t i = pHistory->count - count; i != pHistory->count; i++)
+    {
+        Emulator_FormatHistoryEntry(pHistory->entries[i & (HISTORY_SIZE - 1)], buffer, sizeof(buffer) / sizeof(TCHAR));
+        ::_ftprintf(fpFile, _T("%s\n"), buffer);
+    }
+
+    ::fclose(fpFile);
+    return true;
+}
+
+// Dump the flight recorder copy made by CPU on the invalid instruction, HALT interrupt or bus error
+static void Emulator_CheckHistoryEvent()
+{
+    int event = g_pBoard->GetCPU()->GetHistoryEvent();
+    if (event == HISTORY_EVENT_NONE)
+        return;
+
+    if (m_nEmulatorHistoryDumps < EMULATOR_HISTORY_MAX_DUMPS)
+    {
+        m_nEmulatorHistoryDumps++;
+        LPCTSTR sReason =
+            (event == HISTORY_EVENT_INVALID) ? _T("Invalid instruction") :
+            (event == HISTORY_EVENT_HALT) ? _T("HALT interrupt") : _T("Bus error");
+        Emulator_SaveHistory(g_pBoard->GetCPU()->GetHistoryEventCopy(), sReason);
+    }
+    g_pBoard->GetCPU()->ClearHistoryEvent();
+}
+
 bool Emulator_SystemFrame()
 {
+    FrameTiming_BeginFrame();
     g_pBoard->SetCPUBreakpoints(m_wEmulatorCPUBpsCount > 0 ? m_EmulatorCPUBps : nullptr);
 
-    ScreenView_ScanKeyboard();
-    ScreenView_ProcessKeyboard();
+    bool okMovie = Movie_IsRecording() || Movie_IsPlaying();
+    LONGLONG timeStart = FrameTiming_GetTime();
+    if (Movie_IsPlaying())
+        Movie_PlayFrameEvents();
+    else if (!Option_Headless)
+    {
+        ScreenView_ScanKeyboard();
+        ScreenView_ProcessKeyboard();
+    }
+    FrameTiming_Add(FRAMETIMING_KEYBOARD, timeStart);
 
+    EventTrace_OnFrameStart();
+    timeStart = FrameTiming_GetTime();
     if (!g_pBoard->SystemFrame())
+    {
+        FrameTiming_CancelFrame();
+        EventTrace_OnBreakpoint();
+        Emulator_CheckHistoryEvent();
+        if (m_nEmulatorHistoryDumps < EMULATOR_HISTORY_MAX_DUMPS)  // Same limit as for the events; "frs" saves on request
+        {
+            m_nEmulatorHistoryDumps++;
+            Emulator_SaveHistory(g_pBoard->GetCPU()->GetHistory(), _T("Breakpoint"));
+        }
+        if (okMovie)  // The frame is not complete, so the movie can't continue
+        {
+            Movie_Stop();
+            MainWindow_SetStatusbarText(StatusbarPartMessage, _T("Movie stopped on breakpoint"));
+        }
         return false;
+    }
+    FrameTiming_Add(FRAMETIMING_CPU, timeStart);
+    timeStart = FrameTiming_GetTime();
+
+    if (m_hEmulatorHashLog != nullptr)
+    {
+        HashLogFile_Write(m_hEmulatorHashLog, m_nEmulatorHashLogFrame, g_pBoard->GetStateHash());
+        m_nEmulatorHashLogFrame++;
+    }
+
+    EventTrace_OnFrameEnd();
+    Profiler_OnFrameDone();
+    PerfCounters_OnFrameDone();
+    Emulator_CheckHistoryEvent();
+
+    if (okMovie)
+    {
+        Movie_OnFrameDone();
+        if (!Movie_IsRecording() && !Movie_IsPlaying())  // Playback finished
+            MainWindow_UpdateMenu();
+    }
+
+    if (m_nEmulatorRunAhead > 0)
+        Emulator_RunAheadFrames();
 
     // Calculate frames per second
     m_nFrameCount++;
     uint32_t dwCurrentTicks = GetTickCount();
+
+    // Autosave by the host time, so the period does not depend on the speed; if the previous save
+    // is still writing, try again on the next frame
+    if (m_dwEmulatorAutoSavePeriod > 0 && dwCurrentTicks - m_dwEmulatorAutoSaveTicks >= m_dwEmulatorAutoSavePeriod &&
+        Emulator_SaveImageAsync(FILENAME_AUTOSAVE, true))
+        m_dwEmulatorAutoSaveTicks = dwCurrentTicks;
     long nTicksElapsed = dwCurrentTicks - m_dwTickCount;
     if (nTicksElapsed >= 1200)
     {
@@ -519,12 +849,16 @@ bool Emulator_SystemFrame()
         //TODO
     }
 
+    FrameTiming_Add(FRAMETIMING_EVENTS, timeStart);
+
     return true;
 }
 
-void CALLBACK Emulator_SoundGenCallback(unsigned short L, unsigned short R)
+void Emulator_SoundGenCallback(unsigned short L, unsigned short R)
 {
+    LONGLONG timeStart = FrameTiming_GetTime();
     SoundGen_FeedDAC(L, R);
+    FrameTiming_Add(FRAMETIMING_SOUND, timeStart);
 }
 
 // Update cached values after Run or Step
@@ -589,7 +923,9 @@ void Emulator_PrepareScreenRGB32(void* pImageBits, int screenMode, int palette)
 {
     if (pImageBits == nullptr) return;
 
-    const uint8_t* pVideoBuffer = g_pBoard->GetVideoBuffer();
+    // Show the run-ahead screen while running, the actual one when stopped
+    const uint8_t* pVideoBuffer = (g_okEmulatorRunning && m_okEmulatorRunAheadVideo) ?
+            m_EmulatorRunAheadVideo : g_pBoard->GetVideoBuffer();
     ASSERT(pVideoBuffer != nullptr);
 
     const uint32_t * pPalette = Emulator_GetPalette(palette);
@@ -717,98 +1053,526 @@ void CALLBACK Emulator_PrepareScreen960x512(const uint8_t* pVideoBuffer, const u
 
 //////////////////////////////////////////////////////////////////////
 //
-// Emulator image format - see CMotherboard::SaveToImage()
+// Emulator image format
+// All the numbers are native (little-endian x86) words and dwords.
 // Image header format (32 bytes):
 //   4 bytes        MK90IMAGE_HEADER1
 //   4 bytes        MK90IMAGE_HEADER2
-//   4 bytes        MK90IMAGE_VERSION
-//   4 bytes        MK90IMAGE_SIZE
+//   4 bytes        MK90IMAGE_VERSION or MK90IMAGE_VERSION2
+//   4 bytes        Image file size
 //   4 bytes        MK90 uptime
 //   12 bytes       Not used
+// Version 1.0: fixed-size image, see CMotherboard::SaveToImage()
+// Version 2.0: the header followed by chunks, see CMotherboard::SaveStateChunk()
+// Chunk header format (16 bytes):
+//   4 bytes        Chunk tag, MK90STATE_CHUNK_XXX
+//   2 bytes        Chunk version
+//   2 bytes        Chunk flags, MK90STATE_CHUNK_FLAG_XXX
+//   4 bytes        Chunk data size, as stored in the file
+//   4 bytes        CRC-32 of the chunk data, as stored in the file
+// Chunks with unknown tags are skipped on load; MK90STATE_CHUNK_END chunk finishes the image.
+// Chunks are LZ-compressed when it makes them smaller. The standard ROM is not stored:
+// MK90STATE_CHUNK_ROMREF chunk has 2 bytes configuration, 2 bytes not used, 8 bytes ROM hash,
+// and the ROM is taken from basic10.rom / basic20.rom file or from the resource on load.
+
+// Chunks in the order of saving; BORD, CPU and RAM are required to load the image; ROMREF replaces ROM
+static const uint32_t m_EmulatorStateChunks[] =
+{
+    MK90STATE_CHUNK_BOARD, MK90STATE_CHUNK_CPU, MK90STATE_CHUNK_SMP, MK90STATE_CHUNK_ROM, MK90STATE_CHUNK_RAM
+};
+const int EMULATOR_STATE_CHUNK_COUNT = sizeof(m_EmulatorStateChunks) / sizeof(m_EmulatorStateChunks[0]);
+const int EMULATOR_STATE_CHUNKS_REQUIRED = 1 | 2 | 16;  // Bits by m_EmulatorStateChunks index
 
-bool Emulator_SaveImage(LPCTSTR sFilePath)
+const int EMULATOR_STATE_ROMREF_SIZE = 12;
+
+// Scratch buffer for the decompressed chunks on load: RAM, ROM and the small chunks
+const size_t EMULATOR_STATE_SCRATCH_SIZE = 65536 + 32768 + 1024;
+
+// Write one chunk: chunk header then chunk data, compressed using pPackBuffer if it gets smaller
+static bool Emulator_WriteStateChunk(FILE* fpFile, uint32_t tag, uint16_t version, const uint8_t* pData, size_t size, uint8_t* pPackBuffer)
+{
+    uint16_t flags = 0;
+    if (size > 16)
+    {
+        size_t packedSize = LzCodec_Compress(pData, size, pPackBuffer + 4, size - 4 - 1);
+        if (packedSize > 0)
+        {
+            *(uint32_t*)pPackBuffer = static_cast<uint32_t>(size);
+            pData = pPackBuffer;
+            size = packedSize + 4;
+            flags = MK90STATE_CHUNK_FLAG_LZ;
+        }
+    }
+
+    uint32_t chunkHeader[MK90STATE_CHUNK_HEADER_SIZE / sizeof(uint32_t)];
+    chunkHeader[0] = tag;
+    chunkHeader[1] = version | (flags << 16);
+    chunkHeader[2] = static_cast<uint32_t>(size);
+    chunkHeader[3] = Crc32_Update(0, pData, size);
+    if (::fwrite(chunkHeader, 1, MK90STATE_CHUNK_HEADER_SIZE, fpFile) != MK90STATE_CHUNK_HEADER_SIZE)
+        return false;
+    return size == 0 || ::fwrite(pData, 1, size, fpFile) == size;
+}
+
+// Everything needed to write the image, taken at the frame boundary
+struct EmulatorSaveJob
+{
+    CMotherboardSnapshot snapshot;
+    uint32_t    uptime;
+    uint16_t    configuration;
+    uint64_t    romHash;
+    bool        okRomRef;  // Standard ROM, store the reference only
+    uint8_t     rom[32768];  // Used when okRomRef is false
+    TCHAR       filePath[MAX_PATH];
+};
+
+EmulatorSaveJob* m_pEmulatorSaveJob = nullptr;
+HANDLE m_hEmulatorSaveThread = NULL;
+volatile LONG m_nEmulatorSaveStatus = EMUSAVE_IDLE;
+bool m_okEmulatorSaveQuiet = false;  // The background save is autosave, report the failure only
+
+// Write the image file, see image format above; could be called on any thread
+static bool Emulator_WriteImage(const EmulatorSaveJob* pJob)
 {
     // Create file
-    FILE* fpFile = ::_tfsopen(sFilePath, _T("w+b"), _SH_DENYWR);
+    FILE* fpFile = ::_tfsopen(pJob->filePath, _T("w+b"), _SH_DENYWR);
     if (fpFile == nullptr)
         return false;
 
-    // Allocate memory
-    uint8_t* pImage = (uint8_t*) ::calloc(MK90IMAGE_SIZE, 1);
-    if (pImage == nullptr)
+    // Chunk buffer and compression buffer, reused for every chunk
+    uint8_t* pChunk = (uint8_t*) ::malloc(MK90STATE_CHUNK_MAXSIZE * 2);
+    if (pChunk == nullptr)
     {
         ::fclose(fpFile);
         return false;
     }
-    memset(pImage, 0, MK90IMAGE_SIZE);
-    // Prepare header
-    uint32_t* pHeader = (uint32_t*) pImage;
-    *pHeader++ = MK90IMAGE_HEADER1;
-    *pHeader++ = MK90IMAGE_HEADER2;
-    *pHeader++ = MK90IMAGE_VERSION;
-    *pHeader++ = MK90IMAGE_SIZE;
-    // Store emulator state to the image
-    g_pBoard->SaveToImage(pImage);
-    *(uint32_t*)(pImage + 16) = m_dwEmulatorUptime;
-
-    // Save image to the file
-    size_t dwBytesWritten = ::fwrite(pImage, 1, MK90IMAGE_SIZE, fpFile);
-    ::free(pImage);
+    uint8_t* pPack = pChunk + MK90STATE_CHUNK_MAXSIZE;
+
+    // Header, the image size is updated when all the chunks are written
+    uint32_t bufHeader[MK90IMAGE_HEADER_SIZE / sizeof(uint32_t)];
+    memset(bufHeader, 0, sizeof(bufHeader));
+    bufHeader[0] = MK90IMAGE_HEADER1;
+    bufHeader[1] = MK90IMAGE_HEADER2;
+    bufHeader[2] = MK90IMAGE_VERSION2;
+    bufHeader[4] = pJob->uptime;
+    bool result = (::fwrite(bufHeader, 1, MK90IMAGE_HEADER_SIZE, fpFile) == MK90IMAGE_HEADER_SIZE);
+
+    // Store emulator state chunk by chunk
+    for (int i = 0; result && i < EMULATOR_STATE_CHUNK_COUNT; i++)
+    {
+        uint32_t tag = m_EmulatorStateChunks[i];
+        if (tag == MK90STATE_CHUNK_ROM)
+        {
+            if (pJob->okRomRef)
+            {
+                *(uint16_t*)pChunk = pJob->configuration;
+                *(uint16_t*)(pChunk + 2) = 0;
+                *(uint64_t*)(pChunk + 4) = pJob->romHash;
+                result = Emulator_WriteStateChunk(fpFile, MK90STATE_CHUNK_ROMREF, 1, pChunk, EMULATOR_STATE_ROMREF_SIZE, pPack);
+            }
+            else
+                result = Emulator_WriteStateChunk(fpFile, MK90STATE_CHUNK_ROM, 1, pJob->rom, sizeof(pJob->rom), pPack);
+            continue;
+        }
+        uint16_t version;
+        size_t size = CMotherboard::SaveStateChunk(&pJob->snapshot, tag, pChunk, &version);
+        result = Emulator_WriteStateChunk(fpFile, tag, version, pChunk, size, pPack);
+    }
+    if (result)
+        result = Emulator_WriteStateChunk(fpFile, MK90STATE_CHUNK_END, 1, pChunk, 0, pPack);
+
+    if (result)
+    {
+        bufHeader[3] = static_cast<uint32_t>(::ftell(fpFile));
+        ::fseek(fpFile, 0, SEEK_SET);
+        result = (::fwrite(bufHeader, 1, MK90IMAGE_HEADER_SIZE, fpFile) == MK90IMAGE_HEADER_SIZE);
+    }
+
+    ::free(pChunk);
     ::fclose(fpFile);
-    if (dwBytesWritten != MK90IMAGE_SIZE)
+    return result;
+}
+
+bool Emulator_SaveStateChunks(FILE* fpFile)
+{
+    CMotherboardSnapshot* pSnapshot = static_cast<CMotherboardSnapshot*>(::calloc(1, sizeof(CMotherboardSnapshot)));
+    uint8_t* pChunk = (uint8_t*) ::malloc(MK90STATE_CHUNK_MAXSIZE * 2);
+    bool result = pSnapshot != nullptr && pChunk != nullptr;
+    if (result)
+    {
+        uint8_t* pPack = pChunk + MK90STATE_CHUNK_MAXSIZE;
+        g_pBoard->SaveToSnapshot(pSnapshot);
+        for (int i = 0; result && i < EMULATOR_STATE_CHUNK_COUNT; i++)
+        {
+            uint32_t tag = m_EmulatorStateChunks[i];
+            if (tag == MK90STATE_CHUNK_ROM)
+                continue;
+            uint16_t version;
+            size_t size = CMotherboard::SaveStateChunk(pSnapshot, tag, pChunk, &version);
+            result = Emulator_WriteStateChunk(fpFile, tag, version, pChunk, size, pPack);
+        }
+        if (result)
+            result = Emulator_WriteStateChunk(fpFile, MK90STATE_CHUNK_END, 1, pChunk, 0, pPack);
+    }
+
+    ::free(pChunk);
+    ::free(pSnapshot);
+    return result;
+}
+
+// Wait for the background save to finish
+static void Emulator_WaitSaveThread()
+{
+    if (m_hEmulatorSaveThread == NULL)
+        return;
+
+    ::WaitForSingleObject(m_hEmulatorSaveThread, INFINITE);
+    ::CloseHandle(m_hEmulatorSaveThread);
+    m_hEmulatorSaveThread = NULL;
+}
+
+// Take the machine state for saving, fast: RAM copy and ROM hash; the job is allocated on first use
+static bool Emulator_PrepareSaveJob(EmulatorSaveJob** ppJob, LPCTSTR sFilePath)
+{
+    if (*ppJob == nullptr)
+    {
+        *ppJob = (EmulatorSaveJob*) ::malloc(sizeof(EmulatorSaveJob));
+        if (*ppJob == nullptr)
+            return false;
+    }
+
+    EmulatorSaveJob* pJob = *ppJob;
+    g_pBoard->SaveToSnapshot(&pJob->snapshot);
+    pJob->uptime = m_dwEmulatorUptime;
+    pJob->configuration = static_cast<uint16_t>(g_nEmulatorConfiguration);
+    pJob->romHash = m_EmulatorRomHash;
+    pJob->okRomRef = (g_pBoard->GetRomHash() == m_EmulatorRomHash);
+    if (!pJob->okRomRef)
+    {
+        for (uint16_t offset = 0; offset < 32768; offset++)
+            pJob->rom[offset] = g_pBoard->GetROMByte(offset);
+    }
+    _tcsncpy_s(pJob->filePath, MAX_PATH, sFilePath, _TRUNCATE);
+    return true;
+}
+
+// Finish the background save and free the save buffer
+static void Emulator_DoneSaveImage()
+{
+    Emulator_WaitSaveThread();
+    ::free(m_pEmulatorSaveJob);  m_pEmulatorSaveJob = nullptr;
+}
+
+static DWORD WINAPI Emulator_SaveThreadProc(LPVOID lpParameter)
+{
+    bool result = Emulator_WriteImage(static_cast<const EmulatorSaveJob*>(lpParameter));
+    LONG status = EMUSAVE_FAILED;
+    if (result)
+        status = m_okEmulatorSaveQuiet ? EMUSAVE_IDLE : EMUSAVE_DONE;
+    ::InterlockedExchange(&m_nEmulatorSaveStatus, status);
+    return 0;
+}
+
+bool Emulator_SaveImage(LPCTSTR sFilePath)
+{
+    Emulator_WaitSaveThread();
+
+    if (!Emulator_PrepareSaveJob(&m_pEmulatorSaveJob, sFilePath))
+        return false;
+    return Emulator_WriteImage(m_pEmulatorSaveJob);
+}
+
+// Take the state now, compress and write it on the background thread; see Emulator_GetSaveImageStatus() for the result.
+// If the previous save is not finished yet: autosave returns false, the other save waits for it.
+bool Emulator_SaveImageAsync(LPCTSTR sFilePath, bool okAutoSave)
+{
+    if (okAutoSave && m_nEmulatorSaveStatus == EMUSAVE_WRITING)
         return false;
+    Emulator_WaitSaveThread();
 
+    if (!Emulator_PrepareSaveJob(&m_pEmulatorSaveJob, sFilePath))
+        return false;
+
+    m_okEmulatorSaveQuiet = okAutoSave;
+    m_nEmulatorSaveStatus = EMUSAVE_WRITING;
+    m_hEmulatorSaveThread = ::CreateThread(NULL, 0, Emulator_SaveThreadProc, m_pEmulatorSaveJob, 0, NULL);
+    if (m_hEmulatorSaveThread == NULL)
+    {
+        m_nEmulatorSaveStatus = EMUSAVE_FAILED;
+        return false;
+    }
     return true;
 }
 
-bool Emulator_LoadImage(LPCTSTR sFilePath)
+int Emulator_GetSaveImageStatus()
 {
-    Emulator_Stop();
-    Emulator_Reset();
+    return m_nEmulatorSaveStatus;
+}
 
-    // Open file
-    FILE* fpFile = ::_tfsopen(sFilePath, _T("rb"), _SH_DENYWR);
-    if (fpFile == nullptr)
+// Forget the result of the finished background save
+void Emulator_ClearSaveImageStatus()
+{
+    ::InterlockedCompareExchange(&m_nEmulatorSaveStatus, EMUSAVE_IDLE, EMUSAVE_DONE);
+    ::InterlockedCompareExchange(&m_nEmulatorSaveStatus, EMUSAVE_IDLE, EMUSAVE_FAILED);
+}
+
+void Emulator_SetAutoSave(int seconds)
+{
+    m_dwEmulatorAutoSavePeriod = (uint32_t)seconds * 1000;
+    m_dwEmulatorAutoSaveTicks = ::GetTickCount();
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Quick-save slots: the machine state kept in memory, no files involved
+
+EmulatorSaveJob* m_pEmulatorQuickSlots[EMULATOR_QUICKSLOT_COUNT];
+
+bool Emulator_QuickSave(int slot)
+{
+    if (slot < 0 || slot >= EMULATOR_QUICKSLOT_COUNT)
         return false;
 
-    // Read header
-    uint32_t bufHeader[MK90IMAGE_HEADER_SIZE / sizeof(uint32_t)];
-    uint32_t dwBytesRead = ::fread(bufHeader, 1, MK90IMAGE_HEADER_SIZE, fpFile);
-    if (dwBytesRead != MK90IMAGE_HEADER_SIZE)
+    TCHAR bufFileName[16];
+    _sntprintf(bufFileName, sizeof(bufFileName) / sizeof(TCHAR) - 1, _T("quick%d.mk90st"), slot);
+    return Emulator_PrepareSaveJob(&m_pEmulatorQuickSlots[slot], bufFileName);
+}
+
+// Restore the slot; fails if the slot is empty or the slot was saved with another ROM
+bool Emulator_QuickLoad(int slot)
+{
+    if (slot < 0 || slot >= EMULATOR_QUICKSLOT_COUNT || m_pEmulatorQuickSlots[slot] == nullptr)
+        return false;
+    const EmulatorSaveJob* pJob = m_pEmulatorQuickSlots[slot];
+    uint64_t romHash = pJob->okRomRef ? pJob->romHash : CMotherboard::CalculateRomHash(pJob->rom);
+    if (romHash != g_pBoard->GetRomHash())
+        return false;
+
+    Movie_Stop();
+    g_pBoard->LoadFromSnapshot(&pJob->snapshot);
+    m_nUptimeFrameCount = 0;
+    m_dwEmulatorUptime = pJob->uptime;
+    g_wEmulatorCpuPC = g_pBoard->GetCPU()->GetPC();
+    return true;
+}
+
+const CMotherboardSnapshot* Emulator_GetQuickSlot(int slot)
+{
+    if (slot < 0 || slot >= EMULATOR_QUICKSLOT_COUNT || m_pEmulatorQuickSlots[slot] == nullptr)
+        return nullptr;
+    return &m_pEmulatorQuickSlots[slot]->snapshot;
+}
+
+// Write the used slots to quickN.mk90st files, for Option_QuickFlush
+static void Emulator_FlushQuickSlots()
+{
+    for (int slot = 0; slot < EMULATOR_QUICKSLOT_COUNT; slot++)
     {
-        ::fclose(fpFile);
+        if (m_pEmulatorQuickSlots[slot] != nullptr)
+            Emulator_WriteImage(m_pEmulatorQuickSlots[slot]);
+    }
+}
+
+static void Emulator_DoneQuickSlots()
+{
+    if (Option_QuickFlush)
+        Emulator_FlushQuickSlots();
+
+    for (int slot = 0; slot < EMULATOR_QUICKSLOT_COUNT; slot++)
+    {
+        ::free(m_pEmulatorQuickSlots[slot]);  m_pEmulatorQuickSlots[slot] = nullptr;
+    }
+}
+
+// Find the ROM by the reference: try the saved configuration first, then the others
+static bool Emulator_ResolveStateRomRef(uint16_t version, const uint8_t* pData, size_t size, uint8_t* pRom, uint16_t* pConfiguration)
+{
+    if (version != 1 || size != EMULATOR_STATE_ROMREF_SIZE)
+        return false;
+    uint16_t configurations[] = { *(const uint16_t*)pData, EMU_CONF_BASIC10, EMU_CONF_BASIC20 };
+    uint64_t romHash = *(const uint64_t*)(pData + 4);
+
+    for (size_t i = 0; i < sizeof(configurations) / sizeof(configurations[0]); i++)
+    {
+        if (Emulator_LoadConfigurationRom(configurations[i], pRom) &&
+            CMotherboard::CalculateRomHash(pRom) == romHash)
+        {
+            *pConfiguration = configurations[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+// Load the chunks of version 2.0 image, up to the END chunk. Chunk data is taken right from the mapped image,
+// only compressed chunks and the referenced ROM go through the scratch buffer.
+bool Emulator_LoadStateChunks(const uint8_t* pImage, size_t imageSize)
+{
+    if (m_pEmulatorStateScratch == nullptr)
+    {
+        m_pEmulatorStateScratch = (uint8_t*) ::malloc(EMULATOR_STATE_SCRATCH_SIZE);
+        if (m_pEmulatorStateScratch == nullptr)
+            return false;
+    }
+    size_t scratchUsed = 0;
+
+    CMotherboardStateChunk chunks[EMULATOR_STATE_CHUNK_COUNT];
+    int count = 0;
+    int chunksLoaded = 0;
+    const uint8_t* pRomRef = nullptr;
+    uint16_t romConfiguration = 0;
+    size_t offset = 0;
+    for (;;)
+    {
+        if (imageSize - offset < MK90STATE_CHUNK_HEADER_SIZE)
+            return false;  // Unexpected end of file
+        const uint32_t* chunkHeader = (const uint32_t*)(pImage + offset);
+        uint32_t tag = chunkHeader[0];
+        uint16_t version = static_cast<uint16_t>(chunkHeader[1]);
+        uint16_t flags = static_cast<uint16_t>(chunkHeader[1] >> 16);
+        size_t size = chunkHeader[2];
+        offset += MK90STATE_CHUNK_HEADER_SIZE;
+        if (size > imageSize - offset)
+            return false;
+        const uint8_t* pData = pImage + offset;
+        offset += size;
+        if (tag == MK90STATE_CHUNK_END)
+            break;
+
+        int index = 0;
+        uint32_t indexTag = (tag == MK90STATE_CHUNK_ROMREF) ? MK90STATE_CHUNK_ROM : tag;  // Counts as the ROM chunk
+        while (index < EMULATOR_STATE_CHUNK_COUNT && m_EmulatorStateChunks[index] != indexTag)
+            index++;
+        if (index == EMULATOR_STATE_CHUNK_COUNT)
+            continue;  // Unknown chunk, skip it
+        if ((chunksLoaded & (1 << index)) != 0 || (flags & ~MK90STATE_CHUNK_FLAG_LZ) != 0)
+            return false;
+
+        if (Crc32_Update(0, pData, size) != chunkHeader[3])
+            return false;  // Corrupted chunk
+        if (flags & MK90STATE_CHUNK_FLAG_LZ)
+        {
+            size_t unpackedSize = (size < 4) ? 0 : *(const uint32_t*)pData;
+            uint8_t* pUnpacked = m_pEmulatorStateScratch + scratchUsed;
+            if (unpackedSize == 0 || unpackedSize > EMULATOR_STATE_SCRATCH_SIZE - scratchUsed ||
+                !LzCodec_Decompress(pData + 4, size - 4, pUnpacked, unpackedSize))
+                return false;
+            scratchUsed += unpackedSize;
+            pData = pUnpacked;
+            size = unpackedSize;
+        }
+        if (tag == MK90STATE_CHUNK_ROMREF)
+        {
+            uint8_t* pRom = m_pEmulatorStateScratch + scratchUsed;
+            if (32768 > EMULATOR_STATE_SCRATCH_SIZE - scratchUsed ||
+                !Emulator_ResolveStateRomRef(version, pData, size, pRom, &romConfiguration))
+                return false;  // ROM not found
+            scratchUsed += 32768;
+            tag = MK90STATE_CHUNK_ROM;
+            version = 1;
+            pData = pRomRef = pRom;
+            size = 32768;
+        }
+
+        chunks[count].tag = tag;
+        chunks[count].version = version;
+        chunks[count].pData = pData;
+        chunks[count].size = size;
+        count++;
+        chunksLoaded |= (1 << index);
+    }
+    if ((chunksLoaded & EMULATOR_STATE_CHUNKS_REQUIRED) != EMULATOR_STATE_CHUNKS_REQUIRED)
         return false;
+
+    // Restore the machine state all at once
+    if (!g_pBoard->LoadFromStateChunks(chunks, count))
+        return false;
+    if (pRomRef != nullptr)
+    {
+        g_nEmulatorConfiguration = romConfiguration;
+        m_EmulatorRomHash = CMotherboard::CalculateRomHash(pRomRef);
     }
+    return true;
+}
 
-    //TODO: Check version and size
+// Load the image mapped to memory, without reading the file to an intermediate buffer.
+// Version 2.0 image is checked completely before it is applied, so the failed load does not change the machine.
+static bool Emulator_LoadImageFile(LPCTSTR sFilePath)
+{
+    Emulator_WaitSaveThread();  // The file could be the one being written
 
-    // Allocate memory
-    uint8_t* pImage = (uint8_t*) ::calloc(MK90IMAGE_SIZE, 1);
+    // Open file and map it to memory
+    HANDLE hFile = ::CreateFile(sFilePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return false;
+    DWORD dwFileSize = ::GetFileSize(hFile, NULL);
+    if (dwFileSize == INVALID_FILE_SIZE || dwFileSize < MK90IMAGE_HEADER_SIZE)
+    {
+        ::CloseHandle(hFile);
+        return false;
+    }
+    HANDLE hMapping = ::CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (hMapping == NULL)
+    {
+        ::CloseHandle(hFile);
+        return false;
+    }
+    const uint8_t* pImage = (const uint8_t*) ::MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
     if (pImage == nullptr)
     {
-        ::fclose(fpFile);
+        ::CloseHandle(hMapping);
+        ::CloseHandle(hFile);
         return false;
     }
 
-    // Read image
-    ::fseek(fpFile, 0, SEEK_SET);
-    dwBytesRead = ::fread(pImage, 1, MK90IMAGE_SIZE, fpFile);
-    if (dwBytesRead != MK90IMAGE_SIZE)
+    // Check header
+    const uint32_t* pHeader = (const uint32_t*)pImage;
+    bool result = false;
+    if (pHeader[0] == MK90IMAGE_HEADER1 && pHeader[1] == MK90IMAGE_HEADER2)
     {
-        ::free(pImage);
-        ::fclose(fpFile);
-        return false;
+        if (pHeader[2] == MK90IMAGE_VERSION && pHeader[3] == MK90IMAGE_SIZE && dwFileSize >= MK90IMAGE_SIZE)
+        {
+            g_pBoard->Reset();  // Version 1.0 image does not have the complete machine state
+            g_pBoard->LoadFromImage(pImage);
+            result = true;
+        }
+        else if (pHeader[2] == MK90IMAGE_VERSION2)
+        {
+            result = Emulator_LoadStateChunks(pImage + MK90IMAGE_HEADER_SIZE, dwFileSize - MK90IMAGE_HEADER_SIZE);
+        }
+        if (result)
+        {
+            m_nUptimeFrameCount = 0;
+            m_dwEmulatorUptime = pHeader[4];
+        }
     }
 
-    // Restore emulator state from the image
-    g_pBoard->LoadFromImage(pImage);
+    ::UnmapViewOfFile(pImage);
+    ::CloseHandle(hMapping);
+    ::CloseHandle(hFile);
+    return result;
+}
 
-    m_dwEmulatorUptime = *(uint32_t*)(pImage + 16);
-    g_wEmulatorCpuPC = g_pBoard->GetCPU()->GetPC();
+bool Emulator_LoadImage(LPCTSTR sFilePath)
+{
+    Movie_Stop();
+    Emulator_Stop();
 
-    // Free memory, close file
-    ::free(pImage);
-    ::fclose(fpFile);
+    uint16_t configuration = g_nEmulatorConfiguration;
+    if (!Emulator_LoadImageFile(sFilePath))
+        return false;
+
+    // The image refers to the ROM of the other configuration: switch to it, as the menu command does
+    if (g_nEmulatorConfiguration != configuration)
+    {
+        Settings_SetConfiguration(g_nEmulatorConfiguration);
+        Profiler_OnConfigurationChanged();
+        Coverage_OnConfigurationChanged();
+        MainWindow_UpdateMenu();
+        MainWindow_UpdateWindowTitle();
+    }
+
+    g_wEmulatorCpuPC = g_pBoard->GetCPU()->GetPC();
 
     g_okEmulatorRunning = false;
 
@@ -818,4 +1582,120 @@ bool Emulator_LoadImage(LPCTSTR sFilePath)
 }
 
 
+//////////////////////////////////////////////////////////////////////
+// Boot cache: the state after the cold boot reached the prompt, keyed by ROM, configuration and SMP images.
+// The cold boot is deterministic, so the configuration init could start from the cached state instead of running
+// the ROM initialization. It is off by default, see Settings_GetBootCache(): the machine starts at the prompt,
+// not at the reset, and the first boot with the new key runs up to 250 frames before the window shows.
+// Reset command starts from the cached state too, but does not boot to fill the cache.
+// The state is kept in memory and in bootXXXXXXXXXXXXXXXX.mk90st file next to the .ini file, for the next runs.
+
+const int EMULATOR_BOOT_MAX_FRAMES = 250;  // Give up if the prompt is not reached in 10 seconds
+const int EMULATOR_BOOT_STABLE_FRAMES = 10;  // PC is the same at the end of frames, waiting for the input
+
+uint64_t m_EmulatorBootKey = 0;
+uint64_t m_EmulatorBootKeyFailed = 0;  // Cold boot never reached the prompt with this key
+
+// ROM hash, configuration and SMP images chained through the 64-bit hash
+static uint64_t Emulator_GetBootCacheKey()
+{
+    uint16_t configuration = g_pBoard->GetConfiguration();
+    uint64_t key = CMotherboard::CalculateHash(reinterpret_cast<const uint8_t*>(&configuration), sizeof(configuration),
+            g_pBoard->GetRomHash());
+    for (int slot = 0; slot < 2; slot++)
+    {
+        size_t size = 0;
+        const uint8_t* pData = g_pBoard->GetSmpImageData(slot, &size);
+        key = CMotherboard::CalculateHash(pData, (pData != nullptr) ? size : 0, key);
+    }
+    return key;
+}
+
+// Cold boot and run until PC stays the same for several frames; the boot frames are hidden from the observers
+static bool Emulator_ColdBootToPrompt()
+{
+    g_pBoard->Reset();
+    Emulator_BeginHiddenFrames();
+
+    bool okStable = false;
+    uint16_t prevPC = 0177777;
+    int stableFrames = 0;
+    for (int frame = 0; frame < EMULATOR_BOOT_MAX_FRAMES; frame++)
+    {
+        g_pBoard->SystemFrame();
+        uint16_t pc = g_pBoard->GetCPU()->GetPC();
+        stableFrames = (pc == prevPC) ? stableFrames + 1 : 0;
+        prevPC = pc;
+        if (stableFrames >= EMULATOR_BOOT_STABLE_FRAMES)
+        {
+            okStable = true;
+            break;
+        }
+    }
+
+    Emulator_EndHiddenFrames();
+    return okStable;
+}
+
+// Reset the board, from the boot cache when it is on and the key hits, in memory or in the file.
+// On a miss the configuration init boots to the prompt to fill the cache, Reset command does the real reset.
+// Cold boot for Option_ColdBoot, for movies (the reset should replay exactly), when breakpoints are set,
+// and when the coverage is on (the boot code should be marked too).
+static void Emulator_BootBoard(bool okFillCache)
+{
+    if (!Settings_GetBootCache() || Option_ColdBoot || Movie_IsRecording() || Movie_IsPlaying() || m_wEmulatorCPUBpsCount > 0 ||
+        Coverage_IsRunning())
+    {
+        g_pBoard->Reset();
+        return;
+    }
+
+    uint64_t key = Emulator_GetBootCacheKey();
+    if (m_pEmulatorBootSnapshot != nullptr && key == m_EmulatorBootKey)
+    {
+        g_pBoard->LoadFromSnapshot(m_pEmulatorBootSnapshot);
+        return;
+    }
+    if (key == m_EmulatorBootKeyFailed)
+    {
+        g_pBoard->Reset();
+        return;
+    }
+
+    if (m_pEmulatorBootSnapshot == nullptr)
+    {
+        m_pEmulatorBootSnapshot = (CMotherboardSnapshot*) ::malloc(sizeof(CMotherboardSnapshot));
+        if (m_pEmulatorBootSnapshot == nullptr)
+        {
+            g_pBoard->Reset();
+            return;
+        }
+    }
+
+    // Try the boot cache file left by the previous runs, otherwise boot and make the file
+    TCHAR bufName[32];
+    _sntprintf(bufName, sizeof(bufName) / sizeof(TCHAR) - 1, FILENAME_BOOTCACHE_FORMAT,
+            (uint32_t)(key >> 32), (uint32_t)key);
+    TCHAR bufFileName[MAX_PATH];
+    Settings_GetFilePath(bufName, bufFileName);
+    if (!Emulator_LoadImageFile(bufFileName) || Emulator_GetBootCacheKey() != key)
+    {
+        if (!okFillCache)
+        {
+            g_pBoard->Reset();
+            return;
+        }
+        if (!Emulator_ColdBootToPrompt())
+        {
+            m_EmulatorBootKeyFailed = key;
+            g_pBoard->Reset();
+            return;
+        }
+        Emulator_SaveImage(bufFileName);
+    }
+
+    g_pBoard->SaveToSnapshot(m_pEmulatorBootSnapshot);
+    m_EmulatorBootKey = key;
+}
+
 //////////////////////////////////////////////////////////////////////
@@ -29,6 +29,7 @@ enum EmulatorConfiguration
 
 const int MAX_BREAKPOINTCOUNT = 16;
 const int MAX_WATCHPOINTCOUNT = 16;
+const int MAX_RUNAHEADFRAMES = 3;
 
 extern CMotherboard* g_pBoard;
 extern int g_nEmulatorConfiguration;  // Current configuration
@@ -67,6 +68,20 @@ void Emulator_Stop();
 void Emulator_Reset();
 bool Emulator_SystemFrame();
 void Emulator_SetSpeed(uint16_t realspeed);
+void Emulator_SetRunAhead(int frames);  // 0 = turn off run-ahead
+
+void Emulator_KeyboardEvent(uint8_t scancode, bool okPressed);
+bool Emulator_AttachSmpImage(int slot, LPCTSTR sFilePath);
+void Emulator_DetachSmpImage(int slot);
+
+bool Emulator_StartHashLog(LPCTSTR sFilePath);  // Write the machine state hash after every frame
+void Emulator_StopHashLog();
+
+// Flight recorder: the last instructions retired, see CProcessorHistory
+const LPCTSTR FILENAME_HISTORY = _T("history.txt");
+// Format the flight recorder entry: address, disassembly, PSW and registers after the instruction
+void Emulator_FormatHistoryEntry(const CProcessorHistoryEntry& entry, TCHAR* buffer, size_t bufferSize);
+bool Emulator_SaveHistory(const CProcessorHistory* pHistory, LPCTSTR sReason);  // Append to history.txt
 
 int  Emulator_GetScreenScale(int scrmode);
 void Emulator_GetScreenSize(int scrmode, int* pwid, int* phei);
@@ -78,8 +93,30 @@ void Emulator_PrepareScreenRGB32(void* pBits, int screenMode, int palette);
 void Emulator_OnUpdate();
 uint16_t Emulator_GetChangeRamStatus(uint16_t address);
 
+enum EmulatorSaveStatus
+{
+    EMUSAVE_IDLE = 0,
+    EMUSAVE_WRITING = 1,  // Background save in progress
+    EMUSAVE_DONE = 2,
+    EMUSAVE_FAILED = 3,
+};
+
 bool Emulator_SaveImage(LPCTSTR sFilePath);
+bool Emulator_SaveImageAsync(LPCTSTR sFilePath, bool okAutoSave = false);  // Save on the background thread
+int  Emulator_GetSaveImageStatus();  // See EmulatorSaveStatus
+void Emulator_ClearSaveImageStatus();
+// Save to autosave.mk90st in background every N seconds of the host time while running, 0 = off; success is not reported
+void Emulator_SetAutoSave(int seconds);
 bool Emulator_LoadImage(LPCTSTR sFilePath);
 
+const int EMULATOR_QUICKSLOT_COUNT = 8;
+bool Emulator_QuickSave(int slot);  // Save the machine state to the memory slot 0..7
+bool Emulator_QuickLoad(int slot);
+const CMotherboardSnapshot* Emulator_GetQuickSlot(int slot);  // nullptr if the slot is empty
+
+// Machine state as the image v2 chunks without the ROM, up to the END chunk; used for the movie start state
+bool Emulator_SaveStateChunks(FILE* fpFile);
+bool Emulator_LoadStateChunks(const uint8_t* pData, size_t size);
+
 
 //////////////////////////////////////////////////////////////////////
@@ -0,0 +1,297 @@
+﻿/*  This file is part of MK90BTL.
+    MK90BTL is free software: you can redistribute it and/or modify it under the terms
+of the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+    MK90BTL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License along with
+MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
+
+// EventTrace.cpp
+
+#include "stdafx.h"
+#include <vector>
+#include "Main.h"
+#include "Emulator.h"
+#include "EventTrace.h"
+#include "emubase\Emubase.h"
+
+//////////////////////////////////////////////////////////////////////
+
+
+const int EVENTTRACE_RECORDS_MAX = 1024 * 1024;  // 24 MB at most
+
+// Events added by the tracer itself, the board events are BOARDEVENT_XXX
+#define EVENTTRACE_FRAMESTART   16  // param1/param2 = frame number low/high word
+#define EVENTTRACE_FRAMEEND     17
+#define EVENTTRACE_BREAKPOINT   18  // param1 = PC
+
+struct EventTraceRecord
+{
+    uint64_t emuTick;  // CPU ticks from the trace start
+    LONGLONG hostTick;  // QueryPerformanceCounter value
+    uint16_t param1;
+    uint16_t param2;
+    uint32_t type;
+};
+
+std::vector<EventTraceRecord> m_EventTraceRecords;
+bool m_okEventTraceRunning = false;
+int m_nEventTraceDropped = 0;
+uint32_t m_nEventTraceFrame = 0;
+uint64_t m_nEventTraceFrameTick = 0;  // CPU ticks from the trace start to the current frame start
+LONGLONG m_nEventTraceHostStart = 0;
+LONGLONG m_nEventTraceHostFrequency = 1;
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+bool EventTrace_IsRunning() { return m_okEventTraceRunning; }
+int  EventTrace_GetEventCount() { return (int)m_EventTraceRecords.size(); }
+int  EventTrace_GetDroppedCount() { return m_nEventTraceDropped; }
+
+static void EventTrace_Add(uint32_t type, uint16_t param1, uint16_t param2, int step)
+{
+    if (m_EventTraceRecords.size() >= (size_t)EVENTTRACE_RECORDS_MAX)
+    {
+        m_nEventTraceDropped++;
+        return;
+    }
+
+    LARGE_INTEGER nHostTick;
+    ::QueryPerformanceCounter(&nHostTick);
+
+    EventTraceRecord record;
+    record.emuTick = m_nEventTraceFrameTick + step;
+    record.hostTick = nHostTick.QuadPart;
+    record.param1 = param1;
+    record.param2 = param2;
+    record.type = type;
+    m_EventTraceRecords.push_back(record);
+}
+
+static void EventTrace_EventCallback(int event, uint16_t param1, uint16_t param2, int step)
+{
+    EventTrace_Add((uint32_t)event, param1, param2, step);
+}
+
+bool EventTrace_Start()
+{
+    EventTrace_Clear();
+
+    LARGE_INTEGER nFrequency, nStart;
+    ::QueryPerformanceFrequency(&nFrequency);
+    ::QueryPerformanceCounter(&nStart);
+    m_nEventTraceHostFrequency = nFrequency.QuadPart;
+    m_nEventTraceHostStart = nStart.QuadPart;
+
+    g_pBoard->SetEventCallback(EventTrace_EventCallback);
+    m_okEventTraceRunning = true;
+    return true;
+}
+
+void EventTrace_Stop()
+{
+    if (g_pBoard != nullptr)
+        g_pBoard->SetEventCallback(nullptr);
+    m_okEventTraceRunning = false;
+}
+
+void EventTrace_Clear()
+{
+    m_EventTraceRecords.clear();
+    m_nEventTraceDropped = 0;
+    m_nEventTraceFrame = 0;
+    m_nEventTraceFrameTick = 0;
+}
+
+void EventTrace_Done()
+{
+    EventTrace_Stop();
+    std::vector<EventTraceRecord>().swap(m_EventTraceRecords);
+}
+
+void EventTrace_OnFrameStart()
+{
+    if (!m_okEventTraceRunning)
+        return;
+
+    EventTrace_Add(EVENTTRACE_FRAMESTART, (uint16_t)m_nEventTraceFrame, (uint16_t)(m_nEventTraceFrame >> 16), 0);
+}
+
+void EventTrace_OnFrameEnd()
+{
+    if (!m_okEventTraceRunning)
+        return;
+
+    EventTrace_Add(EVENTTRACE_FRAMEEND, 0, 0, FRAME_STEPS);
+    m_nEventTraceFrameTick += FRAME_STEPS;
+    m_nEventTraceFrame++;
+}
+
+void EventTrace_OnBreakpoint()
+{
+    if (!m_okEventTraceRunning)
+        return;
+
+    // The next frame starts right after the breakpoint tick
+    int step = g_pBoard->GetEventStep() + 1;
+    EventTrace_Add(EVENTTRACE_BREAKPOINT, g_pBoard->GetCPU()->GetPC(), 0, step);
+    EventTrace_Add(EVENTTRACE_FRAMEEND, 0, 0, step);
+    m_nEventTraceFrameTick += step;
+    m_nEventTraceFrame++;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Chrome trace event JSON
+
+
+// Interrupts shown as slices; other vectors are tracked for the nesting only
+static bool EventTrace_IsSliceVector(uint16_t vector)
+{
+    return vector == 0000100 || vector == 0000304 || vector == 0000310;
+}
+
+static LPCTSTR EventTrace_GetVectorName(uint16_t vector)
+{
+    switch (vector)
+    {
+    case 0000100: return _T("EVNT");
+    case 0000304: return _T("VIRQ devices");
+    case 0000310: return _T("VIRQ keyboard");
+    default: return _T("Interrupt");
+    }
+}
+
+// Write one event on both timelines; ph is "B", "E" or "i"
+static void EventTrace_WriteEvent(FILE* fpFile, const EventTraceRecord& record,
+        LPCTSTR ph, int tid, LPCTSTR name, LPCTSTR args)
+{
+    double emuTime = record.emuTick / 8.0;
+    double hostTime = (record.hostTick - m_nEventTraceHostStart) * 1000000.0 / m_nEventTraceHostFrequency;
+
+    for (int pid = 1; pid <= 2; pid++)
+    {
+        ::_ftprintf(fpFile,
+                _T(",\n{\"name\":\"%s\",\"ph\":\"%s\",%s\"pid\":%d,\"tid\":%d,\"ts\":%.3f,")
+                _T("\"args\":{\"emu_us\":%.3f,\"host_us\":%.3f%s%s}}"),
+                name, ph,
+                (*ph == _T('i')) ? _T("\"s\":\"t\",") : _T(""),
+                pid, tid, (pid == 1) ? emuTime : hostTime, emuTime, hostTime,
+                (*args != 0) ? _T(",") : _T(""), args);
+    }
+}
+
+static void EventTrace_WriteMetadata(FILE* fpFile, int pid, int tid, LPCTSTR kind, LPCTSTR name)
+{
+    ::_ftprintf(fpFile, _T("%s{\"name\":\"%s\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}"),
+            (pid == 1 && tid == 0) ? _T("") : _T(",\n"), kind, pid, tid, name);
+}
+
+bool EventTrace_Save(LPCTSTR sFilePath)
+{
+    FILE* fpFile = ::_tfsopen(sFilePath, _T("wt"), _SH_DENYWR);
+    if (fpFile == nullptr)
+        return false;
+
+    ::_fputts(_T("{\"traceEvents\":[\n"), fpFile);
+
+    static LPCTSTR threadNames[] = { _T("Frames"), _T("Interrupts"), _T("Ports"), _T("LCD"), _T("SMP"), _T("Breakpoints") };
+    for (int pid = 1; pid <= 2; pid++)
+    {
+        EventTrace_WriteMetadata(fpFile, pid, 0, _T("process_name"), (pid == 1) ? _T("Emulated time") : _T("Host time"));
+        for (int tid = 1; tid <= 6; tid++)
+            EventTrace_WriteMetadata(fpFile, pid, tid, _T("thread_name"), threadNames[tid - 1]);
+    }
+
+    // Interrupt nesting by SP: the interrupt is left when RTI/RTT pops above the SP saved on the entry
+    struct EventTraceInterrupt
+    {
+        uint16_t vector;
+        uint16_t sp;
+    };
+    std::vector<EventTraceInterrupt> interrupts;
+
+    bool okFrameOpen = false;
+    TCHAR name[48];
+    TCHAR args[64];
+    for (size_t i = 0; i < m_EventTraceRecords.size(); i++)
+    {
+        const EventTraceRecord& record = m_EventTraceRecords[i];
+        args[0] = 0;
+        switch (record.type)
+        {
+        case EVENTTRACE_FRAMESTART:
+            _sntprintf(name, sizeof(name) / sizeof(TCHAR) - 1, _T("Frame %u"), record.param1 | ((uint32_t)record.param2 << 16));
+            EventTrace_WriteEvent(fpFile, record, _T("B"), 1, name, args);
+            okFrameOpen = true;
+            break;
+        case EVENTTRACE_FRAMEEND:
+            if (!okFrameOpen)
+                break;
+            EventTrace_WriteEvent(fpFile, record, _T("E"), 1, _T("Frame"), args);
+            okFrameOpen = false;
+            break;
+        case EVENTTRACE_BREAKPOINT:
+            _sntprintf(name, sizeof(name) / sizeof(TCHAR) - 1, _T("Breakpoint %06o"), record.param1);
+            EventTrace_WriteEvent(fpFile, record, _T("i"), 6, name, args);
+            break;
+        case BOARDEVENT_INTERRUPT:
+            {
+                EventTraceInterrupt interrupt;
+                interrupt.vector = record.param1;
+                interrupt.sp = record.param2;
+                interrupts.push_back(interrupt);
+                if (!EventTrace_IsSliceVector(record.param1))
+                    break;
+                _sntprintf(name, sizeof(name) / sizeof(TCHAR) - 1, _T("%s %06o"), EventTrace_GetVectorName(record.param1), record.param1);
+                _sntprintf(args, sizeof(args) / sizeof(TCHAR) - 1, _T("\"sp\":\"%06o\""), record.param2);
+                EventTrace_WriteEvent(fpFile, record, _T("B"), 2, name, args);
+            }
+            break;
+        case BOARDEVENT_RETURN:
+            while (!interrupts.empty() && interrupts.back().sp < record.param2)
+            {
+                uint16_t vector = interrupts.back().vector;
+                interrupts.pop_back();
+                if (!EventTrace_IsSliceVector(vector))
+                    continue;
+                _sntprintf(args, sizeof(args) / sizeof(TCHAR) - 1, _T("\"pc\":\"%06o\""), record.param1);
+                EventTrace_WriteEvent(fpFile, record, _T("E"), 2, EventTrace_GetVectorName(vector), args);
+            }
+            break;
+        case BOARDEVENT_PORTREAD:
+        case BOARDEVENT_PORTWRITE:
+            _sntprintf(name, sizeof(name) / sizeof(TCHAR) - 1, _T("%s %06o"),
+                    (record.type == BOARDEVENT_PORTREAD) ? _T("Read") : _T("Write"), record.param1);
+            _sntprintf(args, sizeof(args) / sizeof(TCHAR) - 1, _T("\"value\":\"%06o\""), record.param2);
+            EventTrace_WriteEvent(fpFile, record, _T("i"), 3, name, args);
+            break;
+        case BOARDEVENT_LCDWRITE:
+            _sntprintf(name, sizeof(name) / sizeof(TCHAR) - 1, _T("LCD %s"),
+                    (record.param1 & 2) ? _T("config") : _T("address"));
+            _sntprintf(args, sizeof(args) / sizeof(TCHAR) - 1, _T("\"port\":\"%06o\",\"value\":\"%06o\""), record.param1, record.param2);
+            EventTrace_WriteEvent(fpFile, record, _T("i"), 4, name, args);
+            break;
+        case BOARDEVENT_SMPREAD:
+        case BOARDEVENT_SMPWRITE:
+            _sntprintf(name, sizeof(name) / sizeof(TCHAR) - 1, _T("SMP%u %s"),
+                    (unsigned)record.param1, (record.type == BOARDEVENT_SMPREAD) ? _T("read") : _T("write"));
+            _sntprintf(args, sizeof(args) / sizeof(TCHAR) - 1, _T("\"byte\":\"%03o\""), record.param2);
+            EventTrace_WriteEvent(fpFile, record, _T("i"), 5, name, args);
+            break;
+        }
+    }
+
+    ::_ftprintf(fpFile, _T("\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"emulator\":\"MK90BTL\",\"events\":%d,\"dropped\":%d}}\n"),
+            (int)m_EventTraceRecords.size(), m_nEventTraceDropped);
+
+    ::fclose(fpFile);
+    return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////
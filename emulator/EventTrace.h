@@ -0,0 +1,41 @@
+﻿/*  This file is part of MK90BTL.
+    MK90BTL is free software: you can redistribute it and/or modify it under the terms
+of the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+    MK90BTL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License along with
+MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
+
+// EventTrace.h
+
+#pragma once
+
+//////////////////////////////////////////////////////////////////////
+//
+// Event tracer records the emulator events on two timelines, emulated time and host time:
+// frames, interrupts entered and left, external devices port reads and writes, LCD controller
+// register writes, SMP data bytes, breakpoint hits; see BOARDEVENT_XXX in Board.h.
+// The events are kept in memory and saved as Chrome trace event JSON, to open in
+// chrome://tracing or Perfetto UI. Process 1 is the emulated time, 1 us = 8 CPU ticks;
+// process 2 is the host time. Every event has both timestamps in its args.
+
+const LPCTSTR FILENAME_EVENTTRACE = _T("events.json");  // Default event trace file
+
+bool EventTrace_Start();  // Clear the events and start recording
+void EventTrace_Stop();  // Stop recording, the events are kept to save
+bool EventTrace_IsRunning();
+void EventTrace_Clear();
+void EventTrace_Done();  // Free the memory, called on the emulator exit
+
+void EventTrace_OnFrameStart();  // Called before the board frame
+void EventTrace_OnFrameEnd();  // Called after the board frame completed
+void EventTrace_OnBreakpoint();  // Called when the board frame stopped on breakpoint
+
+int  EventTrace_GetEventCount();
+int  EventTrace_GetDroppedCount();  // Events lost because of the memory limit
+bool EventTrace_Save(LPCTSTR sFilePath);  // Write the events as Chrome trace event JSON
+
+
+//////////////////////////////////////////////////////////////////////
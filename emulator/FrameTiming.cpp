@@ -0,0 +1,188 @@
+﻿/*  This file is part of MK90BTL.
+    MK90BTL is free software: you can redistribute it and/or modify it under the terms
+of the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+    MK90BTL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License along with
+MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
+
+// FrameTiming.cpp
+
+#include "stdafx.h"
+#include <algorithm>
+#include "Main.h"
+#include "FrameTiming.h"
+
+//////////////////////////////////////////////////////////////////////
+
+
+bool m_okFrameTimingRunning = false;
+LONGLONG m_nFrameTimingFrequency = 1;
+bool m_okFrameTimingFrameOpen = false;
+LONGLONG m_nFrameTimingFrameStart = 0;
+LONGLONG m_FrameTimingParts[FRAMETIMING_COUNT];  // Current frame, QueryPerformanceCounter ticks
+FrameTimingRecord m_FrameTimingWindow[FRAMETIMING_WINDOW];  // Ring buffer
+uint32_t m_nFrameTimingFrames = 0;
+float m_FrameTimingMax[FRAMETIMING_COUNT];
+FrameTimingRecord m_FrameTimingWorst[FRAMETIMING_WORST];  // Sorted by total time, worst first
+int m_nFrameTimingWorstCount = 0;
+
+static LPCTSTR FrameTiming_PartNames[FRAMETIMING_COUNT] =
+{
+    _T("CPU"), _T("Events"), _T("Sound"), _T("Keyboard"), _T("Screen"), _T("Total"), _T("Interval")
+};
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+bool FrameTiming_IsRunning() { return m_okFrameTimingRunning; }
+
+LPCTSTR FrameTiming_GetPartName(int part)
+{
+    return (part >= 0 && part < FRAMETIMING_COUNT) ? FrameTiming_PartNames[part] : _T("");
+}
+
+bool FrameTiming_Start()
+{
+    FrameTiming_Clear();
+
+    LARGE_INTEGER nFrequency;
+    ::QueryPerformanceFrequency(&nFrequency);
+    m_nFrameTimingFrequency = nFrequency.QuadPart;
+
+    m_okFrameTimingRunning = true;
+    return true;
+}
+
+void FrameTiming_Stop()
+{
+    m_okFrameTimingRunning = false;
+    m_okFrameTimingFrameOpen = false;
+}
+
+void FrameTiming_Clear()
+{
+    m_okFrameTimingFrameOpen = false;
+    m_nFrameTimingFrames = 0;
+    m_nFrameTimingWorstCount = 0;
+    ::memset(m_FrameTimingMax, 0, sizeof(m_FrameTimingMax));
+}
+
+LONGLONG FrameTiming_GetTime()
+{
+    if (!m_okFrameTimingRunning)
+        return 0;
+
+    LARGE_INTEGER nTime;
+    ::QueryPerformanceCounter(&nTime);
+    return nTime.QuadPart;
+}
+
+void FrameTiming_Add(int part, LONGLONG startTime)
+{
+    if (!m_okFrameTimingFrameOpen || startTime == 0)
+        return;
+
+    LARGE_INTEGER nTime;
+    ::QueryPerformanceCounter(&nTime);
+    m_FrameTimingParts[part] += nTime.QuadPart - startTime;
+}
+
+// Put the record to the worst frames list if it is bad enough
+static void FrameTiming_AddWorst(const FrameTimingRecord& record)
+{
+    int index = m_nFrameTimingWorstCount;
+    while (index > 0 && m_FrameTimingWorst[index - 1].time[FRAMETIMING_TOTAL] < record.time[FRAMETIMING_TOTAL])
+        index--;
+    if (index >= FRAMETIMING_WORST)
+        return;
+
+    int last = (m_nFrameTimingWorstCount < FRAMETIMING_WORST) ? m_nFrameTimingWorstCount : FRAMETIMING_WORST - 1;
+    for (int i = last; i > index; i--)
+        m_FrameTimingWorst[i] = m_FrameTimingWorst[i - 1];
+    m_FrameTimingWorst[index] = record;
+    if (m_nFrameTimingWorstCount < FRAMETIMING_WORST)
+        m_nFrameTimingWorstCount++;
+}
+
+void FrameTiming_BeginFrame()
+{
+    if (!m_okFrameTimingRunning)
+        return;
+
+    LARGE_INTEGER nTime;
+    ::QueryPerformanceCounter(&nTime);
+
+    if (m_okFrameTimingFrameOpen)
+    {
+        // The sound is generated inside the board frame, take it out of the CPU time
+        m_FrameTimingParts[FRAMETIMING_CPU] -= m_FrameTimingParts[FRAMETIMING_SOUND];
+        if (m_FrameTimingParts[FRAMETIMING_CPU] < 0)
+            m_FrameTimingParts[FRAMETIMING_CPU] = 0;
+        m_FrameTimingParts[FRAMETIMING_TOTAL] = 0;
+        for (int part = 0; part < FRAMETIMING_TOTAL; part++)
+            m_FrameTimingParts[FRAMETIMING_TOTAL] += m_FrameTimingParts[part];
+        m_FrameTimingParts[FRAMETIMING_INTERVAL] = nTime.QuadPart - m_nFrameTimingFrameStart;
+
+        FrameTimingRecord& record = m_FrameTimingWindow[m_nFrameTimingFrames % FRAMETIMING_WINDOW];
+        record.frame = m_nFrameTimingFrames;
+        for (int part = 0; part < FRAMETIMING_COUNT; part++)
+        {
+            record.time[part] = (float)(m_FrameTimingParts[part] * 1000000.0 / m_nFrameTimingFrequency);
+            if (record.time[part] > m_FrameTimingMax[part])
+                m_FrameTimingMax[part] = record.time[part];
+        }
+        FrameTiming_AddWorst(record);
+        m_nFrameTimingFrames++;
+    }
+
+    ::memset(m_FrameTimingParts, 0, sizeof(m_FrameTimingParts));
+    m_nFrameTimingFrameStart = nTime.QuadPart;
+    m_okFrameTimingFrameOpen = true;
+}
+
+void FrameTiming_CancelFrame()
+{
+    m_okFrameTimingFrameOpen = false;
+}
+
+void FrameTiming_GetStats(FrameTimingStats* pStats)
+{
+    pStats->frames = m_nFrameTimingFrames;
+    pStats->window = (m_nFrameTimingFrames < FRAMETIMING_WINDOW) ? (int)m_nFrameTimingFrames : FRAMETIMING_WINDOW;
+    ::memcpy(pStats->max, m_FrameTimingMax, sizeof(pStats->max));
+    ::memset(pStats->p50, 0, sizeof(pStats->p50));
+    ::memset(pStats->p99, 0, sizeof(pStats->p99));
+    if (pStats->window == 0)
+        return;
+
+    float* pValues = static_cast<float*>(::malloc(pStats->window * sizeof(float)));
+    if (pValues == nullptr)
+        return;
+    for (int part = 0; part < FRAMETIMING_COUNT; part++)
+    {
+        for (int i = 0; i < pStats->window; i++)
+            pValues[i] = m_FrameTimingWindow[i].time[part];
+        int index50 = pStats->window / 2;
+        std::nth_element(pValues, pValues + index50, pValues + pStats->window);
+        pStats->p50[part] = pValues[index50];
+        int index99 = pStats->window * 99 / 100;
+        std::nth_element(pValues, pValues + index99, pValues + pStats->window);
+        pStats->p99[part] = pValues[index99];
+    }
+    ::free(pValues);
+}
+
+int FrameTiming_GetWorstFrames(FrameTimingRecord* pRecords, int maxCount)
+{
+    int count = (m_nFrameTimingWorstCount < maxCount) ? m_nFrameTimingWorstCount : maxCount;
+    for (int i = 0; i < count; i++)
+        pRecords[i] = m_FrameTimingWorst[i];
+    return count;
+}
+
+
+//////////////////////////////////////////////////////////////////////
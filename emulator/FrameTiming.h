@@ -0,0 +1,64 @@
+﻿/*  This file is part of MK90BTL.
+    MK90BTL is free software: you can redistribute it and/or modify it under the terms
+of the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+    MK90BTL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License along with
+MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
+
+// FrameTiming.h
+
+#pragma once
+
+//////////////////////////////////////////////////////////////////////
+//
+// Frame timing measures the host time of every emulated frame with QueryPerformanceCounter,
+// split into the parts below. The last FRAMETIMING_WINDOW frames are kept for the percentiles;
+// the maximums and the worst frames are kept since the start, so a single spike is never averaged away.
+
+#define FRAMETIMING_CPU         0  // Board frame: CPU with the devices it drives, sound excluded
+#define FRAMETIMING_EVENTS      1  // Frame events: hash log, profilers, movie, run-ahead, auto-save
+#define FRAMETIMING_SOUND       2  // Sound generation, including the wait for the free sound buffer
+#define FRAMETIMING_KEYBOARD    3  // Keyboard scanning, or movie input when playing
+#define FRAMETIMING_SCREEN      4  // Screen preparation and drawing
+#define FRAMETIMING_TOTAL       5  // Sum of the parts above
+#define FRAMETIMING_INTERVAL    6  // From the frame start to the next frame start, the speed limit wait included
+#define FRAMETIMING_COUNT       7
+
+#define FRAMETIMING_WINDOW      4096  // Frames kept for the percentiles, about 2.7 minutes
+#define FRAMETIMING_WORST       8     // Worst frames kept
+
+struct FrameTimingRecord
+{
+    uint32_t frame;  // Frame number from the start
+    float time[FRAMETIMING_COUNT];  // Microseconds by FRAMETIMING_XXX
+};
+
+struct FrameTimingStats
+{
+    uint32_t frames;  // Frames measured since the start
+    int window;  // Frames in the window, up to FRAMETIMING_WINDOW
+    float p50[FRAMETIMING_COUNT];  // Microseconds, over the window
+    float p99[FRAMETIMING_COUNT];
+    float max[FRAMETIMING_COUNT];  // Microseconds, since the start
+};
+
+bool FrameTiming_Start();  // Clear the statistics and start measuring
+void FrameTiming_Stop();
+bool FrameTiming_IsRunning();
+void FrameTiming_Clear();
+
+LONGLONG FrameTiming_GetTime();  // Current QueryPerformanceCounter value, 0 when not measuring
+void FrameTiming_Add(int part, LONGLONG startTime);  // Add the time from startTime to now to the current frame
+void FrameTiming_BeginFrame();  // Finish the previous frame if any, start the new one
+void FrameTiming_CancelFrame();  // Drop the current frame: stopped on breakpoint or by the user
+
+void FrameTiming_GetStats(FrameTimingStats* pStats);
+// Get the worst frames by total time, worst first; returns number of records filled
+int  FrameTiming_GetWorstFrames(FrameTimingRecord* pRecords, int maxCount);
+LPCTSTR FrameTiming_GetPartName(int part);
+
+
+//////////////////////////////////////////////////////////////////////
@@ -0,0 +1,932 @@
+﻿/*  This file is part of MK90BTL.
+    MK90BTL is free software: you can redistribute it and/or modify it under the terms
+of the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+    MK90BTL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License along with
+MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
+
+// Headless.cpp : Running the emulator with no window, for benchmarks and movie playback
+
+#include "stdafx.h"
+#include "Main.h"
+#include "Emulator.h"
+#include "Movie.h"
+#include "Profiler.h"
+#include "Coverage.h"
+#include "TraceLog.h"
+#include "util/HashLogFile.h"
+#include <vector>
+#include <algorithm>
+#include "emubase\Emubase.h"
+
+//////////////////////////////////////////////////////////////////////
+
+
+const long HEADLESS_DEFAULT_FRAMES = 25 * 60;  // One minute of the emulated time
+
+HANDLE m_hHeadlessOutput = INVALID_HANDLE_VALUE;
+
+// Observers for the "instrumented" bisector variant
+const int HEADLESS_BISECT_TRACE_CAPACITY = 4096;
+CProcessorProfile* m_pHeadlessBisectProfile = nullptr;
+CProcessorWordProfile* m_pHeadlessBisectWordProfile = nullptr;
+CProcessorCoverage* m_pHeadlessBisectCoverage = nullptr;
+CMotherboardAccessCounters* m_pHeadlessBisectAccessCounters = nullptr;
+CPerfCounters* m_pHeadlessBisectPerfCounters = nullptr;
+CTraceRecord* m_pHeadlessBisectTraceBlock = nullptr;
+CCallGraph* m_pHeadlessBisectCallGraph = nullptr;
+CSampler* m_pHeadlessBisectSampler = nullptr;
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+// We are GUI application, so stdout is valid only when redirected; otherwise write to the parent console
+void Headless_InitOutput()
+{
+    if (m_hHeadlessOutput != INVALID_HANDLE_VALUE)
+        return;  // Already done
+
+    m_hHeadlessOutput = ::GetStdHandle(STD_OUTPUT_HANDLE);
+    if (m_hHeadlessOutput == NULL || m_hHeadlessOutput == INVALID_HANDLE_VALUE)
+    {
+        if (::AttachConsole(ATTACH_PARENT_PROCESS))
+            m_hHeadlessOutput = ::GetStdHandle(STD_OUTPUT_HANDLE);
+    }
+}
+
+void Headless_Print(LPCTSTR message)
+{
+    if (m_hHeadlessOutput == NULL || m_hHeadlessOutput == INVALID_HANDLE_VALUE)
+        return;
+
+    char buffer[512];
+#ifdef _UNICODE
+    int length = ::WideCharToMultiByte(CP_ACP, 0, message, -1, buffer, sizeof(buffer), NULL, NULL);
+    if (length <= 0) return;
+    length--;  // Without the trailing zero
+#else
+    strncpy_s(buffer, sizeof(buffer), message, _TRUNCATE);
+    int length = (int)strlen(buffer);
+#endif
+
+    DWORD dwBytesWritten;
+    ::WriteFile(m_hHeadlessOutput, buffer, length, &dwBytesWritten, NULL);
+}
+
+void Headless_PrintFormat(LPCTSTR pszFormat, ...)
+{
+    const size_t buffersize = 512;
+    TCHAR buffer[buffersize];
+
+    va_list ptr;
+    va_start(ptr, pszFormat);
+    _vsntprintf_s(buffer, buffersize, buffersize - 1, pszFormat, ptr);
+    va_end(ptr);
+
+    Headless_Print(buffer);
+}
+
+// Run the emulator at maximum speed until the movie ends or for the given number of frames.
+// Returns the process exit code.
+int Headless_Run()
+{
+    Headless_InitOutput();
+
+    if (Option_HashCompare[0][0] != 0)
+        return Headless_CompareHashLogs(Option_HashCompare[0], Option_HashCompare[1]);
+    if (Option_Bisect[0] != 0)
+        return Headless_Bisect(Option_Bisect);
+    if (Option_SampleReport[0] != 0)
+        return Headless_SampleReport(Option_SampleReport);
+    if (Option_CoverageMerge[0][0] != 0)
+        return Headless_CoverageMerge(Option_CoverageMerge[0], Option_CoverageMerge[1]);
+    if (Option_CoverageDiff[0][0] != 0)
+        return Headless_CoverageDiff(Option_CoverageDiff[0], Option_CoverageDiff[1]);
+    if (Option_CoverageListing[0][0] != 0)
+        return Headless_CoverageListing(Option_CoverageListing[0], Option_CoverageListing[1], Option_CoverageListing[2]);
+    if (Option_TraceDecode[0][0] != 0)
+        return Headless_DecodeTrace(Option_TraceDecode[0], Option_TraceDecode[1]);
+    if (Option_TraceQuery[0][0] != 0)
+        return Headless_TraceQuery(Option_TraceQuery[0], Option_TraceQuery[1], Option_TraceQueryStat);
+
+    if (Option_RecordMovie[0] != 0)
+    {
+        Headless_Print(_T("Movie recording is not supported in headless mode, there is no input to record\r\n"));
+        return 1;
+    }
+
+    long nFramesToRun = Option_Frames;
+    if (Option_PlayMovie[0] != 0)
+    {
+        if (!Movie_StartPlayback(Option_PlayMovie))
+        {
+            Headless_PrintFormat(_T("Failed to load the movie: %s\r\n"), Option_PlayMovie);
+            return 1;
+        }
+        Headless_PrintFormat(_T("Movie: %s, %u frames\r\n"), Option_PlayMovie, Movie_GetFrameCount());
+    }
+    else
+    {
+        // Attach the SMP images the same way the main window does
+        TCHAR buf[MAX_PATH];
+        for (int slot = 0; slot < 2; slot++)
+        {
+            buf[0] = _T('\0');
+            Settings_GetSmpFilePath(slot, buf);
+            if (buf[0] != _T('\0') && !Emulator_AttachSmpImage(slot, buf))
+                Headless_PrintFormat(_T("Failed to attach the SMP image: %s\r\n"), buf);
+        }
+
+        if (nFramesToRun <= 0)
+            nFramesToRun = HEADLESS_DEFAULT_FRAMES;
+    }
+
+    LARGE_INTEGER nPerformanceFrequency, nStartTime, nFinishTime;
+    ::QueryPerformanceFrequency(&nPerformanceFrequency);
+    ::QueryPerformanceCounter(&nStartTime);
+
+    g_okEmulatorRunning = true;
+    long nFrames = 0;
+    int result = 0;
+    while (nFramesToRun <= 0 || nFrames < nFramesToRun)
+    {
+        bool okMovie = Movie_IsPlaying();
+        if (!Emulator_SystemFrame())
+        {
+            Headless_PrintFormat(_T("Breakpoint hit at %06o\r\n"), g_pBoard->GetCPU()->GetPC());
+            result = 2;
+            break;
+        }
+        nFrames++;
+
+        if (okMovie && !Movie_IsPlaying())  // Movie finished
+            break;
+    }
+    g_okEmulatorRunning = false;
+
+    ::QueryPerformanceCounter(&nFinishTime);
+    LONGLONG nTimeElapsed = (nFinishTime.QuadPart - nStartTime.QuadPart) * 1000 / nPerformanceFrequency.QuadPart;
+    if (nTimeElapsed <= 0) nTimeElapsed = 1;
+
+    // Speed relative to the real MK-90: 25 frames per second
+    LONGLONG nSpeed = (LONGLONG)nFrames * 1000 / 25 * 100 / nTimeElapsed;
+    Headless_PrintFormat(_T("Frames: %ld, time: %I64d ms, speed: %I64d%%\r\n"), nFrames, nTimeElapsed, nSpeed);
+
+    Movie_Stop();
+
+    return result;
+}
+
+// Compare two hash logs record by record and report the first divergent frame.
+// Returns 0 if the logs are the same, 1 if diverged, 3 on error.
+int Headless_CompareHashLogs(LPCTSTR sFilePath1, LPCTSTR sFilePath2)
+{
+    HHASHLOGFILE hashlog1 = HashLogFile_Open(::_tfsopen(sFilePath1, _T("rb"), _SH_DENYWR));
+    if (hashlog1 == nullptr)
+    {
+        Headless_PrintFormat(_T("Failed to open the hash log: %s\r\n"), sFilePath1);
+        return 3;
+    }
+    HHASHLOGFILE hashlog2 = HashLogFile_Open(::_tfsopen(sFilePath2, _T("rb"), _SH_DENYWR));
+    if (hashlog2 == nullptr)
+    {
+        HashLogFile_Close(hashlog1);
+        Headless_PrintFormat(_T("Failed to open the hash log: %s\r\n"), sFilePath2);
+        return 3;
+    }
+
+    int result = 0;
+    uint32_t nRecords = 0;
+    for (;;)
+    {
+        uint32_t frame1, frame2;
+        uint64_t hash1, hash2;
+        bool ok1 = HashLogFile_Read(hashlog1, &frame1, &hash1);
+        bool ok2 = HashLogFile_Read(hashlog2, &frame2, &hash2);
+        if (!ok1 && !ok2)
+        {
+            Headless_PrintFormat(_T("Hash logs match, %u frames\r\n"), nRecords);
+            break;
+        }
+        if (!ok1 || !ok2)
+        {
+            Headless_PrintFormat(_T("Hash logs match for %u frames, then log %d ends\r\n"), nRecords, ok1 ? 2 : 1);
+            result = 1;
+            break;
+        }
+        if (frame1 != frame2 || hash1 != hash2)
+        {
+            Headless_PrintFormat(_T("First divergent frame: %u\r\n  %016I64x  %s\r\n  %016I64x  %s\r\n"),
+                    frame1, hash1, sFilePath1, hash2, sFilePath2);
+            result = 1;
+            break;
+        }
+        nRecords++;
+    }
+
+    HashLogFile_Close(hashlog1);
+    HashLogFile_Close(hashlog2);
+
+    return result;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Bisector front-end, see CBisector
+
+void Headless_BisectInput(CMotherboard* pBoard, uint32_t frame)
+{
+    Movie_ApplyFrameEvents(pBoard, frame);
+}
+
+// The records are dropped, the trace is only to run the tracing code
+CTraceRecord* Headless_BisectTraceCallback(CTraceRecord* pBlock, int /*count*/)
+{
+    return pBlock;
+}
+
+void Headless_BisectEventCallback(int /*event*/, uint16_t /*param1*/, uint16_t /*param2*/, int /*step*/)
+{
+}
+
+// Attach all the profiling and tracing observers to the machine: they should not change the emulation,
+// but they make the CPU and the board take the other code paths. Returns false if out of memory.
+bool Headless_BisectAttachObservers(CMotherboard* pBoard)
+{
+    m_pHeadlessBisectProfile = static_cast<CProcessorProfile*>(::calloc(1, sizeof(CProcessorProfile)));
+    m_pHeadlessBisectWordProfile = static_cast<CProcessorWordProfile*>(::calloc(1, sizeof(CProcessorWordProfile)));
+    m_pHeadlessBisectCoverage = static_cast<CProcessorCoverage*>(::calloc(1, sizeof(CProcessorCoverage)));
+    m_pHeadlessBisectAccessCounters = static_cast<CMotherboardAccessCounters*>(::calloc(1, sizeof(CMotherboardAccessCounters)));
+    m_pHeadlessBisectPerfCounters = static_cast<CPerfCounters*>(::calloc(1, sizeof(CPerfCounters)));
+    m_pHeadlessBisectTraceBlock = static_cast<CTraceRecord*>(::calloc(HEADLESS_BISECT_TRACE_CAPACITY, sizeof(CTraceRecord)));
+    if (m_pHeadlessBisectProfile == nullptr || m_pHeadlessBisectWordProfile == nullptr || m_pHeadlessBisectCoverage == nullptr ||
+        m_pHeadlessBisectAccessCounters == nullptr || m_pHeadlessBisectPerfCounters == nullptr || m_pHeadlessBisectTraceBlock == nullptr)
+        return false;
+    m_pHeadlessBisectCallGraph = new CCallGraph();
+    if (!m_pHeadlessBisectCallGraph->IsValid())
+    {
+        delete m_pHeadlessBisectCallGraph;  m_pHeadlessBisectCallGraph = nullptr;
+    }
+    m_pHeadlessBisectSampler = new CSampler(65536);
+    m_pHeadlessBisectSampler->SetInterval(4096);
+
+    CProcessor* pProc = pBoard->GetCPU();
+    pProc->SetProfile(m_pHeadlessBisectProfile);
+    pProc->SetWordProfile(m_pHeadlessBisectWordProfile);
+    pProc->SetCoverage(m_pHeadlessBisectCoverage);
+    pProc->SetCallGraph(m_pHeadlessBisectCallGraph);
+    pProc->SetSampler(m_pHeadlessBisectSampler);
+    pBoard->SetAccessCounters(m_pHeadlessBisectAccessCounters);
+    pBoard->SetPerfCounters(m_pHeadlessBisectPerfCounters);
+    pBoard->SetEventCallback(Headless_BisectEventCallback);
+    pBoard->SetTraceCallback(Headless_BisectTraceCallback, m_pHeadlessBisectTraceBlock, HEADLESS_BISECT_TRACE_CAPACITY);
+    pBoard->SetTrace(TRACE_ALL);
+    return true;
+}
+
+// Called after the machine with the observers is deleted
+void Headless_BisectFreeObservers()
+{
+    delete m_pHeadlessBisectSampler;  m_pHeadlessBisectSampler = nullptr;
+    delete m_pHeadlessBisectCallGraph;  m_pHeadlessBisectCallGraph = nullptr;
+    ::free(m_pHeadlessBisectTraceBlock);  m_pHeadlessBisectTraceBlock = nullptr;
+    ::free(m_pHeadlessBisectPerfCounters);  m_pHeadlessBisectPerfCounters = nullptr;
+    ::free(m_pHeadlessBisectAccessCounters);  m_pHeadlessBisectAccessCounters = nullptr;
+    ::free(m_pHeadlessBisectCoverage);  m_pHeadlessBisectCoverage = nullptr;
+    ::free(m_pHeadlessBisectWordProfile);  m_pHeadlessBisectWordProfile = nullptr;
+    ::free(m_pHeadlessBisectProfile);  m_pHeadlessBisectProfile = nullptr;
+}
+
+void Headless_PrintBisectResult(CBisector* pBisector, const BisectResult& result)
+{
+    CMotherboard* pBoardA = pBisector->GetBoardA();
+    CMotherboard* pBoardB = pBisector->GetBoardB();
+
+    Headless_PrintFormat(_T("First divergent frame: %u\r\n"), result.frame);
+    if (result.step == BISECT_STEP_FRAMESTART)
+        Headless_PrintFormat(_T("The machines differ at the frame start, PC %06o\r\n"), result.address);
+    else if (result.step == BISECT_STEP_NOTFOUND)
+        Headless_Print(_T("The frame run again did not diverge, the run is not repeatable\r\n"));
+    else
+    {
+        Headless_PrintFormat(_T("CPU tick %d of the frame, frame tick %d\r\n"), result.step, result.step / 16);
+
+        uint16_t memory[3];
+        bool okHaltMode = pBoardA->GetCPU()->IsHaltMode();
+        int addrtype;
+        for (int i = 0; i < 3; i++)
+            memory[i] = pBoardA->GetWordView((uint16_t)(result.address + i * 2), okHaltMode, true, &addrtype);
+        TCHAR instr[8], args[32];
+        DisassembleInstruction(memory, result.address, instr, args);
+        Headless_PrintFormat(_T("Instruction: %06o  %06o  %s %s\r\n"), result.address, memory[0], instr, args);
+    }
+
+    // Register deltas
+    Headless_Print(_T("Registers:   A       B\r\n"));
+    CProcessor* pProcA = pBoardA->GetCPU();
+    CProcessor* pProcB = pBoardB->GetCPU();
+    int nDeltas = 0;
+    for (int r = 0; r < 8; r++)
+    {
+        if (pProcA->GetReg(r) == pProcB->GetReg(r))
+            continue;
+        Headless_PrintFormat(_T("  %s        %06o  %06o\r\n"), REGISTER_NAME[r], pProcA->GetReg(r), pProcB->GetReg(r));
+        nDeltas++;
+    }
+    if (pProcA->GetPSW() != pProcB->GetPSW())
+    {
+        Headless_PrintFormat(_T("  PS        %06o  %06o\r\n"), pProcA->GetPSW(), pProcB->GetPSW());
+        nDeltas++;
+    }
+    if (pProcA->GetInternalTick() != pProcB->GetInternalTick())
+    {
+        Headless_PrintFormat(_T("  tick      %6d  %6d\r\n"), pProcA->GetInternalTick(), pProcB->GetInternalTick());
+        nDeltas++;
+    }
+
+    // Memory deltas
+    const int maxMemoryDeltas = 16;
+    int nMemoryDeltas = 0;
+    for (int address = 0; address < 65536; address++)
+    {
+        uint8_t byteA = pBoardA->GetRAMByte((uint16_t)address);
+        uint8_t byteB = pBoardB->GetRAMByte((uint16_t)address);
+        if (byteA == byteB)
+            continue;
+        if (nMemoryDeltas == 0)
+            Headless_Print(_T("Memory:      A       B\r\n"));
+        if (nMemoryDeltas < maxMemoryDeltas)
+            Headless_PrintFormat(_T("  %06o    %03o     %03o\r\n"), address, byteA, byteB);
+        nMemoryDeltas++;
+    }
+    if (nMemoryDeltas > maxMemoryDeltas)
+        Headless_PrintFormat(_T("  ... %d more bytes differ\r\n"), nMemoryDeltas - maxMemoryDeltas);
+
+    if (nDeltas == 0 && nMemoryDeltas == 0)
+        Headless_Print(_T("The difference is in the CPU internal flags or device registers\r\n"));
+}
+
+// Run two machines from the same state, the second one on the execution path given by the variant:
+// "none" = the same path, "instrumented" = all the profiling and tracing observers attached;
+// report the first divergent frame and instruction.
+// Returns 0 if no divergence, 1 if diverged, 3 on error.
+int Headless_Bisect(LPCTSTR sVariant)
+{
+    bool okInstrumented = (_tcscmp(sVariant, _T("instrumented")) == 0);
+    if (!okInstrumented && _tcscmp(sVariant, _T("none")) != 0)
+    {
+        Headless_PrintFormat(_T("Unknown bisector variant: %s\r\n"), sVariant);
+        return 3;
+    }
+
+    // Common start state: the movie start or the current machine with SMPs from the settings
+    uint32_t nFrames = (uint32_t)Option_Frames;
+    if (Option_PlayMovie[0] != 0)
+    {
+        if (!Movie_StartPlayback(Option_PlayMovie))
+        {
+            Headless_PrintFormat(_T("Failed to load the movie: %s\r\n"), Option_PlayMovie);
+            return 3;
+        }
+        if (nFrames == 0)
+            nFrames = Movie_GetFrameCount();
+    }
+    else
+    {
+        TCHAR buf[MAX_PATH];
+        for (int slot = 0; slot < 2; slot++)
+        {
+            buf[0] = _T('\0');
+            Settings_GetSmpFilePath(slot, buf);
+            if (buf[0] != _T('\0'))
+                Emulator_AttachSmpImage(slot, buf);
+        }
+    }
+    if (nFrames == 0)
+        nFrames = HEADLESS_DEFAULT_FRAMES;
+
+    uint8_t* pRom = static_cast<uint8_t*>(::calloc(1, 32768));
+    CMotherboardSnapshot* pStart = static_cast<CMotherboardSnapshot*>(::calloc(1, sizeof(CMotherboardSnapshot)));
+    CBisector* pBisector = new CBisector();
+
+    int result = 3;
+    if (pRom != nullptr && pStart != nullptr)
+    {
+        for (uint16_t offset = 0; offset < 32768; offset++)
+            pRom[offset] = g_pBoard->GetROMByte(offset);
+        g_pBoard->SaveToSnapshot(pStart);
+
+        if (pBisector->Init(pRom, pStart) &&
+            (!okInstrumented || Headless_BisectAttachObservers(pBisector->GetBoardB())))
+        {
+            for (int slot = 0; slot < 2; slot++)
+            {
+                size_t size;
+                const uint8_t* pData = g_pBoard->GetSmpImageData(slot, &size);
+                if (pData != nullptr)
+                    pBisector->AttachSmpImage(slot, pData, size);
+            }
+            if (Movie_IsPlaying())
+                pBisector->SetInputCallback(Headless_BisectInput);
+
+            Headless_PrintFormat(_T("Bisect: variant %s, %u frames\r\n"), sVariant, nFrames);
+            BisectResult bisectResult;
+            if (pBisector->Run(nFrames, &bisectResult))
+            {
+                Headless_PrintBisectResult(pBisector, bisectResult);
+                result = 1;
+            }
+            else
+            {
+                Headless_PrintFormat(_T("No divergence in %u frames\r\n"), nFrames);
+                result = 0;
+            }
+        }
+    }
+    if (result == 3)
+        Headless_Print(_T("Failed to prepare the bisector\r\n"));
+
+    delete pBisector;
+    Headless_BisectFreeObservers();
+    ::free(pStart);
+    ::free(pRom);
+
+    Movie_Stop();
+
+    return result;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Sampling profiler report
+
+const int HEADLESS_SAMPLE_NESTING_MAX = 4;  // Nesting level 4 and deeper are counted together
+
+struct HeadlessSampleStats
+{
+    uint32_t samples;
+    uint32_t haltmode;
+    uint32_t waitmode;
+    uint32_t nesting[HEADLESS_SAMPLE_NESTING_MAX + 1];
+    std::vector<uint32_t> pc;  // Samples by PC
+    std::vector<uint32_t> retaddr;  // Samples by return address
+};
+
+// Read all the run blocks of the samples file; returns number of runs read, -1 on error
+static int Headless_ReadSampleFile(LPCTSTR sFilePath, HeadlessSampleStats* pStats, uint32_t* pDropped)
+{
+    FILE* fpFile = ::_tfsopen(sFilePath, _T("rb"), _SH_DENYWR);
+    if (fpFile == nullptr)
+        return -1;
+
+    int runs = 0;
+    const size_t bufferCount = 4096;
+    CSamplerSample* pBuffer = static_cast<CSamplerSample*>(::malloc(bufferCount * sizeof(CSamplerSample)));
+    ProfilerSampleHeader header;
+    while (pBuffer != nullptr && ::fread(&header, 1, sizeof(header), fpFile) == sizeof(header))
+    {
+        if (header.header1 != MK90SAMPLE_HEADER1 || header.header2 != MK90SAMPLE_HEADER2 ||
+            (header.version >> 16) != (MK90SAMPLE_VERSION >> 16))
+            break;  // Not a samples file, or the rest of the file is broken
+
+        HeadlessSampleStats& stats = pStats[header.configuration == EMU_CONF_BASIC10 ? 0 : 1];
+        uint32_t remaining = header.sampleCount;
+        while (remaining > 0)
+        {
+            size_t count = (std::min)((size_t)remaining, bufferCount);
+            if (::fread(pBuffer, sizeof(CSamplerSample), count, fpFile) != count)
+                break;
+            for (size_t i = 0; i < count; i++)
+            {
+                const CSamplerSample& sample = pBuffer[i];
+                stats.samples++;
+                if (sample.flags & SAMPLE_FLAG_HALTMODE) stats.haltmode++;
+                if (sample.flags & SAMPLE_FLAG_WAITMODE) stats.waitmode++;
+                stats.nesting[(std::min)((int)sample.nesting, HEADLESS_SAMPLE_NESTING_MAX)]++;
+                stats.pc[sample.pc]++;
+                stats.retaddr[sample.retaddr]++;
+            }
+            remaining -= (uint32_t)count;
+        }
+        *pDropped += header.dropped;
+        runs++;
+        if (remaining > 0)
+            break;  // Unexpected end of file
+    }
+
+    ::free(pBuffer);
+    ::fclose(fpFile);
+    return runs;
+}
+
+typedef std::pair<uint32_t, uint16_t> HeadlessSampleCount;  // Samples, address
+
+static bool Headless_SampleCountCompare(const HeadlessSampleCount& item1, const HeadlessSampleCount& item2)
+{
+    if (item1.first != item2.first)
+        return item1.first > item2.first;
+    return item1.second < item2.second;
+}
+
+static void Headless_PrintSampleTop(const std::vector<uint32_t>& counts, uint32_t total, int lines)
+{
+    std::vector<HeadlessSampleCount> items;
+    for (int address = 0; address < 65536; address++)
+    {
+        if (counts[address] != 0)
+            items.push_back(HeadlessSampleCount(counts[address], (uint16_t)address));
+    }
+    std::sort(items.begin(), items.end(), Headless_SampleCountCompare);
+
+    for (int i = 0; i < lines && i < (int)items.size(); i++)
+    {
+        uint16_t address = items[i].second;
+        TCHAR symbol[40];
+        symbol[0] = 0;
+        uint16_t offset;
+        LPCTSTR name = Profiler_FindSymbol(address, &offset);
+        if (name != nullptr && offset == 0)
+            _sntprintf(symbol, sizeof(symbol) / sizeof(TCHAR) - 1, _T("%s"), name);
+        else if (name != nullptr)
+            _sntprintf(symbol, sizeof(symbol) / sizeof(TCHAR) - 1, _T("%s+%o"), name, offset);
+        Headless_PrintFormat(_T("  %10u %6.2f%%  %06o  %s\r\n"),
+                counts[address], counts[address] * 100.0 / total, address, symbol);
+    }
+}
+
+// Aggregate the samples from all the files matching the mask, and print the report.
+// Returns 0 on success, 3 on error.
+int Headless_SampleReport(LPCTSTR sFileMask)
+{
+    HeadlessSampleStats stats[2];  // BASIC 1.0, BASIC 2.0
+    for (int conf = 0; conf < 2; conf++)
+    {
+        stats[conf].samples = stats[conf].haltmode = stats[conf].waitmode = 0;
+        ::memset(stats[conf].nesting, 0, sizeof(stats[conf].nesting));
+        stats[conf].pc.resize(65536);
+        stats[conf].retaddr.resize(65536);
+    }
+
+    // The mask may have the directory part, the found names don't
+    TCHAR filePath[MAX_PATH];
+    _tcsncpy_s(filePath, MAX_PATH, sFileMask, _TRUNCATE);
+    LPTSTR pFileName = filePath;
+    for (LPTSTR p = filePath; *p != 0; p++)
+    {
+        if (*p == _T('\\') || *p == _T('/') || *p == _T(':'))
+            pFileName = p + 1;
+    }
+    size_t nameSize = MAX_PATH - (pFileName - filePath);
+
+    int files = 0, runs = 0;
+    uint32_t dropped = 0;
+    WIN32_FIND_DATA findData;
+    HANDLE hFind = ::FindFirstFile(sFileMask, &findData);
+    if (hFind != INVALID_HANDLE_VALUE)
+    {
+        do
+        {
+            if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+                continue;
+            _tcsncpy_s(pFileName, nameSize, findData.cFileName, _TRUNCATE);
+            int fileRuns = Headless_ReadSampleFile(filePath, stats, &dropped);
+            if (fileRuns < 0)
+            {
+                Headless_PrintFormat(_T("Failed to read the samples file: %s\r\n"), filePath);
+                continue;
+            }
+            files++;
+            runs += fileRuns;
+        }
+        while (::FindNextFile(hFind, &findData));
+        ::FindClose(hFind);
+    }
+    if (files == 0)
+    {
+        Headless_PrintFormat(_T("No samples files found: %s\r\n"), sFileMask);
+        return 3;
+    }
+
+    Headless_PrintFormat(_T("Samples: %u files, %d runs, %u samples dropped\r\n"),
+            files, runs, dropped);
+    for (int conf = 0; conf < 2; conf++)
+    {
+        const HeadlessSampleStats& item = stats[conf];
+        if (item.samples == 0)
+            continue;
+
+        int configuration = (conf == 0) ? EMU_CONF_BASIC10 : EMU_CONF_BASIC20;
+        Profiler_LoadSymbols(configuration);
+        Headless_PrintFormat(_T("\r\nConfiguration: %s, %u samples\r\n"),
+                conf == 0 ? _T("BASIC V1.0") : _T("BASIC V2.0"), item.samples);
+        Headless_PrintFormat(_T("  HALT mode %.2f%%, USER mode %.2f%%, WAIT %.2f%%\r\n"),
+                item.haltmode * 100.0 / item.samples, (item.samples - item.haltmode) * 100.0 / item.samples,
+                item.waitmode * 100.0 / item.samples);
+        Headless_Print(_T("  Interrupt nesting:"));
+        for (int level = 0; level <= HEADLESS_SAMPLE_NESTING_MAX; level++)
+        {
+            Headless_PrintFormat(level < HEADLESS_SAMPLE_NESTING_MAX ? _T("  %d: %.2f%%") : _T("  %d+: %.2f%%"),
+                    level, item.nesting[level] * 100.0 / item.samples);
+        }
+        Headless_Print(_T("\r\n  Top addresses:\r\n"));
+        Headless_PrintSampleTop(item.pc, item.samples, 30);
+        Headless_Print(_T("  Top return addresses on the stack:\r\n"));
+        Headless_PrintSampleTop(item.retaddr, item.samples, 15);
+    }
+
+    return 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Code coverage tools, see Coverage.h
+
+// Merge all the coverage files matching the mask into the file.
+// Returns 0 on success, 3 on error.
+int Headless_CoverageMerge(LPCTSTR sFilePath, LPCTSTR sFileMask)
+{
+    // The mask may have the directory part, the found names don't
+    TCHAR filePath[MAX_PATH];
+    _tcsncpy_s(filePath, MAX_PATH, sFileMask, _TRUNCATE);
+    LPTSTR pFileName = filePath;
+    for (LPTSTR p = filePath; *p != 0; p++)
+    {
+        if (*p == _T('\\') || *p == _T('/') || *p == _T(':'))
+            pFileName = p + 1;
+    }
+    size_t nameSize = MAX_PATH - (pFileName - filePath);
+
+    int files = 0;
+    WIN32_FIND_DATA findData;
+    HANDLE hFind = ::FindFirstFile(sFileMask, &findData);
+    if (hFind != INVALID_HANDLE_VALUE)
+    {
+        do
+        {
+            if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+                continue;
+            _tcsncpy_s(pFileName, nameSize, findData.cFileName, _TRUNCATE);
+            CoverageMap map;
+            if (!Coverage_LoadMap(filePath, &map))
+            {
+                Headless_PrintFormat(_T("Failed to read the coverage file: %s\r\n"), filePath);
+                continue;
+            }
+            if (!Coverage_MergeToFile(sFilePath, &map))
+            {
+                Headless_PrintFormat(_T("Failed to merge the coverage file, configuration differs: %s\r\n"), filePath);
+                continue;
+            }
+            files++;
+        }
+        while (::FindNextFile(hFind, &findData));
+        ::FindClose(hFind);
+    }
+    if (files == 0)
+    {
+        Headless_PrintFormat(_T("No coverage files merged: %s\r\n"), sFileMask);
+        return 3;
+    }
+
+    CoverageMap map;
+    CoverageStats stats;
+    Coverage_LoadMap(sFilePath, &map);
+    Coverage_GetStats(&map, &stats);
+    Headless_PrintFormat(_T("Merged %d files to %s: ROM %d words, RAM %d words executed\r\n"),
+            files, sFilePath, stats.romWords, stats.ramWords);
+    return 0;
+}
+
+// Print the ranges of the addresses executed in the first map but not in the second one; returns number of words
+static int Headless_PrintCoverageRanges(const CoverageMap* pMap1, const CoverageMap* pMap2)
+{
+    int words = 0;
+    int start = -1;
+    for (int address = 0; address <= 65536; address += 2)
+    {
+        bool okOnly = address < 65536 &&
+                Coverage_IsExecuted(pMap1, (uint16_t)address) && !Coverage_IsExecuted(pMap2, (uint16_t)address);
+        if (okOnly)
+        {
+            words++;
+            if (start < 0) start = address;
+            continue;
+        }
+        if (start < 0)
+            continue;
+
+        TCHAR symbol[40];
+        symbol[0] = 0;
+        uint16_t offset;
+        LPCTSTR name = Profiler_FindSymbol((uint16_t)start, &offset);
+        if (name != nullptr && offset == 0)
+            _sntprintf(symbol, sizeof(symbol) / sizeof(TCHAR) - 1, _T("%s"), name);
+        else if (name != nullptr)
+            _sntprintf(symbol, sizeof(symbol) / sizeof(TCHAR) - 1, _T("%s+%o"), name, offset);
+        Headless_PrintFormat(_T("  %06o-%06o  %s\r\n"), start, address - 1, symbol);
+        start = -1;
+    }
+    return words;
+}
+
+// Compare two coverage files and print the address ranges executed in one run only.
+// Returns 0 if the maps are the same, 1 if differ, 3 on error.
+int Headless_CoverageDiff(LPCTSTR sFilePath1, LPCTSTR sFilePath2)
+{
+    CoverageMap map1, map2;
+    if (!Coverage_LoadMap(sFilePath1, &map1))
+    {
+        Headless_PrintFormat(_T("Failed to read the coverage file: %s\r\n"), sFilePath1);
+        return 3;
+    }
+    if (!Coverage_LoadMap(sFilePath2, &map2))
+    {
+        Headless_PrintFormat(_T("Failed to read the coverage file: %s\r\n"), sFilePath2);
+        return 3;
+    }
+    if (map1.configuration != map2.configuration)
+    {
+        Headless_Print(_T("Coverage files are made for different configurations\r\n"));
+        return 3;
+    }
+
+    Profiler_LoadSymbols(map1.configuration);
+    CoverageStats stats1, stats2;
+    Coverage_GetStats(&map1, &stats1);
+    Coverage_GetStats(&map2, &stats2);
+    Headless_PrintFormat(_T("1: ROM %d words, RAM %d words executed  %s\r\n"), stats1.romWords, stats1.ramWords, sFilePath1);
+    Headless_PrintFormat(_T("2: ROM %d words, RAM %d words executed  %s\r\n"), stats2.romWords, stats2.ramWords, sFilePath2);
+
+    Headless_Print(_T("Executed in 1 only:\r\n"));
+    int words1 = Headless_PrintCoverageRanges(&map1, &map2);
+    Headless_Print(_T("Executed in 2 only:\r\n"));
+    int words2 = Headless_PrintCoverageRanges(&map2, &map1);
+    Headless_PrintFormat(_T("Words executed in 1 only: %d, in 2 only: %d\r\n"), words1, words2);
+
+    return (words1 == 0 && words2 == 0) ? 0 : 1;
+}
+
+// Write the listing marking the executed and never executed instructions.
+// Returns 0 on success, 3 on error.
+int Headless_CoverageListing(LPCTSTR sFilePath, LPCTSTR sListingPath, LPCTSTR sOutputPath)
+{
+    CoverageMap map;
+    if (!Coverage_LoadMap(sFilePath, &map))
+    {
+        Headless_PrintFormat(_T("Failed to read the coverage file: %s\r\n"), sFilePath);
+        return 3;
+    }
+
+    int executed = 0;
+    int total = Coverage_AnnotateListing(&map, sListingPath, sOutputPath, &executed);
+    if (total < 0)
+    {
+        Headless_PrintFormat(_T("Failed to annotate the listing: %s\r\n"), sListingPath);
+        return 3;
+    }
+
+    Headless_PrintFormat(_T("Instructions executed: %d of %d (%.1f%%), written to %s\r\n"),
+            executed, total, total > 0 ? executed * 100.0 / total : 0.0, sOutputPath);
+    return 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Binary trace decoder, see TraceLog.h
+
+// Returns 0 on success, 3 on error.
+int Headless_DecodeTrace(LPCTSTR sFilePath, LPCTSTR sTextPath)
+{
+    int records = TraceLog_Decode(sFilePath, sTextPath);
+    if (records < 0)
+    {
+        Headless_PrintFormat(_T("Failed to decode the trace file: %s\r\n"), sFilePath);
+        return 3;
+    }
+
+    Headless_PrintFormat(_T("Trace decoded: %d records, written to %s\r\n"), records, sTextPath);
+    return 0;
+}
+
+const LONGLONG HEADLESS_TRACE_LINES_MAX = 1000;  // Records to print, the rest are counted only
+
+// Print the record matched: cycle, frame, and the text trace line
+static bool CALLBACK Headless_TraceQueryPrint(const CTraceRecord& record, uint32_t frame, void* pParam)
+{
+    LONGLONG* pLines = static_cast<LONGLONG*>(pParam);
+    if (++*pLines > HEADLESS_TRACE_LINES_MAX)
+        return true;
+
+    TCHAR buffer[80];
+    if (record.type == TRACE_RECORD_FRAME)
+        _sntprintf(buffer, sizeof(buffer) / sizeof(TCHAR) - 1, _T("FRAME %u"), frame);
+    else if (!TraceLog_FormatRecord(record, buffer, sizeof(buffer) / sizeof(TCHAR)))
+        _sntprintf(buffer, sizeof(buffer) / sizeof(TCHAR) - 1, _T("CPU interrupt vector=%06o PC=%06o PSW=%06o"),
+                record.words[0], record.reg[7], record.psw);  // IOT/EMT/TRAP vector, skipped by the decoder
+    Headless_PrintFormat(_T("%12I64u %7u  %s\r\n"), TraceLog_GetRecordCycle(record), frame, buffer);
+    return true;
+}
+
+struct HeadlessOpcodeCount
+{
+    uint64_t count;
+    LPCTSTR instr;  // Mnemonic
+};
+
+static bool Headless_OpcodeCountCompare(const HeadlessOpcodeCount& item1, const HeadlessOpcodeCount& item2)
+{
+    if (item1.count != item2.count)
+        return item1.count > item2.count;
+    return _tcscmp(item1.instr, item2.instr) < 0;
+}
+
+// Print the instruction counts by mnemonic and the record counts by class
+static void Headless_PrintTraceStats(const TraceLogCounts& counts)
+{
+    static LPCTSTR classNames[TRACELOG_CLASS_COUNT] =
+    {
+        _T("move"), _T("branch"), _T("jump"), _T("trap"), _T("other"), _T("interrupt"), _T("write"), _T("frame")
+    };
+    uint64_t instructions = 0;
+    Headless_Print(_T("Records by class:\r\n"));
+    for (int bit = 0; bit < TRACELOG_CLASS_COUNT; bit++)
+    {
+        Headless_PrintFormat(_T("  %-10s %12I64u\r\n"), classNames[bit], counts.classes[bit]);
+        if ((1 << bit) & TRACELOG_CLASS_INSTRUCTION)
+            instructions += counts.classes[bit];
+    }
+    if (instructions == 0)
+        return;
+
+    std::vector<HeadlessOpcodeCount> items;
+    for (int group = 0; group < TRACELOG_OPCODE_GROUPS; group++)
+    {
+        if (counts.opcodeGroups[group] == 0)
+            continue;
+        HeadlessOpcodeCount item;
+        item.count = counts.opcodeGroups[group];
+        item.instr = TraceLog_GetOpcodeGroupName(group);
+        items.push_back(item);
+    }
+    std::sort(items.begin(), items.end(), Headless_OpcodeCountCompare);
+
+    Headless_Print(_T("Instructions by mnemonic:\r\n"));
+    for (size_t i = 0; i < items.size(); i++)
+    {
+        Headless_PrintFormat(_T("  %-7s %12I64u %6.2f%%\r\n"),
+                items[i].instr, items[i].count, items[i].count * 100.0 / instructions);
+    }
+}
+
+// Run the query on the binary trace file, print the records matched or the statistics on them.
+// Returns 0 on success, 1 if nothing matched, 3 on error.
+int Headless_TraceQuery(LPCTSTR sFilePath, LPCTSTR sQuery, bool okStat)
+{
+    TraceLogQuery query;
+    if (!TraceLog_ParseQuery(sQuery, &query))
+    {
+        Headless_PrintFormat(_T("Wrong trace query: %s\r\n"), sQuery);
+        return 3;
+    }
+    HTRACELOGFILE tracelogfile = TraceLog_Open(sFilePath);
+    if (tracelogfile == INVALID_HANDLE_VALUE)
+    {
+        Headless_PrintFormat(_T("Failed to open the trace file: %s\r\n"), sFilePath);
+        return 3;
+    }
+
+    LARGE_INTEGER nPerformanceFrequency, nStartTime, nFinishTime;
+    ::QueryPerformanceFrequency(&nPerformanceFrequency);
+    ::QueryPerformanceCounter(&nStartTime);
+
+    LONGLONG lines = 0;
+    TraceLogCounts counts;
+    LONGLONG matched = okStat ?
+            TraceLog_CountQuery(tracelogfile, query, &counts) :
+            TraceLog_RunQuery(tracelogfile, query, Headless_TraceQueryPrint, &lines);
+    int blockCount = TraceLog_GetBlockCount(tracelogfile);
+    TraceLog_Close(tracelogfile);
+    if (matched < 0)
+    {
+        Headless_PrintFormat(_T("Failed to read the trace file: %s\r\n"), sFilePath);
+        return 3;
+    }
+
+    ::QueryPerformanceCounter(&nFinishTime);
+    LONGLONG nTimeElapsed = (nFinishTime.QuadPart - nStartTime.QuadPart) * 1000 / nPerformanceFrequency.QuadPart;
+
+    if (okStat)
+        Headless_PrintTraceStats(counts);
+    else if (lines > HEADLESS_TRACE_LINES_MAX)
+        Headless_PrintFormat(_T("... %I64d more records\r\n"), lines - HEADLESS_TRACE_LINES_MAX);
+    Headless_PrintFormat(_T("Records matched: %I64d, %d blocks in the file, time: %I64d ms\r\n"),
+            matched, blockCount, nTimeElapsed);
+    return (matched > 0) ? 0 : 1;
+}
+
+
+//////////////////////////////////////////////////////////////////////
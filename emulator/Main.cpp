@@ -20,6 +20,10 @@ MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
 
 #include "Main.h"
 #include "Emulator.h"
+#include "Profiler.h"
+#include "Coverage.h"
+#include "PerfCounters.h"
+#include "FrameTiming.h"
 #include "Dialogs.h"
 #include "Views.h"
 #include "util/BitmapFile.h"
@@ -73,6 +77,13 @@ int APIENTRY _tWinMain(
     if (! InitInstance(hInstance, nCmdShow))
         return FALSE;
 
+    if (Option_Headless)
+    {
+        int result = Headless_Run();
+        DoneInstance();
+        return result;
+    }
+
     HACCEL hAccelTable = ::LoadAccelerators(hInstance, MAKEINTRESOURCE(IDC_APPLICATION));
 
     LARGE_INTEGER nPerformanceFrequency;
@@ -96,7 +107,9 @@ int APIENTRY _tWinMain(
                     ::PostMessage(g_hwnd, WM_COMMAND, ID_VIEW_DEBUG, 0);
             }
 
+            LONGLONG timeStart = FrameTiming_GetTime();
             ScreenView_RedrawScreen();
+            FrameTiming_Add(FRAMETIMING_SCREEN, timeStart);
         }
 
         // Process all queue
@@ -112,6 +125,15 @@ int APIENTRY _tWinMain(
             ::DispatchMessage(&msg);
         }
 
+        // Report the background state save result
+        int saveStatus = Emulator_GetSaveImageStatus();
+        if (saveStatus == EMUSAVE_DONE || saveStatus == EMUSAVE_FAILED)
+        {
+            Emulator_ClearSaveImageStatus();
+            MainWindow_SetStatusbarText(StatusbarPartMessage,
+                    saveStatus == EMUSAVE_DONE ? _T("State saved") : _T("Failed to save the state"));
+        }
+
         if (g_okEmulatorRunning && !Settings_GetSound())
         {
             if (Settings_GetRealSpeed() == 0)
@@ -179,17 +201,49 @@ BOOL InitInstance(HINSTANCE /*hInstance*/, int /*nCmdShow*/)
     Settings_Init();
 
     ParseCommandLine();  // Override settings by command-line option if needed
+    if (Option_Headless)
+        Headless_InitOutput();
 
     if (!Emulator_Init())
         return FALSE;
 
+    // Code coverage starts before the first boot, to mark the boot code too
+    if (Option_Coverage[0] != 0)
+    {
+        Coverage_SetAutoSaveFile(Option_Coverage);
+        Coverage_Start();
+    }
+    if (Option_Metrics[0] != 0)
+    {
+        PerfCounters_SetDumpFile(Option_Metrics, 1000);
+        PerfCounters_Start();
+    }
+
     WORD conf = (WORD) Settings_GetConfiguration();
     if (conf == 0) conf = EMU_CONF_BASIC10;
     if (!Emulator_InitConfiguration(conf))
         return FALSE;
 
+    if (Option_HashLog[0] != 0 && !Emulator_StartHashLog(Option_HashLog))
+        AlertWarning(_T("Failed to create the hash log file."));
+
+    Emulator_SetAutoSave(Settings_GetAutoSave());
+
+    // Sampling profiler is on by default, it is cheap and the samples file is limited; /sampleint:0 turns it off
+    DWORD dwSampleInterval = Settings_GetSampleInterval();
+    bool okToolMode = Option_SampleReport[0] != 0 || Option_HashCompare[0][0] != 0 ||
+            Option_CoverageMerge[0][0] != 0 || Option_CoverageDiff[0][0] != 0 || Option_CoverageListing[0][0] != 0 ||
+            Option_TraceDecode[0][0] != 0 || Option_TraceQuery[0][0] != 0;
+    if (dwSampleInterval > 0 && !okToolMode &&
+        !Profiler_StartSampling(Option_Samples[0] != 0 ? Option_Samples : FILENAME_SAMPLES, (int)dwSampleInterval))
+        AlertWarning(_T("Failed to create the samples file."));
+
+    if (Option_Headless)
+        return TRUE;  // No window, no sound, no run-ahead
+
     Emulator_SetSound(Settings_GetSound() != 0);
     Emulator_SetSpeed(Settings_GetRealSpeed());
+    Emulator_SetRunAhead(Settings_GetRunAhead());
 
     if (!CreateMainWindow())
         return FALSE;
@@ -207,6 +261,10 @@ void DoneInstance()
 
     BitmapFile_Done();
 
+#if !defined(PRODUCT)
+    DebugLogDone();
+#endif
+
     Settings_Done();
 }
 
@@ -251,6 +309,127 @@ void ParseCommandLine()
         {
             Settings_SetSound(FALSE);
         }
+        else if (_tcslen(arg) >= 9 && _tcsncmp(arg, _T("/runahead"), 9) == 0)  // "/runahead" or "/runaheadN", N=0..3
+        {
+            WORD frames = 1;
+            if (_tcslen(arg) >= 10 && arg[9] >= _T('0') && arg[9] <= _T('3'))
+                frames = arg[9] - _T('0');
+            Settings_SetRunAhead(frames);
+        }
+        else if (_tcscmp(arg, _T("/norunahead")) == 0)
+        {
+            Settings_SetRunAhead(0);
+        }
+        else if (_tcslen(arg) > 10 && _tcsncmp(arg, _T("/autosave:"), 10) == 0)  // "/autosave:N", N seconds, 0 = off
+        {
+            Settings_SetAutoSave((WORD)_tcstol(arg + 10, NULL, 10));
+        }
+        else if (_tcscmp(arg, _T("/headless")) == 0)
+        {
+            Option_Headless = true;
+        }
+        else if (_tcslen(arg) > 8 && _tcsncmp(arg, _T("/frames:"), 8) == 0)  // "/frames:N"
+        {
+            Option_Frames = _tcstol(arg + 8, NULL, 10);
+        }
+        else if (_tcslen(arg) > 7 && _tcsncmp(arg, _T("/movie:"), 7) == 0)  // "/movie:filePath"
+        {
+            _tcsncpy_s(Option_PlayMovie, MAX_PATH, arg + 7, _TRUNCATE);
+        }
+        else if (_tcslen(arg) > 8 && _tcsncmp(arg, _T("/record:"), 8) == 0)  // "/record:filePath"
+        {
+            _tcsncpy_s(Option_RecordMovie, MAX_PATH, arg + 8, _TRUNCATE);
+        }
+        else if (_tcslen(arg) > 9 && _tcsncmp(arg, _T("/hashlog:"), 9) == 0)  // "/hashlog:filePath"
+        {
+            _tcsncpy_s(Option_HashLog, MAX_PATH, arg + 9, _TRUNCATE);
+        }
+        else if (_tcscmp(arg, _T("/hashcmp")) == 0 && curargn + 2 < argnum)  // "/hashcmp filePath1 filePath2"
+        {
+            _tcsncpy_s(Option_HashCompare[0], MAX_PATH, args[curargn + 1], _TRUNCATE);
+            _tcsncpy_s(Option_HashCompare[1], MAX_PATH, args[curargn + 2], _TRUNCATE);
+            curargn += 2;
+            Option_Headless = true;
+        }
+        else if (_tcslen(arg) > 8 && _tcsncmp(arg, _T("/bisect:"), 8) == 0)  // "/bisect:variant"
+        {
+            _tcsncpy_s(Option_Bisect, 16, arg + 8, _TRUNCATE);
+            Option_Headless = true;
+        }
+        else if (_tcscmp(arg, _T("/quickflush")) == 0)
+        {
+            Option_QuickFlush = true;
+        }
+        else if (_tcscmp(arg, _T("/coldboot")) == 0)
+        {
+            Option_ColdBoot = true;
+        }
+        else if (_tcscmp(arg, _T("/bootcache")) == 0)
+        {
+            Settings_SetBootCache(TRUE);
+        }
+        else if (_tcscmp(arg, _T("/nobootcache")) == 0)
+        {
+            Settings_SetBootCache(FALSE);
+        }
+        else if (_tcslen(arg) > 11 && _tcsncmp(arg, _T("/sampleint:"), 11) == 0)  // "/sampleint:N", N ticks, 0 = off
+        {
+            Settings_SetSampleInterval((DWORD)_tcstoul(arg + 11, NULL, 10));
+        }
+        else if (_tcslen(arg) > 9 && _tcsncmp(arg, _T("/samples:"), 9) == 0)  // "/samples:filePath"
+        {
+            _tcsncpy_s(Option_Samples, MAX_PATH, arg + 9, _TRUNCATE);
+        }
+        else if (_tcslen(arg) > 14 && _tcsncmp(arg, _T("/samplereport:"), 14) == 0)  // "/samplereport:fileMask"
+        {
+            _tcsncpy_s(Option_SampleReport, MAX_PATH, arg + 14, _TRUNCATE);
+            Option_Headless = true;
+        }
+        else if (_tcslen(arg) > 10 && _tcsncmp(arg, _T("/coverage:"), 10) == 0)  // "/coverage:filePath"
+        {
+            _tcsncpy_s(Option_Coverage, MAX_PATH, arg + 10, _TRUNCATE);
+        }
+        else if (_tcslen(arg) > 9 && _tcsncmp(arg, _T("/metrics:"), 9) == 0)  // "/metrics:filePath"
+        {
+            _tcsncpy_s(Option_Metrics, MAX_PATH, arg + 9, _TRUNCATE);
+        }
+        else if (_tcscmp(arg, _T("/covmerge")) == 0 && curargn + 2 < argnum)  // "/covmerge filePath fileMask"
+        {
+            _tcsncpy_s(Option_CoverageMerge[0], MAX_PATH, args[curargn + 1], _TRUNCATE);
+            _tcsncpy_s(Option_CoverageMerge[1], MAX_PATH, args[curargn + 2], _TRUNCATE);
+            curargn += 2;
+            Option_Headless = true;
+        }
+        else if (_tcscmp(arg, _T("/covdiff")) == 0 && curargn + 2 < argnum)  // "/covdiff filePath1 filePath2"
+        {
+            _tcsncpy_s(Option_CoverageDiff[0], MAX_PATH, args[curargn + 1], _TRUNCATE);
+            _tcsncpy_s(Option_CoverageDiff[1], MAX_PATH, args[curargn + 2], _TRUNCATE);
+            curargn += 2;
+            Option_Headless = true;
+        }
+        else if (_tcscmp(arg, _T("/covlist")) == 0 && curargn + 3 < argnum)  // "/covlist filePath listingPath outputPath"
+        {
+            for (int i = 0; i < 3; i++)
+                _tcsncpy_s(Option_CoverageListing[i], MAX_PATH, args[curargn + 1 + i], _TRUNCATE);
+            curargn += 3;
+            Option_Headless = true;
+        }
+        else if (_tcscmp(arg, _T("/tracedecode")) == 0 && curargn + 2 < argnum)  // "/tracedecode filePath textPath"
+        {
+            _tcsncpy_s(Option_TraceDecode[0], MAX_PATH, args[curargn + 1], _TRUNCATE);
+            _tcsncpy_s(Option_TraceDecode[1], MAX_PATH, args[curargn + 2], _TRUNCATE);
+            curargn += 2;
+            Option_Headless = true;
+        }
+        else if ((_tcscmp(arg, _T("/tracequery")) == 0 || _tcscmp(arg, _T("/tracestat")) == 0) &&
+                 curargn + 2 < argnum)  // "/tracequery filePath query", "/tracestat filePath query"
+        {
+            _tcsncpy_s(Option_TraceQuery[0], MAX_PATH, args[curargn + 1], _TRUNCATE);
+            _tcsncpy_s(Option_TraceQuery[1], MAX_PATH, args[curargn + 2], _TRUNCATE);
+            Option_TraceQueryStat = _tcscmp(arg, _T("/tracestat")) == 0;
+            curargn += 2;
+            Option_Headless = true;
+        }
         else if (_tcslen(arg) > 7 && _tcsncmp(arg, _T("/smp"), 4) == 0)  // "/smpN:filePath", N=0..1
         {
             if (arg[4] >= _T('0') && arg[4] <= _T('1') && arg[5] == ':')
@@ -115,6 +115,7 @@ enum ColorIndices
 
 void Settings_Init();
 void Settings_Done();
+void Settings_GetFilePath(LPCTSTR sFileName, LPTSTR sFilePath);  // The file in the folder of the .ini file; MAX_PATH buffer
 BOOL Settings_GetWindowRect(RECT * pRect);
 void Settings_SetWindowRect(const RECT * pRect);
 void Settings_SetWindowMaximized(BOOL flag);
@@ -145,6 +146,14 @@ void Settings_SetAutostart(BOOL flag);
 BOOL Settings_GetAutostart();
 void Settings_SetRealSpeed(WORD speed);
 WORD Settings_GetRealSpeed();
+void Settings_SetRunAhead(WORD frames);
+WORD Settings_GetRunAhead();
+void Settings_SetAutoSave(WORD seconds);
+WORD Settings_GetAutoSave();
+void Settings_SetBootCache(BOOL flag);
+BOOL Settings_GetBootCache();
+void Settings_SetSampleInterval(DWORD ticks);
+DWORD Settings_GetSampleInterval();
 void Settings_SetSound(BOOL flag);
 BOOL Settings_GetSound();
 void Settings_SetSoundVolume(WORD value);
@@ -164,10 +173,46 @@ COLORREF Settings_GetDefaultColor(ColorIndices colorIndex);
 void Settings_SetColor(ColorIndices colorIndex, COLORREF color);
 
 
+//////////////////////////////////////////////////////////////////////
+// Headless mode
+
+void Headless_InitOutput();  // Find the console to write to, called before the emulator init to report the errors
+int  Headless_Run();  // Returns the process exit code
+void Headless_Print(LPCTSTR message);
+void Headless_PrintFormat(LPCTSTR pszFormat, ...);
+int  Headless_CompareHashLogs(LPCTSTR sFilePath1, LPCTSTR sFilePath2);
+int  Headless_Bisect(LPCTSTR sVariant);
+int  Headless_SampleReport(LPCTSTR sFileMask);
+int  Headless_CoverageMerge(LPCTSTR sFilePath, LPCTSTR sFileMask);
+int  Headless_CoverageDiff(LPCTSTR sFilePath1, LPCTSTR sFilePath2);
+int  Headless_CoverageListing(LPCTSTR sFilePath, LPCTSTR sListingPath, LPCTSTR sOutputPath);
+int  Headless_DecodeTrace(LPCTSTR sFilePath, LPCTSTR sTextPath);
+int  Headless_TraceQuery(LPCTSTR sFilePath, LPCTSTR sQuery, bool okStat);
+
+
 //////////////////////////////////////////////////////////////////////
 // Options
 
 extern int Option_AutoBoot;  // -1 = no autoboot, 0 = SMP0, 1 = SMP1
+extern bool Option_Headless;  // Run with no window, at maximum speed
+extern long Option_Frames;  // Frames to run in headless mode, 0 = until the movie ends
+extern TCHAR Option_PlayMovie[MAX_PATH];  // Movie to play on start
+extern TCHAR Option_RecordMovie[MAX_PATH];  // Movie to record from start
+extern TCHAR Option_HashLog[MAX_PATH];  // Hash log file to write
+extern TCHAR Option_HashCompare[2][MAX_PATH];  // Two hash log files to compare
+extern TCHAR Option_Bisect[16];  // Bisector variant: "none", "instrumented"
+extern bool Option_QuickFlush;  // Write quick-save slots to quickN.mk90st files on exit
+extern bool Option_ColdBoot;  // Do not use the boot cache, always boot from the ROM
+extern TCHAR Option_Samples[MAX_PATH];  // Samples file for the sampling profiler
+extern TCHAR Option_SampleReport[MAX_PATH];  // Samples files mask to make the report on
+extern TCHAR Option_Coverage[MAX_PATH];  // Coverage file to merge the executed addresses into
+extern TCHAR Option_Metrics[MAX_PATH];  // Performance counters file to write every second, Prometheus format
+extern TCHAR Option_CoverageMerge[2][MAX_PATH];  // Coverage file to write, coverage files mask to merge
+extern TCHAR Option_CoverageDiff[2][MAX_PATH];  // Two coverage files to compare
+extern TCHAR Option_CoverageListing[3][MAX_PATH];  // Coverage file, listing file, annotated listing to write
+extern TCHAR Option_TraceDecode[2][MAX_PATH];  // Binary trace file to decode, text file to write
+extern TCHAR Option_TraceQuery[2][MAX_PATH];  // Binary trace file, query to run, see TraceLog_ParseQuery()
+extern bool Option_TraceQueryStat;  // Print the opcode statistics instead of the records matched
 
 
 //////////////////////////////////////////////////////////////////////
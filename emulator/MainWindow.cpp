@@ -20,6 +20,7 @@ MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
 #include "Main.h"
 #include "emubase\Emubase.h"
 #include "Emulator.h"
+#include "Movie.h"
 #include "Dialogs.h"
 #include "Views.h"
 #include "ToolWindow.h"
@@ -59,6 +60,9 @@ void MainWindow_DoEmulatorSound();
 void MainWindow_DoEmulatorSmp(int slot);
 void MainWindow_DoFileSaveState();
 void MainWindow_DoFileLoadState();
+void MainWindow_DoFileRecordMovie();
+void MainWindow_DoFilePlayMovie();
+void MainWindow_DoFileStopMovie();
 void MainWindow_DoEmulatorConf(uint16_t configuration);
 void MainWindow_DoFileScreenshot();
 void MainWindow_DoFileScreenshotToClipboard();
@@ -143,8 +147,15 @@ BOOL CreateMainWindow()
     MainWindow_UpdateMenu();
     MainWindow_UpdateWindowTitle();
 
+    // Movie options
+    if (Option_RecordMovie[0] != 0 && !Movie_StartRecording(Option_RecordMovie))
+        AlertWarning(_T("Failed to start the movie recording."));
+    if (Option_PlayMovie[0] != 0 && !Movie_StartPlayback(Option_PlayMovie))
+        AlertWarning(_T("Failed to load the movie file."));
+    MainWindow_UpdateMenu();
+
     // Autostart
-    if (Settings_GetAutostart() || Option_AutoBoot >= 0)
+    if (Settings_GetAutostart() || Option_AutoBoot >= 0 || Movie_IsPlaying())
         ::PostMessage(g_hwnd, WM_COMMAND, ID_EMULATOR_RUN, 0);
 
     return TRUE;
@@ -241,7 +252,7 @@ void MainWindow_RestoreSettings()
         Settings_GetSmpFilePath(slot, buf);
         if (buf[0] != _T('\0'))
         {
-            if (! g_pBoard->AttachSmpImage(slot, buf))
+            if (! Emulator_AttachSmpImage(slot, buf))
                 Settings_SetSmpFilePath(slot, NULL);
         }
     }
@@ -616,6 +627,11 @@ void MainWindow_UpdateMenu()
     SendMessage(m_hwndToolbar, TB_CHECKBUTTON, ID_EMULATOR_RUN, (g_okEmulatorRunning ? 1 : 0));
     //MainWindow_SetToolbarImage(ID_EMULATOR_RUN, g_okEmulatorRunning ? ToolbarImageRun : ToolbarImagePause);
 
+    // File menu
+    CheckMenuItem(hMenu, ID_FILE_RECORDMOVIE, (Movie_IsRecording() ? MF_CHECKED : MF_UNCHECKED));
+    CheckMenuItem(hMenu, ID_FILE_PLAYMOVIE, (Movie_IsPlaying() ? MF_CHECKED : MF_UNCHECKED));
+    EnableMenuItem(hMenu, ID_FILE_STOPMOVIE, (Movie_IsRecording() || Movie_IsPlaying() ? MF_ENABLED : MF_DISABLED));
+
     // View menu
     CheckMenuItem(hMenu, ID_VIEW_TOOLBAR, (Settings_GetToolbar() ? MF_CHECKED : MF_UNCHECKED));
     // View|Screen Mode
@@ -781,6 +797,15 @@ bool MainWindow_DoCommand(int commandId)
     case ID_FILE_SAVESTATE:
         MainWindow_DoFileSaveState();
         break;
+    case ID_FILE_RECORDMOVIE:
+        MainWindow_DoFileRecordMovie();
+        break;
+    case ID_FILE_PLAYMOVIE:
+        MainWindow_DoFilePlayMovie();
+        break;
+    case ID_FILE_STOPMOVIE:
+        MainWindow_DoFileStopMovie();
+        break;
     case ID_FILE_SCREENSHOT:
         MainWindow_DoFileScreenshot();
         break;
@@ -913,12 +938,61 @@ void MainWindow_DoFileSaveState()
             bufFileName);
     if (! okResult) return;
 
-    if (!Emulator_SaveImage(bufFileName))
+    // Written in background, the result goes to the status bar
+    if (!Emulator_SaveImageAsync(bufFileName))
     {
         AlertWarning(_T("Failed to save image file."));
     }
 }
 
+void MainWindow_DoFileRecordMovie()
+{
+    TCHAR bufFileName[MAX_PATH];
+    BOOL okResult = ShowSaveDialog(g_hwnd,
+            _T("Record movie as"),
+            _T("MK90 movies (*.mk90mov)\0*.mk90mov\0All Files (*.*)\0*.*\0\0"),
+            _T("mk90mov"),
+            bufFileName);
+    if (! okResult) return;
+
+    if (!Movie_StartRecording(bufFileName))
+    {
+        AlertWarning(_T("Failed to create movie file."));
+    }
+
+    MainWindow_UpdateMenu();
+}
+
+void MainWindow_DoFilePlayMovie()
+{
+    TCHAR bufFileName[MAX_PATH];
+    BOOL okResult = ShowOpenDialog(g_hwnd,
+            _T("Open movie to play"),
+            _T("MK90 movies (*.mk90mov)\0*.mk90mov\0All Files (*.*)\0*.*\0\0"),
+            bufFileName);
+    if (!okResult) return;
+
+    if (!Movie_StartPlayback(bufFileName))
+    {
+        AlertWarning(_T("Failed to load movie file."));
+        MainWindow_UpdateMenu();
+        return;
+    }
+
+    MainWindow_UpdateAllViews();
+    if (!g_okEmulatorRunning)
+        Emulator_Start();
+    else
+        MainWindow_UpdateMenu();
+}
+
+void MainWindow_DoFileStopMovie()
+{
+    Movie_Stop();
+
+    MainWindow_UpdateMenu();
+}
+
 void MainWindow_DoFileScreenshot()
 {
     TCHAR bufFileName[MAX_PATH];
@@ -1000,7 +1074,7 @@ void MainWindow_DoEmulatorSmp(int slot)
     BOOL okLoaded = g_pBoard->IsSmpImageAttached(slot);
     if (okLoaded)
     {
-        g_pBoard->DetachSmpImage(slot);
+        Emulator_DetachSmpImage(slot);
         Settings_SetSmpFilePath(slot, NULL);
     }
     else
@@ -1013,7 +1087,7 @@ void MainWindow_DoEmulatorSmp(int slot)
                 bufFileName);
         if (!okResult) return;
 
-        if (!g_pBoard->AttachSmpImage(slot, bufFileName))
+        if (!Emulator_AttachSmpImage(slot, bufFileName))
         {
             AlertWarning(_T("Failed to attach the SMP image."));
             return;
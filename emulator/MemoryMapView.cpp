@@ -17,6 +17,7 @@ MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
 #include "ToolWindow.h"
 #include "Dialogs.h"
 #include "Emulator.h"
+#include "Profiler.h"
 
 //////////////////////////////////////////////////////////////////////
 
@@ -410,6 +411,12 @@ void MemoryMapView_PrepareBitmap()
             pBits++;
         }
     }
+
+    // Memory access heatmap below the memory map, when the counters are on
+    // Made right in the bitmap: bottom-up, so the first row is the last one in memory
+    uint32_t* pHeatmap = (uint32_t*)(m_pMemoryMap_bits + (256 - 1) * 256);
+    if (!Profiler_IsMemoryCounting() || !Profiler_GetMemoryHeatmap(pHeatmap, -256))
+        memset(m_pMemoryMap_bits, 0, 256 * 256 * sizeof(DWORD));
 }
 
 
@@ -0,0 +1,345 @@
+﻿/*  This file is part of MK90BTL.
+    MK90BTL is free software: you can redistribute it and/or modify it under the terms
+of the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+    MK90BTL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License along with
+MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
+
+// Movie.cpp
+
+#include "stdafx.h"
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+#include <Share.h>
+#include "Main.h"
+#include "Emulator.h"
+#include "Movie.h"
+#include "emubase\Emubase.h"
+
+//////////////////////////////////////////////////////////////////////
+//
+// Movie file format:
+//   40 bytes       Header, see MovieHeader
+//   N bytes        Machine state at the movie start, stateSize bytes: image v2 chunks without the ROM,
+//                  see Emulator_SaveStateChunks(); the ROM is checked by the ROM hash
+//   8 bytes        Event, see MovieEvent
+//   ...            More events, in frame order
+// SMP attach event is followed by the SMP image data, param2 bytes.
+
+#define MK90MOVIE_HEADER1 0x30394B4D  // "MK90"
+#define MK90MOVIE_HEADER2 0x21564F4D  // "MOV!"
+#define MK90MOVIE_VERSION 0x00020000  // 2.0
+
+struct MovieHeader
+{
+    uint32_t header1;
+    uint32_t header2;
+    uint32_t version;
+    uint32_t configuration;
+    uint32_t stateSize;
+    uint32_t frameCount;  // Filled when the recording stopped; 0 = unknown, play until the last event
+    uint32_t eventCount;
+    uint32_t reserved;
+    uint64_t romHash;  // CMotherboard::GetRomHash() at the movie start
+};
+
+const size_t MOVIE_STATE_MAXSIZE = 2 * 65536;  // More than enough for the chunks, even not compressed
+
+enum MovieEventType
+{
+    MOVIE_EVENT_KEYBOARD = 1,   // param1 = scan code, param2 = 1 pressed / 0 released
+    MOVIE_EVENT_RESET = 2,
+    MOVIE_EVENT_SMPATTACH = 3,  // param1 = slot, param2 = image size; image data follows
+    MOVIE_EVENT_SMPDETACH = 4,  // param1 = slot
+};
+
+struct MovieEvent
+{
+    uint32_t frame;  // Frame number from the movie start, the event applied before the frame
+    uint8_t  type;   // See MovieEventType
+    uint8_t  param1;
+    uint16_t param2;
+};
+
+const size_t MOVIE_SMPIMAGE_MAXSIZE = 10240;
+
+struct MoviePlayEvent
+{
+    MovieEvent event;
+    size_t dataOffset;  // SMP image data offset in m_MovieEventData
+};
+
+bool operator<(const MoviePlayEvent& item, uint32_t frame) { return item.event.frame < frame; }
+
+
+FILE* m_fpMovieFile = nullptr;  // The movie being recorded
+bool m_okMovieRecording = false;
+bool m_okMoviePlaying = false;
+uint32_t m_nMovieFrame = 0;  // Current frame number from the movie start
+uint32_t m_nMovieFrameCount = 0;  // Frames in the movie being played
+uint32_t m_nMovieEventCount = 0;  // Events recorded
+std::vector<MoviePlayEvent> m_MovieEvents;  // Events of the movie being played, sorted by frame
+std::vector<uint8_t> m_MovieEventData;  // SMP images for the attach events
+size_t m_nMovieNextEvent = 0;  // Index of the next event to play
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+bool Movie_IsRecording() { return m_okMovieRecording; }
+bool Movie_IsPlaying() { return m_okMoviePlaying; }
+uint32_t Movie_GetFrame() { return m_nMovieFrame; }
+uint32_t Movie_GetFrameCount() { return m_nMovieFrameCount; }
+
+bool Movie_StartRecording(LPCTSTR sFilePath)
+{
+    Movie_Stop();
+
+    FILE* fpFile = ::_tfsopen(sFilePath, _T("w+b"), _SH_DENYWR);
+    if (fpFile == nullptr)
+        return false;
+
+    MovieHeader header;
+    ::memset(&header, 0, sizeof(header));
+    header.header1 = MK90MOVIE_HEADER1;
+    header.header2 = MK90MOVIE_HEADER2;
+    header.version = MK90MOVIE_VERSION;
+    header.configuration = (uint32_t)g_nEmulatorConfiguration;
+    header.romHash = g_pBoard->GetRomHash();
+
+    // Header, then the state chunks, then the header again with the state size
+    bool okWritten =
+        ::fwrite(&header, 1, sizeof(header), fpFile) == sizeof(header) &&
+        Emulator_SaveStateChunks(fpFile);
+    if (okWritten)
+    {
+        header.stateSize = static_cast<uint32_t>(::ftell(fpFile) - sizeof(header));
+        okWritten =
+            ::fseek(fpFile, 0, SEEK_SET) == 0 &&
+            ::fwrite(&header, 1, sizeof(header), fpFile) == sizeof(header) &&
+            ::fseek(fpFile, 0, SEEK_END) == 0;
+    }
+    if (!okWritten)
+    {
+        ::fclose(fpFile);
+        return false;
+    }
+
+    m_fpMovieFile = fpFile;
+    m_okMovieRecording = true;
+    m_nMovieFrame = 0;
+    m_nMovieEventCount = 0;
+
+    // The snapshot has no SMP images, so record them as the very first events
+    for (int slot = 0; slot < 2; slot++)
+        Movie_RecordSmpAttach(slot);
+
+    return m_okMovieRecording;
+}
+
+// Read all the events into memory
+bool Movie_ReadEvents(FILE* fpFile)
+{
+    m_MovieEvents.clear();
+    m_MovieEventData.clear();
+
+    MoviePlayEvent item;
+    while (::fread(&item.event, 1, sizeof(MovieEvent), fpFile) == sizeof(MovieEvent))
+    {
+        item.dataOffset = m_MovieEventData.size();
+        if (item.event.type == MOVIE_EVENT_SMPATTACH)
+        {
+            size_t size = item.event.param2;
+            if (size > MOVIE_SMPIMAGE_MAXSIZE)
+                return false;
+            m_MovieEventData.resize(item.dataOffset + size);
+            if (::fread(m_MovieEventData.data() + item.dataOffset, 1, size, fpFile) != size)
+                return false;
+        }
+        if (!m_MovieEvents.empty() && item.event.frame < m_MovieEvents.back().event.frame)
+            return false;  // Events should go in frame order
+
+        m_MovieEvents.push_back(item);
+    }
+
+    return true;
+}
+
+bool Movie_StartPlayback(LPCTSTR sFilePath)
+{
+    Movie_Stop();
+
+    FILE* fpFile = ::_tfsopen(sFilePath, _T("rb"), _SH_DENYWR);
+    if (fpFile == nullptr)
+        return false;
+
+    MovieHeader header;
+    if (::fread(&header, 1, sizeof(header), fpFile) != sizeof(header) ||
+        header.header1 != MK90MOVIE_HEADER1 || header.header2 != MK90MOVIE_HEADER2 ||
+        header.version != MK90MOVIE_VERSION || header.stateSize > MOVIE_STATE_MAXSIZE)
+    {
+        ::fclose(fpFile);
+        return false;
+    }
+
+    std::vector<uint8_t> state(header.stateSize);
+    if (::fread(state.data(), 1, state.size(), fpFile) != state.size() ||
+        !Movie_ReadEvents(fpFile))
+    {
+        ::fclose(fpFile);
+        return false;
+    }
+    ::fclose(fpFile);
+
+    // Prepare the machine: ROM for the configuration, the same ROM as recorded, no SMPs, then the start state
+    if (g_nEmulatorConfiguration != (int)header.configuration &&
+        !Emulator_InitConfiguration((uint16_t)header.configuration))
+        return false;
+    if (g_pBoard->GetRomHash() != header.romHash)
+        return false;  // Another ROM file, the playback would go another way
+    g_pBoard->DetachSmpImage(0);
+    g_pBoard->DetachSmpImage(1);
+    if (!Emulator_LoadStateChunks(state.data(), state.size()))
+        return false;
+
+    m_okMoviePlaying = true;
+    m_nMovieFrame = 0;
+    m_nMovieFrameCount = header.frameCount;
+    m_nMovieNextEvent = 0;
+
+    return true;
+}
+
+void Movie_Stop()
+{
+    if (m_okMoviePlaying)
+    {
+        m_okMoviePlaying = false;
+        m_MovieEvents.clear();
+        m_MovieEventData.clear();
+    }
+
+    if (m_okMovieRecording)
+    {
+        // Update the counters in the header
+        uint32_t counters[2];
+        counters[0] = m_nMovieFrame;
+        counters[1] = m_nMovieEventCount;
+        ::fseek(m_fpMovieFile, offsetof(MovieHeader, frameCount), SEEK_SET);
+        ::fwrite(counters, 1, sizeof(counters), m_fpMovieFile);
+
+        ::fclose(m_fpMovieFile);
+        m_fpMovieFile = nullptr;
+        m_okMovieRecording = false;
+    }
+}
+
+void Movie_WriteEvent(uint8_t type, uint8_t param1, uint16_t param2, const uint8_t* pData = nullptr)
+{
+    MovieEvent event;
+    event.frame = m_nMovieFrame;
+    event.type = type;
+    event.param1 = param1;
+    event.param2 = param2;
+
+    if (::fwrite(&event, 1, sizeof(event), m_fpMovieFile) != sizeof(event) ||
+        (pData != nullptr && ::fwrite(pData, 1, param2, m_fpMovieFile) != param2))
+    {
+        Movie_Stop();  // Disk full or alike
+        // We are in the middle of the frame, so no message box here
+        MainWindow_SetStatusbarText(StatusbarPartMessage, _T("Failed to write the movie file, the recording stopped"));
+        return;
+    }
+
+    m_nMovieEventCount++;
+}
+
+void Movie_RecordKeyboardEvent(uint8_t scancode, bool okPressed)
+{
+    if (!m_okMovieRecording) return;
+    Movie_WriteEvent(MOVIE_EVENT_KEYBOARD, scancode, okPressed ? 1 : 0);
+}
+void Movie_RecordReset()
+{
+    if (!m_okMovieRecording) return;
+    Movie_WriteEvent(MOVIE_EVENT_RESET, 0, 0);
+}
+void Movie_RecordSmpAttach(int slot)
+{
+    if (!m_okMovieRecording) return;
+
+    size_t size;
+    const uint8_t* pData = g_pBoard->GetSmpImageData(slot, &size);
+    if (pData == nullptr)
+        return;
+
+    Movie_WriteEvent(MOVIE_EVENT_SMPATTACH, (uint8_t)slot, (uint16_t)size, pData);
+}
+void Movie_RecordSmpDetach(int slot)
+{
+    if (!m_okMovieRecording) return;
+    Movie_WriteEvent(MOVIE_EVENT_SMPDETACH, (uint8_t)slot, 0);
+}
+
+void Movie_ApplyEvent(CMotherboard* pBoard, const MoviePlayEvent& item)
+{
+    const MovieEvent& event = item.event;
+    switch (event.type)
+    {
+    case MOVIE_EVENT_KEYBOARD:
+        pBoard->KeyboardEvent(event.param1, event.param2 != 0);
+        break;
+    case MOVIE_EVENT_RESET:
+        pBoard->Reset();
+        break;
+    case MOVIE_EVENT_SMPATTACH:
+        pBoard->AttachSmpImage(event.param1 & 1, m_MovieEventData.data() + item.dataOffset, event.param2);
+        break;
+    case MOVIE_EVENT_SMPDETACH:
+        pBoard->DetachSmpImage(event.param1 & 1);
+        break;
+    }
+}
+
+void Movie_PlayFrameEvents()
+{
+    if (!m_okMoviePlaying) return;
+
+    while (m_nMovieNextEvent < m_MovieEvents.size() &&
+           m_MovieEvents[m_nMovieNextEvent].event.frame <= m_nMovieFrame)
+    {
+        Movie_ApplyEvent(g_pBoard, m_MovieEvents[m_nMovieNextEvent]);
+        m_nMovieNextEvent++;
+    }
+}
+
+void Movie_ApplyFrameEvents(CMotherboard* pBoard, uint32_t frame)
+{
+    if (!m_okMoviePlaying) return;
+
+    std::vector<MoviePlayEvent>::const_iterator it = std::lower_bound(m_MovieEvents.begin(), m_MovieEvents.end(), frame);
+    for (; it != m_MovieEvents.end() && it->event.frame == frame; ++it)
+        Movie_ApplyEvent(pBoard, *it);
+}
+
+void Movie_OnFrameDone()
+{
+    if (!m_okMovieRecording && !m_okMoviePlaying)
+        return;
+
+    m_nMovieFrame++;
+
+    if (m_okMoviePlaying)
+    {
+        bool okFinished = (m_nMovieFrameCount > 0) ? (m_nMovieFrame >= m_nMovieFrameCount) : (m_nMovieNextEvent >= m_MovieEvents.size());
+        if (okFinished)
+            Movie_Stop();
+    }
+}
+
+
+//////////////////////////////////////////////////////////////////////
@@ -0,0 +1,46 @@
+﻿/*  This file is part of MK90BTL.
+    MK90BTL is free software: you can redistribute it and/or modify it under the terms
+of the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+    MK90BTL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License along with
+MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
+
+// Movie.h
+
+#pragma once
+
+//////////////////////////////////////////////////////////////////////
+//
+// Movie is a record of the user input applied to the emulator, tied to the machine state at the start.
+// Every event is stamped with the frame number and applied just before the frame runs,
+// so the playback reproduces the same machine state frame by frame.
+
+class CMotherboard;
+
+
+bool Movie_StartRecording(LPCTSTR sFilePath);
+bool Movie_StartPlayback(LPCTSTR sFilePath);
+void Movie_Stop();
+bool Movie_IsRecording();
+bool Movie_IsPlaying();
+uint32_t Movie_GetFrame();  // Current frame number from the movie start
+uint32_t Movie_GetFrameCount();  // Total frames in the movie being played
+
+// Record the events, do nothing if not recording
+void Movie_RecordKeyboardEvent(uint8_t scancode, bool okPressed);
+void Movie_RecordReset();
+void Movie_RecordSmpAttach(int slot);
+void Movie_RecordSmpDetach(int slot);
+
+// Called by the emulator for every frame
+void Movie_PlayFrameEvents();  // Apply the events for the coming frame
+void Movie_OnFrameDone();  // Advance the frame counter; stops the playback at the end of the movie
+
+// Apply the events of the movie being played for the given frame to any machine, used by the bisector
+void Movie_ApplyFrameEvents(CMotherboard* pBoard, uint32_t frame);
+
+
+//////////////////////////////////////////////////////////////////////
@@ -0,0 +1,153 @@
+﻿/*  This file is part of MK90BTL.
+    MK90BTL is free software: you can redistribute it and/or modify it under the terms
+of the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+    MK90BTL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License along with
+MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
+
+// PerfCounters.cpp
+
+#include "stdafx.h"
+#include "Main.h"
+#include "Emulator.h"
+#include "PerfCounters.h"
+#include "emubase\Emubase.h"
+
+//////////////////////////////////////////////////////////////////////
+
+
+CPerfCounters m_PerfCounters;
+bool m_okPerfCountersRunning = false;
+TCHAR m_sPerfCountersDumpFile[MAX_PATH] = { 0 };
+int m_nPerfCountersDumpInterval = 0;  // Milliseconds
+uint32_t m_dwPerfCountersDumpTicks = 0;  // GetTickCount() of the last dump
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+bool PerfCounters_IsRunning() { return m_okPerfCountersRunning; }
+
+bool PerfCounters_Start()
+{
+    g_pBoard->SetPerfCounters(&m_PerfCounters);
+    m_okPerfCountersRunning = true;
+    return true;
+}
+
+void PerfCounters_Stop()
+{
+    if (g_pBoard != nullptr)
+        g_pBoard->SetPerfCounters(nullptr);
+    m_okPerfCountersRunning = false;
+}
+
+void PerfCounters_Clear()
+{
+    ::memset(&m_PerfCounters, 0, sizeof(m_PerfCounters));
+}
+
+void PerfCounters_Done()
+{
+    PerfCounters_Stop();
+    if (m_sPerfCountersDumpFile[0] != 0)
+        PerfCounters_SaveMetrics(m_sPerfCountersDumpFile);
+}
+
+void PerfCounters_GetSnapshot(CPerfCounters* pCounters)
+{
+    *pCounters = m_PerfCounters;
+}
+
+void PerfCounters_SetDumpFile(LPCTSTR sFilePath, int intervalMs)
+{
+    if (sFilePath == nullptr)
+        m_sPerfCountersDumpFile[0] = 0;
+    else
+        _tcsncpy_s(m_sPerfCountersDumpFile, MAX_PATH, sFilePath, _TRUNCATE);
+    m_nPerfCountersDumpInterval = intervalMs;
+    m_dwPerfCountersDumpTicks = ::GetTickCount();
+}
+
+void PerfCounters_OnFrameDone()
+{
+    if (m_sPerfCountersDumpFile[0] == 0)
+        return;
+
+    uint32_t dwTicks = ::GetTickCount();
+    if ((long)(dwTicks - m_dwPerfCountersDumpTicks) < m_nPerfCountersDumpInterval)
+        return;
+    m_dwPerfCountersDumpTicks = dwTicks;
+
+    if (!PerfCounters_SaveMetrics(m_sPerfCountersDumpFile))
+        DebugLogFormat(_T("Failed to write the metrics to %s\r\n"), m_sPerfCountersDumpFile);
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Prometheus text exposition format, written with narrow chars
+
+
+static void PerfCounters_WriteHeader(FILE* fpFile, const char* name, const char* help)
+{
+    ::fprintf(fpFile, "# HELP mk90_%s %s\n# TYPE mk90_%s counter\n", name, help, name);
+}
+
+static void PerfCounters_WriteCounter(FILE* fpFile, const char* name, const char* help, uint64_t value)
+{
+    PerfCounters_WriteHeader(fpFile, name, help);
+    ::fprintf(fpFile, "mk90_%s %I64u\n", name, value);
+}
+
+// Write the counters with the label, skipping zero values; the label value is octal address
+static void PerfCounters_WriteOctalLabeled(FILE* fpFile, const char* name, const char* help, const char* label,
+        const uint64_t* pValues, int count, uint16_t base, int step)
+{
+    PerfCounters_WriteHeader(fpFile, name, help);
+    for (int i = 0; i < count; i++)
+    {
+        if (pValues[i] != 0)
+            ::fprintf(fpFile, "mk90_%s{%s=\"%06o\"} %I64u\n", name, label, (uint16_t)(base + i * step), pValues[i]);
+    }
+}
+
+bool PerfCounters_SaveMetrics(LPCTSTR sFilePath)
+{
+    TCHAR sTempPath[MAX_PATH];
+    _sntprintf(sTempPath, MAX_PATH - 1, _T("%s.tmp"), sFilePath);
+    sTempPath[MAX_PATH - 1] = 0;
+    FILE* fpFile = ::_tfsopen(sTempPath, _T("wb"), _SH_DENYWR);  // Binary, the format wants LF line ends
+    if (fpFile == nullptr)
+        return false;
+
+    const CPerfCounters& counters = m_PerfCounters;
+    PerfCounters_WriteCounter(fpFile, "instructions_total", "Instructions retired.", counters.instructions);
+    PerfCounters_WriteCounter(fpFile, "cpu_ticks_total", "CPU ticks, 8 per microsecond.", counters.ticks);
+    PerfCounters_WriteCounter(fpFile, "frames_total", "Frames completed, 25 per second.", counters.frames);
+    PerfCounters_WriteOctalLabeled(fpFile, "interrupts_total", "Interrupts and traps taken, by vector.", "vector",
+            counters.interrupts, PERFCOUNTER_VECTORS, 0, 4);
+    PerfCounters_WriteCounter(fpFile, "reserved_traps_total", "Reserved instruction traps.", counters.reservedTraps);
+    PerfCounters_WriteCounter(fpFile, "bus_faults_total", "Bus errors, no reply from the memory.", counters.busFaults);
+    PerfCounters_WriteOctalLabeled(fpFile, "port_reads_total", "Port reads, by port address.", "port",
+            counters.portReads, PERFCOUNTER_PORTS - 1, 0164000, 2);
+    if (counters.portReads[PERFCOUNTER_PORTS - 1] != 0)
+        ::fprintf(fpFile, "mk90_port_reads_total{port=\"other\"} %I64u\n", counters.portReads[PERFCOUNTER_PORTS - 1]);
+    PerfCounters_WriteOctalLabeled(fpFile, "port_writes_total", "Port writes, by port address.", "port",
+            counters.portWrites, PERFCOUNTER_PORTS - 1, 0164000, 2);
+    if (counters.portWrites[PERFCOUNTER_PORTS - 1] != 0)
+        ::fprintf(fpFile, "mk90_port_writes_total{port=\"other\"} %I64u\n", counters.portWrites[PERFCOUNTER_PORTS - 1]);
+    PerfCounters_WriteCounter(fpFile, "lcd_address_changes_total", "LCD address register changes.", counters.lcdAddressChanges);
+    PerfCounters_WriteHeader(fpFile, "smp_bytes_total", "Bytes read from or written to SMP, by slot.");
+    for (int slot = 0; slot < 2; slot++)
+        ::fprintf(fpFile, "mk90_smp_bytes_total{slot=\"%d\"} %I64u\n", slot, counters.smpBytes[slot]);
+
+    ::fclose(fpFile);
+
+    return ::MoveFileEx(sTempPath, sFilePath, MOVEFILE_REPLACE_EXISTING) != 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////
@@ -0,0 +1,38 @@
+﻿/*  This file is part of MK90BTL.
+    MK90BTL is free software: you can redistribute it and/or modify it under the terms
+of the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+    MK90BTL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License along with
+MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
+
+// PerfCounters.h
+
+#pragma once
+
+//////////////////////////////////////////////////////////////////////
+//
+// Performance counters: instructions, CPU ticks, interrupts by vector, traps, port accesses,
+// LCD address changes, SMP bytes and frames, see CPerfCounters. The board and the CPU count them
+// with no checks; when the counters are off, they count to the board's own block nobody reads.
+// The counters can be dumped to a file in Prometheus text exposition format, for a scraper to pick up;
+// the file is written to a temporary file first and then renamed, so the scraper never sees it half-written.
+
+const LPCTSTR FILENAME_METRICS = _T("metrics.prom");  // Default metrics file
+
+bool PerfCounters_Start();  // Start or continue counting
+void PerfCounters_Stop();  // Stop counting, the counters are kept
+bool PerfCounters_IsRunning();
+void PerfCounters_Clear();
+void PerfCounters_Done();  // Write the last periodic dump, called on the emulator exit
+
+void PerfCounters_GetSnapshot(CPerfCounters* pCounters);  // Get copy of the current counters
+bool PerfCounters_SaveMetrics(LPCTSTR sFilePath);  // Write the counters in Prometheus text format
+// Set the file to write the metrics to every intervalMs milliseconds of host time; nullptr = no periodic dump
+void PerfCounters_SetDumpFile(LPCTSTR sFilePath, int intervalMs);
+void PerfCounters_OnFrameDone();  // Write the periodic dump when it's time
+
+
+//////////////////////////////////////////////////////////////////////
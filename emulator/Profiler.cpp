@@ -0,0 +1,868 @@
+﻿/*  This file is part of MK90BTL.
+    MK90BTL is free software: you can redistribute it and/or modify it under the terms
+of the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+    MK90BTL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License along with
+MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
+
+// Profiler.cpp
+
+#include "stdafx.h"
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <Share.h>
+#include "Main.h"
+#include "Emulator.h"
+#include "Profiler.h"
+#include "emubase\Emubase.h"
+#include "util/Crc32.h"
+
+//////////////////////////////////////////////////////////////////////
+
+
+const LPCTSTR FILENAME_SYMBOLS_BASIC10 = _T("basic10.sym");
+const LPCTSTR FILENAME_SYMBOLS_BASIC20 = _T("basic20.sym");
+
+const int PROFILER_SAMPLER_CAPACITY = 65536;  // 512 KB
+
+// Current BASIC line number variable, zero in the direct mode, see docs/basic10.lst, docs/basic20.lst
+const uint16_t PROFILER_BASIC10_LINE_ADDRESS = 034352;
+const uint16_t PROFILER_BASIC20_LINE_ADDRESS = 007360;
+
+struct ProfilerSymbol
+{
+    uint16_t address;
+    TCHAR name[32];
+};
+
+bool operator<(const ProfilerSymbol& item1, const ProfilerSymbol& item2) { return item1.address < item2.address; }
+bool operator<(uint16_t address, const ProfilerSymbol& item) { return address < item.address; }
+
+bool ProfilerEntryCompare(const ProfilerEntry& item1, const ProfilerEntry& item2)
+{
+    if (item1.ticks != item2.ticks)
+        return item1.ticks > item2.ticks;
+    return item1.address < item2.address;
+}
+
+
+CProcessorProfile* m_pProfilerData = nullptr;  // Allocated on the first start, ~768 KB
+CCallGraph* m_pProfilerCallGraph = nullptr;
+bool m_okProfilerRunning = false;
+std::vector<ProfilerSymbol> m_ProfilerSymbols;  // Sorted by address
+
+CSampler* m_pProfilerSampler = nullptr;
+FILE* m_fpProfilerSampleFile = nullptr;
+TCHAR m_szProfilerSampleFile[MAX_PATH];
+long m_nProfilerSampleHeaderOffset = 0;  // Position of the current run block in the file
+uint32_t m_nProfilerSampleOverLimit = 0;  // Samples not written because of PROFILER_SAMPLES_MAX_FILE_SIZE
+ProfilerSampleHeader m_ProfilerSampleHeader;
+
+CProcessorWordProfile* m_pProfilerBasic = nullptr;  // Allocated on the first start, ~768 KB
+bool m_okProfilerBasicRunning = false;
+
+CMotherboardAccessCounters* m_pProfilerMemory = nullptr;  // Allocated on the first start, 768 KB
+bool m_okProfilerMemoryRunning = false;
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+bool Profiler_IsRunning() { return m_okProfilerRunning; }
+
+bool Profiler_Start()
+{
+    if (m_pProfilerData == nullptr)
+    {
+        m_pProfilerData = static_cast<CProcessorProfile*>(::calloc(1, sizeof(CProcessorProfile)));
+        if (m_pProfilerData == nullptr)
+            return false;
+    }
+    if (m_pProfilerCallGraph == nullptr)
+    {
+        m_pProfilerCallGraph = new CCallGraph();
+        if (!m_pProfilerCallGraph->IsValid())  // Profile without the call graph
+        {
+            delete m_pProfilerCallGraph;  m_pProfilerCallGraph = nullptr;
+        }
+    }
+
+    g_pBoard->GetCPU()->SetProfile(m_pProfilerData);
+    g_pBoard->GetCPU()->SetCallGraph(m_pProfilerCallGraph);
+    m_okProfilerRunning = true;
+    return true;
+}
+
+void Profiler_Stop()
+{
+    if (g_pBoard != nullptr)
+    {
+        g_pBoard->GetCPU()->SetProfile(nullptr);
+        g_pBoard->GetCPU()->SetCallGraph(nullptr);
+    }
+    m_okProfilerRunning = false;
+}
+
+void Profiler_Clear()
+{
+    if (m_pProfilerData != nullptr)
+        ::memset(m_pProfilerData, 0, sizeof(CProcessorProfile));
+    if (m_pProfilerCallGraph != nullptr)
+        m_pProfilerCallGraph->Clear();
+}
+
+void Profiler_Done()
+{
+    Profiler_Stop();
+    Profiler_StopSampling();
+    Profiler_StopBasic();
+    Profiler_StopMemoryCounters();
+
+    ::free(m_pProfilerData);  m_pProfilerData = nullptr;
+    ::free(m_pProfilerBasic);  m_pProfilerBasic = nullptr;
+    ::free(m_pProfilerMemory);  m_pProfilerMemory = nullptr;
+    delete m_pProfilerCallGraph;  m_pProfilerCallGraph = nullptr;
+    m_ProfilerSymbols.clear();
+}
+
+uint64_t Profiler_GetTotalTicks()
+{
+    if (m_pProfilerData == nullptr)
+        return 0;
+
+    uint64_t total = 0;
+    for (int address = 0; address < 65536; address++)
+        total += m_pProfilerData->ticks[address];
+    return total;
+}
+
+int Profiler_GetTopEntries(ProfilerEntry* pEntries, int maxCount)
+{
+    if (m_pProfilerData == nullptr || maxCount <= 0)
+        return 0;
+
+    std::vector<ProfilerEntry> entries;
+    for (int address = 0; address < 65536; address++)
+    {
+        if (m_pProfilerData->ticks[address] == 0)
+            continue;
+        ProfilerEntry entry;
+        entry.address = (uint16_t)address;
+        entry.count = m_pProfilerData->count[address];
+        entry.ticks = m_pProfilerData->ticks[address];
+        entries.push_back(entry);
+    }
+
+    int count = (std::min)(maxCount, (int)entries.size());
+    std::partial_sort(entries.begin(), entries.begin() + count, entries.end(), ProfilerEntryCompare);
+    std::copy(entries.begin(), entries.begin() + count, pEntries);
+    return count;
+}
+
+void Profiler_FormatEntry(const ProfilerEntry& entry, uint64_t totalTicks, TCHAR* buffer, size_t bufferSize)
+{
+    // Disassemble using the current processor mode
+    bool okHaltMode = g_pBoard->GetCPU()->IsHaltMode();
+    uint16_t memory[4];
+    int addrtype;
+    for (int i = 0; i < 4; i++)
+        memory[i] = g_pBoard->GetWordView((uint16_t)(entry.address + i * 2), okHaltMode, true, &addrtype);
+    TCHAR instr[8];
+    TCHAR args[32];
+    DisassembleInstruction(memory, entry.address, instr, args);
+
+    TCHAR symbol[40];
+    symbol[0] = 0;
+    uint16_t offset;
+    LPCTSTR name = Profiler_FindSymbol(entry.address, &offset);
+    if (name != nullptr && offset == 0)
+        _sntprintf(symbol, sizeof(symbol) / sizeof(TCHAR) - 1, _T("%s"), name);
+    else if (name != nullptr)
+        _sntprintf(symbol, sizeof(symbol) / sizeof(TCHAR) - 1, _T("%s+%o"), name, offset);
+
+    double percent = totalTicks == 0 ? 0.0 : entry.ticks * 100.0 / totalTicks;
+    _sntprintf(buffer, bufferSize - 1, _T("%06o %10u %12I64u %6.2f%%  %-7s %-20s %s"),
+            entry.address, entry.count, entry.ticks, percent, instr, args, symbol);
+    buffer[bufferSize - 1] = 0;
+}
+
+bool Profiler_SaveReport(LPCTSTR sFilePath)
+{
+    if (m_pProfilerData == nullptr)
+        return false;
+
+    FILE* fpFile = ::_tfsopen(sFilePath, _T("wt"), _SH_DENYWR);
+    if (fpFile == nullptr)
+        return false;
+
+    Profiler_LoadSymbols(g_nEmulatorConfiguration);
+
+    uint64_t totalTicks = Profiler_GetTotalTicks();
+    std::vector<ProfilerEntry> entries(65536);
+    int count = Profiler_GetTopEntries(entries.data(), 65536);
+
+    ::_ftprintf(fpFile, _T("Configuration: %s\n"), Emulator_GetConfigurationName());
+    ::_ftprintf(fpFile, _T("Total ticks: %I64u, addresses: %d\n\n"), totalTicks, count);
+    ::_ftprintf(fpFile, _T("Addr        Count        Ticks   Ticks%%  Instruction                  Symbol\n"));
+    TCHAR buffer[128];
+    for (int i = 0; i < count; i++)
+    {
+        Profiler_FormatEntry(entries[i], totalTicks, buffer, sizeof(buffer) / sizeof(TCHAR));
+        ::_ftprintf(fpFile, _T("%s\n"), buffer);
+    }
+
+    ::fclose(fpFile);
+    return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Call graph
+
+struct ProfilerCallee
+{
+    uint32_t key;  // Address << 16 | vector
+    uint32_t calls;
+    uint64_t inclusive;
+    uint64_t exclusive;
+};
+
+bool operator<(const ProfilerCallee& item1, const ProfilerCallee& item2) { return item1.key < item2.key; }
+
+bool ProfilerCalleeCompare(const ProfilerCallee& item1, const ProfilerCallee& item2)
+{
+    if (item1.inclusive != item2.inclusive)
+        return item1.inclusive > item2.inclusive;
+    return item1.key < item2.key;
+}
+
+// Frame name for the reports: symbol or octal address; traps and interrupts get the vector prefix
+static void Profiler_FormatFrameName(uint16_t address, uint16_t vector, TCHAR* buffer, size_t bufferSize)
+{
+    TCHAR prefix[12] = { 0 };
+    switch (vector)
+    {
+    case 0000014: _tcscpy_s(prefix, _T("BPT:"));  break;
+    case 0000020: _tcscpy_s(prefix, _T("IOT:"));  break;
+    case 0000030: _tcscpy_s(prefix, _T("EMT:"));  break;
+    case 0000034: _tcscpy_s(prefix, _T("TRAP:"));  break;
+    default:      _sntprintf(prefix, sizeof(prefix) / sizeof(TCHAR) - 1, _T("INT%03o:"), vector);  break;
+    }
+
+    uint16_t offset;
+    LPCTSTR name = Profiler_FindSymbol(address, &offset);
+    if (name != nullptr && offset == 0)
+        _sntprintf(buffer, bufferSize - 1, _T("%s%s"), prefix, name);
+    else if (name != nullptr)
+        _sntprintf(buffer, bufferSize - 1, _T("%s%s+%o"), prefix, name, offset);
+    else
+        _sntprintf(buffer, bufferSize - 1, _T("%s%06o"), prefix, address);
+    buffer[bufferSize - 1] = 0;
+}
+
+bool Profiler_SaveCallGraphReport(LPCTSTR sFilePath)
+{
+    if (m_pProfilerCallGraph == nullptr)
+        return false;
+
+    FILE* fpFile = ::_tfsopen(sFilePath, _T("wt"), _SH_DENYWR);
+    if (fpFile == nullptr)
+        return false;
+
+    Profiler_LoadSymbols(g_nEmulatorConfiguration);
+
+    // Inclusive ticks per node; children always have greater index than the parent
+    const CCallGraph* pGraph = m_pProfilerCallGraph;
+    int nodeCount = pGraph->GetNodeCount();
+    std::vector<uint64_t> inclusive(nodeCount);
+    for (int index = nodeCount - 1; index >= 0; index--)
+    {
+        const CCallGraphNode* pNode = pGraph->GetNode(index);
+        inclusive[index] += pNode->ticks;
+        if (pNode->parent >= 0)
+            inclusive[pNode->parent] += inclusive[index];
+    }
+    uint64_t totalTicks = inclusive[0];
+
+    // Sum up per callee; for the recursive calls, the inclusive ticks counted on the outermost call only
+    std::vector<ProfilerCallee> callees;
+    for (int index = 1; index < nodeCount; index++)
+    {
+        const CCallGraphNode* pNode = pGraph->GetNode(index);
+        ProfilerCallee callee;
+        callee.key = (uint32_t)pNode->address << 16 | pNode->vector;
+        callee.calls = pNode->calls;
+        callee.exclusive = pNode->ticks;
+        callee.inclusive = inclusive[index];
+        for (int parent = pNode->parent; parent > 0; parent = pGraph->GetNode(parent)->parent)
+        {
+            const CCallGraphNode* pParent = pGraph->GetNode(parent);
+            if (pParent->address == pNode->address && pParent->vector == pNode->vector)
+            {
+                callee.inclusive = 0;
+                break;
+            }
+        }
+        callees.push_back(callee);
+    }
+    std::sort(callees.begin(), callees.end());
+    std::vector<ProfilerCallee> merged;
+    for (size_t i = 0; i < callees.size(); i++)
+    {
+        if (!merged.empty() && merged.back().key == callees[i].key)
+        {
+            merged.back().calls += callees[i].calls;
+            merged.back().inclusive += callees[i].inclusive;
+            merged.back().exclusive += callees[i].exclusive;
+        }
+        else
+            merged.push_back(callees[i]);
+    }
+    std::sort(merged.begin(), merged.end(), ProfilerCalleeCompare);
+
+    ::_ftprintf(fpFile, _T("Configuration: %s\n"), Emulator_GetConfigurationName());
+    ::_ftprintf(fpFile, _T("Total ticks: %I64u, call tree nodes: %d, entries lost: %u\n"),
+            totalTicks, nodeCount, pGraph->GetLostCount());
+    ::_ftprintf(fpFile, _T("Top level ticks: %I64u\n\n"), pGraph->GetNode(0)->ticks);
+    ::_ftprintf(fpFile, _T("     Calls    Inclusive  Incl%%    Exclusive  Excl%%  Callee\n"));
+    for (size_t i = 0; i < merged.size(); i++)
+    {
+        const ProfilerCallee& callee = merged[i];
+        TCHAR name[48];
+        Profiler_FormatFrameName((uint16_t)(callee.key >> 16), (uint16_t)(callee.key & 0xffff), name, sizeof(name) / sizeof(TCHAR));
+        double inclusivePercent = totalTicks == 0 ? 0.0 : callee.inclusive * 100.0 / totalTicks;
+        double exclusivePercent = totalTicks == 0 ? 0.0 : callee.exclusive * 100.0 / totalTicks;
+        ::_ftprintf(fpFile, _T("%10u %12I64u %6.2f %12I64u %6.2f  %s\n"),
+                callee.calls, callee.inclusive, inclusivePercent, callee.exclusive, exclusivePercent, name);
+    }
+
+    ::fclose(fpFile);
+    return true;
+}
+
+bool Profiler_SaveCollapsedStacks(LPCTSTR sFilePath)
+{
+    if (m_pProfilerCallGraph == nullptr)
+        return false;
+
+    FILE* fpFile = ::_tfsopen(sFilePath, _T("wt"), _SH_DENYWR);
+    if (fpFile == nullptr)
+        return false;
+
+    Profiler_LoadSymbols(g_nEmulatorConfiguration);
+
+    const CCallGraph* pGraph = m_pProfilerCallGraph;
+    if (pGraph->GetNode(0)->ticks > 0)
+        ::_ftprintf(fpFile, _T("[top] %I64u\n"), pGraph->GetNode(0)->ticks);
+    std::vector<int> path;
+    for (int index = 1; index < pGraph->GetNodeCount(); index++)
+    {
+        const CCallGraphNode* pNode = pGraph->GetNode(index);
+        if (pNode->ticks == 0)
+            continue;
+
+        path.clear();
+        for (int node = index; node > 0; node = pGraph->GetNode(node)->parent)
+            path.push_back(node);
+        for (size_t i = path.size(); i-- > 0; )
+        {
+            const CCallGraphNode* pFrame = pGraph->GetNode(path[i]);
+            TCHAR name[48];
+            Profiler_FormatFrameName(pFrame->address, pFrame->vector, name, sizeof(name) / sizeof(TCHAR));
+            ::_ftprintf(fpFile, i > 0 ? _T("%s;") : _T("%s"), name);
+        }
+        ::_ftprintf(fpFile, _T(" %I64u\n"), pNode->ticks);
+    }
+
+    ::fclose(fpFile);
+    return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// BASIC line profiler
+
+bool Profiler_IsBasicRunning() { return m_okProfilerBasicRunning; }
+
+bool Profiler_StartBasic()
+{
+    if (m_pProfilerBasic == nullptr)
+    {
+        m_pProfilerBasic = static_cast<CProcessorWordProfile*>(::calloc(1, sizeof(CProcessorWordProfile)));
+        if (m_pProfilerBasic == nullptr)
+            return false;
+    }
+    m_pProfilerBasic->address = (g_nEmulatorConfiguration == EMU_CONF_BASIC10) ?
+            PROFILER_BASIC10_LINE_ADDRESS : PROFILER_BASIC20_LINE_ADDRESS;
+
+    g_pBoard->GetCPU()->SetWordProfile(m_pProfilerBasic);
+    m_okProfilerBasicRunning = true;
+    return true;
+}
+
+void Profiler_StopBasic()
+{
+    if (g_pBoard != nullptr)
+        g_pBoard->GetCPU()->SetWordProfile(nullptr);
+    m_okProfilerBasicRunning = false;
+}
+
+void Profiler_ClearBasic()
+{
+    if (m_pProfilerBasic == nullptr)
+        return;
+
+    uint16_t address = (g_nEmulatorConfiguration == EMU_CONF_BASIC10) ?
+            PROFILER_BASIC10_LINE_ADDRESS : PROFILER_BASIC20_LINE_ADDRESS;
+    ::memset(m_pProfilerBasic, 0, sizeof(CProcessorWordProfile));
+    m_pProfilerBasic->address = address;
+}
+
+// Format the ticks of the BASIC line: ticks, percent of the program ticks, entries, average ticks per entry
+static void Profiler_FormatBasicLine(uint16_t line, uint64_t programTicks, TCHAR* buffer, size_t bufferSize)
+{
+    uint64_t ticks = m_pProfilerBasic->ticks[line];
+    uint32_t entries = m_pProfilerBasic->entries[line];
+    double percent = programTicks == 0 ? 0.0 : ticks * 100.0 / programTicks;
+    _sntprintf(buffer, bufferSize - 1, _T("%12I64u %6.2f%% %10u %10I64u"),
+            ticks, percent, entries, entries == 0 ? (uint64_t)0 : ticks / entries);
+    buffer[bufferSize - 1] = 0;
+}
+
+uint64_t Profiler_GetBasicProgramTicks()
+{
+    if (m_pProfilerBasic == nullptr)
+        return 0;
+
+    // Line 0 is the direct mode, not a part of the program
+    uint64_t programTicks = 0;
+    for (int line = 1; line < 65536; line++)
+        programTicks += m_pProfilerBasic->ticks[line];
+    return programTicks;
+}
+
+int Profiler_GetBasicTopLines(ProfilerEntry* pEntries, int maxCount)
+{
+    if (m_pProfilerBasic == nullptr || maxCount <= 0)
+        return 0;
+
+    std::vector<ProfilerEntry> lines;
+    for (int line = 1; line < 65536; line++)
+    {
+        if (m_pProfilerBasic->ticks[line] == 0)
+            continue;
+        ProfilerEntry entry;
+        entry.address = (uint16_t)line;
+        entry.count = m_pProfilerBasic->entries[line];
+        entry.ticks = m_pProfilerBasic->ticks[line];
+        lines.push_back(entry);
+    }
+
+    int count = (std::min)(maxCount, (int)lines.size());
+    std::partial_sort(lines.begin(), lines.begin() + count, lines.end(), ProfilerEntryCompare);
+    std::copy(lines.begin(), lines.begin() + count, pEntries);
+    return count;
+}
+
+void Profiler_FormatBasicEntry(const ProfilerEntry& entry, uint64_t programTicks, TCHAR* buffer, size_t bufferSize)
+{
+    TCHAR bufTicks[64];
+    Profiler_FormatBasicLine(entry.address, programTicks, bufTicks, sizeof(bufTicks) / sizeof(TCHAR));
+    _sntprintf(buffer, bufferSize - 1, _T("%5u %s"), entry.address, bufTicks);
+    buffer[bufferSize - 1] = 0;
+}
+
+bool Profiler_SaveBasicReport(LPCTSTR sFilePath)
+{
+    if (m_pProfilerBasic == nullptr)
+        return false;
+
+    FILE* fpFile = ::_tfsopen(sFilePath, _T("wt"), _SH_DENYWR);
+    if (fpFile == nullptr)
+        return false;
+
+    uint64_t programTicks = Profiler_GetBasicProgramTicks();
+    std::vector<ProfilerEntry> lines(65536);
+    int count = Profiler_GetBasicTopLines(lines.data(), 65536);
+
+    ::_ftprintf(fpFile, _T("Configuration: %s\n"), Emulator_GetConfigurationName());
+    ::_ftprintf(fpFile, _T("Program ticks: %I64u, direct mode ticks: %I64u, lines: %d\n\n"),
+            programTicks, m_pProfilerBasic->ticks[0], count);
+    ::_ftprintf(fpFile, _T(" Line        Ticks   Ticks%%    Entries  Ticks/Entry\n"));
+    TCHAR buffer[80];
+    for (int i = 0; i < count; i++)
+    {
+        Profiler_FormatBasicEntry(lines[i], programTicks, buffer, sizeof(buffer) / sizeof(TCHAR));
+        ::_ftprintf(fpFile, _T("%s\n"), buffer);
+    }
+
+    ::fclose(fpFile);
+    return true;
+}
+
+bool Profiler_SaveBasicListing(LPCTSTR sSourcePath, LPCTSTR sFilePath)
+{
+    if (m_pProfilerBasic == nullptr)
+        return false;
+
+    FILE* fpFile = ::_tfsopen(sFilePath, _T("wt"), _SH_DENYWR);
+    if (fpFile == nullptr)
+        return false;
+
+    uint64_t programTicks = Profiler_GetBasicProgramTicks();
+
+    TCHAR buffer[64];
+    FILE* fpSource = (sSourcePath != nullptr) ? ::_tfsopen(sSourcePath, _T("rt"), _SH_DENYWR) : nullptr;
+    if (fpSource != nullptr)
+    {
+        // Annotate the source lines starting with a line number; keep the other lines as is
+        TCHAR text[256];
+        while (::_fgetts(text, sizeof(text) / sizeof(TCHAR), fpSource) != nullptr)
+        {
+            size_t length = _tcslen(text);
+            if (length > 0 && text[length - 1] == _T('\n'))
+                text[length - 1] = 0;
+            LPCTSTR p = text;
+            while (*p == _T(' ') || *p == _T('\t')) p++;
+            unsigned int line = 0;
+            bool okLine = (*p >= _T('0') && *p <= _T('9'));
+            for (; *p >= _T('0') && *p <= _T('9'); p++)
+                line = line * 10 + (*p - _T('0'));
+            if (okLine && line > 0 && line < 65536)
+            {
+                Profiler_FormatBasicLine((uint16_t)line, programTicks, buffer, sizeof(buffer) / sizeof(TCHAR));
+                ::_ftprintf(fpFile, _T("%s | %s\n"), buffer, text);
+            }
+            else
+                ::_ftprintf(fpFile, _T("%45s | %s\n"), _T(""), text);
+        }
+        ::fclose(fpSource);
+    }
+    else
+    {
+        // No source, list the line numbers in the program order
+        for (int line = 1; line < 65536; line++)
+        {
+            if (m_pProfilerBasic->ticks[line] == 0)
+                continue;
+            Profiler_FormatBasicLine((uint16_t)line, programTicks, buffer, sizeof(buffer) / sizeof(TCHAR));
+            ::_ftprintf(fpFile, _T("%s | %u\n"), buffer, line);
+        }
+    }
+
+    ::fclose(fpFile);
+    return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Memory access counters
+
+bool Profiler_IsMemoryCounting() { return m_okProfilerMemoryRunning; }
+
+bool Profiler_StartMemoryCounters()
+{
+    if (m_pProfilerMemory == nullptr)
+    {
+        m_pProfilerMemory = static_cast<CMotherboardAccessCounters*>(::calloc(1, sizeof(CMotherboardAccessCounters)));
+        if (m_pProfilerMemory == nullptr)
+            return false;
+    }
+
+    g_pBoard->SetAccessCounters(m_pProfilerMemory);
+    m_okProfilerMemoryRunning = true;
+    return true;
+}
+
+void Profiler_StopMemoryCounters()
+{
+    if (g_pBoard != nullptr)
+        g_pBoard->SetAccessCounters(nullptr);
+    m_okProfilerMemoryRunning = false;
+}
+
+void Profiler_ClearMemoryCounters()
+{
+    if (m_pProfilerMemory != nullptr)
+        ::memset(m_pProfilerMemory, 0, sizeof(CMotherboardAccessCounters));
+}
+
+// Scale the counter to 0..255 in log scale; any non-zero counter gets at least 32 to be visible
+static uint32_t Profiler_ScaleCounter(uint32_t value, double logMax)
+{
+    if (value == 0)
+        return 0;
+    double scaled = 32.0 + 223.0 * log((double)value + 1.0) / logMax;
+    return scaled >= 255.0 ? 255 : (uint32_t)scaled;
+}
+
+bool Profiler_GetMemoryHeatmap(uint32_t* pBits, int nRowPitch)
+{
+    if (m_pProfilerMemory == nullptr)
+        return false;
+
+    uint32_t maxRead = 0, maxWrite = 0, maxExec = 0;
+    for (int address = 0; address < 65536; address++)
+    {
+        maxRead = (std::max)(maxRead, m_pProfilerMemory->read[address]);
+        maxWrite = (std::max)(maxWrite, m_pProfilerMemory->write[address]);
+        maxExec = (std::max)(maxExec, m_pProfilerMemory->exec[address]);
+    }
+    double logMaxRead = log((double)maxRead + 1.0);
+    double logMaxWrite = log((double)maxWrite + 1.0);
+    double logMaxExec = log((double)maxExec + 1.0);
+
+    for (int address = 0; address < 65536; address++)
+    {
+        uint32_t red = Profiler_ScaleCounter(m_pProfilerMemory->write[address], logMaxWrite);
+        uint32_t green = Profiler_ScaleCounter(m_pProfilerMemory->exec[address], logMaxExec);
+        uint32_t blue = Profiler_ScaleCounter(m_pProfilerMemory->read[address], logMaxRead);
+        pBits[(address >> 8) * nRowPitch + (address & 0xff)] = red << 16 | green << 8 | blue;
+    }
+
+    return true;
+}
+
+bool Profiler_SaveMemoryCounters(LPCTSTR sFilePath)
+{
+    if (m_pProfilerMemory == nullptr)
+        return false;
+
+    FILE* fpFile = ::_tfsopen(sFilePath, _T("wb"), _SH_DENYWR);
+    if (fpFile == nullptr)
+        return false;
+
+    bool okResult = ::fwrite(m_pProfilerMemory, 1, sizeof(CMotherboardAccessCounters), fpFile) == sizeof(CMotherboardAccessCounters);
+    ::fclose(fpFile);
+    return okResult;
+}
+
+// PNG writer for the heatmap: RGB, 8 bits per channel, no filtering,
+// zlib stream made of stored (uncompressed) deflate blocks
+
+static void Profiler_PngPutDword(std::vector<uint8_t>& data, uint32_t value)  // Big-endian
+{
+    data.push_back((uint8_t)(value >> 24));
+    data.push_back((uint8_t)(value >> 16));
+    data.push_back((uint8_t)(value >> 8));
+    data.push_back((uint8_t)value);
+}
+
+static void Profiler_PngPutChunk(std::vector<uint8_t>& file, const char* type, const std::vector<uint8_t>& data)
+{
+    Profiler_PngPutDword(file, (uint32_t)data.size());
+    size_t start = file.size();
+    file.insert(file.end(), type, type + 4);
+    file.insert(file.end(), data.begin(), data.end());
+    Profiler_PngPutDword(file, Crc32_Update(0, &file[start], file.size() - start));
+}
+
+bool Profiler_SaveMemoryHeatmap(LPCTSTR sFilePath)
+{
+    uint32_t* pHeatmap = static_cast<uint32_t*>(::calloc(65536, sizeof(uint32_t)));
+    if (pHeatmap == nullptr)
+        return false;
+    if (!Profiler_GetMemoryHeatmap(pHeatmap, 256))
+    {
+        ::free(pHeatmap);
+        return false;
+    }
+
+    // Raw image: every line is the filter type byte (0 = none) and 256 RGB pixels
+    const int lineSize = 1 + 256 * 3;
+    std::vector<uint8_t> raw(lineSize * 256);
+    for (int line = 0; line < 256; line++)
+    {
+        uint8_t* pLine = &raw[line * lineSize];
+        pLine[0] = 0;
+        for (int x = 0; x < 256; x++)
+        {
+            uint32_t color = pHeatmap[line * 256 + x];
+            pLine[1 + x * 3] = (uint8_t)(color >> 16);
+            pLine[2 + x * 3] = (uint8_t)(color >> 8);
+            pLine[3 + x * 3] = (uint8_t)color;
+        }
+    }
+    ::free(pHeatmap);
+
+    // zlib stream: header, stored blocks up to 65535 bytes each, Adler-32 of the raw data
+    std::vector<uint8_t> idat;
+    idat.push_back(0x78);  idat.push_back(0x01);
+    size_t offset = 0;
+    while (offset < raw.size())
+    {
+        size_t blockSize = (std::min)(raw.size() - offset, (size_t)65535);
+        idat.push_back(offset + blockSize == raw.size() ? 1 : 0);  // BFINAL, BTYPE = 00
+        idat.push_back((uint8_t)blockSize);  idat.push_back((uint8_t)(blockSize >> 8));
+        idat.push_back((uint8_t)~blockSize);  idat.push_back((uint8_t)(~blockSize >> 8));
+        idat.insert(idat.end(), raw.begin() + offset, raw.begin() + offset + blockSize);
+        offset += blockSize;
+    }
+    uint32_t adlerA = 1, adlerB = 0;
+    for (size_t i = 0; i < raw.size(); i++)
+    {
+        adlerA = (adlerA + raw[i]) % 65521;
+        adlerB = (adlerB + adlerA) % 65521;
+    }
+    Profiler_PngPutDword(idat, adlerB << 16 | adlerA);
+
+    std::vector<uint8_t> ihdr;
+    Profiler_PngPutDword(ihdr, 256);  // Width
+    Profiler_PngPutDword(ihdr, 256);  // Height
+    ihdr.push_back(8);  // Bit depth
+    ihdr.push_back(2);  // Color type: RGB
+    ihdr.push_back(0);  ihdr.push_back(0);  ihdr.push_back(0);  // Compression, filter, interlace
+
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    std::vector<uint8_t> file(signature, signature + 8);
+    Profiler_PngPutChunk(file, "IHDR", ihdr);
+    Profiler_PngPutChunk(file, "IDAT", idat);
+    Profiler_PngPutChunk(file, "IEND", std::vector<uint8_t>());
+
+    FILE* fpFile = ::_tfsopen(sFilePath, _T("wb"), _SH_DENYWR);
+    if (fpFile == nullptr)
+        return false;
+    bool okResult = ::fwrite(&file[0], 1, file.size(), fpFile) == file.size();
+    ::fclose(fpFile);
+    return okResult;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Symbols
+
+void Profiler_LoadSymbols(int configuration)
+{
+    m_ProfilerSymbols.clear();
+
+    LPCTSTR szFileName = (configuration == EMU_CONF_BASIC10) ? FILENAME_SYMBOLS_BASIC10 : FILENAME_SYMBOLS_BASIC20;
+    FILE* fpFile = ::_tfsopen(szFileName, _T("rt"), _SH_DENYWR);
+    if (fpFile == nullptr)
+        return;  // No symbols, that's okay
+
+    TCHAR line[80];
+    while (::_fgetts(line, sizeof(line) / sizeof(TCHAR), fpFile) != nullptr)
+    {
+        if (line[0] == _T(';'))
+            continue;
+        unsigned int address;
+        ProfilerSymbol symbol;
+        if (_stscanf_s(line, _T("%o %31s"), &address, symbol.name, (unsigned)(sizeof(symbol.name) / sizeof(TCHAR))) != 2)
+            continue;
+        symbol.address = (uint16_t)address;
+        m_ProfilerSymbols.push_back(symbol);
+    }
+    ::fclose(fpFile);
+
+    std::stable_sort(m_ProfilerSymbols.begin(), m_ProfilerSymbols.end());
+}
+
+LPCTSTR Profiler_FindSymbol(uint16_t address, uint16_t* pOffset)
+{
+    std::vector<ProfilerSymbol>::const_iterator it =
+        std::upper_bound(m_ProfilerSymbols.begin(), m_ProfilerSymbols.end(), address);
+    if (it == m_ProfilerSymbols.begin())
+        return nullptr;
+    --it;
+    *pOffset = address - it->address;
+    return it->name;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Sampling profiler
+
+bool Profiler_IsSampling() { return m_pProfilerSampler != nullptr; }
+
+bool Profiler_StartSampling(LPCTSTR sFilePath, int interval)
+{
+    Profiler_StopSampling();
+
+    // Append to the existing file, the header is updated in place later
+    FILE* fpFile = ::_tfsopen(sFilePath, _T("r+b"), _SH_DENYWR);
+    if (fpFile == nullptr)
+        fpFile = ::_tfsopen(sFilePath, _T("w+b"), _SH_DENYWR);
+    if (fpFile == nullptr)
+        return false;
+    ::fseek(fpFile, 0, SEEK_END);
+
+    CSampler* pSampler = new CSampler(PROFILER_SAMPLER_CAPACITY);
+    pSampler->SetInterval(interval);
+
+    ::memset(&m_ProfilerSampleHeader, 0, sizeof(m_ProfilerSampleHeader));
+    m_ProfilerSampleHeader.header1 = MK90SAMPLE_HEADER1;
+    m_ProfilerSampleHeader.header2 = MK90SAMPLE_HEADER2;
+    m_ProfilerSampleHeader.version = MK90SAMPLE_VERSION;
+    m_ProfilerSampleHeader.configuration = (uint32_t)g_nEmulatorConfiguration;
+    m_ProfilerSampleHeader.interval = (uint32_t)pSampler->GetInterval();
+    m_nProfilerSampleHeaderOffset = ::ftell(fpFile);
+    m_nProfilerSampleOverLimit = 0;
+    if (pSampler->GetCapacity() == 0 ||
+        ::fwrite(&m_ProfilerSampleHeader, 1, sizeof(m_ProfilerSampleHeader), fpFile) != sizeof(m_ProfilerSampleHeader))
+    {
+        delete pSampler;
+        ::fclose(fpFile);
+        return false;
+    }
+
+    m_fpProfilerSampleFile = fpFile;
+    if (sFilePath != m_szProfilerSampleFile)
+        _tcsncpy_s(m_szProfilerSampleFile, MAX_PATH, sFilePath, _TRUNCATE);
+    m_pProfilerSampler = pSampler;
+    g_pBoard->GetCPU()->SetSampler(pSampler);
+    return true;
+}
+
+static void Profiler_WriteSamples()
+{
+    int count = m_pProfilerSampler->GetCount();
+    if (count == 0 && m_pProfilerSampler->GetDropped() + m_nProfilerSampleOverLimit == m_ProfilerSampleHeader.dropped)
+        return;
+
+    size_t size = count * sizeof(CSamplerSample);
+    ::fseek(m_fpProfilerSampleFile, 0, SEEK_END);
+    if (::ftell(m_fpProfilerSampleFile) + (long)size > PROFILER_SAMPLES_MAX_FILE_SIZE)
+        m_nProfilerSampleOverLimit += count;  // The file is full, keep counting only
+    else if (::fwrite(m_pProfilerSampler->GetSamples(), 1, size, m_fpProfilerSampleFile) == size)
+        m_ProfilerSampleHeader.sampleCount += count;
+    m_ProfilerSampleHeader.dropped = m_pProfilerSampler->GetDropped() + m_nProfilerSampleOverLimit;
+    m_pProfilerSampler->Clear();
+
+    ::fseek(m_fpProfilerSampleFile, m_nProfilerSampleHeaderOffset, SEEK_SET);
+    ::fwrite(&m_ProfilerSampleHeader, 1, sizeof(m_ProfilerSampleHeader), m_fpProfilerSampleFile);
+}
+
+void Profiler_OnFrameDone()
+{
+    if (m_pProfilerSampler != nullptr && m_pProfilerSampler->GetCount() >= m_pProfilerSampler->GetCapacity() / 2)
+        Profiler_WriteSamples();
+}
+
+void Profiler_OnConfigurationChanged()
+{
+    if (m_pProfilerSampler != nullptr)
+        Profiler_StartSampling(m_szProfilerSampleFile, m_pProfilerSampler->GetInterval());
+
+    // The line numbers of another BASIC mean nothing
+    Profiler_ClearBasic();
+}
+
+void Profiler_StopSampling()
+{
+    if (m_pProfilerSampler == nullptr)
+        return;
+
+    if (g_pBoard != nullptr)
+        g_pBoard->GetCPU()->SetSampler(nullptr);
+    Profiler_WriteSamples();
+    ::fclose(m_fpProfilerSampleFile);  m_fpProfilerSampleFile = nullptr;
+    delete m_pProfilerSampler;  m_pProfilerSampler = nullptr;
+}
+
+
+//////////////////////////////////////////////////////////////////////
@@ -0,0 +1,115 @@
+﻿/*  This file is part of MK90BTL.
+    MK90BTL is free software: you can redistribute it and/or modify it under the terms
+of the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+    MK90BTL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License along with
+MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
+
+// Profiler.h
+
+#pragma once
+
+//////////////////////////////////////////////////////////////////////
+//
+// Per-PC profiler counts executions and CPU ticks for every instruction address.
+// The counters are flat arrays updated by CProcessor, see CProcessorProfile.
+// Call graph profiler runs together with it, keeping the call tree with the ticks, see CCallGraph.
+// Sampling profiler is separate and light, it is on by default and writes the samples file, see CSampler.
+// BASIC line profiler counts the ticks by the current BASIC line number, see CProcessorWordProfile.
+// Memory access counters count reads, writes and instruction fetches by address, see CMotherboardAccessCounters.
+// Symbol names are taken from basic10.sym / basic20.sym file, when the file exists:
+// one "address name" pair per line, the address is octal; lines starting with ';' are comments.
+
+struct ProfilerEntry
+{
+    uint16_t address;
+    uint32_t count;
+    uint64_t ticks;
+};
+
+bool Profiler_Start();  // Start or continue counting
+void Profiler_Stop();  // Stop counting, the counters are kept
+bool Profiler_IsRunning();
+void Profiler_Clear();
+void Profiler_Done();  // Free the memory, called on the emulator exit
+
+uint64_t Profiler_GetTotalTicks();
+// Get the addresses sorted by ticks, most expensive first; returns number of entries filled
+int  Profiler_GetTopEntries(ProfilerEntry* pEntries, int maxCount);
+// Format the report line: address, count, ticks, percent, disassembly, symbol
+void Profiler_FormatEntry(const ProfilerEntry& entry, uint64_t totalTicks, TCHAR* buffer, size_t bufferSize);
+bool Profiler_SaveReport(LPCTSTR sFilePath);  // Write all the addresses executed
+// Write the inclusive and exclusive ticks per callee, sorted by inclusive ticks
+bool Profiler_SaveCallGraphReport(LPCTSTR sFilePath);
+// Write the call tree in "collapsed stack" format for flamegraph tools: "frame;frame;frame ticks" lines
+bool Profiler_SaveCollapsedStacks(LPCTSTR sFilePath);
+
+bool Profiler_StartBasic();  // Start or continue counting the ticks per BASIC line
+void Profiler_StopBasic();  // Stop counting, the counters are kept
+bool Profiler_IsBasicRunning();
+void Profiler_ClearBasic();
+// Get the BASIC lines sorted by ticks, entry address is the line number; returns number of entries filled
+int  Profiler_GetBasicTopLines(ProfilerEntry* pEntries, int maxCount);
+uint64_t Profiler_GetBasicProgramTicks();  // Ticks of all the lines, the direct mode excluded
+// Format the report line: line number, ticks, percent, entries, ticks per entry
+void Profiler_FormatBasicEntry(const ProfilerEntry& entry, uint64_t programTicks, TCHAR* buffer, size_t bufferSize);
+// Write the lines sorted by ticks
+bool Profiler_SaveBasicReport(LPCTSTR sFilePath);
+// Write the BASIC program source with ticks for every line; with no source, write the line numbers only
+bool Profiler_SaveBasicListing(LPCTSTR sSourcePath, LPCTSTR sFilePath);
+
+bool Profiler_StartMemoryCounters();  // Start or continue counting the memory accesses
+void Profiler_StopMemoryCounters();  // Stop counting, the counters are kept
+bool Profiler_IsMemoryCounting();
+void Profiler_ClearMemoryCounters();
+// Make 256x256 heatmap, one pixel per address, row = address high byte; pixels are 0x00RRGGBB,
+// red = writes, green = instruction fetches, blue = reads, log scale; 0 = no access at all;
+// row N starts at pBits + N * nRowPitch, the pitch is in pixels and is negative for a bottom-up bitmap
+bool Profiler_GetMemoryHeatmap(uint32_t* pBits, int nRowPitch);
+// Write the counters as is: read[65536], write[65536], exec[65536], uint32_t little-endian
+bool Profiler_SaveMemoryCounters(LPCTSTR sFilePath);
+bool Profiler_SaveMemoryHeatmap(LPCTSTR sFilePath);  // Write the heatmap as .PNG file
+
+void Profiler_LoadSymbols(int configuration);  // Load the symbols for the given configuration
+// Find the nearest symbol at or below the address; returns nullptr if none
+LPCTSTR Profiler_FindSymbol(uint16_t address, uint16_t* pOffset);
+
+
+//////////////////////////////////////////////////////////////////////
+//
+// Samples file format, every run appends its block:
+//   32 bytes       Header, see ProfilerSampleHeader
+//   N * 8 bytes    Samples, see CSamplerSample
+//   ...            Next run block
+
+#define MK90SAMPLE_HEADER1 0x30394B4D  // "MK90"
+#define MK90SAMPLE_HEADER2 0x21504D53  // "SMP!"
+#define MK90SAMPLE_VERSION 0x00010000  // 1.0
+
+const LPCTSTR FILENAME_SAMPLES = _T("samples.mk90smp");  // Default samples file
+const int PROFILER_SAMPLE_INTERVAL = 65536;  // Default SampleInterval setting, ticks
+const long PROFILER_SAMPLES_MAX_FILE_SIZE = 64 * 1024 * 1024;  // Samples beyond the size are counted as dropped
+
+struct ProfilerSampleHeader
+{
+    uint32_t header1;
+    uint32_t header2;
+    uint32_t version;
+    uint32_t configuration;
+    uint32_t interval;  // Average ticks between the samples
+    uint32_t sampleCount;  // Updated on every write
+    uint32_t dropped;  // Samples lost because of the buffer overflow or the file size limit
+    uint32_t reserved;
+};
+
+bool Profiler_StartSampling(LPCTSTR sFilePath, int interval);  // Append a new run block to the file
+void Profiler_StopSampling();  // Write the rest of the samples and close the file
+bool Profiler_IsSampling();
+void Profiler_OnFrameDone();  // Write the samples to the file when the buffer is half full
+void Profiler_OnConfigurationChanged();  // Start a new run block in the same file
+
+
+//////////////////////////////////////////////////////////////////////
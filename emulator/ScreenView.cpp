@@ -456,7 +456,7 @@ void ScreenView_ProcessKeyboard()
 
 //        DebugPrintFormat(_T("KeyEvent: 0x%0x %d %d\r\n"), bkscan, pressed, ctrl);
 
-        g_pBoard->KeyboardEvent(bkscan, pressed);
+        Emulator_KeyboardEvent(bkscan, pressed);
     }
 }
 
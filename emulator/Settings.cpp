@@ -12,6 +12,7 @@ MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
 
 #include "stdafx.h"
 #include "Main.h"
+#include "Profiler.h"
 
 //////////////////////////////////////////////////////////////////////
 
@@ -24,6 +25,25 @@ TCHAR m_Settings_IniPath[MAX_PATH];
 // Options
 
 int Option_AutoBoot = -1;
+bool Option_Headless = false;
+long Option_Frames = 0;
+TCHAR Option_PlayMovie[MAX_PATH] = { 0 };
+TCHAR Option_RecordMovie[MAX_PATH] = { 0 };
+TCHAR Option_HashLog[MAX_PATH] = { 0 };
+TCHAR Option_HashCompare[2][MAX_PATH] = { { 0 }, { 0 } };
+TCHAR Option_Bisect[16] = { 0 };
+bool Option_QuickFlush = false;
+bool Option_ColdBoot = false;
+TCHAR Option_Samples[MAX_PATH] = { 0 };
+TCHAR Option_SampleReport[MAX_PATH] = { 0 };
+TCHAR Option_Coverage[MAX_PATH] = { 0 };
+TCHAR Option_Metrics[MAX_PATH] = { 0 };
+TCHAR Option_CoverageMerge[2][MAX_PATH] = { { 0 }, { 0 } };
+TCHAR Option_CoverageDiff[2][MAX_PATH] = { { 0 }, { 0 } };
+TCHAR Option_CoverageListing[3][MAX_PATH] = { { 0 }, { 0 }, { 0 } };
+TCHAR Option_TraceDecode[2][MAX_PATH] = { { 0 }, { 0 } };
+TCHAR Option_TraceQuery[2][MAX_PATH] = { { 0 }, { 0 } };
+bool Option_TraceQueryStat = false;
 
 //////////////////////////////////////////////////////////////////////
 
@@ -41,6 +61,14 @@ void Settings_Done()
 {
 }
 
+void Settings_GetFilePath(LPCTSTR sFileName, LPTSTR sFilePath)
+{
+    _tcsncpy_s(sFilePath, MAX_PATH, m_Settings_IniPath, _TRUNCATE);
+    TCHAR* pName = _tcsrchr(sFilePath, _T('\\'));
+    pName = (pName != nullptr) ? pName + 1 : sFilePath;
+    _tcsncpy_s(pName, MAX_PATH - (pName - sFilePath), sFileName, _TRUNCATE);
+}
+
 BOOL Settings_SaveStringValue(LPCTSTR sName, LPCTSTR sValue)
 {
     BOOL result = WritePrivateProfileString(
@@ -288,6 +316,14 @@ SETTINGS_GETSET_DWORD(Autostart, _T("Autostart"), BOOL, FALSE);
 
 SETTINGS_GETSET_DWORD(RealSpeed, _T("RealSpeed"), WORD, 1);
 
+SETTINGS_GETSET_DWORD(RunAhead, _T("RunAhead"), WORD, 0);
+
+SETTINGS_GETSET_DWORD(AutoSave, _T("AutoSave"), WORD, 0);
+
+SETTINGS_GETSET_DWORD(BootCache, _T("BootCache"), BOOL, FALSE);
+
+SETTINGS_GETSET_DWORD(SampleInterval, _T("SampleInterval"), DWORD, PROFILER_SAMPLE_INTERVAL);
+
 SETTINGS_GETSET_DWORD(Sound, _T("Sound"), BOOL, FALSE);
 SETTINGS_GETSET_DWORD(SoundVolume, _T("SoundVolume"), WORD, 0x3fff);
 
@@ -0,0 +1,885 @@
+﻿/*  This file is part of MK90BTL.
+    MK90BTL is free software: you can redistribute it and/or modify it under the terms
+of the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+    MK90BTL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License along with
+MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
+
+// TraceLog.cpp
+
+#include "stdafx.h"
+#include <stdio.h>
+#include <Share.h>
+#include <vector>
+#include "Main.h"
+#include "Emulator.h"
+#include "TraceLog.h"
+#include "util/LzCodec.h"
+#include "emubase\Emubase.h"
+
+//////////////////////////////////////////////////////////////////////
+
+
+const int TRACELOG_BLOCK_COUNT = 4;
+const size_t TRACELOG_BLOCK_SIZE = TRACELOG_BLOCK_RECORDS * sizeof(CTraceRecord);
+
+// The board fills the capture block; the records go to the write log and to the trace file blocks
+CTraceRecord* m_pTraceLogCapture = nullptr;
+bool m_okTraceLogCapturing = false;
+uint32_t m_dwTraceLogFileFlags = TRACE_NONE;  // Trace flags asked for the trace file
+TRACELOGCAPTURECALLBACK m_TraceLogCaptureCallback = nullptr;
+// The blocks are used in turn: the emulator fills the block, the writer thread writes it and frees it
+CTraceRecord* m_pTraceLogBlocks[TRACELOG_BLOCK_COUNT];
+int m_nTraceLogBlockRecords[TRACELOG_BLOCK_COUNT];  // Records in the filled block
+volatile LONG m_nTraceLogFillIndex = 0;  // Blocks filled so far, changed by the emulator thread only
+LONG m_nTraceLogWriteIndex = 0;  // Blocks written so far, changed by the writer thread only
+HANDLE m_hTraceLogFilled = NULL;  // Semaphore: filled blocks to write
+HANDLE m_hTraceLogFree = NULL;  // Semaphore: free blocks to fill
+HANDLE m_hTraceLogThread = NULL;
+FILE* m_fpTraceLog = nullptr;
+volatile LONG m_okTraceLogWriteError = FALSE;
+// Used by the writer thread only
+uint8_t* m_pTraceLogPacked = nullptr;  // Compressed block
+uint64_t m_nTraceLogOffset = 0;  // File size written so far
+uint32_t m_nTraceLogFrame = 0;  // Frame number at the end of the last block written
+std::vector<TraceLogIndexEntry> m_TraceLogIndex;
+
+// Opcode group names, the group number is stored in the file: add the new names to the end only
+static const LPCTSTR TraceLog_OpcodeGroupNames[] =
+{
+    _T("unknown"), _T("HALT"), _T("WAIT"), _T("RTI"), _T("BPT"), _T("IOT"), _T("RESET"), _T("RTT"), _T("NOP"),
+    _T("CLC"), _T("CLV"), _T("CLVC"), _T("CLZ"), _T("CLZC"), _T("CLZV"), _T("CLZVC"), _T("CLN"), _T("CLNC"),
+    _T("CLNV"), _T("CLNVC"), _T("CLNZ"), _T("CLNZC"), _T("CLNZV"), _T("CCC"), _T("NOP260"), _T("SEC"),
+    _T("SEV"), _T("SEVC"), _T("SEZ"), _T("SEZC"), _T("SEZV"), _T("SEZVC"), _T("SEN"), _T("SENC"), _T("SENV"),
+    _T("SENVC"), _T("SENZ"), _T("SENZC"), _T("SENZV"), _T("SCC"), _T("RETURN"), _T("RTS"), _T("JMP"),
+    _T("SWAB"), _T("MARK"), _T("SXT"), _T("MTPS"), _T("MFPS"), _T("CLR"), _T("CLRB"), _T("COM"), _T("COMB"),
+    _T("INC"), _T("INCB"), _T("DEC"), _T("DECB"), _T("NEG"), _T("NEGB"), _T("ADC"), _T("ADCB"), _T("SBC"),
+    _T("SBCB"), _T("TST"), _T("TSTB"), _T("ROR"), _T("RORB"), _T("ROL"), _T("ROLB"), _T("ASR"), _T("ASRB"),
+    _T("ASL"), _T("ASLB"), _T("BR"), _T("BNE"), _T("BEQ"), _T("BGE"), _T("BLT"), _T("BGT"), _T("BLE"),
+    _T("BPL"), _T("BMI"), _T("BHI"), _T("BLOS"), _T("BVC"), _T("BVS"), _T("BHIS"), _T("BLO"), _T("EMT"),
+    _T("TRAP"), _T("CALL"), _T("JSR"), _T("MUL"), _T("DIV"), _T("ASH"), _T("ASHC"), _T("XOR"), _T("SOB"),
+    _T("MOV"), _T("MOVB"), _T("CMP"), _T("CMPB"), _T("BIT"), _T("BITB"), _T("BIC"), _T("BICB"), _T("BIS"),
+    _T("BISB"), _T("ADD"), _T("SUB")
+};
+const int TRACELOG_OPCODE_GROUP_NAMES = sizeof(TraceLog_OpcodeGroupNames) / sizeof(TraceLog_OpcodeGroupNames[0]);
+uint8_t m_TraceLogOpcodeGroups[65536];  // Opcode group by the instruction word
+bool m_okTraceLogOpcodeGroups = false;
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+int TraceLog_GetRecordClass(const CTraceRecord& record)
+{
+    if (record.type == TRACE_RECORD_INTERRUPT)
+        return TRACELOG_CLASS_INTERRUPT;
+    if (record.type == TRACE_RECORD_WRITE)
+        return TRACELOG_CLASS_WRITE;
+    if (record.type == TRACE_RECORD_FRAME)
+        return TRACELOG_CLASS_FRAME;
+
+    uint16_t instr = record.words[0];
+    if ((instr & 0070000) == 0010000)  // MOV, MOVB
+        return TRACELOG_CLASS_MOVE;
+    if ((instr >= 0000400 && instr <= 0003777) || (instr >= 0100000 && instr <= 0103777) ||
+        (instr & 0177000) == 0077000)  // Branches, SOB
+        return TRACELOG_CLASS_BRANCH;
+    if ((instr & 0177700) == 0000100 || (instr & 0177000) == 0004000 || (instr & 0177770) == 0000200 ||
+        instr == 0000002 || instr == 0000006 || (instr & 0177700) == 0006400)  // JMP, JSR, RTS, RTI, RTT, MARK
+        return TRACELOG_CLASS_JUMP;
+    if ((instr & 0177000) == 0104000 || instr == 0000003 || instr == 0000004)  // EMT, TRAP, BPT, IOT
+        return TRACELOG_CLASS_TRAP;
+    return TRACELOG_CLASS_OTHER;
+}
+
+uint64_t TraceLog_GetRecordCycle(const CTraceRecord& record)
+{
+    return record.cycle | ((uint64_t)record.cycleHigh << 32);
+}
+
+LPCTSTR TraceLog_GetOpcodeGroupName(int group)
+{
+    return (group >= 0 && group < TRACELOG_OPCODE_GROUP_NAMES) ? TraceLog_OpcodeGroupNames[group] : nullptr;
+}
+
+// Find the group for every instruction word by the disassembler mnemonic, once.
+// Called on the main thread before the writer thread starts, the writer thread only reads the table.
+static void TraceLog_InitOpcodeGroups()
+{
+    if (m_okTraceLogOpcodeGroups)
+        return;
+
+    int group = 0;
+    for (int opcode = 0; opcode < 65536; opcode++)
+    {
+        uint16_t words[3] = { (uint16_t)opcode, 0, 0 };
+        TCHAR instr[8];
+        TCHAR args[32];
+        DisassembleInstruction(words, 0, instr, args);
+        if (_tcscmp(TraceLog_OpcodeGroupNames[group], instr) != 0)  // The neighbour opcodes mostly have the same mnemonic
+        {
+            group = 0;
+            for (int i = 1; i < TRACELOG_OPCODE_GROUP_NAMES; i++)
+            {
+                if (_tcscmp(TraceLog_OpcodeGroupNames[i], instr) == 0)
+                {
+                    group = i;
+                    break;
+                }
+            }
+        }
+        m_TraceLogOpcodeGroups[opcode] = (uint8_t)group;
+    }
+    m_okTraceLogOpcodeGroups = true;
+}
+
+// Bit number of the record class, the class is one TRACELOG_CLASS_XXX bit
+static int TraceLog_GetClassBit(int recordClass)
+{
+    int bit = 0;
+    while (bit < TRACELOG_CLASS_COUNT - 1 && recordClass != (1 << bit))
+        bit++;
+    return bit;
+}
+
+// Make the block summary for the index; the frame is the frame number before the block
+static void TraceLog_MakeBlockHeader(const CTraceRecord* pRecords, int count, uint32_t frame, TraceLogBlockHeader* pHeader)
+{
+    ::memset(pHeader, 0, sizeof(TraceLogBlockHeader));
+    pHeader->recordCount = (uint32_t)count;
+    pHeader->firstCycle = TraceLog_GetRecordCycle(pRecords[0]);
+    pHeader->lastCycle = TraceLog_GetRecordCycle(pRecords[count - 1]);
+    for (int i = 0; i < count; i++)
+    {
+        const CTraceRecord& record = pRecords[i];
+        int recordClass = TraceLog_GetRecordClass(record);
+        pHeader->classMask |= recordClass;
+        pHeader->classCounts[TraceLog_GetClassBit(recordClass)]++;
+        if (recordClass & TRACELOG_CLASS_INSTRUCTION)
+            pHeader->opcodeCounts[m_TraceLogOpcodeGroups[record.words[0]]]++;
+        if (recordClass == TRACELOG_CLASS_FRAME)
+            frame = record.words[0] | ((uint32_t)record.words[1] << 16);
+        else
+            pHeader->pcPages |= 1ull << (record.reg[7] >> 10);
+        if (recordClass == TRACELOG_CLASS_WRITE)
+            pHeader->writePages |= 1ull << (record.words[0] >> 10);
+        if (i == 0)
+            pHeader->firstFrame = frame;
+    }
+    pHeader->lastFrame = frame;
+}
+
+bool TraceLog_IsRunning() { return m_hTraceLogThread != NULL; }
+uint32_t TraceLog_GetFlags() { return m_dwTraceLogFileFlags; }
+
+// Compress the block and write it together with its header, add the block to the index
+static bool TraceLog_WriteBlock(const CTraceRecord* pRecords, int count)
+{
+    TraceLogIndexEntry entry;
+    entry.offset = m_nTraceLogOffset;
+    TraceLog_MakeBlockHeader(pRecords, count, m_nTraceLogFrame, &entry.header);
+    m_nTraceLogFrame = entry.header.lastFrame;
+
+    size_t size = count * sizeof(CTraceRecord);
+    const uint8_t* pData = reinterpret_cast<const uint8_t*>(pRecords);
+    size_t packedSize = LzCodec_Compress(pData, size, m_pTraceLogPacked, size - 1);
+    if (packedSize > 0)
+        pData = m_pTraceLogPacked;
+    else
+        packedSize = size;  // Not compressible, store as is
+    entry.header.packedSize = (uint32_t)packedSize;
+
+    if (::fwrite(&entry.header, 1, sizeof(entry.header), m_fpTraceLog) != sizeof(entry.header) ||
+        ::fwrite(pData, 1, packedSize, m_fpTraceLog) != packedSize)
+        return false;
+
+    m_nTraceLogOffset += sizeof(entry.header) + packedSize;
+    m_TraceLogIndex.push_back(entry);
+    return true;
+}
+
+static DWORD WINAPI TraceLog_WriterThreadProc(LPVOID /*lpParameter*/)
+{
+    for (;;)
+    {
+        ::WaitForSingleObject(m_hTraceLogFilled, INFINITE);
+        if (m_nTraceLogWriteIndex == m_nTraceLogFillIndex)
+            break;  // No more blocks, the trace is stopped
+
+        int index = m_nTraceLogWriteIndex % TRACELOG_BLOCK_COUNT;
+        if (!TraceLog_WriteBlock(m_pTraceLogBlocks[index], m_nTraceLogBlockRecords[index]))
+            ::InterlockedExchange(&m_okTraceLogWriteError, TRUE);
+
+        m_nTraceLogWriteIndex++;
+        ::ReleaseSemaphore(m_hTraceLogFree, 1, NULL);
+    }
+    return 0;
+}
+
+// Copy the records asked for the trace file to the next free block, pass the block to the writer thread
+static void TraceLog_PassBlock(const CTraceRecord* pRecords, int count)
+{
+    ::WaitForSingleObject(m_hTraceLogFree, INFINITE);  // Wait if the disk is slower than the emulator
+
+    int index = m_nTraceLogFillIndex % TRACELOG_BLOCK_COUNT;
+    CTraceRecord* pBlock = m_pTraceLogBlocks[index];
+    int blockCount = 0;
+    bool okWrites = (m_dwTraceLogFileFlags & TRACE_MEMWRITE) != 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (pRecords[i].type == TRACE_RECORD_WRITE && !okWrites)
+            continue;  // Captured for the write log only
+        pBlock[blockCount++] = pRecords[i];
+    }
+    if (blockCount == 0)
+    {
+        ::ReleaseSemaphore(m_hTraceLogFree, 1, NULL);
+        return;
+    }
+
+    m_nTraceLogBlockRecords[index] = blockCount;
+    ::InterlockedIncrement(&m_nTraceLogFillIndex);
+    ::ReleaseSemaphore(m_hTraceLogFilled, 1, NULL);
+}
+
+// Pass the captured records to the write log and to the trace file writer, the capture block is reused
+static CTraceRecord* TraceLog_CaptureCallback(CTraceRecord* pBlock, int count)
+{
+    if (m_TraceLogCaptureCallback != nullptr)
+        m_TraceLogCaptureCallback(pBlock, count);
+    if (m_hTraceLogThread != NULL)
+        TraceLog_PassBlock(pBlock, count);
+    return pBlock;
+}
+
+// Attach the capture to the board or detach it, set the board trace flags for the trace file and the write log
+static bool TraceLog_UpdateCapture()
+{
+    uint32_t dwTrace = (m_hTraceLogThread != NULL) ? m_dwTraceLogFileFlags : TRACE_NONE;
+    if (m_TraceLogCaptureCallback != nullptr)
+        dwTrace |= TRACE_MEMWRITE;
+
+    if (dwTrace != TRACE_NONE && !m_okTraceLogCapturing)
+    {
+        if (m_pTraceLogCapture == nullptr)
+            m_pTraceLogCapture = static_cast<CTraceRecord*>(::malloc(TRACELOG_BLOCK_SIZE));
+        if (m_pTraceLogCapture == nullptr)
+            return false;
+        g_pBoard->SetTraceCallback(TraceLog_CaptureCallback, m_pTraceLogCapture, TRACELOG_BLOCK_RECORDS);
+        m_okTraceLogCapturing = true;
+    }
+    else if (dwTrace == TRACE_NONE && m_okTraceLogCapturing)
+    {
+        g_pBoard->FlushTrace();
+        g_pBoard->SetTraceCallback(nullptr, nullptr, 0);
+        m_okTraceLogCapturing = false;
+        ::free(m_pTraceLogCapture);  m_pTraceLogCapture = nullptr;
+    }
+    g_pBoard->SetTrace(dwTrace);
+    return true;
+}
+
+void TraceLog_SetFlags(uint32_t dwFlags)
+{
+    TraceLog_FlushCapture();  // The records captured before go with the old flags
+    m_dwTraceLogFileFlags = dwFlags;
+    TraceLog_UpdateCapture();
+}
+
+bool TraceLog_SetCaptureCallback(TRACELOGCAPTURECALLBACK callback)
+{
+    TraceLog_FlushCapture();
+    m_TraceLogCaptureCallback = callback;
+    if (TraceLog_UpdateCapture())
+        return true;
+    m_TraceLogCaptureCallback = nullptr;
+    return false;
+}
+
+void TraceLog_FlushCapture()
+{
+    if (m_okTraceLogCapturing)
+        g_pBoard->FlushTrace();
+}
+
+bool TraceLog_Start(LPCTSTR sFilePath, uint32_t dwFlags)
+{
+    TraceLog_Stop();
+    TraceLog_FlushCapture();  // The records captured before go to the write log only
+    TraceLog_InitOpcodeGroups();
+
+    for (int i = 0; i < TRACELOG_BLOCK_COUNT; i++)
+    {
+        m_pTraceLogBlocks[i] = static_cast<CTraceRecord*>(::malloc(TRACELOG_BLOCK_SIZE));
+        if (m_pTraceLogBlocks[i] == nullptr)
+        {
+            TraceLog_Stop();
+            return false;
+        }
+    }
+    m_pTraceLogPacked = static_cast<uint8_t*>(::malloc(TRACELOG_BLOCK_SIZE));
+    if (m_pTraceLogPacked == nullptr)
+    {
+        TraceLog_Stop();
+        return false;
+    }
+
+    m_fpTraceLog = ::_tfsopen(sFilePath, _T("wb"), _SH_DENYWR);
+    if (m_fpTraceLog == nullptr)
+    {
+        TraceLog_Stop();
+        return false;
+    }
+
+    TraceLogFileHeader header;
+    header.header1 = MK90TRACE_HEADER1;
+    header.header2 = MK90TRACE_HEADER2;
+    header.version = MK90TRACE_VERSION;
+    header.configuration = (uint32_t)g_nEmulatorConfiguration;
+    ::fwrite(&header, 1, sizeof(header), m_fpTraceLog);
+    m_nTraceLogOffset = sizeof(header);
+    m_nTraceLogFrame = 0;
+    m_TraceLogIndex.clear();
+
+    m_nTraceLogFillIndex = m_nTraceLogWriteIndex = 0;
+    m_okTraceLogWriteError = FALSE;
+    m_hTraceLogFilled = ::CreateSemaphore(NULL, 0, TRACELOG_BLOCK_COUNT + 1, NULL);
+    m_hTraceLogFree = ::CreateSemaphore(NULL, TRACELOG_BLOCK_COUNT, TRACELOG_BLOCK_COUNT, NULL);
+    if (m_hTraceLogFilled != NULL && m_hTraceLogFree != NULL)
+        m_hTraceLogThread = ::CreateThread(NULL, 0, TraceLog_WriterThreadProc, NULL, 0, NULL);
+    if (m_hTraceLogThread == NULL)
+    {
+        TraceLog_Stop();
+        return false;
+    }
+
+    m_dwTraceLogFileFlags = dwFlags;
+    if (!TraceLog_UpdateCapture())
+    {
+        TraceLog_Stop();
+        return false;
+    }
+    return true;
+}
+
+void TraceLog_Stop()
+{
+    if (m_hTraceLogThread != NULL)
+    {
+        TraceLog_FlushCapture();
+
+        ::ReleaseSemaphore(m_hTraceLogFilled, 1, NULL);  // Wake up the thread with no block to write
+        ::WaitForSingleObject(m_hTraceLogThread, INFINITE);
+        ::CloseHandle(m_hTraceLogThread);
+        m_hTraceLogThread = NULL;
+        TraceLog_UpdateCapture();  // The capture goes on for the write log
+
+        // Write the index and the trailer pointing to it
+        TraceLogTrailer trailer;
+        trailer.marker = MK90TRACE_INDEX;
+        trailer.blockCount = (uint32_t)m_TraceLogIndex.size();
+        trailer.indexOffset = m_nTraceLogOffset;
+        size_t indexSize = m_TraceLogIndex.size() * sizeof(TraceLogIndexEntry);
+        if ((indexSize > 0 && ::fwrite(&m_TraceLogIndex[0], 1, indexSize, m_fpTraceLog) != indexSize) ||
+            ::fwrite(&trailer, 1, sizeof(trailer), m_fpTraceLog) != sizeof(trailer))
+            m_okTraceLogWriteError = TRUE;
+
+        if (m_okTraceLogWriteError)
+            DebugLog(_T("Failed to write the binary trace file.\r\n"));
+    }
+
+    if (m_hTraceLogFilled != NULL)
+    {
+        ::CloseHandle(m_hTraceLogFilled);  m_hTraceLogFilled = NULL;
+    }
+    if (m_hTraceLogFree != NULL)
+    {
+        ::CloseHandle(m_hTraceLogFree);  m_hTraceLogFree = NULL;
+    }
+    if (m_fpTraceLog != nullptr)
+    {
+        ::fclose(m_fpTraceLog);  m_fpTraceLog = nullptr;
+    }
+    for (int i = 0; i < TRACELOG_BLOCK_COUNT; i++)
+    {
+        ::free(m_pTraceLogBlocks[i]);  m_pTraceLogBlocks[i] = nullptr;
+    }
+    ::free(m_pTraceLogPacked);  m_pTraceLogPacked = nullptr;
+    m_TraceLogIndex.clear();
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Trace file reader
+
+struct TRACELOGFILE
+{
+    FILE* fpFile;
+    uint32_t configuration;
+    std::vector<TraceLogIndexEntry> index;
+    uint8_t* pPacked;  // Compressed block buffer, TRACELOG_BLOCK_SIZE bytes
+};
+
+// Check the block header read from the file
+static bool TraceLog_IsBlockHeaderValid(const TraceLogBlockHeader& header, uint64_t offset, uint64_t fileSize)
+{
+    return header.recordCount > 0 && header.recordCount <= (uint32_t)TRACELOG_BLOCK_RECORDS &&
+            header.packedSize > 0 && header.packedSize <= header.recordCount * sizeof(CTraceRecord) &&
+            offset + sizeof(TraceLogBlockHeader) + header.packedSize <= fileSize;
+}
+
+// Read the index pointed by the trailer; returns false if there is no valid index
+static bool TraceLog_LoadIndex(TRACELOGFILE* pTraceLog, uint64_t fileSize)
+{
+    TraceLogTrailer trailer;
+    if (fileSize < sizeof(TraceLogFileHeader) + sizeof(trailer) ||
+        ::_fseeki64(pTraceLog->fpFile, (__int64)(fileSize - sizeof(trailer)), SEEK_SET) != 0 ||
+        ::fread(&trailer, 1, sizeof(trailer), pTraceLog->fpFile) != sizeof(trailer) ||
+        trailer.marker != MK90TRACE_INDEX ||
+        trailer.indexOffset + (uint64_t)trailer.blockCount * sizeof(TraceLogIndexEntry) + sizeof(trailer) != fileSize)
+        return false;
+
+    pTraceLog->index.resize(trailer.blockCount);
+    size_t indexSize = trailer.blockCount * sizeof(TraceLogIndexEntry);
+    if (indexSize == 0)
+        return true;
+    if (::_fseeki64(pTraceLog->fpFile, (__int64)trailer.indexOffset, SEEK_SET) != 0 ||
+        ::fread(&pTraceLog->index[0], 1, indexSize, pTraceLog->fpFile) != indexSize)
+        return false;
+    for (size_t i = 0; i < pTraceLog->index.size(); i++)
+    {
+        const TraceLogIndexEntry& entry = pTraceLog->index[i];
+        if (!TraceLog_IsBlockHeaderValid(entry.header, entry.offset, trailer.indexOffset))
+            return false;
+    }
+    return true;
+}
+
+// Rebuild the index reading the block headers one by one, for the file with no index written
+static void TraceLog_ScanIndex(TRACELOGFILE* pTraceLog, uint64_t fileSize)
+{
+    pTraceLog->index.clear();
+    TraceLogIndexEntry entry;
+    entry.offset = sizeof(TraceLogFileHeader);
+    while (::_fseeki64(pTraceLog->fpFile, (__int64)entry.offset, SEEK_SET) == 0 &&
+           ::fread(&entry.header, 1, sizeof(entry.header), pTraceLog->fpFile) == sizeof(entry.header) &&
+           TraceLog_IsBlockHeaderValid(entry.header, entry.offset, fileSize))
+    {
+        pTraceLog->index.push_back(entry);
+        entry.offset += sizeof(entry.header) + entry.header.packedSize;
+    }
+}
+
+HTRACELOGFILE TraceLog_Open(LPCTSTR sFilePath)
+{
+    FILE* fpFile = ::_tfsopen(sFilePath, _T("rb"), _SH_DENYWR);
+    if (fpFile == nullptr)
+        return (HTRACELOGFILE) INVALID_HANDLE_VALUE;  // Failed to open file
+
+    TraceLogFileHeader header;
+    if (::fread(&header, 1, sizeof(header), fpFile) != sizeof(header) ||
+        header.header1 != MK90TRACE_HEADER1 || header.header2 != MK90TRACE_HEADER2 ||
+        (header.version >> 16) != (MK90TRACE_VERSION >> 16))
+    {
+        ::fclose(fpFile);
+        return (HTRACELOGFILE) INVALID_HANDLE_VALUE;  // Not a trace file
+    }
+
+    TraceLog_InitOpcodeGroups();
+
+    TRACELOGFILE* pTraceLog = new TRACELOGFILE();
+    pTraceLog->fpFile = fpFile;
+    pTraceLog->configuration = header.configuration;
+    pTraceLog->pPacked = static_cast<uint8_t*>(::malloc(TRACELOG_BLOCK_SIZE));
+    if (pTraceLog->pPacked == nullptr)
+    {
+        TraceLog_Close((HTRACELOGFILE) pTraceLog);
+        return (HTRACELOGFILE) INVALID_HANDLE_VALUE;  // Failed to allocate memory
+    }
+
+    ::_fseeki64(fpFile, 0, SEEK_END);
+    uint64_t fileSize = (uint64_t)::_ftelli64(fpFile);
+    if (!TraceLog_LoadIndex(pTraceLog, fileSize))
+        TraceLog_ScanIndex(pTraceLog, fileSize);
+
+    return (HTRACELOGFILE) pTraceLog;
+}
+
+void TraceLog_Close(HTRACELOGFILE tracelogfile)
+{
+    TRACELOGFILE* pTraceLog = (TRACELOGFILE*) tracelogfile;
+    if (pTraceLog == nullptr || pTraceLog == INVALID_HANDLE_VALUE)
+        return;
+
+    ::fclose(pTraceLog->fpFile);
+    ::free(pTraceLog->pPacked);
+    delete pTraceLog;
+}
+
+uint32_t TraceLog_GetConfiguration(HTRACELOGFILE tracelogfile)
+{
+    return ((TRACELOGFILE*) tracelogfile)->configuration;
+}
+
+int TraceLog_GetBlockCount(HTRACELOGFILE tracelogfile)
+{
+    return (int)((TRACELOGFILE*) tracelogfile)->index.size();
+}
+
+const TraceLogBlockHeader* TraceLog_GetBlockHeader(HTRACELOGFILE tracelogfile, int block)
+{
+    return &((TRACELOGFILE*) tracelogfile)->index[block].header;
+}
+
+bool TraceLog_ReadBlock(HTRACELOGFILE tracelogfile, int block, CTraceRecord* pRecords)
+{
+    TRACELOGFILE* pTraceLog = (TRACELOGFILE*) tracelogfile;
+    const TraceLogIndexEntry& entry = pTraceLog->index[block];
+
+    size_t size = entry.header.recordCount * sizeof(CTraceRecord);
+    size_t packedSize = entry.header.packedSize;
+    uint8_t* pBuffer = (packedSize == size) ? reinterpret_cast<uint8_t*>(pRecords) : pTraceLog->pPacked;
+    if (::_fseeki64(pTraceLog->fpFile, (__int64)(entry.offset + sizeof(TraceLogBlockHeader)), SEEK_SET) != 0 ||
+        ::fread(pBuffer, 1, packedSize, pTraceLog->fpFile) != packedSize)
+        return false;
+
+    if (packedSize == size)
+        return true;  // Stored as is
+    return LzCodec_Decompress(pTraceLog->pPacked, packedSize, reinterpret_cast<uint8_t*>(pRecords), size);
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Trace queries
+
+void TraceLog_InitQuery(TraceLogQuery* pQuery)
+{
+    pQuery->cycleFrom = 0;  pQuery->cycleTo = ~(uint64_t)0;
+    pQuery->frameFrom = 0;  pQuery->frameTo = 0xffffffff;
+    pQuery->pcFrom = 0;  pQuery->pcTo = 0177777;
+    pQuery->addressFrom = 0;  pQuery->addressTo = 0177777;
+    pQuery->classMask = TRACELOG_CLASS_INSTRUCTION | TRACELOG_CLASS_INTERRUPT | TRACELOG_CLASS_WRITE;
+}
+
+// Parse "N" or "N-M" value; returns false on wrong number
+static bool TraceLog_ParseRange(LPCTSTR sValue, int radix, uint64_t* pFrom, uint64_t* pTo)
+{
+    TCHAR* pEnd;
+    *pFrom = ::_tcstoui64(sValue, &pEnd, radix);
+    if (pEnd == sValue)
+        return false;
+    *pTo = *pFrom;
+    if (*pEnd == _T('-'))
+    {
+        LPCTSTR sValueTo = pEnd + 1;
+        *pTo = ::_tcstoui64(sValueTo, &pEnd, radix);
+        if (pEnd == sValueTo || *pTo < *pFrom)
+            return false;
+    }
+    return *pEnd == 0;
+}
+
+static const struct
+{
+    LPCTSTR name;
+    uint32_t mask;
+}
+TraceLog_ClassNames[] =
+{
+    { _T("move"), TRACELOG_CLASS_MOVE },
+    { _T("branch"), TRACELOG_CLASS_BRANCH },
+    { _T("jump"), TRACELOG_CLASS_JUMP },
+    { _T("trap"), TRACELOG_CLASS_TRAP },
+    { _T("other"), TRACELOG_CLASS_OTHER },
+    { _T("instr"), TRACELOG_CLASS_INSTRUCTION },
+    { _T("int"), TRACELOG_CLASS_INTERRUPT },
+    { _T("write"), TRACELOG_CLASS_WRITE },
+    { _T("frame"), TRACELOG_CLASS_FRAME },
+};
+
+// Parse the comma separated class names; returns 0 on unknown name
+static uint32_t TraceLog_ParseClasses(LPCTSTR sValue)
+{
+    uint32_t mask = 0;
+    while (*sValue != 0)
+    {
+        size_t length = ::_tcscspn(sValue, _T(","));
+        int i = 0;
+        const int count = sizeof(TraceLog_ClassNames) / sizeof(TraceLog_ClassNames[0]);
+        for (; i < count; i++)
+        {
+            if (::_tcslen(TraceLog_ClassNames[i].name) == length &&
+                ::_tcsncmp(TraceLog_ClassNames[i].name, sValue, length) == 0)
+                break;
+        }
+        if (i == count)
+            return 0;
+        mask |= TraceLog_ClassNames[i].mask;
+        sValue += length;
+        if (*sValue == _T(','))
+            sValue++;
+    }
+    return mask;
+}
+
+bool TraceLog_ParseQuery(LPCTSTR sQuery, TraceLogQuery* pQuery)
+{
+    TraceLog_InitQuery(pQuery);
+    uint32_t classMask = 0;
+    bool okWriteRange = false;
+
+    TCHAR term[64];
+    while (*sQuery != 0)
+    {
+        while (*sQuery == _T(' '))
+            sQuery++;
+        size_t length = ::_tcscspn(sQuery, _T(" "));
+        if (length == 0)
+            break;
+        if (length >= sizeof(term) / sizeof(TCHAR))
+            return false;
+        ::_tcsncpy_s(term, sQuery, length);
+        sQuery += length;
+
+        TCHAR* pValue = ::_tcschr(term, _T('='));
+        if (pValue == nullptr)
+            return false;
+        *pValue++ = 0;
+
+        uint64_t from, to;
+        uint32_t mask;
+        if (_tcscmp(term, _T("frame")) == 0 && TraceLog_ParseRange(pValue, 10, &from, &to) && to <= 0xffffffff)
+        {
+            pQuery->frameFrom = (uint32_t)from;  pQuery->frameTo = (uint32_t)to;
+        }
+        else if (_tcscmp(term, _T("cycle")) == 0 && TraceLog_ParseRange(pValue, 10, &from, &to))
+        {
+            pQuery->cycleFrom = from;  pQuery->cycleTo = to;
+        }
+        else if (_tcscmp(term, _T("pc")) == 0 && TraceLog_ParseRange(pValue, 8, &from, &to) && to <= 0177777)
+        {
+            pQuery->pcFrom = (uint16_t)from;  pQuery->pcTo = (uint16_t)to;
+        }
+        else if (_tcscmp(term, _T("write")) == 0 && TraceLog_ParseRange(pValue, 8, &from, &to) && to <= 0177777)
+        {
+            pQuery->addressFrom = (uint16_t)from;  pQuery->addressTo = (uint16_t)to;
+            okWriteRange = true;
+        }
+        else if (_tcscmp(term, _T("class")) == 0 && (mask = TraceLog_ParseClasses(pValue)) != 0)
+        {
+            classMask |= mask;
+        }
+        else
+            return false;
+    }
+
+    if (classMask != 0)
+        pQuery->classMask = classMask;
+    else if (okWriteRange)
+        pQuery->classMask = TRACELOG_CLASS_WRITE;
+    return true;
+}
+
+// Bit N set for every 1K page N touched by the address range
+static uint64_t TraceLog_GetPageMask(uint16_t addressFrom, uint16_t addressTo)
+{
+    uint64_t mask = 0;
+    for (int page = addressFrom >> 10; page <= (addressTo >> 10); page++)
+        mask |= 1ull << page;
+    return mask;
+}
+
+// The block has no records out of the query ranges, and the query takes every record of the classes asked for
+static bool TraceLog_IsBlockCovered(const TraceLogBlockHeader& header, const TraceLogQuery& query)
+{
+    uint32_t instructionMask = query.classMask & TRACELOG_CLASS_INSTRUCTION;
+    return header.firstCycle >= query.cycleFrom && header.lastCycle <= query.cycleTo &&
+            header.firstFrame >= query.frameFrom && header.lastFrame <= query.frameTo &&
+            query.pcFrom == 0 && query.pcTo == 0177777 && query.addressFrom == 0 && query.addressTo == 0177777 &&
+            (instructionMask == 0 || instructionMask == TRACELOG_CLASS_INSTRUCTION);  // Opcode counts are for all the instructions
+}
+
+// Run the query: pass the records to the callback, or count them when pCounts is set
+static LONGLONG TraceLog_DoQuery(HTRACELOGFILE tracelogfile, const TraceLogQuery& query,
+        TRACELOGQUERYCALLBACK callback, void* pParam, TraceLogCounts* pCounts)
+{
+    CTraceRecord* pRecords = static_cast<CTraceRecord*>(::malloc(TRACELOG_BLOCK_SIZE));
+    if (pRecords == nullptr)
+        return -1;
+
+    uint64_t pcPages = TraceLog_GetPageMask(query.pcFrom, query.pcTo);
+    uint64_t writePages = TraceLog_GetPageMask(query.addressFrom & 0177776, query.addressTo);
+    bool okWritesOnly = (query.classMask & ~TRACELOG_CLASS_WRITE) == 0;
+
+    LONGLONG passed = 0;
+    int blockCount = TraceLog_GetBlockCount(tracelogfile);
+    for (int block = 0; block < blockCount; block++)
+    {
+        // Skip the block by its summary; cycles and frames only grow
+        const TraceLogBlockHeader* pHeader = TraceLog_GetBlockHeader(tracelogfile, block);
+        if (pHeader->firstCycle > query.cycleTo || pHeader->firstFrame > query.frameTo)
+            break;
+        if (pHeader->lastCycle < query.cycleFrom || pHeader->lastFrame < query.frameFrom ||
+            (pHeader->classMask & query.classMask) == 0 ||
+            ((query.classMask & ~TRACELOG_CLASS_FRAME) != 0 && (pHeader->pcPages & pcPages) == 0) ||
+            (okWritesOnly && (pHeader->writePages & writePages) == 0))
+            continue;
+
+        // Count the block by its summary
+        if (pCounts != nullptr && TraceLog_IsBlockCovered(*pHeader, query))
+        {
+            for (int bit = 0; bit < TRACELOG_CLASS_COUNT; bit++)
+            {
+                if (query.classMask & (1 << bit))
+                {
+                    pCounts->classes[bit] += pHeader->classCounts[bit];
+                    passed += pHeader->classCounts[bit];
+                }
+            }
+            if (query.classMask & TRACELOG_CLASS_INSTRUCTION)
+            {
+                for (int group = 0; group < TRACELOG_OPCODE_GROUPS; group++)
+                    pCounts->opcodeGroups[group] += pHeader->opcodeCounts[group];
+            }
+            continue;
+        }
+
+        if (!TraceLog_ReadBlock(tracelogfile, block, pRecords))
+        {
+            ::free(pRecords);
+            return -1;
+        }
+
+        uint32_t frame = pHeader->firstFrame;
+        for (uint32_t i = 0; i < pHeader->recordCount; i++)
+        {
+            const CTraceRecord& record = pRecords[i];
+            int recordClass = TraceLog_GetRecordClass(record);
+            if (recordClass == TRACELOG_CLASS_FRAME)
+                frame = record.words[0] | ((uint32_t)record.words[1] << 16);
+            if ((recordClass & query.classMask) == 0 || frame < query.frameFrom || frame > query.frameTo)
+                continue;
+            uint64_t cycle = TraceLog_GetRecordCycle(record);
+            if (cycle < query.cycleFrom || cycle > query.cycleTo)
+                continue;
+            if (recordClass != TRACELOG_CLASS_FRAME && (record.reg[7] < query.pcFrom || record.reg[7] > query.pcTo))
+                continue;
+            if (recordClass == TRACELOG_CLASS_WRITE)
+            {
+                uint16_t addressLast = record.words[0] + ((record.flags & TRACE_RECORD_FLAG_BYTE) ? 0 : 1);
+                if (addressLast < query.addressFrom || record.words[0] > query.addressTo)
+                    continue;
+            }
+
+            passed++;
+            if (pCounts != nullptr)
+            {
+                pCounts->classes[TraceLog_GetClassBit(recordClass)]++;
+                if (recordClass & TRACELOG_CLASS_INSTRUCTION)
+                    pCounts->opcodeGroups[m_TraceLogOpcodeGroups[record.words[0]]]++;
+            }
+            else if (!callback(record, frame, pParam))
+            {
+                ::free(pRecords);
+                return passed;
+            }
+        }
+    }
+
+    ::free(pRecords);
+    return passed;
+}
+
+LONGLONG TraceLog_RunQuery(HTRACELOGFILE tracelogfile, const TraceLogQuery& query, TRACELOGQUERYCALLBACK callback, void* pParam)
+{
+    return TraceLog_DoQuery(tracelogfile, query, callback, pParam, nullptr);
+}
+
+LONGLONG TraceLog_CountQuery(HTRACELOGFILE tracelogfile, const TraceLogQuery& query, TraceLogCounts* pCounts)
+{
+    ::memset(pCounts, 0, sizeof(TraceLogCounts));
+    return TraceLog_DoQuery(tracelogfile, query, nullptr, nullptr, pCounts);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Trace decoder
+
+bool TraceLog_FormatRecord(const CTraceRecord& record, TCHAR* buffer, size_t bufferSize)
+{
+    if (record.type == TRACE_RECORD_INSTRUCTION)
+    {
+        uint16_t address = record.reg[7];
+        TCHAR bufaddr[7];
+        PrintOctalValue(bufaddr, address);
+
+        TCHAR instr[8];
+        TCHAR args[32];
+        DisassembleInstruction(record.words, address, instr, args);
+        _sntprintf_s(buffer, bufferSize, _TRUNCATE, _T("%s: %s\t%s"), bufaddr, instr, args);
+        return true;
+    }
+    else if (record.type == TRACE_RECORD_INTERRUPT)
+    {
+        uint16_t vector = record.words[0];
+        if (vector == 0000004)  // HALT
+            _sntprintf_s(buffer, bufferSize, _TRUNCATE, _T("CPU HALT interrupt vector=%06o PC=%06o PSW=%06o"), vector, record.reg[7], record.psw);
+        else if (vector != 000020 && vector != 000030 && vector != 000034)  // skip IOT/EMT/TRAP
+            _sntprintf_s(buffer, bufferSize, _TRUNCATE, _T("CPU interrupt vector=%06o PC=%06o PSW=%06o"), vector, record.reg[7], record.psw);
+        else
+            return false;
+        return true;
+    }
+    else if (record.type == TRACE_RECORD_WRITE)
+    {
+        if (record.flags & TRACE_RECORD_FLAG_BYTE)
+            _sntprintf_s(buffer, bufferSize, _TRUNCATE, _T("WRITE %06o byte=%03o old=%03o PC=%06o"),
+                    record.words[0], record.words[1], record.words[2], record.reg[7]);
+        else
+            _sntprintf_s(buffer, bufferSize, _TRUNCATE, _T("WRITE %06o word=%06o old=%06o PC=%06o"),
+                    record.words[0], record.words[1], record.words[2], record.reg[7]);
+        return true;
+    }
+    return false;  // Frame records have no text
+}
+
+int TraceLog_Decode(LPCTSTR sFilePath, LPCTSTR sTextPath)
+{
+    HTRACELOGFILE tracelogfile = TraceLog_Open(sFilePath);
+    if (tracelogfile == INVALID_HANDLE_VALUE)
+        return -1;
+
+    FILE* fpText = ::_tfsopen(sTextPath, _T("wt"), _SH_DENYWR);
+    if (fpText == nullptr)
+    {
+        TraceLog_Close(tracelogfile);
+        return -1;
+    }
+
+    int records = 0;
+    CTraceRecord* pRecords = static_cast<CTraceRecord*>(::malloc(TRACELOG_BLOCK_SIZE));
+    int blockCount = TraceLog_GetBlockCount(tracelogfile);
+    for (int block = 0; block < blockCount && pRecords != nullptr; block++)
+    {
+        if (!TraceLog_ReadBlock(tracelogfile, block, pRecords))
+            break;
+        int count = (int)TraceLog_GetBlockHeader(tracelogfile, block)->recordCount;
+        TCHAR buffer[80];
+        for (int i = 0; i < count; i++)
+        {
+            if (TraceLog_FormatRecord(pRecords[i], buffer, sizeof(buffer) / sizeof(TCHAR)))
+                ::_ftprintf(fpText, _T("%s\n"), buffer);
+        }
+        records += count;
+    }
+
+    ::free(pRecords);
+    ::fclose(fpText);
+    TraceLog_Close(tracelogfile);
+    return records;
+}
+
+
+//////////////////////////////////////////////////////////////////////
@@ -0,0 +1,159 @@
+﻿/*  This file is part of MK90BTL.
+    MK90BTL is free software: you can redistribute it and/or modify it under the terms
+of the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+    MK90BTL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License along with
+MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
+
+// TraceLog.h
+
+#pragma once
+
+//////////////////////////////////////////////////////////////////////
+//
+// Binary instruction trace: the board fills the blocks of CTraceRecord, the background thread writes them.
+// The trace flags filter the records at capture time, see TRACE_XXX; the text is made later by TraceLog_Decode().
+// The writer thread compresses every block and keeps the block summary, the summaries make the index
+// for the random access: by cycle, by frame, and skipping the blocks with no PC or write address wanted.
+// The capture is shared with the write log, see WriteLog.h: the cycles and the frames are counted from
+// the capture start, so the trace file started while the write log runs does not start from zero.
+// Trace file format:
+// The block summary has the record counts by class and by mnemonic, so the counts are summed up from the index
+// for the blocks the query covers completely, see TraceLog_CountQuery().
+//   16 bytes       Header, see TraceLogFileHeader
+//   600 bytes      Block header, see TraceLogBlockHeader
+//   N bytes        Block records, compressed in LZ4 block format or stored as is, see CTraceRecord
+//   ...            More blocks
+//   M * 608 bytes  Index: block file offset and the block header copy, see TraceLogIndexEntry
+//   16 bytes       Trailer, see TraceLogTrailer; with no trailer (the emulator crashed) the blocks are scanned
+
+#define MK90TRACE_HEADER1 0x30394B4D  // "MK90"
+#define MK90TRACE_HEADER2 0x21435254  // "TRC!"
+#define MK90TRACE_VERSION 0x00030000  // 3.0
+#define MK90TRACE_INDEX   0x21584449  // "IDX!"
+
+const int TRACELOG_BLOCK_RECORDS = 65536;  // Records per block at most, 2 MB unpacked
+
+const LPCTSTR FILENAME_TRACE = _T("trace.mk90trc");  // Default binary trace file
+const LPCTSTR FILENAME_TRACE_TEXT = _T("trace.txt");  // Default decoded trace file
+
+struct TraceLogFileHeader
+{
+    uint32_t header1;
+    uint32_t header2;
+    uint32_t version;
+    uint32_t configuration;
+};
+
+// Record classes for the queries and the block summary
+#define TRACELOG_CLASS_MOVE       0x0001  // MOV, MOVB
+#define TRACELOG_CLASS_BRANCH     0x0002  // Conditional and unconditional branches, SOB
+#define TRACELOG_CLASS_JUMP       0x0004  // JMP, JSR, RTS, RTI, RTT, MARK
+#define TRACELOG_CLASS_TRAP       0x0008  // EMT, TRAP, IOT, BPT
+#define TRACELOG_CLASS_OTHER      0x0010  // Any other instruction
+#define TRACELOG_CLASS_INTERRUPT  0x0020  // Interrupt records
+#define TRACELOG_CLASS_WRITE      0x0040  // Memory write records
+#define TRACELOG_CLASS_FRAME      0x0080  // Frame start records
+#define TRACELOG_CLASS_INSTRUCTION 0x001F  // All the instructions (mask)
+const int TRACELOG_CLASS_COUNT = 8;  // Class bits
+
+const int TRACELOG_OPCODE_GROUPS = 128;  // Opcode groups: instructions by mnemonic, see TraceLog_GetOpcodeGroupName()
+
+struct TraceLogBlockHeader
+{
+    uint32_t recordCount;
+    uint32_t packedSize;  // Equal to recordCount * 32 when the block is stored with no compression
+    uint64_t firstCycle;
+    uint64_t lastCycle;
+    uint32_t firstFrame;  // Frame number at the block start
+    uint32_t lastFrame;
+    uint32_t classMask;  // TRACELOG_CLASS_XXX of all the records
+    uint32_t reserved;
+    uint64_t pcPages;  // Bit N set: there are records with PC in 1K page N
+    uint64_t writePages;  // Bit N set: there are writes to 1K page N
+    uint32_t classCounts[TRACELOG_CLASS_COUNT];  // Records by TRACELOG_CLASS_XXX bit
+    uint32_t opcodeCounts[TRACELOG_OPCODE_GROUPS];  // Instruction records by opcode group
+};
+
+struct TraceLogIndexEntry
+{
+    uint64_t offset;  // Block header offset in the file
+    TraceLogBlockHeader header;
+};
+
+struct TraceLogTrailer
+{
+    uint32_t marker;  // MK90TRACE_INDEX
+    uint32_t blockCount;
+    uint64_t indexOffset;
+};
+
+bool TraceLog_Start(LPCTSTR sFilePath, uint32_t dwFlags);  // Create the file and capture the records, see TRACE_XXX
+void TraceLog_Stop();  // Write the rest of the records, the index, and close the file
+bool TraceLog_IsRunning();
+uint32_t TraceLog_GetFlags();  // Trace flags of the trace file
+void TraceLog_SetFlags(uint32_t dwFlags);  // Change the trace flags of the running trace file
+
+// Capture callback: takes every block of the records captured, the write records included
+typedef void (CALLBACK* TRACELOGCAPTURECALLBACK)(const CTraceRecord* pRecords, int count);
+// Set the write log callback, the memory writes are captured while it is set; nullptr = off. Returns false on error
+bool TraceLog_SetCaptureCallback(TRACELOGCAPTURECALLBACK callback);
+void TraceLog_FlushCapture();  // Pass the records captured so far to the callback and to the trace file
+// Write the trace as text, the same lines as the old text trace had plus the writes; returns number of records, -1 on error
+int  TraceLog_Decode(LPCTSTR sFilePath, LPCTSTR sTextPath);
+
+int  TraceLog_GetRecordClass(const CTraceRecord& record);  // Returns TRACELOG_CLASS_XXX
+LPCTSTR TraceLog_GetOpcodeGroupName(int group);  // Instruction mnemonic, nullptr for the group not used
+uint64_t TraceLog_GetRecordCycle(const CTraceRecord& record);
+
+DECLARE_HANDLE(HTRACELOGFILE);
+
+// Open the trace file for reading, load or rebuild the index; returns INVALID_HANDLE_VALUE on error
+HTRACELOGFILE TraceLog_Open(LPCTSTR sFilePath);
+void TraceLog_Close(HTRACELOGFILE tracelogfile);
+uint32_t TraceLog_GetConfiguration(HTRACELOGFILE tracelogfile);
+int  TraceLog_GetBlockCount(HTRACELOGFILE tracelogfile);
+const TraceLogBlockHeader* TraceLog_GetBlockHeader(HTRACELOGFILE tracelogfile, int block);
+// Read and unpack the block, the buffer is for TraceLog_GetBlockHeader()->recordCount records; returns false on error
+bool TraceLog_ReadBlock(HTRACELOGFILE tracelogfile, int block, CTraceRecord* pRecords);
+
+// Trace query: all the conditions should match; the ranges are inclusive
+struct TraceLogQuery
+{
+    uint64_t cycleFrom, cycleTo;
+    uint32_t frameFrom, frameTo;
+    uint16_t pcFrom, pcTo;  // PC of instruction, interrupt or write record
+    uint16_t addressFrom, addressTo;  // Write address; any write record touching the range matches
+    uint32_t classMask;  // TRACELOG_CLASS_XXX wanted
+};
+
+// Query callback: takes the matching record and its frame number; returns false to stop the query
+typedef bool (CALLBACK* TRACELOGQUERYCALLBACK)(const CTraceRecord& record, uint32_t frame, void* pParam);
+
+void TraceLog_InitQuery(TraceLogQuery* pQuery);  // Match everything but the frame records
+// Parse the query terms separated by spaces; returns false on unknown term. The terms:
+//   frame=N or frame=N-M   frame numbers, decimal
+//   cycle=N or cycle=N-M   CPU ticks from the trace start, decimal
+//   pc=A or pc=A-B         instruction address, octal
+//   class=name,name        move branch jump trap other instr int write frame
+//   write=A or write=A-B   writes to the address range, octal; sets class=write when no class given
+bool TraceLog_ParseQuery(LPCTSTR sQuery, TraceLogQuery* pQuery);
+// Run the query, the blocks that cannot match are skipped by the index; returns number of records passed, -1 on error
+LONGLONG TraceLog_RunQuery(HTRACELOGFILE tracelogfile, const TraceLogQuery& query, TRACELOGQUERYCALLBACK callback, void* pParam);
+
+struct TraceLogCounts
+{
+    uint64_t classes[TRACELOG_CLASS_COUNT];  // Records by TRACELOG_CLASS_XXX bit
+    uint64_t opcodeGroups[TRACELOG_OPCODE_GROUPS];  // Instructions by opcode group
+};
+// Count the records matching the query. The blocks covered by the query completely are counted by the index,
+// only the blocks on the edges of the frame or cycle range are unpacked. Returns number of records, -1 on error
+LONGLONG TraceLog_CountQuery(HTRACELOGFILE tracelogfile, const TraceLogQuery& query, TraceLogCounts* pCounts);
+// Format the record as one line of the text trace; returns false for the records with no text
+bool TraceLog_FormatRecord(const CTraceRecord& record, TCHAR* buffer, size_t bufferSize);
+
+
+//////////////////////////////////////////////////////////////////////
@@ -0,0 +1,336 @@
+﻿/*  This file is part of MK90BTL.
+    MK90BTL is free software: you can redistribute it and/or modify it under the terms
+of the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+    MK90BTL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License along with
+MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
+
+// WriteLog.cpp
+
+#include "stdafx.h"
+#include <vector>
+#include <algorithm>
+#include "Main.h"
+#include "Emulator.h"
+#include "TraceLog.h"
+#include "WriteLog.h"
+#include "util/LzCodec.h"
+#include "emubase\Emubase.h"
+
+//////////////////////////////////////////////////////////////////////
+
+
+const int WRITELOG_CHUNK_RECORDS = 4096;  // 64 KB per chunk unpacked
+const size_t WRITELOG_CHUNK_SIZE = WRITELOG_CHUNK_RECORDS * sizeof(CWriteLogRecord);
+const size_t WRITELOG_MEMORY_MAX = 64 * 1024 * 1024;  // Compressed chunks kept at most
+const int WRITELOG_PAGE_COUNT = 256;  // 256-byte pages
+
+struct WriteLogChunk
+{
+    uint64_t firstCycle;
+    uint64_t lastCycle;
+    uint32_t count;
+    uint32_t packedSize;  // Equal to count * 16 when the chunk is stored with no compression
+    uint8_t* pData;  // nullptr when the chunk is dropped
+};
+
+CWriteLogRecord* m_pWriteLogBlock = nullptr;  // Write records collected for the next chunk
+int m_nWriteLogBlockCount = 0;
+CWriteLogRecord* m_pWriteLogUnpacked = nullptr;  // The block to unpack the chunk for a query
+uint8_t* m_pWriteLogPacked = nullptr;
+bool m_okWriteLogRunning = false;
+// The chunks are numbered from the log start; m_WriteLogChunks[0] has number m_nWriteLogChunkBase,
+// the dropped chunks are forgotten when they take a half of the list, see WriteLog_DropOldChunks()
+std::vector<WriteLogChunk> m_WriteLogChunks;
+uint32_t m_nWriteLogChunkBase = 0;
+uint32_t m_nWriteLogFirstChunk = 0;  // Chunks below are dropped
+size_t m_nWriteLogPackedSize = 0;
+uint64_t m_nWriteLogRecords = 0;
+std::vector<uint32_t> m_WriteLogPages[WRITELOG_PAGE_COUNT];  // Chunk numbers by page, ascending
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+bool WriteLog_IsRunning() { return m_okWriteLogRunning; }
+
+uint64_t WriteLog_GetRecordCycle(const CWriteLogRecord& record)
+{
+    return record.cycle | ((uint64_t)record.cycleHigh << 32);
+}
+
+static uint32_t WriteLog_GetChunkEnd()  // Number of the next chunk to add
+{
+    return m_nWriteLogChunkBase + (uint32_t)m_WriteLogChunks.size();
+}
+
+static const WriteLogChunk& WriteLog_GetChunk(uint32_t chunkNumber)
+{
+    return m_WriteLogChunks[chunkNumber - m_nWriteLogChunkBase];
+}
+
+// Drop the oldest chunks to keep the memory limit
+static void WriteLog_DropOldChunks()
+{
+    while (m_nWriteLogPackedSize > WRITELOG_MEMORY_MAX && m_nWriteLogFirstChunk < WriteLog_GetChunkEnd())
+    {
+        WriteLogChunk& chunk = m_WriteLogChunks[m_nWriteLogFirstChunk++ - m_nWriteLogChunkBase];
+        m_nWriteLogPackedSize -= chunk.packedSize;
+        m_nWriteLogRecords -= chunk.count;
+        ::free(chunk.pData);  chunk.pData = nullptr;
+    }
+
+    // Forget the dropped chunks, so the lists do not grow with the log running for long
+    size_t dropped = m_nWriteLogFirstChunk - m_nWriteLogChunkBase;
+    if (dropped == 0 || dropped * 2 < m_WriteLogChunks.size())
+        return;
+    m_WriteLogChunks.erase(m_WriteLogChunks.begin(), m_WriteLogChunks.begin() + dropped);
+    m_nWriteLogChunkBase = m_nWriteLogFirstChunk;
+    for (int page = 0; page < WRITELOG_PAGE_COUNT; page++)
+    {
+        std::vector<uint32_t>& chunks = m_WriteLogPages[page];
+        chunks.erase(chunks.begin(), std::lower_bound(chunks.begin(), chunks.end(), m_nWriteLogFirstChunk));
+    }
+}
+
+// Compress the write block to the new chunk, add the chunk to the lists of the pages written
+static void WriteLog_PackBlock()
+{
+    int count = m_nWriteLogBlockCount;
+    if (count == 0)
+        return;
+    m_nWriteLogBlockCount = 0;
+
+    const CWriteLogRecord* pBlock = m_pWriteLogBlock;
+    size_t size = count * sizeof(CWriteLogRecord);
+    const uint8_t* pData = reinterpret_cast<const uint8_t*>(pBlock);
+    size_t packedSize = LzCodec_Compress(pData, size, m_pWriteLogPacked, size - 1);
+    if (packedSize > 0)
+        pData = m_pWriteLogPacked;
+    else
+        packedSize = size;  // Not compressible, store as is
+
+    WriteLogChunk chunk;
+    chunk.firstCycle = WriteLog_GetRecordCycle(pBlock[0]);
+    chunk.lastCycle = WriteLog_GetRecordCycle(pBlock[count - 1]);
+    chunk.count = (uint32_t)count;
+    chunk.packedSize = (uint32_t)packedSize;
+    chunk.pData = static_cast<uint8_t*>(::malloc(packedSize));
+    if (chunk.pData == nullptr)
+        return;  // Out of memory, the records are lost
+    ::memcpy(chunk.pData, pData, packedSize);
+
+    uint32_t chunkNumber = WriteLog_GetChunkEnd();
+    m_WriteLogChunks.push_back(chunk);
+    bool pages[WRITELOG_PAGE_COUNT] = { false };
+    for (int i = 0; i < count; i++)
+        pages[pBlock[i].address >> 8] = true;
+    for (int page = 0; page < WRITELOG_PAGE_COUNT; page++)
+    {
+        if (pages[page])
+            m_WriteLogPages[page].push_back(chunkNumber);
+    }
+
+    m_nWriteLogPackedSize += packedSize;
+    m_nWriteLogRecords += count;
+    WriteLog_DropOldChunks();
+}
+
+// Take the write records from the trace capture block
+static void CALLBACK WriteLog_CaptureCallback(const CTraceRecord* pRecords, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        const CTraceRecord& trace = pRecords[i];
+        if (trace.type != TRACE_RECORD_WRITE)
+            continue;
+
+        CWriteLogRecord* pRecord = m_pWriteLogBlock + m_nWriteLogBlockCount;
+        pRecord->cycle = trace.cycle;
+        pRecord->cycleHigh = trace.cycleHigh;
+        pRecord->pc = trace.reg[7];
+        pRecord->address = trace.words[0];
+        pRecord->flags = ((trace.flags & TRACE_RECORD_FLAG_BYTE) ? WRITELOG_FLAG_BYTE : 0) |
+                ((trace.flags & TRACE_RECORD_FLAG_HALTMODE) ? WRITELOG_FLAG_HALTMODE : 0);
+        pRecord->reserved = 0;
+        pRecord->oldValue = trace.words[2];
+        pRecord->newValue = trace.words[1];
+
+        if (++m_nWriteLogBlockCount == WRITELOG_CHUNK_RECORDS)
+            WriteLog_PackBlock();
+    }
+}
+
+// Pack all the writes captured so far, for a query
+static void WriteLog_Flush()
+{
+    if (m_okWriteLogRunning)
+        TraceLog_FlushCapture();
+    WriteLog_PackBlock();
+}
+
+bool WriteLog_Start()
+{
+    WriteLog_Stop();
+    WriteLog_Clear();
+
+    if (m_pWriteLogBlock == nullptr)
+    {
+        m_pWriteLogBlock = static_cast<CWriteLogRecord*>(::malloc(WRITELOG_CHUNK_SIZE));
+        m_pWriteLogUnpacked = static_cast<CWriteLogRecord*>(::malloc(WRITELOG_CHUNK_SIZE));
+        m_pWriteLogPacked = static_cast<uint8_t*>(::malloc(WRITELOG_CHUNK_SIZE));
+        if (m_pWriteLogBlock == nullptr || m_pWriteLogUnpacked == nullptr || m_pWriteLogPacked == nullptr)
+        {
+            WriteLog_Done();
+            return false;
+        }
+    }
+
+    if (!TraceLog_SetCaptureCallback(WriteLog_CaptureCallback))
+        return false;
+    m_okWriteLogRunning = true;
+    return true;
+}
+
+void WriteLog_Stop()
+{
+    if (!m_okWriteLogRunning)
+        return;
+
+    TraceLog_SetCaptureCallback(nullptr);  // Passes the rest of the writes before detaching
+    WriteLog_PackBlock();
+    m_okWriteLogRunning = false;
+}
+
+void WriteLog_Clear()
+{
+    if (m_okWriteLogRunning)
+        TraceLog_FlushCapture();
+    m_nWriteLogBlockCount = 0;
+
+    for (size_t i = 0; i < m_WriteLogChunks.size(); i++)
+        ::free(m_WriteLogChunks[i].pData);
+    m_WriteLogChunks.clear();
+    for (int page = 0; page < WRITELOG_PAGE_COUNT; page++)
+        m_WriteLogPages[page].clear();
+    m_nWriteLogChunkBase = m_nWriteLogFirstChunk = 0;
+    m_nWriteLogPackedSize = 0;
+    m_nWriteLogRecords = 0;
+}
+
+void WriteLog_Done()
+{
+    WriteLog_Stop();
+    WriteLog_Clear();
+
+    ::free(m_pWriteLogBlock);  m_pWriteLogBlock = nullptr;
+    ::free(m_pWriteLogUnpacked);  m_pWriteLogUnpacked = nullptr;
+    ::free(m_pWriteLogPacked);  m_pWriteLogPacked = nullptr;
+}
+
+uint64_t WriteLog_GetCycle()
+{
+    if (m_okWriteLogRunning)
+        return g_pBoard->GetTraceTick();
+    if (m_nWriteLogFirstChunk == WriteLog_GetChunkEnd())
+        return 0;
+    return m_WriteLogChunks.back().lastCycle;
+}
+
+void WriteLog_GetStats(WriteLogStats* pStats)
+{
+    WriteLog_Flush();
+
+    pStats->records = m_nWriteLogRecords;
+    pStats->chunks = (int)(WriteLog_GetChunkEnd() - m_nWriteLogFirstChunk);
+    pStats->packedSize = m_nWriteLogPackedSize;
+    pStats->firstCycle = (pStats->chunks > 0) ? WriteLog_GetChunk(m_nWriteLogFirstChunk).firstCycle : 0;
+}
+
+// Unpack the chunk to m_pWriteLogUnpacked; returns false on error
+static bool WriteLog_UnpackChunk(const WriteLogChunk& chunk)
+{
+    size_t size = chunk.count * sizeof(CWriteLogRecord);
+    if (chunk.packedSize == size)
+    {
+        ::memcpy(m_pWriteLogUnpacked, chunk.pData, size);  // Stored as is
+        return true;
+    }
+    return LzCodec_Decompress(chunk.pData, chunk.packedSize, reinterpret_cast<uint8_t*>(m_pWriteLogUnpacked), size);
+}
+
+static bool WriteLog_IsRecordInRange(const CWriteLogRecord& record, uint16_t addressFrom, uint16_t addressTo)
+{
+    uint16_t addressLast = record.address + ((record.flags & WRITELOG_FLAG_BYTE) ? 0 : 1);
+    return addressLast >= addressFrom && record.address <= addressTo;
+}
+
+int WriteLog_FindLastWriters(uint16_t address, uint64_t cycleBefore, CWriteLogRecord* pRecords, int maxCount)
+{
+    WriteLog_Flush();
+
+    int found = 0;
+    const std::vector<uint32_t>& chunks = m_WriteLogPages[address >> 8];
+    for (size_t i = chunks.size(); i > 0 && found < maxCount; i--)
+    {
+        uint32_t chunkNumber = chunks[i - 1];
+        if (chunkNumber < m_nWriteLogFirstChunk)
+            break;  // The older chunks are dropped
+        const WriteLogChunk& chunk = WriteLog_GetChunk(chunkNumber);
+        if (chunk.firstCycle >= cycleBefore)
+            continue;
+        if (!WriteLog_UnpackChunk(chunk))
+            break;
+
+        for (int j = (int)chunk.count - 1; j >= 0 && found < maxCount; j--)
+        {
+            const CWriteLogRecord& record = m_pWriteLogUnpacked[j];
+            if (WriteLog_GetRecordCycle(record) < cycleBefore && WriteLog_IsRecordInRange(record, address, address))
+                pRecords[found++] = record;
+        }
+    }
+    return found;
+}
+
+uint64_t WriteLog_FindWriters(uint16_t addressFrom, uint16_t addressTo, WRITELOGQUERYCALLBACK callback, void* pParam)
+{
+    WriteLog_Flush();
+
+    // Merge the chunk lists of the pages
+    std::vector<uint32_t> chunks;
+    for (int page = (addressFrom & 0177776) >> 8; page <= (addressTo >> 8); page++)
+    {
+        const std::vector<uint32_t>& pageChunks = m_WriteLogPages[page];
+        chunks.insert(chunks.end(), pageChunks.begin(), pageChunks.end());
+    }
+    std::sort(chunks.begin(), chunks.end());
+    chunks.erase(std::unique(chunks.begin(), chunks.end()), chunks.end());
+
+    uint64_t passed = 0;
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+        if (chunks[i] < m_nWriteLogFirstChunk)
+            continue;  // Dropped
+        const WriteLogChunk& chunk = WriteLog_GetChunk(chunks[i]);
+        if (!WriteLog_UnpackChunk(chunk))
+            break;
+
+        uint32_t count = chunk.count;
+        for (uint32_t j = 0; j < count; j++)
+        {
+            const CWriteLogRecord& record = m_pWriteLogUnpacked[j];
+            if (!WriteLog_IsRecordInRange(record, addressFrom, addressTo))
+                continue;
+            passed++;
+            if (!callback(record, pParam))
+                return passed;
+        }
+    }
+    return passed;
+}
+
+
+//////////////////////////////////////////////////////////////////////
@@ -0,0 +1,65 @@
+﻿/*  This file is part of MK90BTL.
+    MK90BTL is free software: you can redistribute it and/or modify it under the terms
+of the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+    MK90BTL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License along with
+MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
+
+// WriteLog.h
+
+#pragma once
+
+//////////////////////////////////////////////////////////////////////
+//
+// Memory write log keeps every write: cycle, PC, address, old and new value, see CWriteLogRecord.
+// The writes are taken from the binary trace capture, see TraceLog_SetCaptureCallback(), the cycles are the trace cycles.
+// The records are kept in memory in compressed chunks; every 256-byte page has the list of chunks
+// writing to it, so a query unpacks only the chunks touching the addresses asked.
+// When the log grows over the limit, the oldest chunks are dropped.
+
+#define WRITELOG_FLAG_BYTE      1
+#define WRITELOG_FLAG_HALTMODE  2
+
+// Memory write log record, made of TRACE_RECORD_WRITE trace record; 16 bytes
+struct CWriteLogRecord
+{
+    uint32_t    cycle;      // CPU ticks from the trace capture start, low 32 bits
+    uint16_t    cycleHigh;  // CPU ticks from the trace capture start, high 16 bits
+    uint16_t    pc;         // Address of the instruction writing
+    uint16_t    address;    // Word write has even address
+    uint8_t     flags;      // WRITELOG_FLAG_XXX
+    uint8_t     reserved;
+    uint16_t    oldValue;
+    uint16_t    newValue;
+};
+
+struct WriteLogStats
+{
+    uint64_t records;
+    int chunks;
+    size_t packedSize;  // Memory taken by the compressed chunks
+    uint64_t firstCycle;  // Cycle of the oldest record kept
+};
+
+// Writer callback: takes the write record matching the query; returns false to stop the query
+typedef bool (CALLBACK* WRITELOGQUERYCALLBACK)(const CWriteLogRecord& record, void* pParam);
+
+bool WriteLog_Start();  // Clear the log and start logging
+void WriteLog_Stop();  // Stop logging, the log is kept for the queries
+bool WriteLog_IsRunning();
+void WriteLog_Clear();
+void WriteLog_Done();  // Free the memory, called on the emulator exit
+
+uint64_t WriteLog_GetCycle();  // CPU ticks from the trace capture start: current while running, of the last write when stopped
+uint64_t WriteLog_GetRecordCycle(const CWriteLogRecord& record);
+void WriteLog_GetStats(WriteLogStats* pStats);
+// Find the last writes to the address before the cycle, latest first; returns number of records filled
+int  WriteLog_FindLastWriters(uint16_t address, uint64_t cycleBefore, CWriteLogRecord* pRecords, int maxCount);
+// Call the callback for every write touching the address range, oldest first; returns number of records passed
+uint64_t WriteLog_FindWriters(uint16_t addressFrom, uint16_t addressTo, WRITELOGQUERYCALLBACK callback, void* pParam);
+
+
+//////////////////////////////////////////////////////////////////////
@@ -0,0 +1,383 @@
+﻿/*  This file is part of MK90BTL.
+    MK90BTL is free software: you can redistribute it and/or modify it under the terms
+of the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+    MK90BTL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License along with
+MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
+
+// BisectMain.cpp
+// Standalone bisector: runs two machines from the same start state and reports where they diverge,
+// see CBisector. Uses only the emulator core, builds with g++, see Makefile.
+
+#include "emubase/Platform.h"
+#include "emubase/Board.h"
+#include "emubase/Processor.h"
+#include "emubase/Bisect.h"
+#include "emubase/CallGraph.h"
+#include "emubase/Sampler.h"
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+const uint32_t BISECT_DEFAULT_FRAMES = 25 * 60;  // One minute of the emulated time
+const int BISECT_TRACE_CAPACITY = 4096;  // Records in the trace block of the instrumented machine
+const int BISECT_SMP_MAXSIZE = 10240;
+
+static const char* const BISECT_REGISTER_NAME[8] = { "R0", "R1", "R2", "R3", "R4", "R5", "SP", "PC" };
+
+// Options
+static const char* m_sBisectVariant = "instrumented";
+static const char* m_sBisectRomFile = nullptr;
+static const char* m_sBisectSmpFile[2] = { nullptr, nullptr };
+static uint16_t m_nBisectConfiguration = 10;  // 10 = BASIC 1.0, 20 = BASIC 2.0, as EMU_CONF_XXX of the emulator
+static uint32_t m_nBisectBootFrames = 0;
+static uint32_t m_nBisectFrames = BISECT_DEFAULT_FRAMES;
+
+// Observers of the instrumented machine
+static CProcessorProfile* m_pBisectProfile = nullptr;
+static CProcessorWordProfile* m_pBisectWordProfile = nullptr;
+static CProcessorCoverage* m_pBisectCoverage = nullptr;
+static CMotherboardAccessCounters* m_pBisectAccessCounters = nullptr;
+static CPerfCounters* m_pBisectPerfCounters = nullptr;
+static CTraceRecord* m_pBisectTraceBlock = nullptr;
+static CCallGraph* m_pBisectCallGraph = nullptr;
+static CSampler* m_pBisectSampler = nullptr;
+
+
+//////////////////////////////////////////////////////////////////////
+
+static void Bisect_PrintUsage()
+{
+    printf(
+        "Usage: mk90bisect [options]\n"
+        "  --variant=VARIANT  none = both machines on the same path, instrumented = the second machine\n"
+        "                     with all the profiling and tracing observers attached; default instrumented\n"
+        "  --conf=N           10 = BASIC 1.0, 20 = BASIC 2.0; default 10\n"
+        "  --rom=FILE         32K ROM image; default basic10.rom or basic20.rom\n"
+        "  --smp0=FILE        SMP image for slot 0, also --smp1=FILE\n"
+        "  --boot=N           frames to run after the reset to get the start state; default 0\n"
+        "  --frames=N         frames to run both machines; default %u\n"
+        "Exit code: 0 = no divergence, 1 = diverged, 3 = error\n",
+        BISECT_DEFAULT_FRAMES);
+}
+
+// Returns the option value if the argument is the option, nullptr if not
+static const char* Bisect_GetOptionValue(const char* arg, const char* option)
+{
+    size_t len = strlen(option);
+    if (strncmp(arg, option, len) != 0 || arg[len] != '=')
+        return nullptr;
+    return arg + len + 1;
+}
+
+static bool Bisect_ParseCommandLine(int argc, char* argv[])
+{
+    for (int argn = 1; argn < argc; argn++)
+    {
+        const char* arg = argv[argn];
+        const char* value;
+        if ((value = Bisect_GetOptionValue(arg, "--variant")) != nullptr)
+            m_sBisectVariant = value;
+        else if ((value = Bisect_GetOptionValue(arg, "--conf")) != nullptr)
+            m_nBisectConfiguration = static_cast<uint16_t>(strtoul(value, nullptr, 10));
+        else if ((value = Bisect_GetOptionValue(arg, "--rom")) != nullptr)
+            m_sBisectRomFile = value;
+        else if ((value = Bisect_GetOptionValue(arg, "--smp0")) != nullptr)
+            m_sBisectSmpFile[0] = value;
+        else if ((value = Bisect_GetOptionValue(arg, "--smp1")) != nullptr)
+            m_sBisectSmpFile[1] = value;
+        else if ((value = Bisect_GetOptionValue(arg, "--boot")) != nullptr)
+            m_nBisectBootFrames = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+        else if ((value = Bisect_GetOptionValue(arg, "--frames")) != nullptr)
+            m_nBisectFrames = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+        else
+        {
+            printf("Unknown option: %s\n", arg);
+            return false;
+        }
+    }
+
+    if (strcmp(m_sBisectVariant, "none") != 0 && strcmp(m_sBisectVariant, "instrumented") != 0)
+    {
+        printf("Unknown bisector variant: %s\n", m_sBisectVariant);
+        return false;
+    }
+    if (m_nBisectConfiguration != 10 && m_nBisectConfiguration != 20)
+    {
+        printf("Unknown configuration: %u\n", m_nBisectConfiguration);
+        return false;
+    }
+    if (m_sBisectRomFile == nullptr)
+        m_sBisectRomFile = (m_nBisectConfiguration == 20) ? "basic20.rom" : "basic10.rom";
+    if (m_nBisectFrames == 0)
+        m_nBisectFrames = BISECT_DEFAULT_FRAMES;
+
+    return true;
+}
+
+// Read the whole file, up to maxSize bytes; returns the size read, or -1 on error
+static long Bisect_LoadFile(const char* sFileName, uint8_t* pBuffer, long maxSize)
+{
+    FILE* fpFile = ::fopen(sFileName, "rb");
+    if (fpFile == nullptr)
+        return -1;
+
+    long size = static_cast<long>(::fread(pBuffer, 1, maxSize, fpFile));
+    if (::ferror(fpFile) || ::fgetc(fpFile) != EOF)
+        size = -1;  // Read error, or the file is too big
+
+    ::fclose(fpFile);
+    return size;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+// Observers, see Headless_BisectAttachObservers()
+
+// The records are dropped, the trace is only to run the tracing code
+static CTraceRecord* Bisect_TraceCallback(CTraceRecord* pBlock, int /*count*/)
+{
+    return pBlock;
+}
+
+static void Bisect_EventCallback(int /*event*/, uint16_t /*param1*/, uint16_t /*param2*/, int /*step*/)
+{
+}
+
+// Attach all the profiling and tracing observers to the machine. Returns false if out of memory.
+static bool Bisect_AttachObservers(CMotherboard* pBoard)
+{
+    m_pBisectProfile = static_cast<CProcessorProfile*>(::calloc(1, sizeof(CProcessorProfile)));
+    m_pBisectWordProfile = static_cast<CProcessorWordProfile*>(::calloc(1, sizeof(CProcessorWordProfile)));
+    m_pBisectCoverage = static_cast<CProcessorCoverage*>(::calloc(1, sizeof(CProcessorCoverage)));
+    m_pBisectAccessCounters = static_cast<CMotherboardAccessCounters*>(::calloc(1, sizeof(CMotherboardAccessCounters)));
+    m_pBisectPerfCounters = static_cast<CPerfCounters*>(::calloc(1, sizeof(CPerfCounters)));
+    m_pBisectTraceBlock = static_cast<CTraceRecord*>(::calloc(BISECT_TRACE_CAPACITY, sizeof(CTraceRecord)));
+    if (m_pBisectProfile == nullptr || m_pBisectWordProfile == nullptr || m_pBisectCoverage == nullptr ||
+        m_pBisectAccessCounters == nullptr || m_pBisectPerfCounters == nullptr || m_pBisectTraceBlock == nullptr)
+        return false;
+    m_pBisectCallGraph = new CCallGraph();
+    if (!m_pBisectCallGraph->IsValid())
+    {
+        delete m_pBisectCallGraph;  m_pBisectCallGraph = nullptr;
+    }
+    m_pBisectSampler = new CSampler(65536);
+    m_pBisectSampler->SetInterval(4096);
+
+    CProcessor* pProc = pBoard->GetCPU();
+    pProc->SetProfile(m_pBisectProfile);
+    pProc->SetWordProfile(m_pBisectWordProfile);
+    pProc->SetCoverage(m_pBisectCoverage);
+    pProc->SetCallGraph(m_pBisectCallGraph);
+    pProc->SetSampler(m_pBisectSampler);
+    pBoard->SetAccessCounters(m_pBisectAccessCounters);
+    pBoard->SetPerfCounters(m_pBisectPerfCounters);
+    pBoard->SetEventCallback(Bisect_EventCallback);
+    pBoard->SetTraceCallback(Bisect_TraceCallback, m_pBisectTraceBlock, BISECT_TRACE_CAPACITY);
+    pBoard->SetTrace(TRACE_ALL);
+    return true;
+}
+
+// Called after the machine with the observers is deleted
+static void Bisect_FreeObservers()
+{
+    delete m_pBisectSampler;  m_pBisectSampler = nullptr;
+    delete m_pBisectCallGraph;  m_pBisectCallGraph = nullptr;
+    ::free(m_pBisectTraceBlock);  m_pBisectTraceBlock = nullptr;
+    ::free(m_pBisectPerfCounters);  m_pBisectPerfCounters = nullptr;
+    ::free(m_pBisectAccessCounters);  m_pBisectAccessCounters = nullptr;
+    ::free(m_pBisectCoverage);  m_pBisectCoverage = nullptr;
+    ::free(m_pBisectWordProfile);  m_pBisectWordProfile = nullptr;
+    ::free(m_pBisectProfile);  m_pBisectProfile = nullptr;
+}
+
+
+//////////////////////////////////////////////////////////////////////
+
+// Same report as Headless_PrintBisectResult(), with the instruction words instead of the disassembly
+static void Bisect_PrintResult(CBisector* pBisector, const BisectResult& result)
+{
+    CMotherboard* pBoardA = pBisector->GetBoardA();
+    CMotherboard* pBoardB = pBisector->GetBoardB();
+
+    printf("First divergent frame: %u\n", result.frame);
+    if (result.step == BISECT_STEP_FRAMESTART)
+        printf("The machines differ at the frame start, PC %06o\n", result.address);
+    else if (result.step == BISECT_STEP_NOTFOUND)
+        printf("The frame run again did not diverge, the run is not repeatable\n");
+    else
+    {
+        printf("CPU tick %d of the frame, frame tick %d\n", result.step, result.step / 16);
+
+        bool okHaltMode = pBoardA->GetCPU()->IsHaltMode();
+        int addrtype;
+        printf("Instruction: %06o ", result.address);
+        for (int i = 0; i < 3; i++)
+            printf(" %06o", pBoardA->GetWordView(static_cast<uint16_t>(result.address + i * 2), okHaltMode, true, &addrtype));
+        printf("\n");
+    }
+
+    // Register deltas
+    printf("Registers:   A       B\n");
+    CProcessor* pProcA = pBoardA->GetCPU();
+    CProcessor* pProcB = pBoardB->GetCPU();
+    int nDeltas = 0;
+    for (int r = 0; r < 8; r++)
+    {
+        if (pProcA->GetReg(r) == pProcB->GetReg(r))
+            continue;
+        printf("  %s        %06o  %06o\n", BISECT_REGISTER_NAME[r], pProcA->GetReg(r), pProcB->GetReg(r));
+        nDeltas++;
+    }
+    if (pProcA->GetPSW() != pProcB->GetPSW())
+    {
+        printf("  PS        %06o  %06o\n", pProcA->GetPSW(), pProcB->GetPSW());
+        nDeltas++;
+    }
+    if (pProcA->GetInternalTick() != pProcB->GetInternalTick())
+    {
+        printf("  tick      %6d  %6d\n", pProcA->GetInternalTick(), pProcB->GetInternalTick());
+        nDeltas++;
+    }
+
+    // Memory deltas
+    const int maxMemoryDeltas = 16;
+    int nMemoryDeltas = 0;
+    for (int address = 0; address < 65536; address++)
+    {
+        uint8_t byteA = pBoardA->GetRAMByte(static_cast<uint16_t>(address));
+        uint8_t byteB = pBoardB->GetRAMByte(static_cast<uint16_t>(address));
+        if (byteA == byteB)
+            continue;
+        if (nMemoryDeltas == 0)
+            printf("Memory:      A       B\n");
+        if (nMemoryDeltas < maxMemoryDeltas)
+            printf("  %06o    %03o     %03o\n", address, byteA, byteB);
+        nMemoryDeltas++;
+    }
+    if (nMemoryDeltas > maxMemoryDeltas)
+        printf("  ... %d more bytes differ\n", nMemoryDeltas - maxMemoryDeltas);
+
+    if (nDeltas == 0 && nMemoryDeltas == 0)
+        printf("The difference is in the CPU internal flags or device registers\n");
+}
+
+// The start state: the machine after the reset and the boot frames
+static bool Bisect_PrepareStart(const uint8_t* pRom, CMotherboardSnapshot* pStart)
+{
+    CMotherboard* pBoard = new CMotherboard();
+    pBoard->SetConfiguration(m_nBisectConfiguration);
+    pBoard->LoadROM(pRom);
+    pBoard->Reset();
+    for (uint32_t frame = 0; frame < m_nBisectBootFrames; frame++)
+        pBoard->SystemFrame();
+    pBoard->SaveToSnapshot(pStart);
+    delete pBoard;
+    return true;
+}
+
+// Returns 0 if no divergence, 1 if diverged, 3 on error
+static int Bisect_Run()
+{
+    bool okInstrumented = (strcmp(m_sBisectVariant, "instrumented") == 0);
+
+    uint8_t* pRom = static_cast<uint8_t*>(::calloc(1, 32768));
+    uint8_t* pSmp[2];
+    pSmp[0] = static_cast<uint8_t*>(::calloc(1, BISECT_SMP_MAXSIZE));
+    pSmp[1] = static_cast<uint8_t*>(::calloc(1, BISECT_SMP_MAXSIZE));
+    CMotherboardSnapshot* pStart = static_cast<CMotherboardSnapshot*>(::calloc(1, sizeof(CMotherboardSnapshot)));
+    if (pRom == nullptr || pSmp[0] == nullptr || pSmp[1] == nullptr || pStart == nullptr)
+    {
+        printf("Out of memory\n");
+        ::free(pStart);  ::free(pSmp[1]);  ::free(pSmp[0]);  ::free(pRom);
+        return 3;
+    }
+
+    int result = 3;
+    long smpSize[2] = { -1, -1 };
+    if (Bisect_LoadFile(m_sBisectRomFile, pRom, 32768) != 32768)
+        printf("Failed to load the ROM image: %s\n", m_sBisectRomFile);
+    else
+    {
+        result = 0;
+        for (int slot = 0; slot < 2; slot++)
+        {
+            if (m_sBisectSmpFile[slot] == nullptr)
+                continue;
+            smpSize[slot] = Bisect_LoadFile(m_sBisectSmpFile[slot], pSmp[slot], BISECT_SMP_MAXSIZE);
+            if (smpSize[slot] < 0)
+            {
+                printf("Failed to load the SMP image: %s\n", m_sBisectSmpFile[slot]);
+                result = 3;
+            }
+        }
+    }
+
+    CBisector* pBisector = nullptr;
+    if (result == 0)
+    {
+        result = 3;
+        pBisector = new CBisector();
+        if (Bisect_PrepareStart(pRom, pStart) &&
+            pBisector->Init(pRom, pStart) &&
+            (!okInstrumented || Bisect_AttachObservers(pBisector->GetBoardB())))
+        {
+            for (int slot = 0; slot < 2; slot++)
+            {
+                if (smpSize[slot] >= 0)
+                    pBisector->AttachSmpImage(slot, pSmp[slot], static_cast<size_t>(smpSize[slot]));
+            }
+
+            printf("Bisect: variant %s, %u frames\n", m_sBisectVariant, m_nBisectFrames);
+            BisectResult bisectResult;
+            if (pBisector->Run(m_nBisectFrames, &bisectResult))
+            {
+                Bisect_PrintResult(pBisector, bisectResult);
+                result = 1;
+            }
+            else
+            {
+                printf("No divergence in %u frames\n", m_nBisectFrames);
+                result = 0;
+            }
+        }
+        else
+            printf("Failed to prepare the bisector\n");
+    }
+
+    delete pBisector;
+    Bisect_FreeObservers();
+    ::free(pStart);
+    ::free(pSmp[1]);
+    ::free(pSmp[0]);
+    ::free(pRom);
+
+    return result;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && (strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-h") == 0))
+    {
+        Bisect_PrintUsage();
+        return 0;
+    }
+    if (!Bisect_ParseCommandLine(argc, argv))
+    {
+        Bisect_PrintUsage();
+        return 3;
+    }
+
+    CProcessor::Init();
+    int result = Bisect_Run();
+    CProcessor::Done();
+
+    return result;
+}
+
+
+//////////////////////////////////////////////////////////////////////
@@ -0,0 +1,166 @@
+﻿/*  This file is part of MK90BTL.
+    MK90BTL is free software: you can redistribute it and/or modify it under the terms
+of the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+    MK90BTL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License along with
+MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
+
+// Bisect.cpp
+//
+
+#include "Platform.h"
+#include "Processor.h"
+#include "Bisect.h"
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+CBisector::CBisector()
+{
+    m_pBoardA = new CMotherboard();
+    m_pBoardB = new CMotherboard();
+    m_pStartA = static_cast<CMotherboardSnapshot*>(::calloc(1, sizeof(CMotherboardSnapshot)));
+    m_pStartB = static_cast<CMotherboardSnapshot*>(::calloc(1, sizeof(CMotherboardSnapshot)));
+    m_InputCallback = nullptr;
+}
+
+CBisector::~CBisector()
+{
+    delete m_pBoardA;
+    delete m_pBoardB;
+    ::free(m_pStartA);
+    ::free(m_pStartB);
+}
+
+bool CBisector::Init(const uint8_t* pRom, const CMotherboardSnapshot* pStart)
+{
+    if (m_pStartA == nullptr || m_pStartB == nullptr)
+        return false;
+
+    m_pBoardA->SetConfiguration(pStart->configuration);
+    m_pBoardB->SetConfiguration(pStart->configuration);
+    m_pBoardA->LoadROM(pRom);
+    m_pBoardB->LoadROM(pRom);
+    m_pBoardA->LoadFromSnapshot(pStart);
+    m_pBoardB->LoadFromSnapshot(pStart);
+
+    return true;
+}
+
+void CBisector::AttachSmpImage(int slot, const uint8_t* pData, size_t size)
+{
+    m_pBoardA->AttachSmpImage(slot, pData, size);
+    m_pBoardB->AttachSmpImage(slot, pData, size);
+}
+
+bool CBisector::RunToStep(int step)
+{
+    m_pBoardA->LoadFromSnapshot(m_pStartA);
+    m_pBoardB->LoadFromSnapshot(m_pStartB);
+    m_pBoardA->SystemFrame(0, step);
+    m_pBoardB->SystemFrame(0, step);
+
+    return m_pBoardA->GetStateHash() == m_pBoardB->GetStateHash();
+}
+
+bool CBisector::IsSameCPU() const
+{
+    const CProcessor* pProcA = m_pBoardA->GetCPU();
+    const CProcessor* pProcB = m_pBoardB->GetCPU();
+    for (int r = 0; r < 8; r++)
+    {
+        if (pProcA->GetReg(r) != pProcB->GetReg(r))
+            return false;
+    }
+    return pProcA->GetPSW() == pProcB->GetPSW() && pProcA->GetInternalTick() == pProcB->GetInternalTick();
+}
+
+// The difference can come and go during the frame, so the search does not rely on the frame end state.
+// Registers are checked on every tick; memory and devices only every BISECT_HASH_INTERVAL ticks,
+// so a memory difference that appears and disappears between two hash checks is not seen.
+// After the step found, both machines stand just after the divergent step.
+int CBisector::FindDivergentStep()
+{
+    m_pBoardA->LoadFromSnapshot(m_pStartA);
+    m_pBoardB->LoadFromSnapshot(m_pStartB);
+
+    int same = 0;  // The machines are the same after this number of steps
+    for (int step = 0; step < FRAME_STEPS; step++)
+    {
+        m_pBoardA->SystemFrame(step, step + 1);
+        m_pBoardB->SystemFrame(step, step + 1);
+        if (!IsSameCPU())
+            return step;
+
+        if ((step + 1) % BISECT_HASH_INTERVAL != 0 && step + 1 != FRAME_STEPS)
+            continue;
+        if (m_pBoardA->GetStateHash() == m_pBoardB->GetStateHash())
+        {
+            same = step + 1;
+            continue;
+        }
+
+        // Binary search in the interval: the machines are the same after 'lo' steps and differ after 'hi' steps
+        int lo = same, hi = step + 1;
+        while (hi - lo > 1)
+        {
+            int mid = (lo + hi) / 2;
+            if (RunToStep(mid))
+                lo = mid;
+            else
+                hi = mid;
+        }
+        RunToStep(hi);  // Stop both machines right after the divergent step
+        return lo;
+    }
+
+    return BISECT_STEP_NOTFOUND;
+}
+
+bool CBisector::Run(uint32_t frames, BisectResult* pResult)
+{
+    ::memset(pResult, 0, sizeof(BisectResult));
+
+    for (uint32_t frame = 0; frame < frames; frame++)
+    {
+        if (m_InputCallback != nullptr)
+        {
+            (*m_InputCallback)(m_pBoardA, frame);
+            (*m_InputCallback)(m_pBoardB, frame);
+        }
+
+        // Difference made by the input events
+        if (m_pBoardA->GetStateHash() != m_pBoardB->GetStateHash())
+        {
+            pResult->okDiverged = true;
+            pResult->frame = frame;
+            pResult->step = BISECT_STEP_FRAMESTART;
+            pResult->address = m_pBoardA->GetCPU()->GetPC();
+            return true;
+        }
+
+        m_pBoardA->SaveToSnapshot(m_pStartA);
+        m_pBoardB->SaveToSnapshot(m_pStartB);
+
+        m_pBoardA->SystemFrame();
+        m_pBoardB->SystemFrame();
+
+        if (m_pBoardA->GetStateHash() != m_pBoardB->GetStateHash())
+        {
+            pResult->okDiverged = true;
+            pResult->frame = frame;
+            pResult->step = FindDivergentStep();
+            pResult->address = m_pBoardA->GetCPU()->GetInstructionPC();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+//////////////////////////////////////////////////////////////////////
@@ -0,0 +1,71 @@
+﻿/*  This file is part of MK90BTL.
+    MK90BTL is free software: you can redistribute it and/or modify it under the terms
+of the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+    MK90BTL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License along with
+MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
+
+// Bisect.h
+//
+
+#pragma once
+
+#include "Board.h"
+
+
+//////////////////////////////////////////////////////////////////////
+
+// Called for both machines before every frame, to apply the input events
+typedef void (*BISECTINPUTCALLBACK)(CMotherboard* pBoard, uint32_t frame);
+
+#define BISECT_HASH_INTERVAL  4096  // CPU ticks between the state hash checks in the divergent frame
+
+#define BISECT_STEP_FRAMESTART  -1  // The machines differ at the frame start, after the input events applied
+#define BISECT_STEP_NOTFOUND    -2  // The frame run again did not diverge, the run is not repeatable
+
+struct BisectResult
+{
+    bool        okDiverged;
+    uint32_t    frame;          // First divergent frame
+    int         step;           // CPU tick in the frame when the machines diverged, 0..FRAME_STEPS-1, or BISECT_STEP_XXX
+    uint16_t    address;        // Address of the instruction executed on the divergent tick
+};
+
+// Runs two machines side by side from the same state and finds where they diverge.
+// The difference is in how the machines run: the caller sets up the second machine to take another
+// execution path, e.g. with the profiling and tracing hooks attached, see GetBoardB().
+// The first divergent frame is found by comparing the state hashes after every frame. In that frame both machines
+// run again from the frame start in lockstep: the CPU registers are compared on every tick, the state hashes
+// every BISECT_HASH_INTERVAL ticks, and the binary search finds the tick inside the interval.
+// The class does not depend on the UI, it is used by the headless mode.
+class CBisector
+{
+public:
+    CBisector();
+    ~CBisector();
+public:
+    bool        Init(const uint8_t* pRom, const CMotherboardSnapshot* pStart);  // Both machines get the ROM and the start state
+    void        AttachSmpImage(int slot, const uint8_t* pData, size_t size);  // Attach SMP image to both machines
+    void        SetInputCallback(BISECTINPUTCALLBACK callback) { m_InputCallback = callback; }
+    // Run up to the given number of frames; returns true if the machines diverged.
+    // After the divergence found, both machines stand just after the divergent CPU tick.
+    bool        Run(uint32_t frames, BisectResult* pResult);
+    CMotherboard* GetBoardA() { return m_pBoardA; }
+    CMotherboard* GetBoardB() { return m_pBoardB; }
+private:
+    bool        RunToStep(int step);  // Restore the frame start state, run both machines up to the step, compare
+    bool        IsSameCPU() const;  // Compare the registers, PSW and the instruction tick counter
+    int         FindDivergentStep();  // Run the frame again in lockstep; returns the first divergent step
+private:
+    CMotherboard* m_pBoardA;
+    CMotherboard* m_pBoardB;
+    CMotherboardSnapshot* m_pStartA;  // Frame start states
+    CMotherboardSnapshot* m_pStartB;
+    BISECTINPUTCALLBACK m_InputCallback;
+};
+
+
+//////////////////////////////////////////////////////////////////////
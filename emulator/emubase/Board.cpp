@@ -11,10 +11,9 @@ MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
 // Board.cpp
 //
 
-#include "stdafx.h"
-#include "Emubase.h"
-
-void TraceInstruction(const CProcessor* pProc, const CMotherboard* pBoard, uint16_t address, DWORD dwTrace);
+#include "Platform.h"
+#include "Board.h"
+#include "Processor.h"
 
 
 //////////////////////////////////////////////////////////////////////
@@ -23,10 +22,21 @@ CMotherboard::CMotherboard () :
     m_pCPU(new CProcessor(this))
 {
     m_dwTrace = TRACE_NONE;
+    m_TraceCallback = nullptr;
+    m_pTraceBlock = m_pTraceSuspended = nullptr;
+    m_nTraceCount = m_nTraceCapacity = 0;
+    m_TraceFrameTick = m_TraceTick = 0;
+    m_nTraceFrame = 0;
+    m_TraceSuspendedFrameTick = 0;
+    m_nTraceSuspendedFrame = 0;
+    m_EventCallback = nullptr;
+    m_nEventStep = 0;
     m_SoundGenCallback = nullptr;
     m_okTimer50OnOff = false;
     m_okSoundOnOff = false;
     m_CPUbps = nullptr;
+    m_pAccessCounters = nullptr;
+    SetPerfCounters(nullptr);
 
     // Allocate memory for RAM and ROM
     m_pRAM = static_cast<uint8_t*>(::calloc(64 * 1024, 1));
@@ -89,6 +99,50 @@ void CMotherboard::SetTrace(uint32_t dwTrace)
     m_dwTrace = dwTrace;
 }
 
+void CMotherboard::SetTraceCallback(TRACEBLOCKCALLBACK callback, CTraceRecord* pBlock, int capacity)
+{
+    m_TraceCallback = callback;
+    m_pTraceBlock = (callback != nullptr) ? pBlock : nullptr;
+    m_pTraceSuspended = nullptr;
+    m_nTraceCount = 0;
+    m_nTraceCapacity = capacity;
+    m_TraceFrameTick = m_TraceTick = 0;
+    m_nTraceFrame = 0;
+}
+
+void CMotherboard::FlushTrace()
+{
+    if (m_pTraceBlock == nullptr || m_nTraceCount == 0)
+        return;
+
+    m_pTraceBlock = m_TraceCallback(m_pTraceBlock, m_nTraceCount);
+    m_nTraceCount = 0;
+}
+
+void CMotherboard::SetPerfCounters(CPerfCounters* pCounters)
+{
+    m_pPerfCounters = (pCounters != nullptr) ? pCounters : &m_PerfCountersSink;
+    m_pCPU->SetPerfCounters(m_pPerfCounters);
+}
+
+void CMotherboard::SuspendTrace(bool okSuspend)
+{
+    if (okSuspend && m_pTraceBlock != nullptr)
+    {
+        m_pTraceSuspended = m_pTraceBlock;
+        m_pTraceBlock = nullptr;
+        m_TraceSuspendedFrameTick = m_TraceFrameTick;
+        m_nTraceSuspendedFrame = m_nTraceFrame;
+    }
+    else if (!okSuspend && m_pTraceSuspended != nullptr)
+    {
+        m_pTraceBlock = m_pTraceSuspended;
+        m_pTraceSuspended = nullptr;
+        m_TraceFrameTick = m_TraceSuspendedFrameTick;
+        m_nTraceFrame = m_nTraceSuspendedFrame;
+    }
+}
+
 void CMotherboard::Reset()
 {
     m_pCPU->Stop();
@@ -130,20 +184,18 @@ void CMotherboard::LoadRAM(int startbank, const uint8_t* pBuffer, int length)
 bool CMotherboard::IsSmpImageAttached(int slot) const
 {
     ASSERT(slot >= 0 && slot < 2);
-    return m_Smp[slot].fpFile != nullptr;
+    return m_Smp[slot].fpFile != nullptr || m_Smp[slot].pData != nullptr;
 }
-bool CMotherboard::AttachSmpImage(int slot, LPCTSTR sFileName)
+bool CMotherboard::AttachSmpImage(int slot, FILE* fpFile)
 {
     ASSERT(slot >= 0 && slot < 2);
+    ASSERT(fpFile != nullptr);
 
     // if image attached - detach one first
-    if (m_Smp[slot].fpFile != nullptr)
+    if (IsSmpImageAttached(slot))
         DetachSmpImage(slot);
 
-    // open the file
-    m_Smp[slot].fpFile = ::_tfopen(sFileName, _T("r+b"));
-    if (m_Smp[slot].fpFile == nullptr)
-        return false;
+    m_Smp[slot].fpFile = fpFile;
 
     // get file size
     ::fseek(m_Smp[slot].fpFile, 0, SEEK_END);
@@ -169,11 +221,34 @@ bool CMotherboard::AttachSmpImage(int slot, LPCTSTR sFileName)
     return true;
 }
 
+bool CMotherboard::AttachSmpImage(int slot, const uint8_t* pData, size_t size)
+{
+    ASSERT(slot >= 0 && slot < 2);
+    ASSERT(pData != nullptr);
+
+    // if image attached - detach one first
+    if (IsSmpImageAttached(slot))
+        DetachSmpImage(slot);
+
+    if (size > 10240)
+        return false;
+
+    m_Smp[slot].pData = static_cast<uint8_t*>(::calloc(1, size > 0 ? size : 1));
+    if (m_Smp[slot].pData == nullptr)
+        return false;
+    ::memcpy(m_Smp[slot].pData, pData, size);
+
+    m_Smp[slot].size = size;
+    m_Smp[slot].mask = size < 65536 ? 0xffff : 0xffffff;
+
+    return true;
+}
+
 void CMotherboard::DetachSmpImage(int slot)
 {
     ASSERT(slot >= 0 && slot < 2);
 
-    if (m_Smp[slot].fpFile == nullptr)
+    if (!IsSmpImageAttached(slot))
         return;
 
     // free the memory
@@ -184,11 +259,23 @@ void CMotherboard::DetachSmpImage(int slot)
     }
 
     // close the file
-    ::fclose(m_Smp[slot].fpFile);
-    m_Smp[slot].fpFile = nullptr;
+    if (m_Smp[slot].fpFile != nullptr)
+    {
+        ::fclose(m_Smp[slot].fpFile);
+        m_Smp[slot].fpFile = nullptr;
+    }
     m_Smp[slot].size = 0;
 }
 
+// Get the attached SMP image data, returns nullptr if no image attached
+const uint8_t* CMotherboard::GetSmpImageData(int slot, size_t* pSize) const
+{
+    ASSERT(slot >= 0 && slot < 2);
+
+    *pSize = m_Smp[slot].size;
+    return m_Smp[slot].pData;
+}
+
 
 //////////////////////////////////////////////////////////////////////
 
@@ -268,29 +355,54 @@ void CMotherboard::ExecuteCPU()
 * 320000 тиков ЦП       -- 16 раз за тик
 *      2 тика IRQ2 и таймер 2 -- 50 Гц, в 0-й и 10000-й тик фрейма
 */
-bool CMotherboard::SystemFrame()
+// The frame can be done in parts: fromStep..toStep CPU ticks, the next part starts from the previous toStep.
+// Returns false on breakpoint, then the frame is to be restarted from zero step.
+bool CMotherboard::SystemFrame(int fromStep, int toStep)
 {
     const int frameProcTicks = 16;
     const int audioticks = 20286 / (SOUNDSAMPLERATE / 25);
 
-    for (int frameticks = 0; frameticks < 20000; frameticks++)
+    if (fromStep == 0 && m_dwTrace != TRACE_NONE && m_pTraceBlock != nullptr)
+        TraceFrame();
+
+    int procticksFrom = fromStep % frameProcTicks;
+    for (int frameticks = fromStep / frameProcTicks; frameticks < 20000; frameticks++)
     {
-        for (int procticks = 0; procticks < frameProcTicks; procticks++)  // CPU ticks
+        for (int procticks = procticksFrom; procticks < frameProcTicks; procticks++)  // CPU ticks
         {
+            int step = frameticks * frameProcTicks + procticks;
+            if (step == toStep)
+                return true;  // The part is done, the frame tick events before the step are done too
+            if (m_pTraceBlock != nullptr)  // Memory writes are captured in the product build too, for the write log
+            {
+                m_TraceTick = m_TraceFrameTick + step;
 #if !defined(PRODUCT)
-            if ((m_dwTrace & TRACE_CPU) && m_pCPU->GetInternalTick() == 0)
-                TraceInstruction(m_pCPU, this, m_pCPU->GetPC(), m_dwTrace);
+                if ((m_dwTrace & TRACE_CPU) && m_pCPU->GetInternalTick() == 0)
+                    TraceInstruction();
 #endif
+            }
+            if (m_EventCallback != nullptr)
+                m_nEventStep = step;
             m_pCPU->Execute();
             if (m_CPUbps != nullptr)  // Check for breakpoints
             {
                 const uint16_t* pbps = m_CPUbps;
-                while (*pbps != 0177777) { if (m_pCPU->GetPC() == *pbps++) return false; }
+                while (*pbps != 0177777)
+                {
+                    if (m_pCPU->GetPC() == *pbps++)
+                    {
+                        // The frame is restarted from zero tick, keep the trace cycles growing
+                        if (m_pTraceBlock != nullptr)
+                            m_TraceFrameTick += step + 1;
+                        return false;
+                    }
+                }
             }
 
             // Timer 1 ticks
             TimerTick();
         }
+        procticksFrom = 0;
 
         if (frameticks == 0 || frameticks == 10000)
         {
@@ -301,6 +413,10 @@ bool CMotherboard::SystemFrame()
             DoSound();
     }
 
+    if (m_pTraceBlock != nullptr)
+        m_TraceFrameTick += FRAME_STEPS;
+    m_pPerfCounters->frames++;
+
     return true;
 }
 
@@ -309,10 +425,7 @@ void CMotherboard::KeyboardEvent(uint8_t scancode, bool okPressed)
 {
     if (okPressed)  // Key released
     {
-        //if (m_dwTrace & TRACE_KEYBOARD)
-        {
-            DebugLogFormat(_T("Keyboard %03o %d\r\n"), static_cast<uint16_t>(scancode), static_cast<int>(okPressed));
-        }
+        DEBUGLOG_CAT(LOGCAT_KBD, _T("Keyboard %03o %d\r\n"), static_cast<uint16_t>(scancode), static_cast<int>(okPressed));
 
         m_ExtDeviceKeyboardScan = scancode;
         //TODO: Interrupt??
@@ -339,7 +452,7 @@ uint8_t CMotherboard::ExtDeviceReadData()
         case 2:  // read keyboard
             if (m_ExtDeviceKeyboardScan != 0)
             {
-                //DebugLogFormat(_T("ExtDeviceReadData Keyboard %03o\r\n"), (uint16_t)m_ExtDeviceKeyboardScan);
+                DEBUGLOG_CAT(LOGCAT_KBD, _T("ExtDeviceReadData Keyboard %03o\r\n"), (uint16_t)m_ExtDeviceKeyboardScan);
                 m_ExtDeviceShift = m_ExtDeviceKeyboardScan;
                 m_ExtDeviceKeyboardScan = 0;
                 if ((m_ExtDeviceControl & 0x20) == 0)
@@ -382,7 +495,7 @@ void CMotherboard::ExtDeviceWriteData(uint8_t byte)
         case 2:  // read keyboard
             if (m_ExtDeviceKeyboardScan != 0)
             {
-                //DebugLogFormat(_T("ExtDeviceReadData Keyboard %03o\r\n"), (uint16_t)m_ExtDeviceKeyboardScan);
+                DEBUGLOG_CAT(LOGCAT_KBD, _T("ExtDeviceReadData Keyboard %03o\r\n"), (uint16_t)m_ExtDeviceKeyboardScan);
                 m_ExtDeviceShift = m_ExtDeviceKeyboardScan;
                 m_ExtDeviceKeyboardScan = 0;
                 if ((m_ExtDeviceControl & 0x20) == 0)
@@ -418,7 +531,7 @@ void CMotherboard::ExtDeviceWriteControl(uint8_t byte)
         case 2:  // read keyboard
             if (m_ExtDeviceKeyboardScan != 0)
             {
-                //DebugLogFormat(_T("ExtDeviceReadData Keyboard %03o\r\n"), (uint16_t)m_ExtDeviceKeyboardScan);
+                DEBUGLOG_CAT(LOGCAT_KBD, _T("ExtDeviceReadData Keyboard %03o\r\n"), (uint16_t)m_ExtDeviceKeyboardScan);
                 m_ExtDeviceShift = m_ExtDeviceKeyboardScan;
                 m_ExtDeviceKeyboardScan = 0;
                 if ((m_ExtDeviceControl & 0x20) == 0)
@@ -445,7 +558,7 @@ void CMotherboard::ExtDeviceWriteCommand(uint8_t byte)
     case 2:  // read keyboard
         if (m_ExtDeviceKeyboardScan != 0)
         {
-            //DebugLogFormat(_T("ExtDeviceReadData Keyboard %03o\r\n"), (uint16_t)m_ExtDeviceKeyboardScan);
+            DEBUGLOG_CAT(LOGCAT_KBD, _T("ExtDeviceReadData Keyboard %03o\r\n"), (uint16_t)m_ExtDeviceKeyboardScan);
             m_ExtDeviceShift = m_ExtDeviceKeyboardScan;
             m_ExtDeviceKeyboardScan = 0;
             if ((m_ExtDeviceControl & 0x20) == 0)
@@ -471,7 +584,7 @@ void CMotherboard::SmpWriteCommand(int slot, uint8_t byte)
 {
     ASSERT(slot >= 0 && slot < 2);
 
-    //DebugLogFormat(_T("SmpWriteCommand pos %04x cmd %02x\r\n"), m_Smp[slot].dataptr, (uint16_t)byte);
+    DEBUGLOG_CAT(LOGCAT_SMP, _T("SmpWriteCommand pos %04x cmd %02x\r\n"), m_Smp[slot].dataptr, (uint16_t)byte);
     m_Smp[slot].cmd = byte;
 }
 uint8_t CMotherboard::SmpReadData(int slot)
@@ -491,7 +604,9 @@ uint8_t CMotherboard::SmpReadData(int slot)
                 result = *(m_Smp[slot].pData + m_Smp[slot].dataptr);
             }
             m_Smp[slot].dataptr = (m_Smp[slot].dataptr + ((m_Smp[slot].cmd & 0x80) ? 1 : -1)) & m_Smp[slot].mask;
-            //DebugLogFormat(_T("SmpReadData data %02x nextpos %06x\r\n"), (uint16_t)result, m_Smp[slot].dataptr);
+            DEBUGLOG_CAT(LOGCAT_SMP, _T("SmpReadData data %02x nextpos %06x\r\n"), (uint16_t)result, m_Smp[slot].dataptr);
+            RaiseEvent(BOARDEVENT_SMPREAD, (uint16_t)slot, result);
+            m_pPerfCounters->smpBytes[slot]++;
             return result;
         }
     default:
@@ -502,6 +617,9 @@ void CMotherboard::SmpWriteData(int slot, uint8_t byte)
 {
     ASSERT(slot >= 0 && slot < 2);
 
+    RaiseEvent(BOARDEVENT_SMPWRITE, (uint16_t)slot, byte);
+    m_pPerfCounters->smpBytes[slot]++;
+
     switch ((m_Smp[slot].cmd & 0xf0) >> 4)
     {
     case 10:  // write address
@@ -546,6 +664,9 @@ uint16_t CMotherboard::GetWordView(uint16_t address, bool okHaltMode, bool okExe
 
 uint16_t CMotherboard::GetWord(uint16_t address, bool okHaltMode, bool okExec)
 {
+    if (m_pAccessCounters != nullptr)
+        (okExec ? m_pAccessCounters->exec : m_pAccessCounters->read)[address & 0177776]++;
+
     uint16_t offset;
     int addrtype = TranslateAddress(address, okHaltMode, okExec, &offset);
 
@@ -569,6 +690,9 @@ uint16_t CMotherboard::GetWord(uint16_t address, bool okHaltMode, bool okExec)
 
 uint8_t CMotherboard::GetByte(uint16_t address, bool okHaltMode)
 {
+    if (m_pAccessCounters != nullptr)
+        m_pAccessCounters->read[address]++;
+
     uint16_t offset;
     int addrtype = TranslateAddress(address, okHaltMode, false, &offset);
 
@@ -576,7 +700,7 @@ uint8_t CMotherboard::GetByte(uint16_t address, bool okHaltMode)
     {
     case ADDRTYPE_RAM:
         if (address == 0177562)
-            DebugLogFormat(_T("GetByte %06o %03o\r\n"), address, static_cast<uint16_t>(GetRAMByte(offset)));
+            DEBUGLOG_CAT(LOGCAT_CPU, _T("GetByte %06o %03o\r\n"), address, static_cast<uint16_t>(GetRAMByte(offset)));
         return GetRAMByte(offset);
     case ADDRTYPE_ROM:
         return GetROMByte(offset);
@@ -594,6 +718,11 @@ uint8_t CMotherboard::GetByte(uint16_t address, bool okHaltMode)
 
 void CMotherboard::SetWord(uint16_t address, bool okHaltMode, uint16_t word)
 {
+    if (m_pAccessCounters != nullptr)
+        m_pAccessCounters->write[address & 0177776]++;
+    if ((m_dwTrace & TRACE_MEMWRITE) && m_pTraceBlock != nullptr)
+        TraceWrite(address & 0177776, okHaltMode, word, false);
+
     uint16_t offset;
 
     int addrtype = TranslateAddress(address, okHaltMode, false, &offset);
@@ -619,6 +748,11 @@ void CMotherboard::SetWord(uint16_t address, bool okHaltMode, uint16_t word)
 
 void CMotherboard::SetByte(uint16_t address, bool okHaltMode, uint8_t byte)
 {
+    if (m_pAccessCounters != nullptr)
+        m_pAccessCounters->write[address]++;
+    if ((m_dwTrace & TRACE_MEMWRITE) && m_pTraceBlock != nullptr)
+        TraceWrite(address, okHaltMode, byte, true);
+
     uint16_t offset;
     int addrtype = TranslateAddress(address, okHaltMode, false, &offset);
 
@@ -697,30 +831,39 @@ uint8_t CMotherboard::GetPortByte(uint16_t address)
     return static_cast<uint8_t>(GetPortWord(address));
 }
 
+// Performance counter index for the port, see PERFCOUNTER_PORTS
+static inline int PerfPortIndex(uint16_t address)
+{
+    uint16_t index = static_cast<uint16_t>(address - 0164000) >> 1;
+    return (index < PERFCOUNTER_PORTS - 1) ? index : PERFCOUNTER_PORTS - 1;
+}
+
 uint16_t CMotherboard::GetPortWord(uint16_t address)
 {
+    m_pPerfCounters->portReads[PerfPortIndex(address)]++;
+
     switch (address)
     {
     case 0164020:  // External devices controller, data register
-        return ExtDeviceReadData();
+        return PortReadEvent(address, ExtDeviceReadData());
     case 0164022:  // External devices controller, interrupt status
-        return ExtDeviceReadIntStatus();
+        return PortReadEvent(address, ExtDeviceReadIntStatus());
     case 0164024:  // External devices controller, status register
-        return ExtDeviceReadStatus();
+        return PortReadEvent(address, ExtDeviceReadStatus());
     case 0164026:  // External devices controller, command
-        return ExtDeviceReadCommand();
+        return PortReadEvent(address, ExtDeviceReadCommand());
 
         //TODO
 
     default:
         if (address >= 0165000 && address <= 0165177)  // Real time clock
         {
-            DebugLogFormat(_T("READ PORT %06o PC=%06o\r\n"), address, m_pCPU->GetInstructionPC());
+            DEBUGLOG_CAT(LOGCAT_PORT, _T("READ PORT %06o PC=%06o\r\n"), address, m_pCPU->GetInstructionPC());
             //TODO
         }
         else
         {
-            DebugLogFormat(_T("READ UNKNOWN PORT %06o PC=%06o\r\n"), address, m_pCPU->GetInstructionPC());
+            DEBUGLOG_CAT(LOGCAT_PORT, _T("READ UNKNOWN PORT %06o PC=%06o\r\n"), address, m_pCPU->GetInstructionPC());
 
             m_pCPU->MemoryError();
         }
@@ -762,14 +905,23 @@ void CMotherboard::SetPortByte(uint16_t address, uint8_t byte)
 
 void CMotherboard::SetPortWord(uint16_t address, uint16_t word)
 {
+    if (address >= 0164000 && address <= 0164006)
+        RaiseEvent(BOARDEVENT_LCDWRITE, address, word);
+    else if (address >= 0164020 && address <= 0164026)
+        RaiseEvent(BOARDEVENT_PORTWRITE, address, word);
+    m_pPerfCounters->portWrites[PerfPortIndex(address)]++;
+
     switch (address)
     {
     case 0164000:
     case 0164004:
+        DEBUGLOG_CAT(LOGCAT_LCD, _T("LCD address %06o PC=%06o\r\n"), word, m_pCPU->GetInstructionPC());
+        m_pPerfCounters->lcdAddressChanges += (m_LcdAddr != word);
         m_LcdAddr = word;
         break;
     case 0164002:
     case 0164006:
+        DEBUGLOG_CAT(LOGCAT_LCD, _T("LCD config %06o PC=%06o\r\n"), word, m_pCPU->GetInstructionPC());
         m_LcdConf = word;
         break;
 
@@ -790,7 +942,7 @@ void CMotherboard::SetPortWord(uint16_t address, uint16_t word)
     case 0164032:  // RG1
     case 0164034:  // RG2
     case 0164036:
-        DebugLogFormat(_T("WRITE PORT %06o word=%06o PC=%06o\r\n"), address, word, m_pCPU->GetInstructionPC());
+        DEBUGLOG_CAT(LOGCAT_PORT, _T("WRITE PORT %06o word=%06o PC=%06o\r\n"), address, word, m_pCPU->GetInstructionPC());
         break;  //STUB
 
     default:
@@ -800,7 +952,7 @@ void CMotherboard::SetPortWord(uint16_t address, uint16_t word)
         }
         else
         {
-            DebugLogFormat(_T("WRITE UNKNOWN PORT %06o word=%06o PC=%06o\r\n"), address, word, m_pCPU->GetInstructionPC());
+            DEBUGLOG_CAT(LOGCAT_PORT, _T("WRITE UNKNOWN PORT %06o word=%06o PC=%06o\r\n"), address, word, m_pCPU->GetInstructionPC());
 
             m_pCPU->MemoryError();
         }
@@ -890,38 +1042,435 @@ void CMotherboard::LoadFromImage(const uint8_t* pImage)
     memcpy(m_pRAM, pImageRam, 64 * 1024);
 }
 
+// Savestate v2 chunk data: every field stored separately as native 16-bit words (little-endian on x86),
+// so the format does not depend on the structure layout, only on the byte order. Chunk header and checksum are written by the caller.
+// Works from the snapshot, so the chunks could be prepared on another thread while the machine runs.
+// ROM is not in the snapshot, ROM chunk data is just 32 KB of ROM.
+size_t CMotherboard::SaveStateChunk(const CMotherboardSnapshot* pSnapshot, uint32_t tag, uint8_t* pBuffer, uint16_t* pVersion)
+{
+    uint16_t* pw = reinterpret_cast<uint16_t*>(pBuffer);
+    *pVersion = 1;
+    switch (tag)
+    {
+    case MK90STATE_CHUNK_BOARD:
+        *pw++ = pSnapshot->configuration;
+        *pw++ = pSnapshot->lcdAddr;
+        *pw++ = pSnapshot->lcdConf;
+        *pw++ = pSnapshot->lcdIndex;
+        *pw++ = pSnapshot->extDeviceKeyboardScan;
+        *pw++ = pSnapshot->extDeviceControl;
+        *pw++ = pSnapshot->extDeviceShift;
+        *pw++ = pSnapshot->extDeviceSelect ? 1 : 0;
+        *pw++ = pSnapshot->extDeviceIntStatus;
+        *pw++ = pSnapshot->okTimer50OnOff ? 1 : 0;
+        *pw++ = pSnapshot->okSoundOnOff ? 1 : 0;
+        break;
+    case MK90STATE_CHUNK_CPU:
+        {
+            const CProcessorSnapshot& cpu = pSnapshot->cpu;
+            for (int i = 0; i < 8; i++)
+                *pw++ = cpu.R[i];
+            *pw++ = cpu.psw;
+            *pw++ = static_cast<uint16_t>(cpu.internalTick);
+            *pw++ = static_cast<uint16_t>(cpu.internalTick >> 16);
+            *pw++ =
+                (cpu.okStopped ? 1 : 0) | (cpu.haltmode ? 2 : 0) | (cpu.stepmode ? 4 : 0) | (cpu.waitmode ? 010 : 0) |
+                (cpu.RPLYrq ? 020 : 0) | (cpu.RSVDrq ? 040 : 0) | (cpu.TBITrq ? 0100 : 0) | (cpu.HALTrq ? 0200 : 0) |
+                (cpu.RPL2rq ? 0400 : 0) | (cpu.EVNTrq ? 01000 : 0) | (cpu.BPT_rq ? 02000 : 0) | (cpu.IOT_rq ? 04000 : 0) |
+                (cpu.EMT_rq ? 010000 : 0) | (cpu.TRAPrq ? 020000 : 0);
+            *pw++ = cpu.instruction;
+            *pw++ = cpu.instructionpc;
+            *pw++ = cpu.regsrc | (cpu.methsrc << 8);
+            *pw++ = cpu.addrsrc;
+            *pw++ = cpu.regdest | (cpu.methdest << 8);
+            *pw++ = cpu.addrdest;
+            *pw++ = static_cast<uint16_t>(cpu.virqrq);
+            for (int i = 0; i < 16; i++)
+                *pw++ = cpu.virq[i];
+        }
+        break;
+    case MK90STATE_CHUNK_SMP:
+        for (int slot = 0; slot < 2; slot++)
+        {
+            *pw++ = static_cast<uint16_t>(pSnapshot->smpDataPtr[slot]);
+            *pw++ = static_cast<uint16_t>(pSnapshot->smpDataPtr[slot] >> 16);
+            *pw++ = pSnapshot->smpCmd[slot];
+        }
+        break;
+    case MK90STATE_CHUNK_RAM:
+        memcpy(pBuffer, pSnapshot->ram, 64 * 1024);
+        return 64 * 1024;
+    default:
+        return 0;
+    }
+    return reinterpret_cast<uint8_t*>(pw) - pBuffer;
+}
+// Check the chunk can be loaded by LoadStateChunk(): known tag, supported version and proper size
+bool CMotherboard::CheckStateChunk(uint32_t tag, uint16_t version, size_t size)
+{
+    if (version != 1)
+        return false;
 
-//////////////////////////////////////////////////////////////////////
+    switch (tag)
+    {
+    case MK90STATE_CHUNK_BOARD:
+        return size == 11 * sizeof(uint16_t);
+    case MK90STATE_CHUNK_CPU:
+        return size == 35 * sizeof(uint16_t);
+    case MK90STATE_CHUNK_SMP:
+        return size == 6 * sizeof(uint16_t);
+    case MK90STATE_CHUNK_ROM:
+        return size == 32 * 1024;
+    case MK90STATE_CHUNK_RAM:
+        return size == 64 * 1024;
+    default:
+        return false;
+    }
+}
+// Restore the chunk saved by SaveStateChunk(); returns false for unknown version or wrong size
+bool CMotherboard::LoadStateChunk(uint32_t tag, uint16_t version, const uint8_t* pData, size_t size)
+{
+    if (!CheckStateChunk(tag, version, size))
+        return false;
 
-#if !defined(PRODUCT)
+    const uint16_t* pw = reinterpret_cast<const uint16_t*>(pData);
+    switch (tag)
+    {
+    case MK90STATE_CHUNK_BOARD:
+        m_Configuration = *pw++;
+        m_LcdAddr = *pw++;
+        m_LcdConf = *pw++;
+        m_LcdIndex = *pw++;
+        m_ExtDeviceKeyboardScan = static_cast<uint8_t>(*pw++);
+        m_ExtDeviceControl = static_cast<uint8_t>(*pw++);
+        m_ExtDeviceShift = static_cast<uint8_t>(*pw++);
+        m_ExtDeviceSelect = (*pw++ != 0);
+        m_ExtDeviceIntStatus = *pw++;
+        m_okTimer50OnOff = (*pw++ != 0);
+        m_okSoundOnOff = (*pw++ != 0);
+        break;
+    case MK90STATE_CHUNK_CPU:
+        {
+            CProcessorSnapshot cpu;
+            for (int i = 0; i < 8; i++)
+                cpu.R[i] = *pw++;
+            cpu.psw = *pw++;
+            cpu.internalTick = pw[0] | (static_cast<uint32_t>(pw[1]) << 16);  pw += 2;
+            uint16_t flags = *pw++;
+            cpu.okStopped = (flags & 1) != 0;
+            cpu.haltmode = (flags & 2) != 0;
+            cpu.stepmode = (flags & 4) != 0;
+            cpu.waitmode = (flags & 010) != 0;
+            cpu.RPLYrq = (flags & 020) != 0;
+            cpu.RSVDrq = (flags & 040) != 0;
+            cpu.TBITrq = (flags & 0100) != 0;
+            cpu.HALTrq = (flags & 0200) != 0;
+            cpu.RPL2rq = (flags & 0400) != 0;
+            cpu.EVNTrq = (flags & 01000) != 0;
+            cpu.BPT_rq = (flags & 02000) != 0;
+            cpu.IOT_rq = (flags & 04000) != 0;
+            cpu.EMT_rq = (flags & 010000) != 0;
+            cpu.TRAPrq = (flags & 020000) != 0;
+            cpu.instruction = *pw++;
+            cpu.instructionpc = *pw++;
+            cpu.regsrc = static_cast<uint8_t>(*pw);  cpu.methsrc = static_cast<uint8_t>(*pw++ >> 8);
+            cpu.addrsrc = *pw++;
+            cpu.regdest = static_cast<uint8_t>(*pw);  cpu.methdest = static_cast<uint8_t>(*pw++ >> 8);
+            cpu.addrdest = *pw++;
+            cpu.virqrq = *pw++;
+            for (int i = 0; i < 16; i++)
+                cpu.virq[i] = *pw++;
+            m_pCPU->LoadFromSnapshot(&cpu);
+        }
+        break;
+    case MK90STATE_CHUNK_SMP:
+        for (int slot = 0; slot < 2; slot++)
+        {
+            m_Smp[slot].dataptr = pw[0] | (static_cast<uint32_t>(pw[1]) << 16);  pw += 2;
+            m_Smp[slot].cmd = static_cast<uint8_t>(*pw++);
+        }
+        break;
+    case MK90STATE_CHUNK_ROM:
+        memcpy(m_pROM, pData, 32 * 1024);
+        break;
+    case MK90STATE_CHUNK_RAM:
+        memcpy(m_pRAM, pData, 64 * 1024);
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+// Bulk restore from the image chunks, the data could point right into the mapped image file.
+// All the chunks are checked first, so the machine state is not changed if any of them is wrong.
+bool CMotherboard::LoadFromStateChunks(const CMotherboardStateChunk* pChunks, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (!CheckStateChunk(pChunks[i].tag, pChunks[i].version, pChunks[i].size))
+            return false;
+    }
+
+    for (int i = 0; i < count; i++)
+        LoadStateChunk(pChunks[i].tag, pChunks[i].version, pChunks[i].pData, pChunks[i].size);
+    return true;
+}
+
+// Save complete machine state to the memory snapshot, fast enough to call every frame
+void CMotherboard::SaveToSnapshot(CMotherboardSnapshot* pSnapshot) const
+{
+    m_pCPU->SaveToSnapshot(&pSnapshot->cpu);
+
+    pSnapshot->configuration = m_Configuration;
+    pSnapshot->lcdAddr = m_LcdAddr;
+    pSnapshot->lcdConf = m_LcdConf;
+    pSnapshot->lcdIndex = m_LcdIndex;
+    pSnapshot->extDeviceKeyboardScan = m_ExtDeviceKeyboardScan;
+    pSnapshot->extDeviceControl = m_ExtDeviceControl;
+    pSnapshot->extDeviceShift = m_ExtDeviceShift;
+    pSnapshot->extDeviceSelect = m_ExtDeviceSelect;
+    pSnapshot->extDeviceIntStatus = m_ExtDeviceIntStatus;
+    for (int slot = 0; slot < 2; slot++)
+    {
+        pSnapshot->smpDataPtr[slot] = m_Smp[slot].dataptr;
+        pSnapshot->smpCmd[slot] = m_Smp[slot].cmd;
+    }
+    pSnapshot->okTimer50OnOff = m_okTimer50OnOff;
+    pSnapshot->okSoundOnOff = m_okSoundOnOff;
 
-void TraceInstruction(const CProcessor* pProc, const CMotherboard* pBoard, uint16_t address, DWORD dwTrace)
+    ::memcpy(pSnapshot->ram, m_pRAM, 64 * 1024);
+}
+// Restore machine state saved by SaveToSnapshot(); ROM and attached SMPs should be the same
+void CMotherboard::LoadFromSnapshot(const CMotherboardSnapshot* pSnapshot)
 {
-    bool okHaltMode = pProc->IsHaltMode();
+    m_pCPU->LoadFromSnapshot(&pSnapshot->cpu);
+
+    m_Configuration = pSnapshot->configuration;
+    m_LcdAddr = pSnapshot->lcdAddr;
+    m_LcdConf = pSnapshot->lcdConf;
+    m_LcdIndex = pSnapshot->lcdIndex;
+    m_ExtDeviceKeyboardScan = pSnapshot->extDeviceKeyboardScan;
+    m_ExtDeviceControl = pSnapshot->extDeviceControl;
+    m_ExtDeviceShift = pSnapshot->extDeviceShift;
+    m_ExtDeviceSelect = pSnapshot->extDeviceSelect;
+    m_ExtDeviceIntStatus = pSnapshot->extDeviceIntStatus;
+    for (int slot = 0; slot < 2; slot++)
+    {
+        m_Smp[slot].dataptr = pSnapshot->smpDataPtr[slot];
+        m_Smp[slot].cmd = pSnapshot->smpCmd[slot];
+    }
+    m_okTimer50OnOff = pSnapshot->okTimer50OnOff;
+    m_okSoundOnOff = pSnapshot->okSoundOnOff;
+
+    ::memcpy(m_pRAM, pSnapshot->ram, 64 * 1024);
+}
 
-    uint16_t memory[4];
-    int addrtype = ADDRTYPE_RAM;
-    memory[0] = pBoard->GetWordView(address + 0 * 2, okHaltMode, true, &addrtype);
-    if (!(addrtype == ADDRTYPE_RAM && (dwTrace & TRACE_CPURAM)) &&
-        !(addrtype == ADDRTYPE_ROM && (dwTrace & TRACE_CPUROM)))
+// xxHash64 primes and round, see https://github.com/Cyan4973/xxHash
+static const uint64_t HASH_PRIME1 = 11400714785074694791ULL;
+static const uint64_t HASH_PRIME2 = 14029467366897019727ULL;
+static const uint64_t HASH_PRIME3 = 1609587929392839161ULL;
+static const uint64_t HASH_PRIME4 = 9650029242287828579ULL;
+static inline uint64_t HashRotl(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+static inline uint64_t HashRound(uint64_t acc, uint64_t input)
+{
+    acc += input * HASH_PRIME2;
+    acc = HashRotl(acc, 31);
+    return acc * HASH_PRIME1;
+}
+static inline uint64_t HashMerge(uint64_t hash, uint64_t value)
+{
+    hash ^= HashRound(0, value);
+    return HashRotl(hash, 27) * HASH_PRIME1 + HASH_PRIME4;
+}
+
+// Memory block goes by four independent lanes, so the multiplications are pipelined; size is multiple of 32
+static uint64_t HashMemory(const uint8_t* pMemory, size_t size)
+{
+    const uint64_t* pData = reinterpret_cast<const uint64_t*>(pMemory);
+    const uint64_t* pDataEnd = pData + size / sizeof(uint64_t);
+    uint64_t v1 = HASH_PRIME1 + HASH_PRIME2;
+    uint64_t v2 = HASH_PRIME2;
+    uint64_t v3 = 0;
+    uint64_t v4 = 0 - HASH_PRIME1;
+    for (; pData < pDataEnd; pData += 4)
+    {
+        v1 = HashRound(v1, pData[0]);
+        v2 = HashRound(v2, pData[1]);
+        v3 = HashRound(v3, pData[2]);
+        v4 = HashRound(v4, pData[3]);
+    }
+    return HashRotl(v1, 1) + HashRotl(v2, 7) + HashRotl(v3, 12) + HashRotl(v4, 18);
+}
+static uint64_t HashAvalanche(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= HASH_PRIME2;
+    hash ^= hash >> 29;
+    hash *= HASH_PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+// Hash of the complete machine state, the same set of values as SaveToSnapshot() stores.
+// 64 KB of RAM takes a few microseconds.
+uint64_t CMotherboard::GetStateHash() const
+{
+    uint64_t hash = HashMemory(m_pRAM, 65536);
+
+    // CPU registers, flags and the current instruction decoding
+    CProcessorSnapshot cpu;
+    m_pCPU->SaveToSnapshot(&cpu);
+    hash = HashMerge(hash, cpu.R[0] | (uint64_t)cpu.R[1] << 16 | (uint64_t)cpu.R[2] << 32 | (uint64_t)cpu.R[3] << 48);
+    hash = HashMerge(hash, cpu.R[4] | (uint64_t)cpu.R[5] << 16 | (uint64_t)cpu.R[6] << 32 | (uint64_t)cpu.R[7] << 48);
+    hash = HashMerge(hash, cpu.psw | (uint64_t)cpu.instruction << 16 | (uint64_t)cpu.instructionpc << 32 | (uint64_t)cpu.addrdest << 48);
+    hash = HashMerge(hash, (uint32_t)cpu.internalTick | (uint64_t)(uint32_t)cpu.virqrq << 32);
+    uint64_t flags =
+        (cpu.okStopped ? 1 : 0) | (cpu.haltmode ? 2 : 0) | (cpu.stepmode ? 4 : 0) | (cpu.waitmode ? 010 : 0) |
+        (cpu.RPLYrq ? 020 : 0) | (cpu.RSVDrq ? 040 : 0) | (cpu.TBITrq ? 0100 : 0) | (cpu.HALTrq ? 0200 : 0) |
+        (cpu.RPL2rq ? 0400 : 0) | (cpu.EVNTrq ? 01000 : 0) | (cpu.BPT_rq ? 02000 : 0) | (cpu.IOT_rq ? 04000 : 0) |
+        (cpu.EMT_rq ? 010000 : 0) | (cpu.TRAPrq ? 020000 : 0);
+    hash = HashMerge(hash, flags | (uint64_t)cpu.regsrc << 16 | (uint64_t)cpu.methsrc << 24 |
+            (uint64_t)cpu.addrsrc << 32 | (uint64_t)cpu.regdest << 48 | (uint64_t)cpu.methdest << 56);
+    for (int i = 0; i < 16; i += 4)
+        hash = HashMerge(hash, cpu.virq[i] | (uint64_t)cpu.virq[i + 1] << 16 | (uint64_t)cpu.virq[i + 2] << 32 | (uint64_t)cpu.virq[i + 3] << 48);
+
+    // Devices
+    hash = HashMerge(hash, m_LcdAddr | (uint64_t)m_LcdConf << 16 | (uint64_t)m_LcdIndex << 32 | (uint64_t)m_ExtDeviceIntStatus << 48);
+    hash = HashMerge(hash, m_ExtDeviceKeyboardScan | (uint64_t)m_ExtDeviceControl << 8 | (uint64_t)m_ExtDeviceShift << 16 |
+            (uint64_t)(m_ExtDeviceSelect ? 1 : 0) << 24 | (uint64_t)(m_okTimer50OnOff ? 1 : 0) << 25 | (uint64_t)(m_okSoundOnOff ? 1 : 0) << 26 |
+            (uint64_t)m_Smp[0].cmd << 32 | (uint64_t)m_Smp[1].cmd << 40 | (uint64_t)m_Configuration << 48);
+    hash = HashMerge(hash, m_Smp[0].dataptr | (uint64_t)m_Smp[1].dataptr << 32);
+
+    return HashAvalanche(hash);
+}
+
+// Hash of 32 KB ROM image, used to refer to the ROM file instead of storing the ROM itself
+uint64_t CMotherboard::CalculateRomHash(const uint8_t* pRom)
+{
+    return HashAvalanche(HashMemory(pRom, 32768));
+}
+
+// The tail shorter than 32 bytes goes by 8-byte words; the seed allows to chain the blocks
+uint64_t CMotherboard::CalculateHash(const uint8_t* pData, size_t size, uint64_t seed)
+{
+    size_t sizeBlocks = size & ~static_cast<size_t>(31);
+    uint64_t hash = HashMerge(seed, HashMemory(pData, sizeBlocks));
+    uint64_t word = 0;
+    for (size_t i = sizeBlocks; i < size; i++)
+    {
+        word |= static_cast<uint64_t>(pData[i]) << ((i & 7) * 8);
+        if ((i & 7) == 7 || i == size - 1)
+        {
+            hash = HashMerge(hash, word);
+            word = 0;
+        }
+    }
+    hash = HashMerge(hash, size);
+    return HashAvalanche(hash);
+}
+
+
+//////////////////////////////////////////////////////////////////////
+
+// Put the instruction record to the binary trace; the text is made later by the trace decoder
+void CMotherboard::TraceInstruction()
+{
+    uint16_t address = m_pCPU->GetPC();
+    bool okHaltMode = m_pCPU->IsHaltMode();
+
+    int addrtype;
+    uint16_t instruction = GetWordView(address, okHaltMode, true, &addrtype);
+    if (!(addrtype == ADDRTYPE_RAM && (m_dwTrace & TRACE_CPURAM)) &&
+        !(addrtype == ADDRTYPE_ROM && (m_dwTrace & TRACE_CPUROM)))
         return;
-    memory[1] = pBoard->GetWordView(address + 1 * 2, okHaltMode, true, &addrtype);
-    memory[2] = pBoard->GetWordView(address + 2 * 2, okHaltMode, true, &addrtype);
-    memory[3] = pBoard->GetWordView(address + 3 * 2, okHaltMode, true, &addrtype);
 
-    TCHAR bufaddr[7];
-    PrintOctalValue(bufaddr, address);
+    CTraceRecord* pRecord = m_pTraceBlock + m_nTraceCount;
+    pRecord->cycle = static_cast<uint32_t>(m_TraceTick);
+    pRecord->cycleHigh = static_cast<uint16_t>(m_TraceTick >> 32);
+    pRecord->type = TRACE_RECORD_INSTRUCTION;
+    pRecord->flags = okHaltMode ? TRACE_RECORD_FLAG_HALTMODE : 0;
+    for (int r = 0; r < 8; r++)
+        pRecord->reg[r] = m_pCPU->GetReg(r);
+    pRecord->psw = m_pCPU->GetPSW();
+    pRecord->words[0] = instruction;
+    pRecord->words[1] = GetWordView(address + 2, okHaltMode, true, &addrtype);
+    pRecord->words[2] = GetWordView(address + 4, okHaltMode, true, &addrtype);
+
+    if (++m_nTraceCount == m_nTraceCapacity)
+        FlushTrace();
+}
 
-    TCHAR instr[8];
-    TCHAR args[32];
-    DisassembleInstruction(memory, address, instr, args);
-    TCHAR buffer[64];
-    _sntprintf(buffer, sizeof(buffer) / sizeof(TCHAR) - 1, _T("%s: %s\t%s\r\n"), bufaddr, instr, args);
-    //_sntprintf(buffer, sizeof(buffer) / sizeof(TCHAR) - 1, _T("%s %s: %s\t%s\r\n"), pProc->IsHaltMode() ? _T("HALT") : _T("USER"), bufaddr, instr, args);
+bool CMotherboard::TraceInterrupt(uint16_t vector)
+{
+    if (m_pTraceBlock == nullptr)
+        return false;
+    if ((m_dwTrace & (TRACE_CPUINT & ~TRACE_CPU)) == 0)
+        return true;  // Interrupts are filtered out
+
+    CTraceRecord* pRecord = m_pTraceBlock + m_nTraceCount;
+    pRecord->cycle = static_cast<uint32_t>(m_TraceTick);
+    pRecord->cycleHigh = static_cast<uint16_t>(m_TraceTick >> 32);
+    pRecord->type = TRACE_RECORD_INTERRUPT;
+    pRecord->flags = m_pCPU->IsHaltMode() ? TRACE_RECORD_FLAG_HALTMODE : 0;
+    for (int r = 0; r < 8; r++)
+        pRecord->reg[r] = m_pCPU->GetReg(r);
+    pRecord->psw = m_pCPU->GetPSW();
+    pRecord->words[0] = vector;
+    pRecord->words[1] = pRecord->words[2] = 0;
+
+    if (++m_nTraceCount == m_nTraceCapacity)
+        FlushTrace();
+    return true;
+}
 
-    DebugLog(buffer);
+// Put the frame start record, the trace analyzer counts the frames by these records
+void CMotherboard::TraceFrame()
+{
+    m_TraceTick = m_TraceFrameTick;
+
+    CTraceRecord* pRecord = m_pTraceBlock + m_nTraceCount;
+    pRecord->cycle = static_cast<uint32_t>(m_TraceTick);
+    pRecord->cycleHigh = static_cast<uint16_t>(m_TraceTick >> 32);
+    pRecord->type = TRACE_RECORD_FRAME;
+    pRecord->flags = m_pCPU->IsHaltMode() ? TRACE_RECORD_FLAG_HALTMODE : 0;
+    for (int r = 0; r < 8; r++)
+        pRecord->reg[r] = m_pCPU->GetReg(r);
+    pRecord->psw = m_pCPU->GetPSW();
+    pRecord->words[0] = static_cast<uint16_t>(m_nTraceFrame);
+    pRecord->words[1] = static_cast<uint16_t>(m_nTraceFrame >> 16);
+    pRecord->words[2] = 0;
+    m_nTraceFrame++;
+
+    if (++m_nTraceCount == m_nTraceCapacity)
+        FlushTrace();
 }
 
-#endif
+// Put the memory write record, with the value the address had before the write
+void CMotherboard::TraceWrite(uint16_t address, bool okHaltMode, uint16_t value, bool okByte)
+{
+    int addrtype;
+    uint16_t oldvalue = GetWordView(address & 0177776, okHaltMode, false, &addrtype);
+    if (okByte)
+        oldvalue = (address & 1) ? (oldvalue >> 8) : (oldvalue & 0377);
+
+    CTraceRecord* pRecord = m_pTraceBlock + m_nTraceCount;
+    pRecord->cycle = static_cast<uint32_t>(m_TraceTick);
+    pRecord->cycleHigh = static_cast<uint16_t>(m_TraceTick >> 32);
+    pRecord->type = TRACE_RECORD_WRITE;
+    pRecord->flags = (okHaltMode ? TRACE_RECORD_FLAG_HALTMODE : 0) | (okByte ? TRACE_RECORD_FLAG_BYTE : 0);
+    for (int r = 0; r < 7; r++)
+        pRecord->reg[r] = m_pCPU->GetReg(r);
+    pRecord->reg[7] = m_pCPU->GetInstructionPC();
+    pRecord->psw = m_pCPU->GetPSW();
+    pRecord->words[0] = address;
+    pRecord->words[1] = value;
+    pRecord->words[2] = oldvalue;
+
+    if (++m_nTraceCount == m_nTraceCapacity)
+        FlushTrace();
+}
 
 //////////////////////////////////////////////////////////////////////
@@ -13,6 +13,7 @@ MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
 
 #pragma once
 
+#include <stdio.h>
 #include "Defines.h"
 
 class CProcessor;
@@ -33,17 +34,34 @@ class CProcessor;
 #define TRACE_CPUROM       1  // Trace CPU instructions from ROM
 #define TRACE_CPURAM       2  // Trace CPU instructions from RAM
 #define TRACE_CPU          3  // Trace CPU instructions (mask)
-#define TRACE_CPUINT       7  // Trace CPU interrupts
+#define TRACE_CPUINT       7  // Trace CPU interrupts, together with the instructions
 #define TRACE_TIMER      010  // Trace timer events
+#define TRACE_MEMWRITE   020  // Trace memory writes, binary trace only
 #define TRACE_KEYBOARD 01000  // Trace keyboard events
 #define TRACE_ALL    0177777  // Trace all
 
+// Frame is 20000 frame ticks, 16 CPU ticks each, see CMotherboard::SystemFrame()
+#define FRAME_STEPS (20000 * 16)
+
 // Emulator image constants
 #define MK90IMAGE_HEADER_SIZE 32
 #define MK90IMAGE_SIZE 147456
 #define MK90IMAGE_HEADER1 0x494D454E  // "MK90"
 #define MK90IMAGE_HEADER2 0x21214147  // "BTL!"
 #define MK90IMAGE_VERSION 0x00010000  // 1.0
+#define MK90IMAGE_VERSION2 0x00020000  // 2.0, chunked format
+
+// Emulator image v2 chunks, see CMotherboard::SaveStateChunk()
+#define MK90STATE_CHUNK_HEADER_SIZE 16
+#define MK90STATE_CHUNK_MAXSIZE 65536  // The biggest chunk is RAM
+#define MK90STATE_CHUNK_BOARD   0x44524F42  // "BORD" board and devices
+#define MK90STATE_CHUNK_CPU     0x20555043  // "CPU " processor, including the current instruction stage
+#define MK90STATE_CHUNK_SMP     0x20504D53  // "SMP " SMP positions and commands
+#define MK90STATE_CHUNK_ROM     0x204D4F52  // "ROM "
+#define MK90STATE_CHUNK_ROMREF  0x46455252  // "RREF" reference to the ROM file by ROM hash, handled by the emulator
+#define MK90STATE_CHUNK_RAM     0x204D4152  // "RAM "
+#define MK90STATE_CHUNK_END     0x20444E45  // "END " terminator, no data
+#define MK90STATE_CHUNK_FLAG_LZ 1  // Chunk data is 4 bytes of the original size then LZ-compressed data
 
 
 //////////////////////////////////////////////////////////////////////
@@ -65,8 +83,175 @@ public:
 
 //////////////////////////////////////////////////////////////////////
 
+// Complete processor state, see CProcessor::SaveToSnapshot()
+struct CProcessorSnapshot
+{
+    int         internalTick;
+    uint16_t    psw;
+    uint16_t    R[8];
+    bool        okStopped;
+    bool        haltmode;
+    bool        stepmode;
+    bool        waitmode;
+    uint16_t    instruction;
+    uint16_t    instructionpc;
+    uint8_t     regsrc;
+    uint8_t     methsrc;
+    uint16_t    addrsrc;
+    uint8_t     regdest;
+    uint8_t     methdest;
+    uint16_t    addrdest;
+    bool        RPLYrq, RSVDrq, TBITrq, HALTrq, RPL2rq, EVNTrq;
+    bool        BPT_rq, IOT_rq, EMT_rq, TRAPrq;
+    int         virqrq;
+    uint16_t    virq[16];
+};
+
+#define HISTORY_SIZE             256  // Flight recorder size, power of 2
+#define HISTORY_EVENT_NONE         0
+#define HISTORY_EVENT_INVALID      1  // Invalid instruction
+#define HISTORY_EVENT_HALT         2  // HALT interrupt
+#define HISTORY_EVENT_BUSERROR     3  // Bus error: no reply from the memory
+
+// Flight recorder entry: the instruction retired and the registers after it
+struct CProcessorHistoryEntry
+{
+    uint16_t    pc;             // Instruction address
+    uint16_t    instruction;
+    uint16_t    psw;
+    uint16_t    reg[4];         // R0..R3
+    uint16_t    sp;
+};
+
+// Flight recorder, the last instructions retired, see CProcessor::GetHistory()
+struct CProcessorHistory
+{
+    uint32_t    count;          // Instructions recorded; the last one is at (count - 1) % HISTORY_SIZE
+    CProcessorHistoryEntry entries[HISTORY_SIZE];
+};
+
+// Per-PC profile counters, see CProcessor::SetProfile()
+struct CProcessorProfile
+{
+    uint32_t    count[65536];   // Instructions executed, by instruction address
+    uint64_t    ticks[65536];   // CPU ticks spent, by instruction address; WAIT ticks are counted on the WAIT address
+};
+
+// Executed instruction addresses, one bit per word, see CProcessor::SetCoverage()
+struct CProcessorCoverage
+{
+    uint8_t     bits[65536 / 16];   // Bit (address >> 1) & 7 of byte address >> 4
+};
+
+#define PERFCOUNTER_VECTORS     256  // Vectors 000000..001774, counted by vector / 4
+#define PERFCOUNTER_PORTS       17   // Ports 164000..164036 by (address - 164000) / 2, the last one for the other ports
+
+// Performance counters, see CMotherboard::SetPerfCounters(); counted with no checks, so they cost nothing but the increment
+struct CPerfCounters
+{
+    uint64_t    instructions;   // Instructions retired
+    uint64_t    ticks;          // CPU ticks
+    uint64_t    interrupts[PERFCOUNTER_VECTORS];  // Interrupts and traps taken, by vector / 4
+    uint64_t    reservedTraps;  // Reserved instruction traps, vector 10
+    uint64_t    busFaults;      // No reply from the memory, vector 4
+    uint64_t    portReads[PERFCOUNTER_PORTS];
+    uint64_t    portWrites[PERFCOUNTER_PORTS];
+    uint64_t    lcdAddressChanges;  // LCD address register writes with the new value
+    uint64_t    smpBytes[2];    // Bytes read from or written to SMP, by slot
+    uint64_t    frames;         // Frames completed
+};
+
+// Memory access counters by address, see CMotherboard::SetAccessCounters(); word access counts on the even address
+struct CMotherboardAccessCounters
+{
+    uint32_t    read[65536];
+    uint32_t    write[65536];
+    uint32_t    exec[65536];    // Instruction fetch
+};
+
+// Ticks by the value of a RAM word, see CProcessor::SetWordProfile(); used for BASIC line numbers
+struct CProcessorWordProfile
+{
+    uint16_t    address;        // RAM address of the word to watch
+    uint16_t    lastValue;      // Value after the previous instruction
+    uint32_t    entries[65536]; // How many times the word changed to the value
+    uint64_t    ticks[65536];   // CPU ticks spent while the word had the value
+};
+
+// Complete machine state for fast in-memory save/restore, see CMotherboard::SaveToSnapshot()
+// ROM is not included, it is not changed by the running machine; SMP data is not included too.
+struct CMotherboardSnapshot
+{
+    CProcessorSnapshot cpu;
+    uint16_t    configuration;
+    uint16_t    lcdAddr;
+    uint16_t    lcdConf;
+    uint16_t    lcdIndex;
+    uint8_t     extDeviceKeyboardScan;
+    uint8_t     extDeviceControl;
+    uint8_t     extDeviceShift;
+    bool        extDeviceSelect;
+    uint16_t    extDeviceIntStatus;
+    uint32_t    smpDataPtr[2];
+    uint8_t     smpCmd[2];
+    bool        okTimer50OnOff;
+    bool        okSoundOnOff;
+    uint8_t     ram[65536];
+};
+
+
+//////////////////////////////////////////////////////////////////////
+
+// Savestate chunk for CMotherboard::LoadFromStateChunks()
+struct CMotherboardStateChunk
+{
+    uint32_t    tag;  // MK90STATE_CHUNK_XXX
+    uint16_t    version;
+    const uint8_t* pData;
+    size_t      size;
+};
+
+
+//////////////////////////////////////////////////////////////////////
+
+#define SOUNDSAMPLERATE  22050
+
 // Sound generator callback function type
-typedef void (CALLBACK* SOUNDGENCALLBACK)(unsigned short L, unsigned short R);
+typedef void (*SOUNDGENCALLBACK)(unsigned short L, unsigned short R);
+
+#define TRACE_RECORD_INSTRUCTION    1  // Instruction to be executed: registers before the instruction
+#define TRACE_RECORD_INTERRUPT      2  // Interrupt taken: words[0] = vector, registers after the vector loaded
+#define TRACE_RECORD_WRITE          3  // Memory write: words[] = address, new value, old value; R7 is the instruction address
+#define TRACE_RECORD_FRAME          4  // Frame start: words[0..1] = frame number low/high, counted from the trace start
+#define TRACE_RECORD_FLAG_HALTMODE  1
+#define TRACE_RECORD_FLAG_BYTE      2  // Byte write, see TRACE_RECORD_WRITE
+
+// Binary trace record, see CMotherboard::SetTraceCallback(); 32 bytes
+struct CTraceRecord
+{
+    uint32_t    cycle;      // CPU ticks from the trace start, low 32 bits
+    uint16_t    cycleHigh;  // CPU ticks from the trace start, high 16 bits
+    uint8_t     type;       // TRACE_RECORD_XXX
+    uint8_t     flags;      // TRACE_RECORD_FLAG_XXX
+    uint16_t    reg[8];     // R0..R7; R7 is the instruction address
+    uint16_t    psw;
+    uint16_t    words[3];   // Instruction words: the instruction and up to two operand words
+};
+
+// Trace block callback function type: takes the records collected, returns the next empty block of the same size
+typedef CTraceRecord* (*TRACEBLOCKCALLBACK)(CTraceRecord* pBlock, int count);
+
+// Board events, see CMotherboard::SetEventCallback()
+#define BOARDEVENT_INTERRUPT    1  // Interrupt taken: param1 = vector, param2 = SP after PC and PSW saved
+#define BOARDEVENT_RETURN       2  // RTI or RTT executed: param1 = PC, param2 = SP after PC and PSW restored
+#define BOARDEVENT_PORTREAD     3  // External devices port read: param1 = port address, param2 = value
+#define BOARDEVENT_PORTWRITE    4  // External devices port write: param1 = port address, param2 = value
+#define BOARDEVENT_LCDWRITE     5  // LCD controller register write: param1 = port address, param2 = value
+#define BOARDEVENT_SMPREAD      6  // SMP data byte read: param1 = slot, param2 = byte
+#define BOARDEVENT_SMPWRITE     7  // SMP data byte written: param1 = slot, param2 = byte
+
+// Board event callback function type; step is the CPU tick of the frame, 0..FRAME_STEPS-1
+typedef void (*BOARDEVENTCALLBACK)(int event, uint16_t param1, uint16_t param2, int step);
 
 
 //////////////////////////////////////////////////////////////////////
@@ -96,6 +281,25 @@ public:  // Debug
     void        SetCPUBreakpoints(const uint16_t* bps) { m_CPUbps = bps; } // Set CPU breakpoint list
     uint32_t    GetTrace() const { return m_dwTrace; }
     void        SetTrace(uint32_t dwTrace);
+    // Binary trace goes to the block; the block is passed to the callback when full. nullptr = no trace
+    void        SetTraceCallback(TRACEBLOCKCALLBACK callback, CTraceRecord* pBlock, int capacity);
+    void        FlushTrace();  // Pass the records collected to the callback
+    // No records and no ticks counted while suspended; the trace cycle and frame counters are restored on resume
+    void        SuspendTrace(bool okSuspend);
+    bool        TraceInterrupt(uint16_t vector);  // Called by CPU; returns false if the binary trace is off
+    uint64_t    GetTraceTick() const { return m_TraceTick; }  // CPU ticks from the trace start
+    void        SetAccessCounters(CMotherboardAccessCounters* pCounters) { m_pAccessCounters = pCounters; }  // nullptr = off
+    CMotherboardAccessCounters* GetAccessCounters() const { return m_pAccessCounters; }
+    void        SetEventCallback(BOARDEVENTCALLBACK callback) { m_EventCallback = callback; }  // nullptr = off
+    BOARDEVENTCALLBACK GetEventCallback() const { return m_EventCallback; }
+    void        RaiseEvent(int event, uint16_t param1, uint16_t param2)  // Called by CPU and devices
+    {
+        if (m_EventCallback != nullptr) m_EventCallback(event, param1, param2, m_nEventStep);
+    }
+    int         GetEventStep() const { return m_nEventStep; }  // CPU tick of the frame, counted while the event callback is set
+    // nullptr = off, the counting goes on to the board's own block which is never read
+    void        SetPerfCounters(CPerfCounters* pCounters);
+    CPerfCounters* GetPerfCounters() const { return (m_pPerfCounters == &m_PerfCountersSink) ? nullptr : m_pPerfCounters; }
 public:  // System control
     void        SetConfiguration(uint16_t conf);
     uint16_t    GetConfiguration() const { return m_Configuration; }
@@ -110,19 +314,22 @@ public:  // System control
     void        ResetHALT();//DEBUG
 public:
     void        ExecuteCPU();  // Execute one CPU instruction
-    bool        SystemFrame();  // Do one frame -- use for normal run
+    // Do one frame -- use for normal run; or a part of the frame, step = one CPU tick, 0..FRAME_STEPS
+    bool        SystemFrame(int fromStep = 0, int toStep = FRAME_STEPS);
     void        KeyboardEvent(uint8_t scancode, bool okPressed);  // Key pressed or released
 public:  // SMPs
-    bool        AttachSmpImage(int slot, LPCTSTR sFileName);
+    bool        AttachSmpImage(int slot, FILE* fpFile);  // Attach the image file opened for update; the board closes the file
+    bool        AttachSmpImage(int slot, const uint8_t* pData, size_t size);  // Attach the image from memory, no file behind
     void        DetachSmpImage(int slot);
     bool        IsSmpImageAttached(int slot) const;
+    const uint8_t* GetSmpImageData(int slot, size_t* pSize) const;
 public:  // Callbacks
     void        SetSoundGenCallback(SOUNDGENCALLBACK callback);
 public:  // Memory
     // Read command for execution
-    uint16_t GetWordExec(uint16_t address, bool okHaltMode) { return GetWord(address, okHaltMode, TRUE); }
+    uint16_t GetWordExec(uint16_t address, bool okHaltMode) { return GetWord(address, okHaltMode, true); }
     // Read word from memory
-    uint16_t GetWord(uint16_t address, bool okHaltMode) { return GetWord(address, okHaltMode, FALSE); }
+    uint16_t GetWord(uint16_t address, bool okHaltMode) { return GetWord(address, okHaltMode, false); }
     // Read word
     uint16_t GetWord(uint16_t address, bool okHaltMode, bool okExec);
     // Write word
@@ -152,6 +359,16 @@ private:  // Access to I/O ports
 public:  // Saving/loading emulator status
     void        SaveToImage(uint8_t* pImage) const;
     void        LoadFromImage(const uint8_t* pImage);
+    static size_t SaveStateChunk(const CMotherboardSnapshot* pSnapshot, uint32_t tag, uint8_t* pBuffer, uint16_t* pVersion);  // Returns chunk data size, 0 for unknown tag
+    bool        LoadStateChunk(uint32_t tag, uint16_t version, const uint8_t* pData, size_t size);
+    bool        LoadFromStateChunks(const CMotherboardStateChunk* pChunks, int count);
+    static bool CheckStateChunk(uint32_t tag, uint16_t version, size_t size);
+    void        SaveToSnapshot(CMotherboardSnapshot* pSnapshot) const;
+    void        LoadFromSnapshot(const CMotherboardSnapshot* pSnapshot);
+    uint64_t    GetStateHash() const;  // Fast 64-bit hash of RAM, CPU and device state
+    uint64_t    GetRomHash() const { return CalculateRomHash(m_pROM); }
+    static uint64_t CalculateRomHash(const uint8_t* pRom);
+    static uint64_t CalculateHash(const uint8_t* pData, size_t size, uint64_t seed);  // Hash of any data block, for cache keys
 private:  // Ports: implementation
     uint16_t    m_LcdAddr;
     uint16_t    m_LcdConf;
@@ -179,11 +396,34 @@ private:  // Implementation: SMPs
 private:
     const uint16_t* m_CPUbps;  // CPU breakpoint list, ends with 177777 value
     uint32_t    m_dwTrace;  // Trace flags
+    TRACEBLOCKCALLBACK m_TraceCallback;
+    CTraceRecord* m_pTraceBlock;  // Binary trace block being filled, nullptr when off or suspended
+    CTraceRecord* m_pTraceSuspended;  // Binary trace block kept while suspended
+    uint64_t    m_TraceSuspendedFrameTick;  // m_TraceFrameTick on suspend
+    uint32_t    m_nTraceSuspendedFrame;  // m_nTraceFrame on suspend
+    int         m_nTraceCount;
+    int         m_nTraceCapacity;
+    uint64_t    m_TraceFrameTick;  // CPU ticks from the trace start to the current frame start
+    uint64_t    m_TraceTick;  // CPU ticks from the trace start to the current tick
+    uint32_t    m_nTraceFrame;  // Frames from the trace start, see TRACE_RECORD_FRAME
+    BOARDEVENTCALLBACK m_EventCallback;
+    int         m_nEventStep;  // CPU tick of the frame
+    CMotherboardAccessCounters* m_pAccessCounters;  // Memory access counters, not a part of the machine state
+    CPerfCounters* m_pPerfCounters;  // Never nullptr, not a part of the machine state
+    CPerfCounters m_PerfCountersSink;  // Counted when the counters are off
     bool        m_okTimer50OnOff;
     bool        m_okSoundOnOff;
 private:
     SOUNDGENCALLBACK m_SoundGenCallback;
     void        DoSound();
+    void        TraceInstruction();
+    void        TraceFrame();
+    void        TraceWrite(uint16_t address, bool okHaltMode, uint16_t value, bool okByte);
+    uint16_t    PortReadEvent(uint16_t address, uint16_t value)
+    {
+        RaiseEvent(BOARDEVENT_PORTREAD, address, value);
+        return value;
+    }
 };
 
 
@@ -0,0 +1,118 @@
+﻿/*  This file is part of MK90BTL.
+    MK90BTL is free software: you can redistribute it and/or modify it under the terms
+of the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+    MK90BTL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License along with
+MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
+
+// CallGraph.cpp
+//
+
+#include "Platform.h"
+#include "CallGraph.h"
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+const int CALLGRAPH_HASH_SIZE = CCallGraph::MAX_NODES * 2;  // Power of 2
+
+static inline uint32_t CallGraph_Hash(int parent, uint16_t address, uint16_t vector)
+{
+    uint32_t hash = (uint32_t)parent * 0x9E3779B1u ^ ((uint32_t)address << 8 | vector);
+    return (hash ^ (hash >> 15)) & (CALLGRAPH_HASH_SIZE - 1);
+}
+
+CCallGraph::CCallGraph()
+{
+    m_pNodes = static_cast<CCallGraphNode*>(::calloc(MAX_NODES, sizeof(CCallGraphNode)));
+    m_pHash = static_cast<int*>(::calloc(CALLGRAPH_HASH_SIZE, sizeof(int)));
+    if (m_pNodes == nullptr || m_pHash == nullptr)
+    {
+        ::free(m_pNodes);  m_pNodes = nullptr;
+        ::free(m_pHash);  m_pHash = nullptr;
+    }
+    Clear();
+}
+
+CCallGraph::~CCallGraph()
+{
+    ::free(m_pNodes);
+    ::free(m_pHash);
+}
+
+void CCallGraph::Clear()
+{
+    m_nodeCount = 0;
+    m_depth = 0;
+    m_current = 0;
+    m_lost = 0;
+    if (!IsValid())
+        return;
+
+    ::memset(m_pNodes, 0, MAX_NODES * sizeof(CCallGraphNode));
+    ::memset(m_pHash, 0, CALLGRAPH_HASH_SIZE * sizeof(int));
+    m_pNodes[0].parent = -1;  // Root node
+    m_nodeCount = 1;
+}
+
+void CCallGraph::Enter(uint16_t address, uint16_t vector, uint16_t sp)
+{
+    if (m_depth == MAX_DEPTH)
+    {
+        m_lost++;
+        return;  // Ticks go to the current node until the stack unwinds
+    }
+
+    // Find the child node, add it if not found
+    uint32_t hash = CallGraph_Hash(m_current, address, vector);
+    int node = -1;
+    for (;;)
+    {
+        int index = m_pHash[hash] - 1;
+        if (index < 0)
+        {
+            if (m_nodeCount == MAX_NODES)
+                break;
+            index = m_nodeCount++;
+            m_pNodes[index].address = address;
+            m_pNodes[index].vector = vector;
+            m_pNodes[index].parent = m_current;
+            m_pHash[hash] = index + 1;
+            node = index;
+            break;
+        }
+        const CCallGraphNode& item = m_pNodes[index];
+        if (item.parent == m_current && item.address == address && item.vector == vector)
+        {
+            node = index;
+            break;
+        }
+        hash = (hash + 1) & (CALLGRAPH_HASH_SIZE - 1);
+    }
+    if (node < 0)  // Tree is full, keep the frame to stay in balance but count the ticks to the caller
+    {
+        m_lost++;
+        node = m_current;
+    }
+    else
+        m_pNodes[node].calls++;
+
+    m_stack[m_depth].node = node;
+    m_stack[m_depth].sp = sp;
+    m_depth++;
+    m_current = node;
+}
+
+void CCallGraph::Leave(uint16_t sp)
+{
+    while (m_depth > 0 && m_stack[m_depth - 1].sp < sp)
+        m_depth--;
+    m_current = (m_depth > 0) ? m_stack[m_depth - 1].node : 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////
@@ -0,0 +1,68 @@
+﻿/*  This file is part of MK90BTL.
+    MK90BTL is free software: you can redistribute it and/or modify it under the terms
+of the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+    MK90BTL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License along with
+MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
+
+// CallGraph.h
+//
+
+#pragma once
+
+
+//////////////////////////////////////////////////////////////////////
+
+// Call tree node: one callee in one call path
+struct CCallGraphNode
+{
+    uint16_t    address;        // Callee address: JSR target or trap/interrupt handler address
+    uint16_t    vector;         // Trap/interrupt vector; 0 = JSR call
+    int         parent;         // Parent node index; -1 for the root node
+    uint32_t    calls;          // Number of entries
+    uint64_t    ticks;          // Exclusive ticks, spent in the callee itself
+};
+
+// Shadow call stack of the processor, see CProcessor::SetCallGraph().
+// Builds the call tree: JSR and traps/interrupts enter a frame, RTS and RTI/RTT leave the frames.
+// The frame is left when the stack pointer rises above the SP value seen on the frame entry,
+// so the frames abandoned by the code that resets the stack are unwound too.
+class CCallGraph
+{
+public:
+    static const int MAX_NODES = 32768;
+    static const int MAX_DEPTH = 256;
+public:
+    CCallGraph();
+    ~CCallGraph();
+    void        Clear();
+    bool        IsValid() const { return m_pNodes != nullptr && m_pHash != nullptr; }  // false if the tables were not allocated
+public:  // Called by the processor
+    void        AddTicks(int ticks) { m_pNodes[m_current].ticks += ticks; }
+    void        Enter(uint16_t address, uint16_t vector, uint16_t sp);
+    void        Leave(uint16_t sp);  // SP after the return instruction
+public:
+    int         GetNodeCount() const { return m_nodeCount; }
+    const CCallGraphNode* GetNode(int index) const { return m_pNodes + index; }
+    int         GetDepth() const { return m_depth; }
+    uint32_t    GetLostCount() const { return m_lost; }  // Entries not recorded because of the limits
+private:
+    struct Frame
+    {
+        int         node;
+        uint16_t    sp;         // SP just after the entry
+    };
+    CCallGraphNode* m_pNodes;
+    int         m_nodeCount;
+    int*        m_pHash;        // Open addressing table: node index + 1, 0 = empty
+    Frame       m_stack[MAX_DEPTH];
+    int         m_depth;
+    int         m_current;      // Node the ticks go to
+    uint32_t    m_lost;
+};
+
+
+//////////////////////////////////////////////////////////////////////
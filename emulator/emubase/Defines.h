@@ -13,6 +13,8 @@ MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
 
 #pragma once
 
+#include <stdint.h>
+
 
 //////////////////////////////////////////////////////////////////////
 
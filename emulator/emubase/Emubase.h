@@ -15,12 +15,9 @@ MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
 
 #include "Board.h"
 #include "Processor.h"
-
-
-//////////////////////////////////////////////////////////////////////
-
-
-#define SOUNDSAMPLERATE  22050
+#include "Bisect.h"
+#include "CallGraph.h"
+#include "Sampler.h"
 
 
 //////////////////////////////////////////////////////////////////////
@@ -0,0 +1,46 @@
+﻿/*  This file is part of MK90BTL.
+    MK90BTL is free software: you can redistribute it and/or modify it under the terms
+of the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+    MK90BTL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License along with
+MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
+
+// Platform.h
+// Standard headers and the host hooks for the emulator core sources.
+// The core has no Win32 types, so it builds with any C++11 compiler, see bisect/Makefile.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+
+// Inside MK90BTL: ASSERT and DEBUGLOG_CAT of the application, see Common.h
+#ifndef _CRT_SECURE_NO_WARNINGS
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#include <tchar.h>
+#include "../Common.h"
+
+#else
+
+// Standalone build: standard assert, no debug log
+#include <assert.h>
+#define ASSERT(f)  assert(f)
+#define DEBUGLOG_CAT(category, ...)  ((void)0)
+
+#endif
+
+
+//////////////////////////////////////////////////////////////////////
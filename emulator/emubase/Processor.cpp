@@ -11,8 +11,10 @@ MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
 // Processor.cpp
 //
 
-#include "stdafx.h"
+#include "Platform.h"
 #include "Processor.h"
+#include "CallGraph.h"
+#include "Sampler.h"
 
 
 // Timings ///////////////////////////////////////////////////////////
@@ -202,6 +204,14 @@ CProcessor::CProcessor(CMotherboard* pBoard)
     m_addrsrc = m_addrdest = 0;
     m_virqrq = 0;
     memset(m_virq, 0, sizeof(m_virq));
+    m_pProfile = nullptr;
+    m_pCallGraph = nullptr;
+    m_pSampler = nullptr;
+    m_pWordProfile = nullptr;
+    m_pCoverage = nullptr;
+    m_pPerfCounters = nullptr;
+    m_history.count = 0;
+    m_nHistoryEvent = HISTORY_EVENT_NONE;
 }
 
 void CProcessor::Start()
@@ -235,6 +245,7 @@ void CProcessor::Stop()
 
 void CProcessor::Execute()
 {
+    m_pPerfCounters->ticks++;
     if (m_okStopped) return;  // Processor is stopped - nothing to do
 
     if (m_internalTick > 0)
@@ -246,7 +257,8 @@ void CProcessor::Execute()
 
     m_RPLYrq = false;
 
-    if (!m_waitmode)
+    bool okExecuted = !m_waitmode;
+    if (okExecuted)
     {
         m_instructionpc = m_R[7];  // Store address of the current instruction
         FetchInstruction();  // Read next instruction from memory
@@ -255,6 +267,58 @@ void CProcessor::Execute()
             TranslateInstruction();  // Execute next instruction
             if (m_internalTick > 0) m_internalTick--;  // Count current tick too
         }
+
+        CProcessorHistoryEntry& entry = m_history.entries[m_history.count++ & (HISTORY_SIZE - 1)];
+        entry.pc = m_instructionpc;
+        entry.instruction = m_instruction;
+        entry.psw = m_psw;
+        entry.reg[0] = m_R[0];  entry.reg[1] = m_R[1];  entry.reg[2] = m_R[2];  entry.reg[3] = m_R[3];
+        entry.sp = m_R[6];
+    }
+
+    m_pPerfCounters->instructions += (okExecuted && !m_RPLYrq);
+    if (m_pCoverage != nullptr && okExecuted && !m_RPLYrq)
+        m_pCoverage->bits[m_instructionpc >> 4] |= (uint8_t)(1 << ((m_instructionpc >> 1) & 7));
+    if (m_pProfile != nullptr)
+    {
+        // This tick plus the ticks to wait, interrupt processing below adds no ticks
+        if (okExecuted) m_pProfile->count[m_instructionpc]++;
+        m_pProfile->ticks[m_instructionpc] += m_internalTick + 1;
+    }
+    if (m_pCallGraph != nullptr)
+    {
+        m_pCallGraph->AddTicks(m_internalTick + 1);
+        if (okExecuted && !m_RPLYrq)
+        {
+            if ((m_instruction & ~0777) == PI_JSR)
+                m_pCallGraph->Enter(GetPC(), 0, GetSP());
+            else if ((m_instruction & ~07) == PI_RTS || m_instruction == PI_RTI || m_instruction == PI_RTT)
+                m_pCallGraph->Leave(GetSP());
+        }
+    }
+    if (m_pSampler != nullptr)
+    {
+        if (m_pSampler->CountTicks(m_internalTick + 1))
+        {
+            int addrtype;
+            uint16_t retaddr = m_pBoard->GetWordView(GetSP() & ~1, IsHaltMode(), false, &addrtype);
+            uint8_t flags = (m_haltmode ? SAMPLE_FLAG_HALTMODE : 0) | (m_waitmode ? SAMPLE_FLAG_WAITMODE : 0);
+            m_pSampler->AddSample(m_instructionpc, retaddr, m_psw, flags);
+        }
+        if (okExecuted && !m_RPLYrq && (m_instruction == PI_RTI || m_instruction == PI_RTT))
+            m_pSampler->LeaveInterrupt();
+    }
+    if (okExecuted && !m_RPLYrq && (m_instruction == PI_RTI || m_instruction == PI_RTT))
+        m_pBoard->RaiseEvent(BOARDEVENT_RETURN, GetPC(), GetSP());
+    if (m_pWordProfile != nullptr)
+    {
+        uint16_t value = m_pBoard->GetRAMWord(m_pWordProfile->address);
+        if (value != m_pWordProfile->lastValue)
+        {
+            m_pWordProfile->lastValue = value;
+            m_pWordProfile->entries[value]++;
+        }
+        m_pWordProfile->ticks[value] += m_internalTick + 1;
     }
 
     if (m_stepmode)
@@ -275,6 +339,7 @@ void CProcessor::Execute()
             if (m_HALTrq)  // HALT command
             {
                 m_HALTrq = false;  intrVector = 0000004;  intrMode = true;
+                FreezeHistory(HISTORY_EVENT_HALT);
             }
             else if (m_BPT_rq)  // BPT command
             {
@@ -295,10 +360,14 @@ void CProcessor::Execute()
             else if (m_RPLYrq)  // Зависание
             {
                 m_RPLYrq = false;  intrVector = 0000004;
+                FreezeHistory(HISTORY_EVENT_BUSERROR);
+                m_pPerfCounters->busFaults++;
             }
             else if (m_RSVDrq)  // Reserved command
             {
                 m_RSVDrq = false;  intrVector = 0000010;
+                FreezeHistory(HISTORY_EVENT_INVALID);
+                m_pPerfCounters->reservedTraps++;
             }
             else if (m_TBITrq && (!m_waitmode))  // T-bit
             {
@@ -325,6 +394,7 @@ void CProcessor::Execute()
 
             if (intrVector == 0)
                 break;  // No more unmasked interrupts
+            m_pPerfCounters->interrupts[(intrVector >> 2) & (PERFCOUNTER_VECTORS - 1)]++;
 
             m_waitmode = false;
 
@@ -342,14 +412,20 @@ void CProcessor::Execute()
             SetPC(GetWord(intrVector) & 0xfffe);
             m_psw = GetWord(intrVector + 2) & 0377;
             if (intrMode) m_psw |= 0400;
+            if (m_pCallGraph != nullptr)
+                m_pCallGraph->Enter(GetPC(), intrVector, GetSP());
+            if (m_pSampler != nullptr)
+                m_pSampler->EnterInterrupt();
+            m_pBoard->RaiseEvent(BOARDEVENT_INTERRUPT, intrVector, GetSP());
 #if !defined(PRODUCT)
-//            if (m_pBoard->GetTrace() & TRACE_CPUINT)
-//            {
-            if (intrVector == 0000004)  // HALT
-                DebugLogFormat(_T("CPU HALT interrupt vector=%06o PC=%06o PSW=%06o\r\n"), intrVector, GetPC(), GetPSW());
+            if (m_pBoard->TraceInterrupt(intrVector))
+            {
+                // Binary trace is on, the record is filtered by the trace flags
+            }
+            else if (intrVector == 0000004)  // HALT
+                DEBUGLOG_CAT(LOGCAT_INT, _T("CPU HALT interrupt vector=%06o PC=%06o PSW=%06o\r\n"), intrVector, GetPC(), GetPSW());
             else if (intrVector != 000020 && intrVector != 000030 && intrVector != 000034)  // skip IOT/EMT/TRAP
-                DebugLogFormat(_T("CPU interrupt vector=%06o PC=%06o PSW=%06o\r\n"), intrVector, GetPC(), GetPSW());
-//            }
+                DEBUGLOG_CAT(LOGCAT_INT, _T("CPU interrupt vector=%06o PC=%06o PSW=%06o\r\n"), intrVector, GetPC(), GetPSW());
 #endif
         }  // end while
     }
@@ -378,6 +454,16 @@ void CProcessor::MemoryError()
     m_RPLYrq = true;
 }
 
+// Keep the flight recorder copy until the emulator takes it; the later events are ignored till then
+void CProcessor::FreezeHistory(int event)
+{
+    if (m_nHistoryEvent != HISTORY_EVENT_NONE)
+        return;
+
+    m_nHistoryEvent = event;
+    m_historyEvent = m_history;
+}
+
 
 //////////////////////////////////////////////////////////////////////
 
@@ -426,7 +512,7 @@ void CProcessor::TranslateInstruction()
 
 void CProcessor::ExecuteUNKNOWN()  // Нет такой инструкции - просто вызывается TRAP 10
 {
-    DebugLogFormat(_T(">>Invalid OPCODE = %06o at %06o\r\n"), m_instruction, m_instructionpc);
+    DEBUGLOG_CAT(LOGCAT_CPU, _T(">>Invalid OPCODE = %06o at %06o\r\n"), m_instruction, m_instructionpc);
 
     m_RSVDrq = true;
 }
@@ -1504,8 +1590,8 @@ void CProcessor::ExecuteMUL()  // MUL - multiply
 
     int res = (signed short)dst * (signed short)src;
 
-    uint16_t hiword = HIWORD(res);
-    uint16_t loword = LOWORD(res);
+    uint16_t hiword = static_cast<uint16_t>(res >> 16);
+    uint16_t loword = static_cast<uint16_t>(res & 0xffff);
     SetReg(m_regsrc, hiword);
     SetReg(m_regsrc | 1, loword);
 
@@ -1527,7 +1613,7 @@ void CProcessor::ExecuteDIV()  // DIV - divide
     int src2 = static_cast<short>(m_methdest ? GetWord(ea) : GetReg(m_regdest));
     if (m_RPLYrq) return;
 
-    int longsrc = static_cast<int>(MAKELONG(GetReg(m_regsrc | 1), GetReg(m_regsrc)));
+    int longsrc = static_cast<int32_t>((static_cast<uint32_t>(GetReg(m_regsrc)) << 16) | GetReg(m_regsrc | 1));
 
     m_internalTick = DIV_TIMING[m_methdest];
 
@@ -1615,7 +1701,7 @@ void CProcessor::ExecuteASHC()  // ASHC - arithmetic shift combined
     if (m_RPLYrq) return;
     src &= 0x3F;
     src |= (src & 040) ? 0177700 : 0;
-    long dst = MAKELONG(GetReg(m_regsrc | 1), GetReg(m_regsrc));
+    int32_t dst = static_cast<int32_t>((static_cast<uint32_t>(GetReg(m_regsrc)) << 16) | GetReg(m_regsrc | 1));
     m_internalTick = ASHC_TIMING[m_methdest];
     if (src >= 0)
     {
@@ -2198,6 +2284,56 @@ void CProcessor::LoadFromImage(const uint8_t* pImage)
     m_haltmode = (*pwImage++ != 0);
 }
 
+void CProcessor::SaveToSnapshot(CProcessorSnapshot* pSnapshot) const
+{
+    pSnapshot->internalTick = m_internalTick;
+    pSnapshot->psw = m_psw;
+    ::memcpy(pSnapshot->R, m_R, sizeof(m_R));
+    pSnapshot->okStopped = m_okStopped;
+    pSnapshot->haltmode = m_haltmode;
+    pSnapshot->stepmode = m_stepmode;
+    pSnapshot->waitmode = m_waitmode;
+    pSnapshot->instruction = m_instruction;
+    pSnapshot->instructionpc = m_instructionpc;
+    pSnapshot->regsrc = m_regsrc;
+    pSnapshot->methsrc = m_methsrc;
+    pSnapshot->addrsrc = m_addrsrc;
+    pSnapshot->regdest = m_regdest;
+    pSnapshot->methdest = m_methdest;
+    pSnapshot->addrdest = m_addrdest;
+    pSnapshot->RPLYrq = m_RPLYrq;  pSnapshot->RSVDrq = m_RSVDrq;  pSnapshot->TBITrq = m_TBITrq;
+    pSnapshot->HALTrq = m_HALTrq;  pSnapshot->RPL2rq = m_RPL2rq;  pSnapshot->EVNTrq = m_EVNTrq;
+    pSnapshot->BPT_rq = m_BPT_rq;  pSnapshot->IOT_rq = m_IOT_rq;
+    pSnapshot->EMT_rq = m_EMT_rq;  pSnapshot->TRAPrq = m_TRAPrq;
+    pSnapshot->virqrq = m_virqrq;
+    ::memcpy(pSnapshot->virq, m_virq, sizeof(m_virq));
+}
+
+void CProcessor::LoadFromSnapshot(const CProcessorSnapshot* pSnapshot)
+{
+    m_internalTick = pSnapshot->internalTick;
+    m_psw = pSnapshot->psw;
+    ::memcpy(m_R, pSnapshot->R, sizeof(m_R));
+    m_okStopped = pSnapshot->okStopped;
+    m_haltmode = pSnapshot->haltmode;
+    m_stepmode = pSnapshot->stepmode;
+    m_waitmode = pSnapshot->waitmode;
+    m_instruction = pSnapshot->instruction;
+    m_instructionpc = pSnapshot->instructionpc;
+    m_regsrc = pSnapshot->regsrc;
+    m_methsrc = pSnapshot->methsrc;
+    m_addrsrc = pSnapshot->addrsrc;
+    m_regdest = pSnapshot->regdest;
+    m_methdest = pSnapshot->methdest;
+    m_addrdest = pSnapshot->addrdest;
+    m_RPLYrq = pSnapshot->RPLYrq;  m_RSVDrq = pSnapshot->RSVDrq;  m_TBITrq = pSnapshot->TBITrq;
+    m_HALTrq = pSnapshot->HALTrq;  m_RPL2rq = pSnapshot->RPL2rq;  m_EVNTrq = pSnapshot->EVNTrq;
+    m_BPT_rq = pSnapshot->BPT_rq;  m_IOT_rq = pSnapshot->IOT_rq;
+    m_EMT_rq = pSnapshot->EMT_rq;  m_TRAPrq = pSnapshot->TRAPrq;
+    m_virqrq = pSnapshot->virqrq;
+    ::memcpy(m_virq, pSnapshot->virq, sizeof(m_virq));
+}
+
 uint16_t CProcessor::GetWordAddr(uint8_t meth, uint8_t reg)
 {
     switch (meth)
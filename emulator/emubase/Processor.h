@@ -16,6 +16,9 @@ MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
 #include "Defines.h"
 #include "Board.h"
 
+class CCallGraph;
+class CSampler;
+
 
 //////////////////////////////////////////////////////////////////////
 
@@ -71,10 +74,19 @@ protected:  // Interrupt processing
 
 protected:
     CMotherboard* m_pBoard;
+    CProcessorProfile* m_pProfile;  // Profile counters, not a part of the processor state
+    CCallGraph* m_pCallGraph;  // Shadow call stack, not a part of the processor state
+    CSampler*   m_pSampler;  // Sampling profiler, not a part of the processor state
+    CProcessorWordProfile* m_pWordProfile;  // Ticks by RAM word value, not a part of the processor state
+    CProcessorCoverage* m_pCoverage;  // Executed addresses, not a part of the processor state
+    CPerfCounters* m_pPerfCounters;  // Never nullptr once the board set it, not a part of the processor state
+    CProcessorHistory m_history;  // Flight recorder, always on, not a part of the processor state
+    CProcessorHistory m_historyEvent;  // Flight recorder copy made on the event
+    int         m_nHistoryEvent;  // HISTORY_EVENT_XXX
 
 public:  // Register control
     uint16_t    GetPSW() const { return m_psw; }
-    uint8_t     GetLPSW() const { return LOBYTE(m_psw); }
+    uint8_t     GetLPSW() const { return static_cast<uint8_t>(m_psw & 0377); }
     void        SetPSW(uint16_t word) { m_psw = word; }
     void        SetLPSW(uint8_t byte)
     {
@@ -89,6 +101,26 @@ public:  // Register control
     void        SetPC(uint16_t word) { m_R[7] = word; }
     uint16_t    GetInstructionPC() const { return m_instructionpc; }  // Address of the current instruction
 
+public:  // Profiling
+    void        SetProfile(CProcessorProfile* pProfile) { m_pProfile = pProfile; }  // nullptr = profiling is off
+    CProcessorProfile* GetProfile() const { return m_pProfile; }
+    void        SetCallGraph(CCallGraph* pCallGraph) { m_pCallGraph = pCallGraph; }  // nullptr = call tracking is off
+    CCallGraph* GetCallGraph() const { return m_pCallGraph; }
+    void        SetSampler(CSampler* pSampler) { m_pSampler = pSampler; }  // nullptr = sampling is off
+    CSampler*   GetSampler() const { return m_pSampler; }
+    void        SetWordProfile(CProcessorWordProfile* pProfile) { m_pWordProfile = pProfile; }  // nullptr = off
+    CProcessorWordProfile* GetWordProfile() const { return m_pWordProfile; }
+    void        SetCoverage(CProcessorCoverage* pCoverage) { m_pCoverage = pCoverage; }  // nullptr = off
+    CProcessorCoverage* GetCoverage() const { return m_pCoverage; }
+    void        SetPerfCounters(CPerfCounters* pCounters) { m_pPerfCounters = pCounters; }  // Called by the board
+
+public:  // Flight recorder
+    const CProcessorHistory* GetHistory() const { return &m_history; }
+    void        SetHistory(const CProcessorHistory* pHistory) { m_history = *pHistory; }  // To roll back
+    int         GetHistoryEvent() const { return m_nHistoryEvent; }  // HISTORY_EVENT_NONE if no event
+    const CProcessorHistory* GetHistoryEventCopy() const { return &m_historyEvent; }  // History at the event
+    void        ClearHistoryEvent() { m_nHistoryEvent = HISTORY_EVENT_NONE; }
+
 public:  // PSW bits control
     void        SetC(bool bFlag);
     uint16_t    GetC() const { return (m_psw & PSW_C) != 0; }
@@ -114,8 +146,11 @@ public:  // Processor control
 public:  // Saving/loading emulator status (pImage addresses up to 32 bytes)
     void        SaveToImage(uint8_t* pImage);
     void        LoadFromImage(const uint8_t* pImage);
+    void        SaveToSnapshot(CProcessorSnapshot* pSnapshot) const;
+    void        LoadFromSnapshot(const CProcessorSnapshot* pSnapshot);
 
 protected:  // Implementation
+    void        FreezeHistory(int event);
     void        FetchInstruction();      // Read next instruction
     void        TranslateInstruction();  // Execute the instruction
 protected:  // Implementation - memory access
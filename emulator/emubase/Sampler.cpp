@@ -0,0 +1,66 @@
+﻿/*  This file is part of MK90BTL.
+    MK90BTL is free software: you can redistribute it and/or modify it under the terms
+of the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+    MK90BTL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License along with
+MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
+
+// Sampler.cpp
+//
+
+#include "Platform.h"
+#include "Sampler.h"
+
+
+//////////////////////////////////////////////////////////////////////
+
+
+CSampler::CSampler(int capacity)
+{
+    m_pSamples = static_cast<CSamplerSample*>(::calloc(capacity, sizeof(CSamplerSample)));
+    m_capacity = (m_pSamples != nullptr) ? capacity : 0;
+    m_count = 0;
+    m_dropped = 0;
+    m_random = 0x2545F491;
+    m_nesting = 0;
+    SetInterval(65536);
+}
+
+CSampler::~CSampler()
+{
+    ::free(m_pSamples);
+}
+
+void CSampler::SetInterval(int ticks)
+{
+    if (ticks < 16) ticks = 16;
+    m_interval = ticks;
+    m_countdown = ticks;
+}
+
+void CSampler::AddSample(uint16_t pc, uint16_t retaddr, uint16_t psw, uint8_t flags)
+{
+    // Next sample in interval +-25%, xorshift32 random
+    m_random ^= m_random << 13;
+    m_random ^= m_random >> 17;
+    m_random ^= m_random << 5;
+    m_countdown += m_interval - m_interval / 4 + (int)(m_random % (uint32_t)(m_interval / 2 + 1));
+
+    if (m_count == m_capacity)
+    {
+        m_dropped++;
+        return;
+    }
+    CSamplerSample& sample = m_pSamples[m_count++];
+    sample.pc = pc;
+    sample.retaddr = retaddr;
+    sample.psw = psw;
+    sample.flags = flags;
+    sample.nesting = m_nesting;
+}
+
+
+//////////////////////////////////////////////////////////////////////
@@ -0,0 +1,65 @@
+﻿/*  This file is part of MK90BTL.
+    MK90BTL is free software: you can redistribute it and/or modify it under the terms
+of the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+    MK90BTL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License along with
+MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
+
+// Sampler.h
+//
+
+#pragma once
+
+
+//////////////////////////////////////////////////////////////////////
+
+#define SAMPLE_FLAG_HALTMODE    1   // Processor was in HALT mode
+#define SAMPLE_FLAG_WAITMODE    2   // Processor was waiting for an interrupt
+
+struct CSamplerSample
+{
+    uint16_t    pc;         // Address of the instruction being executed
+    uint16_t    retaddr;    // Word on the top of the stack, the return address in most cases
+    uint16_t    psw;
+    uint8_t     flags;      // See SAMPLE_FLAG_XXX
+    uint8_t     nesting;    // Trap/interrupt nesting level
+};
+
+// Statistical sampling profiler on the emulated time, see CProcessor::SetSampler().
+// Takes a sample every N processor ticks, N is randomized by +-25% to avoid syncing with the program loops.
+// The samples go to the buffer allocated in advance; the owner should take them away with Clear()
+// before the buffer is full, the samples over the limit are counted as dropped.
+class CSampler
+{
+public:
+    CSampler(int capacity);
+    ~CSampler();
+    void        SetInterval(int ticks);
+    int         GetInterval() const { return m_interval; }
+    void        Clear() { m_count = 0; }  // Remove the samples, keep the nesting level
+public:  // Called by the processor
+    bool        CountTicks(int ticks) { m_countdown -= ticks; return m_countdown <= 0; }  // true = time to sample
+    void        AddSample(uint16_t pc, uint16_t retaddr, uint16_t psw, uint8_t flags);
+    void        EnterInterrupt() { if (m_nesting < 255) m_nesting++; }
+    void        LeaveInterrupt() { if (m_nesting > 0) m_nesting--; }
+public:
+    int         GetCount() const { return m_count; }
+    int         GetCapacity() const { return m_capacity; }
+    const CSamplerSample* GetSamples() const { return m_pSamples; }
+    uint32_t    GetDropped() const { return m_dropped; }
+private:
+    CSamplerSample* m_pSamples;
+    int         m_capacity;
+    int         m_count;
+    uint32_t    m_dropped;
+    int         m_interval;
+    int         m_countdown;
+    uint32_t    m_random;       // Jitter generator state
+    uint8_t     m_nesting;
+};
+
+
+//////////////////////////////////////////////////////////////////////
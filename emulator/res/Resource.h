@@ -108,6 +108,9 @@
 #define ID_DEBUG_COPY_ADDRESS           32900
 #define ID_DEBUG_COPY_VALUE             32901
 #define ID_DEBUG_GOTO_ADDRESS           32902
+#define ID_FILE_RECORDMOVIE             32903
+#define ID_FILE_PLAYMOVIE               32904
+#define ID_FILE_STOPMOVIE               32905
 #define ID_HELP_COMMAND_LINE_HELP       32921
 #define IDC_STATIC                      -1
 
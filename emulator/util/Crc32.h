@@ -0,0 +1,25 @@
+﻿/*  This file is part of MK90BTL.
+    MK90BTL is free software: you can redistribute it and/or modify it under the terms
+of the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+    MK90BTL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License along with
+MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
+
+// Crc32.h
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+//////////////////////////////////////////////////////////////////////
+// CRC-32 (IEEE 802.3), as in zlib and PNG; used for savestate chunks and PNG chunks
+
+// Continue the CRC with the data; start with crc = 0
+uint32_t Crc32_Update(uint32_t crc, const uint8_t* pData, size_t size);
+
+
+//////////////////////////////////////////////////////////////////////
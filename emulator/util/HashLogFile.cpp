@@ -0,0 +1,138 @@
+﻿/*  This file is part of MK90BTL.
+    MK90BTL is free software: you can redistribute it and/or modify it under the terms
+of the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+    MK90BTL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License along with
+MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
+
+// HashLogFile.cpp
+
+#include <stdlib.h>
+#include <string.h>
+#include "HashLogFile.h"
+
+
+//////////////////////////////////////////////////////////////////////
+
+// Hash log file format:
+//   16 bytes       Header: "MK90HASH" magic, version, reserved
+//   12 bytes       Record: 4 bytes frame number, 8 bytes hash, little-endian, no padding
+//   ...            More records
+
+static const char magic[8] = { 'M', 'K', '9', '0', 'H', 'A', 'S', 'H' };
+
+const uint32_t HASHLOG_VERSION = 0x00010000;  // 1.0
+const int HASHLOG_HEADER_SIZE = 16;
+const int HASHLOG_RECORD_SIZE = 12;
+
+struct HASHLOGFILE
+{
+    FILE* fpFile;
+    bool okWriting;
+};
+
+HHASHLOGFILE HashLogFile_Create(FILE* fpFileNew)
+{
+    if (fpFileNew == NULL)
+        return nullptr;  // Failed to create file
+
+    uint8_t header[HASHLOG_HEADER_SIZE];
+    ::memset(header, 0, sizeof(header));
+    memcpy(header, magic, 8);
+    *((uint32_t*)(header + 8)) = HASHLOG_VERSION;
+
+    size_t bytesWritten = ::fwrite(header, 1, sizeof(header), fpFileNew);
+    if (bytesWritten != sizeof(header))
+    {
+        ::fclose(fpFileNew);
+        return nullptr;  // Failed to write header
+    }
+
+    HASHLOGFILE* pHashLog = static_cast<HASHLOGFILE*>(::calloc(1, sizeof(HASHLOGFILE)));
+    if (pHashLog == NULL)
+    {
+        ::fclose(fpFileNew);
+        return nullptr;  // Failed to allocate memory
+    }
+    pHashLog->fpFile = fpFileNew;
+    pHashLog->okWriting = true;
+
+    return pHashLog;
+}
+
+HHASHLOGFILE HashLogFile_Open(FILE* fpFileOpen)
+{
+    if (fpFileOpen == NULL)
+        return nullptr;  // Failed to open file
+
+    uint8_t header[HASHLOG_HEADER_SIZE];
+    size_t bytesRead = ::fread(header, 1, sizeof(header), fpFileOpen);
+    if (bytesRead != sizeof(header) || memcmp(header, magic, 8) != 0 ||
+        *((uint32_t*)(header + 8)) != HASHLOG_VERSION)
+    {
+        ::fclose(fpFileOpen);
+        return nullptr;  // Not a hash log file
+    }
+
+    HASHLOGFILE* pHashLog = static_cast<HASHLOGFILE*>(::calloc(1, sizeof(HASHLOGFILE)));
+    if (pHashLog == NULL)
+    {
+        ::fclose(fpFileOpen);
+        return nullptr;  // Failed to allocate memory
+    }
+    pHashLog->fpFile = fpFileOpen;
+    pHashLog->okWriting = false;
+
+    return pHashLog;
+}
+
+void HashLogFile_Close(HHASHLOGFILE hashlogfile)
+{
+    if (hashlogfile == nullptr)
+        return;
+
+    HASHLOGFILE* pHashLog = hashlogfile;
+
+    ::fclose(pHashLog->fpFile);
+    ::free(pHashLog);
+}
+
+bool HashLogFile_Write(HHASHLOGFILE hashlogfile, uint32_t frame, uint64_t hash)
+{
+    if (hashlogfile == nullptr)
+        return false;
+
+    HASHLOGFILE* pHashLog = hashlogfile;
+    if (!pHashLog->okWriting)
+        return false;
+
+    uint8_t record[HASHLOG_RECORD_SIZE];
+    memcpy(record, &frame, 4);
+    memcpy(record + 4, &hash, 8);
+
+    return ::fwrite(record, 1, HASHLOG_RECORD_SIZE, pHashLog->fpFile) == HASHLOG_RECORD_SIZE;
+}
+
+bool HashLogFile_Read(HHASHLOGFILE hashlogfile, uint32_t* pFrame, uint64_t* pHash)
+{
+    if (hashlogfile == nullptr)
+        return false;
+
+    HASHLOGFILE* pHashLog = hashlogfile;
+    if (pHashLog->okWriting)
+        return false;
+
+    uint8_t record[HASHLOG_RECORD_SIZE];
+    if (::fread(record, 1, HASHLOG_RECORD_SIZE, pHashLog->fpFile) != HASHLOG_RECORD_SIZE)
+        return false;
+
+    memcpy(pFrame, record, 4);
+    memcpy(pHash, record + 4, 8);
+    return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////
@@ -0,0 +1,35 @@
+﻿/*  This file is part of MK90BTL.
+    MK90BTL is free software: you can redistribute it and/or modify it under the terms
+of the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+    MK90BTL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License along with
+MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
+
+// HashLogFile.h
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+//////////////////////////////////////////////////////////////////////
+
+typedef struct HASHLOGFILE* HHASHLOGFILE;  // nullptr = no hash log
+
+// Creates hash log in the file opened for writing; the hash log closes the file, on failure too
+HHASHLOGFILE HashLogFile_Create(FILE* fpFile);
+// Open hash log in the file opened for reading; the hash log closes the file, on failure too
+HHASHLOGFILE HashLogFile_Open(FILE* fpFile);
+// Close hash log file
+void HashLogFile_Close(HHASHLOGFILE hashlogfile);
+
+// Write one record: frame number and the machine state hash
+bool HashLogFile_Write(HHASHLOGFILE hashlogfile, uint32_t frame, uint64_t hash);
+// Read next record, returns false at the end of the file
+bool HashLogFile_Read(HHASHLOGFILE hashlogfile, uint32_t* pFrame, uint64_t* pHash);
+
+
+//////////////////////////////////////////////////////////////////////
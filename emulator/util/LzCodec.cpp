@@ -0,0 +1,178 @@
+﻿/*  This file is part of MK90BTL.
+    MK90BTL is free software: you can redistribute it and/or modify it under the terms
+of the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+    MK90BTL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License along with
+MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
+
+// LzCodec.cpp
+
+#include <string.h>
+#include "LzCodec.h"
+
+
+//////////////////////////////////////////////////////////////////////
+
+// LZ4 block format: a sequence of
+//   1 byte         Token: high 4 bits literal count, low 4 bits match length minus 4; 15 = more bytes follow
+//   0+ bytes       Literal count continuation, 255 = more bytes follow
+//   N bytes        Literals
+//   2 bytes        Match offset back from the current position, little-endian, 1..65535
+//   0+ bytes       Match length continuation, 255 = more bytes follow
+// The last sequence has the literals only. The last 5 bytes are always literals,
+// and the last match starts at least 12 bytes before the end, as the LZ4 decoders expect.
+
+const int LZ_MINMATCH = 4;
+const int LZ_LASTLITERALS = 5;
+const int LZ_MFLIMIT = 12;
+const int LZ_HASH_BITS = 13;
+const size_t LZ_MAX_OFFSET = 65535;
+
+static inline uint32_t LzCodec_Read32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static inline uint8_t* LzCodec_WriteLength(uint8_t* op, size_t length)
+{
+    for (; length >= 255; length -= 255)
+        *op++ = 255;
+    *op++ = static_cast<uint8_t>(length);
+    return op;
+}
+
+// Write one sequence; matchLength 0 means the last sequence, literals only
+static uint8_t* LzCodec_WriteSequence(
+    uint8_t* op, const uint8_t* pDstEnd, const uint8_t* pLiterals, size_t literalCount, size_t offset, size_t matchLength)
+{
+    // Worst case: token, literal count, literals, offset, match length
+    if (static_cast<size_t>(pDstEnd - op) < 1 + literalCount / 255 + 1 + literalCount + 2 + matchLength / 255 + 1)
+        return nullptr;
+
+    uint8_t* pToken = op++;
+    *pToken = static_cast<uint8_t>((literalCount < 15 ? literalCount : 15) << 4);
+    if (literalCount >= 15)
+        op = LzCodec_WriteLength(op, literalCount - 15);
+    ::memcpy(op, pLiterals, literalCount);
+    op += literalCount;
+    if (matchLength == 0)
+        return op;
+
+    *op++ = static_cast<uint8_t>(offset);
+    *op++ = static_cast<uint8_t>(offset >> 8);
+    size_t length = matchLength - LZ_MINMATCH;
+    *pToken |= static_cast<uint8_t>(length < 15 ? length : 15);
+    if (length >= 15)
+        op = LzCodec_WriteLength(op, length - 15);
+    return op;
+}
+
+// Greedy single-pass compressor with the hash table of recent 4-byte sequences
+size_t LzCodec_Compress(const uint8_t* pSrc, size_t srcSize, uint8_t* pDst, size_t dstCapacity)
+{
+    uint32_t table[1 << LZ_HASH_BITS];
+    ::memset(table, 0, sizeof(table));
+
+    const uint8_t* pDstEnd = pDst + dstCapacity;
+    uint8_t* op = pDst;
+    size_t anchor = 0;
+    size_t ip = 0;
+    if (srcSize > LZ_MFLIMIT)
+    {
+        size_t matchLimit = srcSize - LZ_MFLIMIT;
+        size_t lengthLimit = srcSize - LZ_LASTLITERALS;
+        while (ip < matchLimit)
+        {
+            uint32_t sequence = LzCodec_Read32(pSrc + ip);
+            uint32_t hash = (sequence * 2654435761U) >> (32 - LZ_HASH_BITS);
+            size_t ref = table[hash];
+            table[hash] = static_cast<uint32_t>(ip);
+            if (ref >= ip || ip - ref > LZ_MAX_OFFSET || LzCodec_Read32(pSrc + ref) != sequence)
+            {
+                ip++;
+                continue;
+            }
+
+            size_t length = LZ_MINMATCH;
+            while (ip + length < lengthLimit && pSrc[ref + length] == pSrc[ip + length])
+                length++;
+
+            op = LzCodec_WriteSequence(op, pDstEnd, pSrc + anchor, ip - anchor, ip - ref, length);
+            if (op == nullptr)
+                return 0;
+            ip += length;
+            anchor = ip;
+        }
+    }
+
+    op = LzCodec_WriteSequence(op, pDstEnd, pSrc + anchor, srcSize - anchor, 0, 0);
+    if (op == nullptr)
+        return 0;
+    return op - pDst;
+}
+
+static inline bool LzCodec_ReadLength(const uint8_t** pip, const uint8_t* pSrcEnd, size_t* pLength)
+{
+    const uint8_t* ip = *pip;
+    uint8_t value;
+    do
+    {
+        if (ip >= pSrcEnd)
+            return false;
+        value = *ip++;
+        *pLength += value;
+    }
+    while (value == 255);
+    *pip = ip;
+    return true;
+}
+
+bool LzCodec_Decompress(const uint8_t* pSrc, size_t srcSize, uint8_t* pDst, size_t dstSize)
+{
+    const uint8_t* ip = pSrc;
+    const uint8_t* pSrcEnd = pSrc + srcSize;
+    uint8_t* op = pDst;
+    uint8_t* pDstEnd = pDst + dstSize;
+    while (ip < pSrcEnd)
+    {
+        uint8_t token = *ip++;
+
+        size_t literalCount = token >> 4;
+        if (literalCount == 15 && !LzCodec_ReadLength(&ip, pSrcEnd, &literalCount))
+            return false;
+        if (literalCount > static_cast<size_t>(pSrcEnd - ip) || literalCount > static_cast<size_t>(pDstEnd - op))
+            return false;
+        ::memcpy(op, ip, literalCount);
+        ip += literalCount;
+        op += literalCount;
+        if (ip == pSrcEnd)
+            break;  // The last sequence
+
+        if (pSrcEnd - ip < 2)
+            return false;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > static_cast<size_t>(op - pDst))
+            return false;
+        size_t length = token & 15;
+        if (length == 15 && !LzCodec_ReadLength(&ip, pSrcEnd, &length))
+            return false;
+        length += LZ_MINMATCH;
+        if (length > static_cast<size_t>(pDstEnd - op))
+            return false;
+
+        // Byte by byte, the match may overlap the output
+        const uint8_t* pMatch = op - offset;
+        for (size_t i = 0; i < length; i++)
+            op[i] = pMatch[i];
+        op += length;
+    }
+
+    return op == pDstEnd;
+}
+
+
+//////////////////////////////////////////////////////////////////////
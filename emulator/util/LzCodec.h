@@ -0,0 +1,27 @@
+﻿/*  This file is part of MK90BTL.
+    MK90BTL is free software: you can redistribute it and/or modify it under the terms
+of the GNU Lesser General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+    MK90BTL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+See the GNU Lesser General Public License for more details.
+    You should have received a copy of the GNU Lesser General Public License along with
+MK90BTL. If not, see <http://www.gnu.org/licenses/>. */
+
+// LzCodec.h
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+//////////////////////////////////////////////////////////////////////
+// Fast LZ compression in LZ4 block format, used for savestate chunks
+
+// Compress the data; returns the compressed size, or 0 if the result does not fit into the destination
+size_t LzCodec_Compress(const uint8_t* pSrc, size_t srcSize, uint8_t* pDst, size_t dstCapacity);
+// Decompress the data; returns false if the data is corrupted or does not decompress to exactly dstSize bytes
+bool LzCodec_Decompress(const uint8_t* pSrc, size_t srcSize, uint8_t* pDst, size_t dstSize);
+
+
+//////////////////////////////////////////////////////////////////////